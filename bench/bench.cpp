@@ -0,0 +1,552 @@
+// Micro- and macro-benchmarks of the ray tracer's hot paths.
+//
+// Every benchmark is run for 1, 2, 4, ... up to the maximum number of threads, and reports the
+// wall-clock time per operation (over all threads), and the throughput in rays per second where
+// that applies. Results are printed, and written to a JSON file so they can be compared over time.
+//
+// Usage: FinalProjectBench [--out <file.json>] [--filter <substring>] [--threads <max>]
+//                          [--min-time <seconds>] [--resolution <pixels>]
+#include "bvh.h"
+#include "camera.h"
+#include "config.h"
+#include "extra.h"
+#include "intersect.h"
+#include "kernel.h"
+#include "light.h"
+#include "postprocess.h"
+#include "render.h"
+#include "scene.h"
+#include "screen.h"
+#include "texture.h"
+#include "texture_cache.h"
+#include <framework/image.h>
+#include <framework/trackball.h>
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/core.h>
+#include <fmt/ostream.h>
+#include <glm/glm.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <omp.h>
+#include <random>
+#include <string>
+#include <vector>
+
+// The kernel used for BVH traversal benchmarks; matches what `renderImage()` selects for a BVH render
+static constexpr uint32_t TraversalKernel = kernel::AccelStructure | kernel::Shading | kernel::Lambertian | kernel::Shadows;
+
+struct BenchOptions {
+    std::filesystem::path outFile = "bench_results.json";
+    std::string filter;
+    int maxThreads = omp_get_max_threads();
+    double minTime = 0.25; // Minimum measured time per benchmark, in seconds
+    int resolution = 128; // Width and height of images rendered by `renderImage()` benchmarks
+};
+
+struct BenchResult {
+    std::string name;
+    int threads;
+    uint64_t operations;
+    double seconds;
+    double nsPerOp;
+    double raysPerSec; // 0 if the benchmark does not trace rays
+};
+
+// How a benchmark body is run across thread counts
+enum class Threading {
+    Serial, // Only on a single thread
+    Benchmark, // On N benchmark threads at once, each performing the operations
+    OpenMP, // On a single benchmark thread, with OpenMP set to use N threads inside the body
+};
+
+// A benchmark body; performs `count` operations on thread `thread`, and returns a value that
+// depends on the results so the work cannot be optimized away
+using BenchBody = std::function<float(int thread, uint64_t count)>;
+
+class BenchRunner {
+public:
+    explicit BenchRunner(const BenchOptions& options)
+        : m_options(options)
+    {
+    }
+
+    // Run `body` for every thread count, growing the nr. of operations until it runs long enough.
+    // - raysPerOp; the nr. of rays traced by a single operation, or 0
+    // - threading; how the body is run on multiple threads
+    void run(const std::string& name, double raysPerOp, const BenchBody& body, Threading threading = Threading::Benchmark)
+    {
+        if (!m_options.filter.empty() && name.find(m_options.filter) == std::string::npos)
+            return;
+
+        for (int threads : threadCounts(threading)) {
+            const int benchThreads = threading == Threading::Benchmark ? threads : 1;
+            omp_set_num_threads(threading == Threading::OpenMP ? threads : m_options.maxThreads);
+
+            uint64_t count = 1;
+            double seconds = 0.0;
+            while (true) {
+                seconds = measure(benchThreads, count, body);
+                if (seconds >= m_options.minTime || count >= (1ull << 40))
+                    break;
+                // Aim for the minimum time directly, but at most grow 100x per step
+                const double scale = seconds > 0.0 ? std::min(100.0, 1.5 * m_options.minTime / seconds) : 100.0;
+                count = std::max(count + 1, static_cast<uint64_t>(static_cast<double>(count) * scale));
+            }
+
+            const uint64_t operations = count * static_cast<uint64_t>(benchThreads);
+            BenchResult result {
+                .name = name,
+                .threads = threads,
+                .operations = operations,
+                .seconds = seconds,
+                .nsPerOp = seconds * 1e9 / static_cast<double>(operations),
+                .raysPerSec = raysPerOp * static_cast<double>(operations) / seconds
+            };
+            fmt::print("{:<48} threads={:<3} {:>14.1f} ns/op", result.name, result.threads, result.nsPerOp);
+            if (result.raysPerSec > 0.0)
+                fmt::print(" {:>10.3f} Mrays/s", result.raysPerSec * 1e-6);
+            fmt::print("\n");
+            m_results.push_back(result);
+        }
+        omp_set_num_threads(m_options.maxThreads);
+    }
+
+    void writeJson(const std::filesystem::path& path) const
+    {
+        std::ofstream out { path };
+        fmt::print(out, "{{\n");
+        fmt::print(out, "  \"max_threads\": {},\n", m_options.maxThreads);
+        fmt::print(out, "  \"min_time_seconds\": {},\n", m_options.minTime);
+        fmt::print(out, "  \"render_resolution\": {},\n", m_options.resolution);
+#ifdef NDEBUG
+        fmt::print(out, "  \"build\": \"release\",\n");
+#else
+        fmt::print(out, "  \"build\": \"debug\",\n");
+#endif
+        fmt::print(out, "  \"results\": [\n");
+        for (size_t i = 0; i < m_results.size(); i++) {
+            const auto& r = m_results[i];
+            fmt::print(out, "    {{ \"name\": \"{}\", \"threads\": {}, \"operations\": {}, \"seconds\": {:.6f}, \"ns_per_op\": {:.3f}, \"rays_per_sec\": {:.1f} }}{}\n",
+                r.name, r.threads, r.operations, r.seconds, r.nsPerOp, r.raysPerSec, i + 1 < m_results.size() ? "," : "");
+        }
+        fmt::print(out, "  ]\n}}\n");
+    }
+
+private:
+    std::vector<int> threadCounts(Threading threading) const
+    {
+        std::vector<int> counts { 1 };
+        if (threading != Threading::Serial) {
+            for (int threads = 2; threads < m_options.maxThreads; threads *= 2)
+                counts.push_back(threads);
+            if (m_options.maxThreads > 1)
+                counts.push_back(m_options.maxThreads);
+        }
+        return counts;
+    }
+
+    double measure(int threads, uint64_t count, const BenchBody& body)
+    {
+        std::vector<float> sink(static_cast<size_t>(threads), 0.0f);
+        const auto start = std::chrono::steady_clock::now();
+#pragma omp parallel num_threads(threads)
+        {
+            const int thread = omp_get_thread_num();
+            sink[static_cast<size_t>(thread)] = body(thread, count);
+        }
+        const auto end = std::chrono::steady_clock::now();
+        for (float value : sink)
+            m_sink += value;
+        return std::chrono::duration<double>(end - start).count();
+    }
+
+    const BenchOptions& m_options;
+    std::vector<BenchResult> m_results;
+    float m_sink = 0.0f;
+};
+
+static std::vector<Ray> randomRays(size_t count, const glm::vec3& origin, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> dist { -1.0f, 1.0f };
+    std::vector<Ray> rays(count);
+    for (auto& ray : rays) {
+        ray.origin = origin + 0.1f * glm::vec3(dist(rng), dist(rng), dist(rng));
+        ray.direction = glm::normalize(glm::vec3(dist(rng), dist(rng), 1.0f));
+        ray.t = std::numeric_limits<float>::max();
+    }
+    return rays;
+}
+
+// The fixed camera used for all scene benchmarks; the same as the default camera in the config files
+static Camera fixedCamera(float aspectRatio)
+{
+    return Camera { CameraConfig { .rotation = glm::vec3(0.0f) }, aspectRatio };
+}
+
+// Primary rays through a grid of pixels of the fixed camera
+static std::vector<Ray> cameraRays(int resolution)
+{
+    const Camera camera = fixedCamera(1.0f);
+    std::vector<Ray> rays;
+    rays.reserve(static_cast<size_t>(resolution * resolution));
+    for (int y = 0; y < resolution; y++) {
+        for (int x = 0; x < resolution; x++) {
+            const glm::vec2 ndc = (glm::vec2(x, y) + 0.5f) / static_cast<float>(resolution) * 2.0f - 1.0f;
+            rays.push_back(camera.generateRay(ndc));
+        }
+    }
+    return rays;
+}
+
+static void benchIntersections(BenchRunner& runner)
+{
+    constexpr size_t count = 4096;
+    std::mt19937 rng { 42 };
+    std::uniform_real_distribution<float> dist { -1.0f, 1.0f };
+    const std::vector<Ray> rays = randomRays(count, glm::vec3(0.0f, 0.0f, -2.0f), rng);
+
+    std::vector<std::array<glm::vec3, 3>> triangles(count);
+    for (auto& triangle : triangles)
+        triangle = { glm::vec3(dist(rng), dist(rng), dist(rng)), glm::vec3(dist(rng), dist(rng), dist(rng)), glm::vec3(dist(rng), dist(rng), dist(rng)) };
+    std::vector<AxisAlignedBox> boxes(count);
+    for (auto& box : boxes) {
+        const glm::vec3 a { dist(rng), dist(rng), dist(rng) }, b { dist(rng), dist(rng), dist(rng) };
+        box = { glm::min(a, b), glm::max(a, b) };
+    }
+
+    runner.run("intersect/ray_triangle", 1.0, [&](int thread, uint64_t n) {
+        float sum = 0.0f;
+        for (uint64_t i = 0; i < n; i++) {
+            const size_t j = (i + static_cast<uint64_t>(thread)) % count;
+            Ray ray = rays[j];
+            HitInfo hitInfo;
+            if (intersectRayWithTriangle(triangles[j][0], triangles[j][1], triangles[j][2], ray, hitInfo))
+                sum += ray.t;
+        }
+        return sum;
+    });
+
+    runner.run("intersect/ray_box", 1.0, [&](int thread, uint64_t n) {
+        float sum = 0.0f;
+        for (uint64_t i = 0; i < n; i++) {
+            const size_t j = (i + static_cast<uint64_t>(thread)) % count;
+            Ray ray = rays[j];
+            if (intersectRayWithShape(boxes[j], ray))
+                sum += ray.t;
+        }
+        return sum;
+    });
+}
+
+static void benchBVH(BenchRunner& runner, SceneType type, const std::string& sceneName)
+{
+    const Scene scene = loadScenePrebuilt(type, DATA_DIR);
+
+    Features features;
+    features.enableAccelStructure = true;
+    features.enableShading = true;
+    features.enableShadows = true;
+    for (bool sah : { false, true }) {
+        features.extra.enableBvhSahBinning = sah;
+        runner.run(fmt::format("bvh_build/{}/{}", sah ? "sah" : "median", sceneName), 0.0, [&](int, uint64_t n) {
+            float sum = 0.0f;
+            for (uint64_t i = 0; i < n; i++)
+                sum += static_cast<float>(BVH(scene, features).numLeaves());
+            return sum;
+        }, Threading::Serial);
+    }
+    features.extra.enableBvhSahBinning = false;
+    const BVH bvh { scene, features };
+
+    // Closest hit for primary rays of the fixed camera
+    const std::vector<Ray> primaryRays = cameraRays(64);
+    runner.run(fmt::format("bvh_traversal/closest/{}", sceneName), 1.0, [&](int thread, uint64_t n) {
+        RenderState state { .scene = scene, .features = features, .bvh = bvh, .sampler = { static_cast<uint32_t>(thread) } };
+        float sum = 0.0f;
+        for (uint64_t i = 0; i < n; i++) {
+            Ray ray = primaryRays[(i + static_cast<uint64_t>(thread) * 997) % primaryRays.size()];
+            HitInfo hitInfo;
+            if (kernel::intersectRayWithBVH<TraversalKernel>(state, bvh, ray, hitInfo))
+                sum += ray.t;
+        }
+        return sum;
+    });
+
+    // Shadow rays from the primary hits towards the scene's first point light
+    const auto light = std::find_if(scene.lights.begin(), scene.lights.end(), [](const auto& sceneLight) { return std::holds_alternative<PointLight>(sceneLight); });
+    if (light == scene.lights.end())
+        return;
+    const glm::vec3 lightPosition = std::get<PointLight>(*light).position;
+
+    std::vector<Ray> hitRays;
+    {
+        RenderState state { .scene = scene, .features = features, .bvh = bvh, .sampler = {} };
+        for (Ray ray : primaryRays) {
+            HitInfo hitInfo;
+            if (kernel::intersectRayWithBVH<TraversalKernel>(state, bvh, ray, hitInfo))
+                hitRays.push_back(ray);
+        }
+    }
+    if (hitRays.empty())
+        return;
+
+    runner.run(fmt::format("bvh_traversal/shadow/{}", sceneName), 1.0, [&](int thread, uint64_t n) {
+        RenderState state { .scene = scene, .features = features, .bvh = bvh, .sampler = { static_cast<uint32_t>(thread) } };
+        float sum = 0.0f;
+        for (uint64_t i = 0; i < n; i++) {
+            const Ray& ray = hitRays[(i + static_cast<uint64_t>(thread) * 997) % hitRays.size()];
+            if (kernel::visibilityOfLightSampleBinary<TraversalKernel>(state, lightPosition, glm::vec3(1.0f), ray, HitInfo {}))
+                sum += 1.0f;
+        }
+        return sum;
+    });
+}
+
+static void benchTextures(BenchRunner& runner)
+{
+    const Image image { std::filesystem::path(DATA_DIR) / "default.png" };
+
+    constexpr size_t count = 4096;
+    std::mt19937 rng { 42 };
+    std::uniform_real_distribution<float> dist { 0.0f, 1.0f };
+    std::vector<glm::vec2> texCoords(count);
+    for (auto& texCoord : texCoords)
+        texCoord = { dist(rng), dist(rng) };
+
+    runner.run("texture/nearest", 0.0, [&](int thread, uint64_t n) {
+        float sum = 0.0f;
+        for (uint64_t i = 0; i < n; i++)
+            sum += sampleTextureNearest(image, texCoords[(i + static_cast<uint64_t>(thread)) % count]).x;
+        return sum;
+    });
+    runner.run("texture/bilinear", 0.0, [&](int thread, uint64_t n) {
+        float sum = 0.0f;
+        for (uint64_t i = 0; i < n; i++)
+            sum += sampleTextureBilinear(image, texCoords[(i + static_cast<uint64_t>(thread)) % count]).x;
+        return sum;
+    });
+
+    // The compact textures sampled by the specialised kernels, in every format
+    const std::pair<TextureFormat, const char*> formats[] {
+        { TextureFormat::Unorm8, "unorm8" }, { TextureFormat::Srgb8, "srgb8" }, { TextureFormat::Half, "half" }, { TextureFormat::Float, "float" }
+    };
+    for (const auto& [format, formatName] : formats) {
+        const Texture texture { image, format };
+        runner.run(fmt::format("texture/tiled_nearest/{}", formatName), 0.0, [&](int thread, uint64_t n) {
+            float sum = 0.0f;
+            for (uint64_t i = 0; i < n; i++)
+                sum += texture.sampleNearest(texCoords[(i + static_cast<uint64_t>(thread)) % count]).x;
+            return sum;
+        });
+        runner.run(fmt::format("texture/tiled_bilinear/{}", formatName), 0.0, [&](int thread, uint64_t n) {
+            float sum = 0.0f;
+            for (uint64_t i = 0; i < n; i++)
+                sum += texture.sampleBilinear(texCoords[(i + static_cast<uint64_t>(thread)) % count]).x;
+            return sum;
+        });
+    }
+
+    // A texture much larger than the caches, like the environment map; lookups are bound by memory
+    const Image largeImage { std::filesystem::path(DATA_DIR) / "cube2.jpg" };
+    const Texture largeTexture { largeImage };
+    runner.run("texture/large/bilinear", 0.0, [&](int thread, uint64_t n) {
+        float sum = 0.0f;
+        for (uint64_t i = 0; i < n; i++)
+            sum += sampleTextureBilinear(largeImage, texCoords[(i + static_cast<uint64_t>(thread)) % count]).x;
+        return sum;
+    });
+    runner.run("texture/large/tiled_bilinear", 0.0, [&](int thread, uint64_t n) {
+        float sum = 0.0f;
+        for (uint64_t i = 0; i < n; i++)
+            sum += largeTexture.sampleBilinear(texCoords[(i + static_cast<uint64_t>(thread)) % count]).x;
+        return sum;
+    });
+    // Minified lookups, as for a distant surface; the lod falls between two levels
+    runner.run("texture/large/tiled_trilinear", 0.0, [&](int thread, uint64_t n) {
+        float sum = 0.0f;
+        for (uint64_t i = 0; i < n; i++)
+            sum += largeTexture.sampleTrilinear(texCoords[(i + static_cast<uint64_t>(thread)) % count], 3.5f).x;
+        return sum;
+    });
+
+    // The same texture streamed through a texture cache, with room for an eighth of its pages. The first
+    // lookup converts the texture, so do that up front
+    TextureCache cache { TextureCacheConfig { .budgetBytes = size_t(8) << 20 } };
+    const TextureCache::TextureID cachedTexture = cache.addTexture(std::filesystem::path(DATA_DIR) / "cube2.jpg");
+    (void)cache.resolution(cachedTexture);
+    runner.run("texture/large/cached_bilinear", 0.0, [&](int thread, uint64_t n) {
+        float sum = 0.0f;
+        for (uint64_t i = 0; i < n; i++)
+            sum += cache.sampleBilinear(cachedTexture, texCoords[(i + static_cast<uint64_t>(thread)) % count]).x;
+        return sum;
+    });
+    // Lookups along scanlines, as for a surface seen head-on; nearly all of them hit
+    runner.run("texture/large/cached_bilinear_coherent", 0.0, [&](int thread, uint64_t n) {
+        float sum = 0.0f;
+        for (uint64_t i = 0; i < n; i++) {
+            const uint64_t j = i + static_cast<uint64_t>(thread) * 7919;
+            sum += cache.sampleBilinear(cachedTexture, { float(j % 4096) / 4096.0f, float((j / 4096) % 3072) / 3072.0f }).x;
+        }
+        return sum;
+    });
+    const TextureCache::Stats stats = cache.stats();
+    fmt::print("texture cache: {} hits, {} misses, {} evictions, {} MiB peak resident\n", stats.hits, stats.misses, stats.evictions, stats.peakResidentBytes >> 20);
+}
+
+static void benchCameraRays(BenchRunner& runner, int resolution)
+{
+    const glm::ivec2 screenResolution { resolution, resolution };
+    Trackball trackball { glm::radians(50.0f), 1.0f, 3.0f };
+    trackball.setCamera(glm::vec3(0.0f), glm::vec3(0.0f), 3.0f);
+    const Camera camera = fixedCamera(1.0f);
+
+    runner.run("camera_rays/trackball", 1.0, [&](int thread, uint64_t n) {
+        float sum = 0.0f;
+        for (uint64_t i = 0; i < n; i++) {
+            const uint64_t pixel = i + static_cast<uint64_t>(thread);
+            const glm::vec2 xy { pixel % static_cast<uint64_t>(resolution), (pixel / static_cast<uint64_t>(resolution)) % static_cast<uint64_t>(resolution) };
+            sum += trackball.generateRay((xy + 0.5f) / glm::vec2(screenResolution) * 2.0f - 1.0f).direction.x;
+        }
+        return sum;
+    });
+
+    // Rays are generated a 16x16 tile at a time, like `renderImage()` does
+    const int tilesPerRow = std::max(1, resolution / 16);
+    runner.run("camera_rays/camera_tile", 1.0, [&](int, uint64_t n) {
+        std::array<Ray, 256> rays;
+        float sum = 0.0f;
+        for (uint64_t i = 0; i < n; i += rays.size()) {
+            const int tile = static_cast<int>(i / rays.size());
+            const glm::ivec2 tileBegin = glm::ivec2(tile % tilesPerRow, (tile / tilesPerRow) % tilesPerRow) * 16;
+            camera.generateTileRays(tileBegin, glm::min(tileBegin + 16, screenResolution), screenResolution, rays);
+            sum += rays[0].direction.x;
+        }
+        return sum;
+    });
+}
+
+static void benchBloom(BenchRunner& runner, int resolution)
+{
+    Features features;
+    features.extra.enableBloomEffect = true;
+
+    std::mt19937 rng { 42 };
+    std::uniform_real_distribution<float> dist { 0.0f, 1.5f };
+    Screen source { { resolution, resolution }, false };
+    for (auto& pixel : source.pixels())
+        pixel = { dist(rng), dist(rng), dist(rng) };
+
+    runner.run(fmt::format("bloom/{}x{}", resolution, resolution), 0.0, [&](int, uint64_t n) {
+        float sum = 0.0f;
+        for (uint64_t i = 0; i < n; i++) {
+            Screen screen = source;
+            postprocessImageWithBloom(features, screen);
+            sum += screen.pixels()[0].x;
+        }
+        return sum;
+    }, Threading::OpenMP);
+
+    // A full output stage; bloom, tone mapping and quantization to 8 bits
+    PostProcessPipeline pipeline { { ThresholdPass {}, BlurPass {}, CompositePass {}, ExposurePass {}, ToneMapPass {}, GammaPass {}, QuantizePass {} } };
+    runner.run(fmt::format("post_process/{}x{}", resolution, resolution), 0.0, [&](int, uint64_t n) {
+        float sum = 0.0f;
+        Screen screen = source;
+        for (uint64_t i = 0; i < n; i++) {
+            std::copy(std::begin(source.pixels()), std::end(source.pixels()), std::begin(screen.pixels()));
+            pipeline.apply(screen);
+            sum += screen.pixels()[0].x;
+        }
+        return sum;
+    }, Threading::OpenMP);
+}
+
+static void benchRenderImage(BenchRunner& runner, SceneType type, const std::string& sceneName, int resolution)
+{
+    const Scene scene = loadScenePrebuilt(type, DATA_DIR);
+
+    Features features;
+    features.enableShading = true;
+    features.enableReflections = true;
+    features.enableShadows = true;
+    features.enableNormalInterp = true;
+    features.enableTextureMapping = true;
+    features.enableAccelStructure = true;
+    features.shadingModel = ShadingModel::Phong;
+    const BVH bvh { scene, features };
+    const Camera camera = fixedCamera(1.0f);
+
+    const double raysPerImage = static_cast<double>(resolution) * static_cast<double>(resolution) * static_cast<double>(features.numPixelSamples);
+    runner.run(fmt::format("render_image/{}", sceneName), raysPerImage, [&](int, uint64_t n) {
+        float sum = 0.0f;
+        for (uint64_t i = 0; i < n; i++) {
+            Screen screen { { resolution, resolution }, false };
+            renderImage(scene, bvh, features, camera, screen);
+            sum += screen.pixels()[screen.pixels().size() / 2].x;
+        }
+        return sum;
+    }, Threading::OpenMP);
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string arg = argv[i];
+        if (arg == "--out") {
+            options.outFile = argv[i + 1];
+        } else if (arg == "--filter") {
+            options.filter = argv[i + 1];
+        } else if (arg == "--threads") {
+            options.maxThreads = std::max(1, std::atoi(argv[i + 1]));
+        } else if (arg == "--min-time") {
+            options.minTime = std::atof(argv[i + 1]);
+        } else if (arg == "--resolution") {
+            options.resolution = std::max(1, std::atoi(argv[i + 1]));
+        } else {
+            fmt::print(stderr, "Unknown argument {}\n", arg);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Names of prebuilt scenes, used in benchmark names
+    const std::vector<std::pair<SceneType, std::string>> scenes {
+        { SingleTriangle, "single_triangle" },
+        { Cube, "cube" },
+        { CubeTextured, "cube_textured" },
+        { CornellBox, "cornell_box" },
+        { CornellBoxTransparency, "cornell_box_transparency" },
+        { CornellBoxParallelogramLight, "cornell_box_parallelogram_light" },
+        { Monkey, "monkey" },
+        { Teapot, "teapot" },
+        { Dragon, "dragon" },
+        { Spheres, "spheres" },
+    };
+
+    BenchRunner runner { options };
+    benchIntersections(runner);
+    benchTextures(runner);
+    benchCameraRays(runner, options.resolution);
+    benchBloom(runner, options.resolution);
+    for (const auto& [type, name] : scenes) {
+        try {
+            if (type == CornellBox || type == Monkey || type == Teapot || type == Dragon)
+                benchBVH(runner, type, name);
+            benchRenderImage(runner, type, name, options.resolution);
+        } catch (const std::exception&) {
+            // loadMesh() throws if a model is not shipped with the data directory
+            fmt::print(stderr, "Skipping scene {}, it could not be loaded\n", name);
+        }
+    }
+
+    runner.writeJson(options.outFile);
+    fmt::print("Results written to {}\n", options.outFile.string());
+    return EXIT_SUCCESS;
+}
@@ -14,6 +14,8 @@ DISABLE_WARNINGS_POP()
 struct Image {
 public:
     explicit Image(const std::filesystem::path& filePath);
+    // Create a black image of the given size.
+    Image(int width, int height);
 
 
     void writeBitmapToFile(const std::filesystem::path& filePath);
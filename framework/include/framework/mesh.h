@@ -40,9 +40,17 @@ struct Mesh {
 	std::vector<glm::uvec3> triangles;
 
 	Material material;
+	// File that material.kdTexture is loaded from; set even if the texture was not loaded.
+	std::filesystem::path kdTexturePath;
 };
 
-[[nodiscard]] std::vector<Mesh> loadMesh(const std::filesystem::path& file, bool normalize = false);
+// Reads Wavefront OBJ files, or PLY files if the extension is .ply (see mesh_io.h).
+// If loadTextures is false, textures are not read; only Mesh::kdTexturePath is set.
+// Large files are cached in a binary format after the first load, s.t. later loads skip parsing.
+[[nodiscard]] std::vector<Mesh> loadMesh(const std::filesystem::path& file, bool normalize = false, bool loadTextures = true);
+// Directory that loadMesh() caches meshes in; an empty path disables the cache. Defaults to a directory in
+// the system's temporary directory.
+void setMeshCacheDirectory(std::filesystem::path directory);
 [[nodiscard]] Mesh mergeMeshes(std::span<const Mesh> meshes);
 void meshFlipX(Mesh& mesh);
 void meshFlipY(Mesh& mesh);
@@ -0,0 +1,22 @@
+#pragma once
+#include "mesh.h"
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <vector>
+
+// Readers and the binary mesh cache behind loadMesh(). The readers memory map the file, and parse it on all
+// cores in chunks that start at line boundaries. Like loadMesh(), they do not load textures, and throw an
+// std::exception (after printing the reason) if the file cannot be read.
+
+// Read a Wavefront OBJ file (and its MTL material libraries). Polygons are triangulated, and every object,
+// group, and run of faces with the same material becomes a separate mesh.
+[[nodiscard]] std::vector<Mesh> readObj(const std::filesystem::path& file);
+// Read a PLY file (ASCII, or binary in either byte order) into a single mesh with a white material. If the
+// file has no vertex normals, area weighted normals of the adjacent faces are used.
+[[nodiscard]] std::vector<Mesh> readPly(const std::filesystem::path& file);
+
+// Binary copies of meshes, in the layout of `Mesh`, s.t. reading them is a copy from a memory mapped file.
+// A cache file is only used if it is as new as the source file it was written for; returns std::nullopt otherwise.
+[[nodiscard]] std::optional<std::vector<Mesh>> readMeshCache(const std::filesystem::path& cacheFile, const std::filesystem::path& sourceFile);
+bool writeMeshCache(const std::filesystem::path& cacheFile, const std::filesystem::path& sourceFile, std::span<const Mesh> meshes);
@@ -28,6 +28,8 @@ public:
     // ... Feel free to add more methods here (e.g. for setting uniforms or keeping track of texture units) ...
 
     void bind() const;
+    // Location of a uniform of the program, or -1 if the program has no such (active) uniform
+    [[nodiscard]] GLint uniformLocation(const char* name) const;
 
 private:
     friend class ShaderBuilder;
@@ -16,6 +16,8 @@ public:
 	// NOTE(Mathijs): field of view in radians! (use glm::radians(...) to convert from degrees to radians).
 	Trackball(Window* pWindow, float fovy, float distanceFromLookAt = 4.0f, float rotationX = 0.0f, float rotationY = 0.0f);
 	Trackball(Window* pWindow, float fovy, const glm::vec3& lookAt, float distanceFromLookAt = 4.0f, float rotationX = 0.0f, float rotationY = 0.0f);
+	// Camera that is not attached to a window (e.g. for offline rendering), and thus cannot be controlled with the mouse.
+	Trackball(float fovy, float aspectRatio, float distanceFromLookAt = 4.0f, float rotationX = 0.0f, float rotationY = 0.0f);
 	~Trackball() = default;
 
 	static void printHelp();
@@ -32,6 +34,8 @@ public:
 	[[nodiscard]] glm::mat4 projectionMatrix() const;
         [[nodiscard]] glm::vec3 rotationEulerAngles() const;
         [[nodiscard]] float distanceFromLookAt() const;
+	[[nodiscard]] float fieldOfView() const; // Vertical field of view, in radians.
+	[[nodiscard]] float aspectRatio() const;
 
 	void setCamera(const glm::vec3 lookAt, const glm::vec3 rotations, const float dist); // Set the position and orientation of the camera.
 
@@ -49,6 +53,7 @@ private:
 	float m_fovy;
 	float m_halfScreenSpaceHeight;
 	float m_halfScreenSpaceWidth;
+	float m_aspectRatio; // Only used without a window
 	bool m_canTranslate { true };
 
 	glm::vec3 m_lookAt{ 0.0f }; // Point that the camera is looking at / rotating around.
@@ -7,6 +7,7 @@ DISABLE_WARNINGS_PUSH()
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb/stb_image_write.h>
 DISABLE_WARNINGS_POP()
+#include <algorithm>
 #include <cassert>
 #include <exception>
 #include <iostream>
@@ -27,6 +28,14 @@ void Image::writeBitmapToFile(const std::filesystem::path& filePath) {
     stbi_write_bmp(filePathString.c_str(), width, height, 4, textureData8Bits.data());
 }
 
+// Image constructor, create black image of the given size
+Image::Image(int width, int height)
+    : width(width)
+    , height(height)
+    , pixels(size_t(width) * size_t(height), glm::vec3(0.0f))
+{
+}
+
 // Image constructor, create image from file
 Image::Image(const std::filesystem::path& filePath)
 {
@@ -45,6 +54,7 @@ Image::Image(const std::filesystem::path& filePath)
 	}
 
 	constexpr size_t numChannels = 3; // STBI_rgb == 3 channels
+	pixels.reserve(size_t(width) * size_t(height));
 	for (size_t i = 0; i < width * height * numChannels; i += numChannels) {
             pixels.emplace_back(stbPixels[i + 0] / 255.0f, stbPixels[i + 1] / 255.0f, stbPixels[i + 2] / 255.0f);
 	}
@@ -1,144 +1,78 @@
 #include "mesh.h"
+#include "mesh_io.h"
 // Suppress warnings in third-party code.
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
 #include <glm/gtc/matrix_inverse.hpp>
 #include <glm/mat4x4.hpp>
 #include <glm/vec3.hpp>
-#include <tinyobjloader/tiny_obj_loader.h>
+#include <fmt/format.h>
 DISABLE_WARNINGS_POP()
 #include <algorithm>
-#include <cassert>
+#include <cctype>
 #include <exception>
 #include <iostream>
 #include <numeric>
 #include <span>
-#include <stack>
 #include <string>
-#include <tuple>
-#include <unordered_map>
 
 static void centerAndScaleToUnitMesh(std::span<Mesh> meshes);
 
-static glm::vec3 construct_vec3(const float* pFloats)
+// Only files that take noticeably long to parse are cached
+static constexpr uintmax_t MinCachedFileSize = 1 << 20;
+
+static std::filesystem::path& meshCacheDirectory()
 {
-    return glm::vec3(pFloats[0], pFloats[1], pFloats[2]);
+    // Function local, s.t. a failure to find the temporary directory does not throw during static initialization
+    static std::filesystem::path directory = [] {
+        std::error_code error;
+        const std::filesystem::path temp = std::filesystem::temp_directory_path(error);
+        return error ? std::filesystem::path() : temp / "ray-tracer-mesh-cache";
+    }();
+    return directory;
 }
 
-// https://stackoverflow.com/questions/2590677/how-do-i-combine-hash-values-in-c0x
-template <class T>
-static void hash_combine(std::size_t& seed, const T& v)
+void setMeshCacheDirectory(std::filesystem::path directory)
 {
-    std::hash<T> hasher;
-    seed ^= hasher(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    meshCacheDirectory() = std::move(directory);
 }
 
-struct VertexHash {
-    size_t operator()(const Vertex& v) const
-    {
-        size_t seed = 0;
-        hash_combine(seed, v.position.x);
-        hash_combine(seed, v.position.y);
-        hash_combine(seed, v.position.z);
-        hash_combine(seed, v.normal.x);
-        hash_combine(seed, v.normal.y);
-        hash_combine(seed, v.normal.z);
-        hash_combine(seed, v.texCoord.s);
-        hash_combine(seed, v.texCoord.t);
-        return seed;
-    }
-};
+// Cache file for `file`; named after its absolute path, s.t. files with the same name do not collide.
+static std::filesystem::path meshCacheFile(const std::filesystem::path& file)
+{
+    const std::string absolutePath = std::filesystem::absolute(file).lexically_normal().string();
+    const size_t pathHash = std::hash<std::string> {}(absolutePath);
+    return meshCacheDirectory() / (file.stem().string() + "-" + fmt::format("{:016x}", pathHash) + ".mesh");
+}
 
-std::vector<Mesh> loadMesh(const std::filesystem::path& file, bool centerAndNormalize)
+std::vector<Mesh> loadMesh(const std::filesystem::path& file, bool centerAndNormalize, bool loadTextures)
 {
     if (!std::filesystem::exists(file)) {
         std::cerr << "File " << file << " does not exist." << std::endl;
         throw std::exception();
     }
 
-    const auto baseDir = file.parent_path();
+    std::error_code error;
+    const bool useCache = !meshCacheDirectory().empty() && std::filesystem::file_size(file, error) >= MinCachedFileSize && !error;
+    std::optional<std::vector<Mesh>> cached;
+    if (useCache)
+        cached = readMeshCache(meshCacheFile(file), file);
 
-    tinyobj::attrib_t inAttrib;
-    std::vector<tinyobj::shape_t> inShapes;
-    std::vector<tinyobj::material_t> inMaterials;
-
-    std::string warn, error;
-    bool ret = tinyobj::LoadObj(&inAttrib, &inShapes, &inMaterials, &warn, &error, file.string().c_str(), baseDir.string().c_str());
-    if (!ret) {
-        std::cerr << "Failed to load mesh " << file << std::endl;
-        throw std::exception();
+    std::vector<Mesh> out;
+    if (cached) {
+        out = std::move(*cached);
+    } else {
+        std::string extension = file.extension().string();
+        std::transform(std::begin(extension), std::end(extension), std::begin(extension), [](unsigned char c) { return char(std::tolower(c)); });
+        out = extension == ".ply" ? readPly(file) : readObj(file);
+        if (useCache)
+            writeMeshCache(meshCacheFile(file), file, out);
     }
 
-    std::vector<Mesh> out;
-    for (const auto& shape : inShapes) {
-        assert(shape.mesh.indices.size() % 3 == 0);
-
-        size_t startTriangle = 0;
-        auto prevMaterialID = shape.mesh.material_ids[0];
-        for (size_t endTriangle = 0; endTriangle < shape.mesh.indices.size() / 3; ++endTriangle) {
-            // tinyobjloader does not automatically split the mesh into smaller sub meshes according to material so we have to do it ourselves.
-            if (endTriangle == shape.mesh.indices.size() / 3 - 1)
-                ++endTriangle; // End of the tinyobj.shape; write remaining mesh.
-            else if (shape.mesh.material_ids[endTriangle] == prevMaterialID)
-                continue;
-            else
-                prevMaterialID = shape.mesh.material_ids[endTriangle];
-
-            Mesh mesh;
-            std::unordered_map<Vertex, uint32_t, VertexHash> vertexCache;
-            for (size_t i = startTriangle * 3; i != endTriangle * 3; i += 3) {
-                const glm::vec3 v0 = construct_vec3(&inAttrib.vertices[3 * shape.mesh.indices[i + 0].vertex_index]);
-                const glm::vec3 v1 = construct_vec3(&inAttrib.vertices[3 * shape.mesh.indices[i + 1].vertex_index]);
-                const glm::vec3 v2 = construct_vec3(&inAttrib.vertices[3 * shape.mesh.indices[i + 2].vertex_index]);
-                const auto geometricNormal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
-
-                // Load the triangle indices and lazily create the vertices.
-                glm::uvec3 triangle;
-                for (unsigned j = 0; j < 3; j++) {
-                    const auto& tinyObjIndex = shape.mesh.indices[i + j];
-                    Vertex vertex {
-                        .position = construct_vec3(&inAttrib.vertices[3 * tinyObjIndex.vertex_index]),
-                        .normal = glm::vec3(0),
-                        .texCoord = glm::vec2(0)
-                    };
-                    if (tinyObjIndex.normal_index != -1 && !inAttrib.normals.empty())
-                        vertex.normal = glm::vec3(inAttrib.normals[3 * tinyObjIndex.normal_index + 0], inAttrib.normals[3 * tinyObjIndex.normal_index + 1], inAttrib.normals[3 * tinyObjIndex.normal_index + 2]);
-                    else
-                        vertex.normal = geometricNormal;
-                    if (tinyObjIndex.texcoord_index != -1 && !inAttrib.texcoords.empty())
-                        vertex.texCoord = glm::vec2(inAttrib.texcoords[2 * tinyObjIndex.texcoord_index + 0], inAttrib.texcoords[2 * tinyObjIndex.texcoord_index + 1]);
-
-                    if (auto iter = vertexCache.find(vertex); iter != std::end(vertexCache)) {
-                        // Already visited this vertex? Reuse it!
-                        triangle[j] = iter->second;
-                    } else {
-                        // New vertex? Create it and store it in the vertex cache.
-                        vertexCache[vertex] = triangle[j] = (unsigned)mesh.vertices.size();
-                        mesh.vertices.push_back(vertex);
-                    }
-                }
-                mesh.triangles.push_back(triangle);
-            }
-
-            const auto materialID = shape.mesh.material_ids[startTriangle];
-            if (materialID == -1) {
-                mesh.material.kd = glm::vec3(1.0f);
-                mesh.material.ks = glm::vec3(0.0f);
-                mesh.material.shininess = 1.0f;
-            } else {
-                const auto& objMaterial = inMaterials[materialID];
-                mesh.material.kd = construct_vec3(objMaterial.diffuse);
-                if (!objMaterial.diffuse_texname.empty()) {
-                    mesh.material.kdTexture = std::make_shared<Image>(baseDir / objMaterial.diffuse_texname);
-                }
-                mesh.material.ks = construct_vec3(objMaterial.specular);
-                mesh.material.shininess = objMaterial.shininess;
-                mesh.material.transparency = objMaterial.dissolve;
-            }
-
-            out.push_back(std::move(mesh));
-
-            startTriangle = endTriangle;
+    if (loadTextures) {
+        for (Mesh& mesh : out) {
+            if (!mesh.kdTexturePath.empty())
+                mesh.material.kdTexture = std::make_shared<Image>(mesh.kdTexturePath);
         }
     }
 
@@ -0,0 +1,1029 @@
+#include "mesh_io.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+#include <tinyobjloader/tiny_obj_loader.h>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file. Files are memory mapped where possible, s.t. the OS pages them in while
+// the readers parse them, instead of copying them into a buffer first.
+class MappedFile {
+public:
+    explicit MappedFile(const std::filesystem::path& file)
+    {
+#ifdef _WIN32
+        std::ifstream stream { file, std::ios::binary };
+        if (!stream) {
+            std::cerr << "Failed to open " << file << std::endl;
+            throw std::exception();
+        }
+        m_buffer.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+#else
+        const int fd = open(file.c_str(), O_RDONLY);
+        struct stat status;
+        if (fd < 0 || fstat(fd, &status) != 0) {
+            std::cerr << "Failed to open " << file << std::endl;
+            if (fd >= 0)
+                close(fd);
+            throw std::exception();
+        }
+        m_size = size_t(status.st_size);
+        if (m_size > 0) {
+            m_data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m_data == MAP_FAILED) {
+                std::cerr << "Failed to map " << file << " into memory" << std::endl;
+                close(fd);
+                throw std::exception();
+            }
+            // The whole file is read front to back
+            madvise(m_data, m_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+        }
+        close(fd);
+#endif
+    }
+    ~MappedFile()
+    {
+#ifndef _WIN32
+        if (m_size > 0)
+            munmap(m_data, m_size);
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    [[nodiscard]] std::string_view contents() const
+    {
+#ifdef _WIN32
+        return { m_buffer.data(), m_buffer.size() };
+#else
+        return { static_cast<const char*>(m_data), m_size };
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    std::vector<char> m_buffer;
+#else
+    void* m_data = nullptr;
+    size_t m_size = 0;
+#endif
+};
+
+// Run `body(i)` for 0 <= i < count, spread over all cores.
+template <typename F>
+static void parallelFor(size_t count, F&& body)
+{
+    const size_t numThreads = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+    std::atomic<size_t> next { 0 };
+    const auto work = [&]() {
+        for (size_t i = next++; i < count; i = next++)
+            body(i);
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < numThreads; i++)
+        threads.emplace_back(work);
+    work();
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+// Split `text` into about `numChunks` pieces that end right after a newline (or at the end of the text).
+static std::vector<std::string_view> splitAtLines(std::string_view text, size_t numChunks)
+{
+    std::vector<std::string_view> chunks;
+    const size_t chunkSize = std::max<size_t>(text.size() / numChunks, 1);
+    size_t begin = 0;
+    while (begin < text.size()) {
+        size_t end = std::min(begin + chunkSize, text.size());
+        if (end < text.size()) {
+            const size_t newline = text.find('\n', end - 1);
+            end = newline == std::string_view::npos ? text.size() : newline + 1;
+        }
+        chunks.push_back(text.substr(begin, end - begin));
+        begin = end;
+    }
+    return chunks;
+}
+
+// Chunks per core; more chunks than cores evens out the work when lines differ in length.
+static size_t numChunksFor(std::string_view text)
+{
+    constexpr size_t minChunkSize = 1 << 16;
+    return std::clamp<size_t>(text.size() / minChunkSize, 1, 8 * std::max(1u, std::thread::hardware_concurrency()));
+}
+
+// Call `body(line)` for every line of `text`, without the line ending.
+template <typename F>
+static void forEachLine(std::string_view text, F&& body)
+{
+    while (!text.empty()) {
+        size_t end = text.find('\n');
+        std::string_view line = text.substr(0, end);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        body(line);
+        if (end == std::string_view::npos)
+            break;
+        text.remove_prefix(end + 1);
+    }
+}
+
+static void skipSpaces(std::string_view& text)
+{
+    const size_t begin = text.find_first_not_of(" \t");
+    text.remove_prefix(begin == std::string_view::npos ? text.size() : begin);
+}
+
+static std::string_view nextToken(std::string_view& text)
+{
+    skipSpaces(text);
+    const size_t end = std::min(text.find_first_of(" \t"), text.size());
+    const std::string_view token = text.substr(0, end);
+    text.remove_prefix(end);
+    return token;
+}
+
+template <typename T>
+static bool parseNumber(std::string_view& text, T& value)
+{
+    skipSpaces(text);
+    if (!text.empty() && text.front() == '+')
+        text.remove_prefix(1);
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc())
+        return false;
+    text.remove_prefix(size_t(end - text.data()));
+    return true;
+}
+
+// Append the triangles of a polygon, as indices into `corners`, in the same way as tinyobjloader: quads are
+// split along their shorter diagonal, and larger polygons into a fan.
+template <typename Position, typename F>
+static void triangulate(size_t numCorners, Position&& position, F&& emit)
+{
+    if (numCorners == 4) {
+        const float diagonal02 = glm::dot(position(2) - position(0), position(2) - position(0));
+        const float diagonal13 = glm::dot(position(3) - position(1), position(3) - position(1));
+        if (diagonal02 < diagonal13) {
+            emit(0, 1, 2);
+            emit(0, 2, 3);
+        } else {
+            emit(0, 1, 3);
+            emit(1, 2, 3);
+        }
+        return;
+    }
+    for (size_t i = 2; i < numCorners; i++)
+        emit(0, i - 1, i);
+}
+
+namespace {
+
+struct ObjCorner {
+    int v, vt, vn; // Zero-based; -1 if absent
+};
+
+// Groups, objects, and material changes, at the face they precede
+struct ObjEvent {
+    size_t face;
+    bool isMaterial; // A material change if set, else a new group or object
+    std::string material;
+};
+
+struct ObjChunk {
+    std::vector<glm::vec3> positions, normals;
+    std::vector<glm::vec2> texCoords;
+    std::vector<ObjCorner> corners;
+    std::vector<size_t> faceEnds; // End of every face in `corners`
+    std::vector<ObjEvent> events;
+    // Negative (relative) indices can refer to attributes of earlier chunks, so they are stored relative to
+    // the start of this chunk's attributes, and fixed up once those are known; indexed by 3 * corner + attribute
+    std::vector<size_t> relativeIndices;
+    std::vector<std::string> materialLibraries;
+    bool failed = false;
+};
+
+// A run of faces that becomes one mesh
+struct ObjRun {
+    size_t beginFace, endFace;
+    int material;
+};
+
+}
+
+static void parseObjChunk(std::string_view text, ObjChunk& chunk)
+{
+    forEachLine(text, [&](std::string_view line) {
+        skipSpaces(line);
+        if (line.empty() || line.front() == '#')
+            return;
+        const std::string_view keyword = nextToken(line);
+        if (keyword == "v") {
+            glm::vec3 position;
+            chunk.failed |= !(parseNumber(line, position.x) && parseNumber(line, position.y) && parseNumber(line, position.z));
+            chunk.positions.push_back(position);
+        } else if (keyword == "vn") {
+            glm::vec3 normal;
+            chunk.failed |= !(parseNumber(line, normal.x) && parseNumber(line, normal.y) && parseNumber(line, normal.z));
+            chunk.normals.push_back(normal);
+        } else if (keyword == "vt") {
+            glm::vec2 texCoord { 0.0f };
+            chunk.failed |= !parseNumber(line, texCoord.x);
+            (void)parseNumber(line, texCoord.y); // Optional
+            chunk.texCoords.push_back(texCoord);
+        } else if (keyword == "f") {
+            const size_t faceBegin = chunk.corners.size();
+            const size_t attributeCounts[3] { chunk.positions.size(), chunk.texCoords.size(), chunk.normals.size() };
+            for (std::string_view token = nextToken(line); !token.empty(); token = nextToken(line)) {
+                // v, v/vt, v//vn, or v/vt/vn
+                int indices[3] { 0, 0, 0 };
+                for (int attribute = 0; attribute < 3 && !token.empty(); attribute++) {
+                    if (token.front() != '/')
+                        chunk.failed |= !parseNumber(token, indices[attribute]);
+                    if (!token.empty() && token.front() == '/')
+                        token.remove_prefix(1);
+                    else
+                        break;
+                }
+                int* corner = &chunk.corners.emplace_back().v;
+                for (int attribute = 0; attribute < 3; attribute++) {
+                    if (indices[attribute] > 0) {
+                        corner[attribute] = indices[attribute] - 1;
+                    } else if (indices[attribute] < 0) {
+                        corner[attribute] = int(attributeCounts[attribute]) + indices[attribute];
+                        chunk.relativeIndices.push_back(3 * (chunk.corners.size() - 1) + size_t(attribute));
+                    } else {
+                        corner[attribute] = -1;
+                    }
+                }
+                chunk.failed |= indices[0] == 0;
+            }
+            // Skip degenerate faces, as tinyobjloader does
+            if (chunk.corners.size() - faceBegin < 3)
+                chunk.corners.resize(faceBegin);
+            else
+                chunk.faceEnds.push_back(chunk.corners.size());
+        } else if (keyword == "usemtl") {
+            skipSpaces(line);
+            chunk.events.push_back({ chunk.faceEnds.size(), true, std::string(line) });
+        } else if (keyword == "g" || keyword == "o") {
+            chunk.events.push_back({ chunk.faceEnds.size(), false, {} });
+        } else if (keyword == "mtllib") {
+            skipSpaces(line);
+            chunk.materialLibraries.emplace_back(line);
+        }
+    });
+}
+
+// Read the first of the files named on an `mtllib` line that exists.
+static void loadMaterialLibrary(const std::filesystem::path& baseDir, std::string_view fileNames, std::map<std::string, int>& materialIDs, std::vector<tinyobj::material_t>& materials)
+{
+    for (std::string_view fileName = nextToken(fileNames); !fileName.empty(); fileName = nextToken(fileNames)) {
+        std::ifstream stream { baseDir / std::string(fileName) };
+        if (!stream)
+            continue;
+        std::string warning, error;
+        tinyobj::LoadMtl(&materialIDs, &materials, &stream, &warning, &error);
+        return;
+    }
+}
+
+// Insert-only hash table from vertices to their index in a mesh. Vertices are shared if they are equal, even
+// if the file lists them more than once.
+class VertexTable {
+public:
+    explicit VertexTable(size_t maxNumVertices)
+        : m_slots(std::bit_ceil(std::max<size_t>(2 * maxNumVertices, 16)), InvalidVertex)
+        , m_mask(m_slots.size() - 1)
+    {
+    }
+
+    // Return the index of `vertex` in `vertices`, appending it if it is not there yet.
+    uint32_t findOrInsert(const Vertex& vertex, std::vector<Vertex>& vertices)
+    {
+        for (size_t index = hash(vertex) & m_mask;; index = (index + 1) & m_mask) {
+            uint32_t& slot = m_slots[index];
+            if (slot == InvalidVertex) {
+                slot = uint32_t(vertices.size());
+                vertices.push_back(vertex);
+                return slot;
+            }
+            if (vertices[slot] == vertex)
+                return slot;
+        }
+    }
+
+private:
+    static constexpr uint32_t InvalidVertex = ~0u;
+
+    static size_t hash(const Vertex& vertex)
+    {
+        uint64_t key = 0;
+        for (float value : { vertex.position.x, vertex.position.y, vertex.position.z, vertex.normal.x, vertex.normal.y, vertex.normal.z, vertex.texCoord.x, vertex.texCoord.y }) {
+            // Adding zero turns -0 into +0, as they compare equal
+            key = (key ^ std::bit_cast<uint32_t>(value + 0.0f)) * 0x9E3779B97F4A7C15ull;
+        }
+        return size_t(key ^ (key >> 32));
+    }
+
+    std::vector<uint32_t> m_slots;
+    size_t m_mask;
+};
+
+std::vector<Mesh> readObj(const std::filesystem::path& file)
+{
+    const MappedFile mappedFile { file };
+    const std::string_view text = mappedFile.contents();
+
+    // Parse all chunks independently
+    const std::vector<std::string_view> chunkTexts = splitAtLines(text, numChunksFor(text));
+    std::vector<ObjChunk> chunks(chunkTexts.size());
+    parallelFor(chunks.size(), [&](size_t i) { parseObjChunk(chunkTexts[i], chunks[i]); });
+    if (std::any_of(std::begin(chunks), std::end(chunks), [](const ObjChunk& chunk) { return chunk.failed; })) {
+        std::cerr << "Failed to load mesh " << file << ": malformed line" << std::endl;
+        throw std::exception();
+    }
+
+    // Where every chunk's attributes and faces start in the whole file
+    struct Offsets {
+        size_t positions = 0, texCoords = 0, normals = 0, corners = 0, faces = 0;
+    };
+    std::vector<Offsets> offsets(chunks.size() + 1);
+    for (size_t i = 0; i < chunks.size(); i++) {
+        offsets[i + 1] = {
+            offsets[i].positions + chunks[i].positions.size(),
+            offsets[i].texCoords + chunks[i].texCoords.size(),
+            offsets[i].normals + chunks[i].normals.size(),
+            offsets[i].corners + chunks[i].corners.size(),
+            offsets[i].faces + chunks[i].faceEnds.size()
+        };
+    }
+    const Offsets& totals = offsets.back();
+
+    // Gather the chunks
+    std::vector<glm::vec3> positions(totals.positions), normals(totals.normals);
+    std::vector<glm::vec2> texCoords(totals.texCoords);
+    std::vector<ObjCorner> corners(totals.corners);
+    std::vector<size_t> faceEnds(totals.faces);
+    std::atomic<bool> invalidIndex { false };
+    parallelFor(chunks.size(), [&](size_t i) {
+        ObjChunk& chunk = chunks[i];
+        for (size_t index : chunk.relativeIndices) {
+            int* corner = &chunk.corners[index / 3].v;
+            corner[index % 3] += int(index % 3 == 0 ? offsets[i].positions : index % 3 == 1 ? offsets[i].texCoords : offsets[i].normals);
+        }
+        for (ObjCorner& corner : chunk.corners) {
+            // Faces must have positions; other missing attributes are dropped
+            invalidIndex = invalidIndex || corner.v < 0 || size_t(corner.v) >= totals.positions;
+            if (corner.vt < -1 || corner.vt >= int(totals.texCoords))
+                corner.vt = -1;
+            if (corner.vn < -1 || corner.vn >= int(totals.normals))
+                corner.vn = -1;
+        }
+        std::copy(std::begin(chunk.positions), std::end(chunk.positions), std::begin(positions) + ptrdiff_t(offsets[i].positions));
+        std::copy(std::begin(chunk.normals), std::end(chunk.normals), std::begin(normals) + ptrdiff_t(offsets[i].normals));
+        std::copy(std::begin(chunk.texCoords), std::end(chunk.texCoords), std::begin(texCoords) + ptrdiff_t(offsets[i].texCoords));
+        std::copy(std::begin(chunk.corners), std::end(chunk.corners), std::begin(corners) + ptrdiff_t(offsets[i].corners));
+        std::transform(std::begin(chunk.faceEnds), std::end(chunk.faceEnds), std::begin(faceEnds) + ptrdiff_t(offsets[i].faces),
+            [&](size_t end) { return end + offsets[i].corners; });
+        // Keep only the events and material libraries
+        chunk.positions = {};
+        chunk.normals = {};
+        chunk.texCoords = {};
+        chunk.corners = {};
+        chunk.faceEnds = {};
+    });
+    if (invalidIndex) {
+        std::cerr << "Failed to load mesh " << file << ": vertex index out of range" << std::endl;
+        throw std::exception();
+    }
+
+    // Materials, and the runs of faces in the same group and with the same material
+    const std::filesystem::path baseDir = file.parent_path();
+    std::map<std::string, int> materialIDs;
+    std::vector<tinyobj::material_t> materials;
+    std::vector<ObjRun> runs;
+    int material = -1;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        for (const std::string& library : chunks[i].materialLibraries)
+            loadMaterialLibrary(baseDir, library, materialIDs, materials);
+    }
+    const auto startRun = [&](size_t face) {
+        if (!runs.empty())
+            runs.back().endFace = face;
+        if (!runs.empty() && runs.back().beginFace == face)
+            runs.back().material = material;
+        else
+            runs.push_back({ face, face, material });
+    };
+    startRun(0);
+    for (size_t i = 0; i < chunks.size(); i++) {
+        for (const ObjEvent& event : chunks[i].events) {
+            const size_t face = offsets[i].faces + event.face;
+            if (event.isMaterial) {
+                const auto iter = materialIDs.find(event.material);
+                const int newMaterial = iter == std::end(materialIDs) ? -1 : iter->second;
+                if (newMaterial == material)
+                    continue;
+                material = newMaterial;
+            }
+            startRun(face);
+        }
+    }
+    runs.back().endFace = totals.faces;
+    std::erase_if(runs, [](const ObjRun& run) { return run.beginFace == run.endFace; });
+
+    // Build a mesh per run, sharing vertices between the triangles of a run
+    std::vector<Mesh> out(runs.size());
+    parallelFor(runs.size(), [&](size_t i) {
+        const ObjRun& run = runs[i];
+        Mesh& mesh = out[i];
+        const size_t beginCorner = run.beginFace == 0 ? 0 : faceEnds[run.beginFace - 1];
+        VertexTable vertexTable { faceEnds[run.endFace - 1] - beginCorner };
+        mesh.triangles.reserve(run.endFace - run.beginFace);
+
+        for (size_t face = run.beginFace, faceBegin = beginCorner; face < run.endFace; faceBegin = faceEnds[face++]) {
+            const std::span<const ObjCorner> faceCorners { &corners[faceBegin], faceEnds[face] - faceBegin };
+            triangulate(
+                faceCorners.size(), [&](size_t j) { return positions[size_t(faceCorners[j].v)]; },
+                [&](size_t j0, size_t j1, size_t j2) {
+                    const size_t triangleCorners[3] { j0, j1, j2 };
+                    const glm::vec3 v0 = positions[size_t(faceCorners[j0].v)];
+                    const glm::vec3 v1 = positions[size_t(faceCorners[j1].v)];
+                    const glm::vec3 v2 = positions[size_t(faceCorners[j2].v)];
+                    const glm::vec3 geometricNormal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+
+                    glm::uvec3 triangle;
+                    for (int j = 0; j < 3; j++) {
+                        const ObjCorner& corner = faceCorners[triangleCorners[j]];
+                        const Vertex vertex {
+                            .position = positions[size_t(corner.v)],
+                            .normal = corner.vn == -1 ? geometricNormal : normals[size_t(corner.vn)],
+                            .texCoord = corner.vt == -1 ? glm::vec2(0) : texCoords[size_t(corner.vt)]
+                        };
+                        triangle[j] = vertexTable.findOrInsert(vertex, mesh.vertices);
+                    }
+                    mesh.triangles.push_back(triangle);
+                });
+        }
+
+        if (run.material == -1) {
+            mesh.material.kd = glm::vec3(1.0f);
+            mesh.material.ks = glm::vec3(0.0f);
+            mesh.material.shininess = 1.0f;
+        } else {
+            const tinyobj::material_t& objMaterial = materials[size_t(run.material)];
+            mesh.material.kd = glm::vec3(objMaterial.diffuse[0], objMaterial.diffuse[1], objMaterial.diffuse[2]);
+            if (!objMaterial.diffuse_texname.empty())
+                mesh.kdTexturePath = baseDir / objMaterial.diffuse_texname;
+            mesh.material.ks = glm::vec3(objMaterial.specular[0], objMaterial.specular[1], objMaterial.specular[2]);
+            mesh.material.shininess = objMaterial.shininess;
+            mesh.material.transparency = objMaterial.dissolve;
+        }
+    });
+    return out;
+}
+
+namespace {
+
+enum class PlyType {
+    Int8,
+    UInt8,
+    Int16,
+    UInt16,
+    Int32,
+    UInt32,
+    Float32,
+    Float64,
+};
+
+struct PlyProperty {
+    std::string name;
+    PlyType type;
+    bool isList = false;
+    PlyType countType = PlyType::UInt8; // Type of a list's length
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+};
+
+}
+
+static std::optional<PlyType> parsePlyType(std::string_view name)
+{
+    if (name == "char" || name == "int8")
+        return PlyType::Int8;
+    if (name == "uchar" || name == "uint8")
+        return PlyType::UInt8;
+    if (name == "short" || name == "int16")
+        return PlyType::Int16;
+    if (name == "ushort" || name == "uint16")
+        return PlyType::UInt16;
+    if (name == "int" || name == "int32")
+        return PlyType::Int32;
+    if (name == "uint" || name == "uint32")
+        return PlyType::UInt32;
+    if (name == "float" || name == "float32")
+        return PlyType::Float32;
+    if (name == "double" || name == "float64")
+        return PlyType::Float64;
+    return std::nullopt;
+}
+
+static size_t plyTypeSize(PlyType type)
+{
+    constexpr size_t sizes[] { 1, 1, 2, 2, 4, 4, 4, 8 };
+    return sizes[size_t(type)];
+}
+
+// Read a binary value and advance `data` past it.
+static double readPlyValue(const char*& data, PlyType type, bool swapBytes)
+{
+    char bytes[8];
+    const size_t size = plyTypeSize(type);
+    std::memcpy(bytes, data, size);
+    if (swapBytes)
+        std::reverse(bytes, bytes + size);
+    data += size;
+
+    const auto as = [&]<typename T>(T value) {
+        std::memcpy(&value, bytes, sizeof(T));
+        return double(value);
+    };
+    switch (type) {
+    case PlyType::Int8:
+        return as(int8_t());
+    case PlyType::UInt8:
+        return as(uint8_t());
+    case PlyType::Int16:
+        return as(int16_t());
+    case PlyType::UInt16:
+        return as(uint16_t());
+    case PlyType::Int32:
+        return as(int32_t());
+    case PlyType::UInt32:
+        return as(uint32_t());
+    case PlyType::Float32:
+        return as(float());
+    case PlyType::Float64:
+    default:
+        return as(double());
+    }
+}
+
+std::vector<Mesh> readPly(const std::filesystem::path& file)
+{
+    const MappedFile mappedFile { file };
+    std::string_view text = mappedFile.contents();
+    const auto fail = [&](const char* reason) {
+        std::cerr << "Failed to load mesh " << file << ": " << reason << std::endl;
+        throw std::exception();
+    };
+
+    // Header
+    enum class Format { Ascii, BinaryLittleEndian, BinaryBigEndian } format = Format::Ascii;
+    std::vector<PlyElement> elements;
+    bool hasHeaderEnd = false, isPly = false;
+    while (!text.empty() && !hasHeaderEnd) {
+        const size_t end = text.find('\n');
+        std::string_view line = text.substr(0, end);
+        text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+
+        const std::string_view keyword = nextToken(line);
+        if (keyword == "ply") {
+            isPly = true;
+        } else if (keyword == "format") {
+            const std::string_view name = nextToken(line);
+            format = name == "binary_little_endian" ? Format::BinaryLittleEndian : name == "binary_big_endian" ? Format::BinaryBigEndian : Format::Ascii;
+        } else if (keyword == "element") {
+            PlyElement& element = elements.emplace_back();
+            element.name = nextToken(line);
+            if (!parseNumber(line, element.count))
+                fail("malformed element");
+        } else if (keyword == "property") {
+            if (elements.empty())
+                fail("property outside of an element");
+            PlyProperty property;
+            std::string_view type = nextToken(line);
+            if (type == "list") {
+                property.isList = true;
+                const auto countType = parsePlyType(nextToken(line));
+                if (!countType)
+                    fail("unknown property type");
+                property.countType = *countType;
+                type = nextToken(line);
+            }
+            const auto valueType = parsePlyType(type);
+            if (!valueType)
+                fail("unknown property type");
+            property.type = *valueType;
+            property.name = nextToken(line);
+            elements.back().properties.push_back(property);
+        } else if (keyword == "end_header") {
+            hasHeaderEnd = true;
+        }
+    }
+    if (!isPly || !hasHeaderEnd)
+        fail("not a PLY file");
+
+    std::vector<glm::vec3> positions, normals;
+    std::vector<glm::vec2> texCoords;
+    std::vector<uint32_t> faceIndices;
+    std::vector<size_t> faceEnds;
+
+    // Which vertex properties hold positions, normals and texture coordinates
+    const auto findProperty = [](const PlyElement& element, std::initializer_list<std::string_view> names) {
+        for (size_t i = 0; i < element.properties.size(); i++) {
+            if (std::find(std::begin(names), std::end(names), element.properties[i].name) != std::end(names))
+                return int(i);
+        }
+        return -1;
+    };
+    struct VertexLayout {
+        int position[3], normal[3], texCoord[2];
+    };
+    const auto vertexLayout = [&](const PlyElement& element) {
+        return VertexLayout {
+            { findProperty(element, { "x" }), findProperty(element, { "y" }), findProperty(element, { "z" }) },
+            { findProperty(element, { "nx" }), findProperty(element, { "ny" }), findProperty(element, { "nz" }) },
+            { findProperty(element, { "u", "s", "texture_u", "texture_s" }), findProperty(element, { "v", "t", "texture_v", "texture_t" }) }
+        };
+    };
+    // Store a vertex from the values of its properties
+    const auto storeVertex = [](const VertexLayout& layout, const double* values, size_t index, glm::vec3* outPositions, glm::vec3* outNormals, glm::vec2* outTexCoords) {
+        for (int i = 0; i < 3; i++)
+            outPositions[index][i] = float(values[layout.position[i]]);
+        if (outNormals) {
+            for (int i = 0; i < 3; i++)
+                outNormals[index][i] = float(values[layout.normal[i]]);
+        }
+        if (outTexCoords) {
+            for (int i = 0; i < 2; i++)
+                outTexCoords[index][i] = float(values[layout.texCoord[i]]);
+        }
+    };
+    const auto prepareVertices = [&](const PlyElement& element, const VertexLayout& layout) {
+        if (layout.position[0] < 0 || layout.position[1] < 0 || layout.position[2] < 0)
+            fail("vertices without positions");
+        positions.resize(element.count);
+        if (layout.normal[0] >= 0 && layout.normal[1] >= 0 && layout.normal[2] >= 0)
+            normals.resize(element.count);
+        if (layout.texCoord[0] >= 0 && layout.texCoord[1] >= 0)
+            texCoords.resize(element.count);
+    };
+
+    if (format == Format::Ascii) {
+        // Elements are stored one per line, so split the body at lines, count the lines of every chunk,
+        // and parse the chunks in parallel, knowing which line each starts at
+        const std::vector<std::string_view> chunkTexts = splitAtLines(text, numChunksFor(text));
+        std::vector<size_t> firstLines(chunkTexts.size() + 1, 0);
+        parallelFor(chunkTexts.size(), [&](size_t i) { firstLines[i + 1] = size_t(std::count(std::begin(chunkTexts[i]), std::end(chunkTexts[i]), '\n')); });
+        for (size_t i = 0; i < chunkTexts.size(); i++)
+            firstLines[i + 1] += firstLines[i];
+
+        std::vector<size_t> elementFirstLines(elements.size() + 1, 0);
+        VertexLayout layout {};
+        int faceList = -1;
+        for (size_t i = 0; i < elements.size(); i++) {
+            elementFirstLines[i + 1] = elementFirstLines[i] + elements[i].count;
+            if (elements[i].name == "vertex") {
+                layout = vertexLayout(elements[i]);
+                prepareVertices(elements[i], layout);
+            } else if (elements[i].name == "face") {
+                faceList = findProperty(elements[i], { "vertex_indices", "vertex_index" });
+            }
+        }
+
+        struct Faces {
+            std::vector<uint32_t> indices;
+            std::vector<size_t> ends;
+            bool failed = false;
+        };
+        std::vector<Faces> chunkFaces(chunkTexts.size());
+        parallelFor(chunkTexts.size(), [&](size_t chunk) {
+            size_t lineNumber = firstLines[chunk];
+            std::vector<double> values;
+            forEachLine(chunkTexts[chunk], [&](std::string_view line) {
+                const size_t element = size_t(std::upper_bound(std::begin(elementFirstLines), std::end(elementFirstLines), lineNumber) - std::begin(elementFirstLines)) - 1;
+                const size_t index = lineNumber++ - elementFirstLines[element];
+                if (element >= elements.size())
+                    return;
+                const bool isVertex = elements[element].name == "vertex";
+                const bool isFace = elements[element].name == "face";
+                if (!isVertex && !isFace)
+                    return;
+
+                values.clear();
+                for (size_t i = 0; i < elements[element].properties.size(); i++) {
+                    const PlyProperty& property = elements[element].properties[i];
+                    double value = 0.0;
+                    if (property.isList) {
+                        size_t count = 0;
+                        chunkFaces[chunk].failed |= !parseNumber(line, count);
+                        for (size_t j = 0; j < count; j++) {
+                            chunkFaces[chunk].failed |= !parseNumber(line, value);
+                            if (isFace && int(i) == faceList)
+                                chunkFaces[chunk].indices.push_back(uint32_t(value));
+                        }
+                        if (isFace && int(i) == faceList)
+                            chunkFaces[chunk].ends.push_back(chunkFaces[chunk].indices.size());
+                    } else {
+                        chunkFaces[chunk].failed |= !parseNumber(line, value);
+                    }
+                    values.push_back(value);
+                }
+                if (isVertex && index < positions.size())
+                    storeVertex(layout, values.data(), index, positions.data(), normals.empty() ? nullptr : normals.data(), texCoords.empty() ? nullptr : texCoords.data());
+            });
+        });
+        for (const Faces& faces : chunkFaces) {
+            if (faces.failed)
+                fail("malformed line");
+            const size_t offset = faceIndices.size();
+            faceIndices.insert(std::end(faceIndices), std::begin(faces.indices), std::end(faces.indices));
+            std::transform(std::begin(faces.ends), std::end(faces.ends), std::back_inserter(faceEnds), [&](size_t end) { return end + offset; });
+        }
+    } else {
+        const bool swapBytes = (format == Format::BinaryBigEndian) != (std::endian::native == std::endian::big);
+        const char* data = text.data();
+        const char* const dataEnd = text.data() + text.size();
+        // Size of an element, if all of its properties are scalars
+        const auto fixedSize = [](const PlyElement& element) -> std::optional<size_t> {
+            size_t size = 0;
+            for (const PlyProperty& property : element.properties) {
+                if (property.isList)
+                    return std::nullopt;
+                size += plyTypeSize(property.type);
+            }
+            return size;
+        };
+        // Read an element of any layout, calling `onList(property, count, data)` for lists
+        const auto readElement = [&](const PlyElement& element, double* values, auto&& onList) {
+            for (size_t i = 0; i < element.properties.size(); i++) {
+                const PlyProperty& property = element.properties[i];
+                if (data + (property.isList ? plyTypeSize(property.countType) : plyTypeSize(property.type)) > dataEnd)
+                    fail("unexpected end of file");
+                if (property.isList) {
+                    const auto count = size_t(readPlyValue(data, property.countType, swapBytes));
+                    if (data + count * plyTypeSize(property.type) > dataEnd)
+                        fail("unexpected end of file");
+                    onList(i, count);
+                } else {
+                    values[i] = readPlyValue(data, property.type, swapBytes);
+                }
+            }
+        };
+
+        for (const PlyElement& element : elements) {
+            std::vector<double> values(element.properties.size());
+            const std::optional<size_t> size = fixedSize(element);
+            if (element.name == "vertex") {
+                const VertexLayout layout = vertexLayout(element);
+                prepareVertices(element, layout);
+                if (size && data + *size * element.count <= dataEnd) {
+                    // Vertices are all the same size, so read them in parallel
+                    const char* const vertices = data;
+                    constexpr size_t batchSize = 1 << 14;
+                    parallelFor((element.count + batchSize - 1) / batchSize, [&](size_t batch) {
+                        std::vector<double> batchValues(element.properties.size());
+                        for (size_t i = batch * batchSize; i < std::min(element.count, (batch + 1) * batchSize); i++) {
+                            const char* vertex = vertices + i * *size;
+                            for (size_t j = 0; j < element.properties.size(); j++)
+                                batchValues[j] = readPlyValue(vertex, element.properties[j].type, swapBytes);
+                            storeVertex(layout, batchValues.data(), i, positions.data(), normals.empty() ? nullptr : normals.data(), texCoords.empty() ? nullptr : texCoords.data());
+                        }
+                    });
+                    data += *size * element.count;
+                } else {
+                    for (size_t i = 0; i < element.count; i++) {
+                        readElement(element, values.data(), [&](size_t, size_t count) { data += count * plyTypeSize(element.properties[0].type); });
+                        storeVertex(layout, values.data(), i, positions.data(), normals.empty() ? nullptr : normals.data(), texCoords.empty() ? nullptr : texCoords.data());
+                    }
+                }
+            } else if (element.name == "face") {
+                const int faceList = findProperty(element, { "vertex_indices", "vertex_index" });
+                faceEnds.reserve(element.count);
+                faceIndices.reserve(3 * element.count);
+                for (size_t i = 0; i < element.count; i++) {
+                    readElement(element, values.data(), [&](size_t property, size_t count) {
+                        const PlyType type = element.properties[property].type;
+                        for (size_t j = 0; j < count; j++) {
+                            const double index = readPlyValue(data, type, swapBytes);
+                            if (int(property) == faceList)
+                                faceIndices.push_back(uint32_t(index));
+                        }
+                    });
+                    faceEnds.push_back(faceIndices.size());
+                }
+            } else if (size) {
+                if (data + *size * element.count > dataEnd)
+                    fail("unexpected end of file");
+                data += *size * element.count;
+            } else {
+                for (size_t i = 0; i < element.count; i++)
+                    readElement(element, values.data(), [&](size_t property, size_t count) { data += count * plyTypeSize(element.properties[property].type); });
+            }
+        }
+    }
+
+    if (std::any_of(std::begin(faceIndices), std::end(faceIndices), [&](uint32_t index) { return index >= positions.size(); }))
+        fail("vertex index out of range");
+
+    Mesh mesh;
+    mesh.material.kd = glm::vec3(1.0f);
+    mesh.triangles.reserve(faceEnds.size());
+    for (size_t face = 0, faceBegin = 0; face < faceEnds.size(); faceBegin = faceEnds[face++]) {
+        const uint32_t* corners = &faceIndices[faceBegin];
+        if (faceEnds[face] - faceBegin < 3)
+            continue;
+        triangulate(
+            faceEnds[face] - faceBegin, [&](size_t j) { return positions[corners[j]]; },
+            [&](size_t j0, size_t j1, size_t j2) { mesh.triangles.emplace_back(corners[j0], corners[j1], corners[j2]); });
+    }
+
+    // Without normals, use the area weighted average of the normals of the adjacent triangles
+    if (normals.empty()) {
+        normals.resize(positions.size(), glm::vec3(0.0f));
+        for (const glm::uvec3& triangle : mesh.triangles) {
+            const glm::vec3 normal = glm::cross(positions[triangle.y] - positions[triangle.x], positions[triangle.z] - positions[triangle.x]);
+            for (int j = 0; j < 3; j++)
+                normals[triangle[j]] += normal;
+        }
+        for (glm::vec3& normal : normals)
+            normal = glm::length(normal) > 0.0f ? glm::normalize(normal) : glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+    mesh.vertices.resize(positions.size());
+    for (size_t i = 0; i < positions.size(); i++)
+        mesh.vertices[i] = Vertex { .position = positions[i], .normal = normals[i], .texCoord = texCoords.empty() ? glm::vec2(0) : texCoords[i] };
+
+    std::vector<Mesh> out;
+    out.push_back(std::move(mesh));
+    return out;
+}
+
+// Cache files are a header, followed by a record per mesh and its vertices and triangles, each 8-byte aligned.
+static constexpr uint32_t MeshCacheMagic = 0x434d5452; // "RTMC"
+static constexpr uint32_t MeshCacheVersion = 1;
+
+namespace {
+
+struct MeshCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceSize;
+    int64_t sourceWriteTime;
+    uint64_t numMeshes;
+};
+
+struct MeshCacheRecord {
+    uint64_t numVertices;
+    uint64_t numTriangles;
+    float kd[3], ks[3];
+    float shininess, transparency;
+    uint64_t texturePathSize; // In bytes, as UTF-8
+};
+
+}
+
+static size_t alignTo8(size_t size)
+{
+    return (size + 7) & ~size_t(7);
+}
+
+// Identity of the source file a cache file was written for; a different size or time stamp means the cache is stale.
+static std::optional<std::pair<uint64_t, int64_t>> sourceIdentity(const std::filesystem::path& sourceFile)
+{
+    std::error_code error;
+    const uint64_t size = std::filesystem::file_size(sourceFile, error);
+    if (error)
+        return std::nullopt;
+    const auto writeTime = std::filesystem::last_write_time(sourceFile, error);
+    if (error)
+        return std::nullopt;
+    return std::pair { size, int64_t(writeTime.time_since_epoch().count()) };
+}
+
+std::optional<std::vector<Mesh>> readMeshCache(const std::filesystem::path& cacheFile, const std::filesystem::path& sourceFile)
+{
+    const auto identity = sourceIdentity(sourceFile);
+    if (!identity || !std::filesystem::exists(cacheFile))
+        return std::nullopt;
+
+    try {
+        const MappedFile mappedFile { cacheFile };
+        const std::string_view contents = mappedFile.contents();
+        size_t offset = 0;
+        // Copy the next `size` bytes of the file, if it is long enough
+        const auto read = [&](void* destination, size_t size) {
+            if (offset + size > contents.size())
+                return false;
+            std::memcpy(destination, contents.data() + offset, size);
+            offset = alignTo8(offset + size);
+            return true;
+        };
+
+        MeshCacheHeader header;
+        if (!read(&header, sizeof(header)) || header.magic != MeshCacheMagic || header.version != MeshCacheVersion
+            || header.sourceSize != identity->first || header.sourceWriteTime != identity->second)
+            return std::nullopt;
+
+        std::vector<Mesh> meshes(header.numMeshes);
+        for (Mesh& mesh : meshes) {
+            MeshCacheRecord record;
+            if (!read(&record, sizeof(record)) || record.numVertices > contents.size() || record.numTriangles > contents.size() || record.texturePathSize > contents.size())
+                return std::nullopt;
+            mesh.material.kd = glm::vec3(record.kd[0], record.kd[1], record.kd[2]);
+            mesh.material.ks = glm::vec3(record.ks[0], record.ks[1], record.ks[2]);
+            mesh.material.shininess = record.shininess;
+            mesh.material.transparency = record.transparency;
+
+            std::string texturePath(record.texturePathSize, '\0');
+            mesh.vertices.resize(record.numVertices);
+            mesh.triangles.resize(record.numTriangles);
+            if (!read(texturePath.data(), texturePath.size()) || !read(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex))
+                || !read(mesh.triangles.data(), mesh.triangles.size() * sizeof(glm::uvec3)))
+                return std::nullopt;
+            if (!texturePath.empty())
+                mesh.kdTexturePath = std::filesystem::path(std::u8string(std::begin(texturePath), std::end(texturePath)));
+        }
+        return meshes;
+    } catch (const std::exception&) {
+        return std::nullopt;
+    }
+}
+
+bool writeMeshCache(const std::filesystem::path& cacheFile, const std::filesystem::path& sourceFile, std::span<const Mesh> meshes)
+{
+    static_assert(sizeof(Vertex) == 32 && std::is_trivially_copyable_v<Vertex>, "The cache stores vertices as they are laid out in memory");
+    const auto identity = sourceIdentity(sourceFile);
+    if (!identity)
+        return false;
+
+    // Write to a temporary file first, s.t. other processes never read a partial cache file
+    std::error_code error;
+    std::filesystem::create_directories(cacheFile.parent_path(), error);
+    const std::filesystem::path temporaryFile = cacheFile.string() + "." + std::to_string(std::random_device {}()) + ".tmp";
+    {
+        std::ofstream stream { temporaryFile, std::ios::binary };
+        if (!stream)
+            return false;
+        size_t offset = 0;
+        const auto write = [&](const void* data, size_t size) {
+            constexpr char padding[8] {};
+            stream.write(static_cast<const char*>(data), std::streamsize(size));
+            stream.write(padding, std::streamsize(alignTo8(offset + size) - offset - size));
+            offset = alignTo8(offset + size);
+        };
+
+        const MeshCacheHeader header { MeshCacheMagic, MeshCacheVersion, identity->first, identity->second, meshes.size() };
+        write(&header, sizeof(header));
+        for (const Mesh& mesh : meshes) {
+            const std::u8string texturePath = mesh.kdTexturePath.u8string();
+            const Material& material = mesh.material;
+            const MeshCacheRecord record {
+                mesh.vertices.size(), mesh.triangles.size(),
+                { material.kd.x, material.kd.y, material.kd.z }, { material.ks.x, material.ks.y, material.ks.z },
+                material.shininess, material.transparency, texturePath.size()
+            };
+            write(&record, sizeof(record));
+            write(texturePath.data(), texturePath.size());
+            write(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+            write(mesh.triangles.data(), mesh.triangles.size() * sizeof(glm::uvec3));
+        }
+        if (!stream)
+            return false;
+    }
+    std::filesystem::rename(temporaryFile, cacheFile, error);
+    if (error) {
+        std::filesystem::remove(temporaryFile, error);
+        return false;
+    }
+    return true;
+}
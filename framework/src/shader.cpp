@@ -53,6 +53,12 @@ void Shader::bind() const
     glUseProgram(m_program);
 }
 
+GLint Shader::uniformLocation(const char* name) const
+{
+    assert(m_program != invalid);
+    return glGetUniformLocation(m_program, name);
+}
+
 ShaderBuilder::~ShaderBuilder()
 {
     freeShaders();
@@ -25,6 +25,7 @@ Trackball::Trackball(Window* pWindow, float fovy, const glm::vec3& lookAt, float
     , m_fovy(fovy)
     , m_halfScreenSpaceHeight(std::tan(m_fovy / 2.0f))
     , m_halfScreenSpaceWidth(m_pWindow->getAspectRatio() * m_halfScreenSpaceHeight)
+    , m_aspectRatio(m_pWindow->getAspectRatio())
     , m_lookAt(lookAt)
     , m_distanceFromLookAt(distFromLookAt)
     , m_rotationEulerAngles(rotationX, rotationY, 0)
@@ -49,6 +50,17 @@ Trackball::Trackball(Window* pWindow, float fovy, const glm::vec3& lookAt, float
     });
 }
 
+Trackball::Trackball(float fovy, float aspectRatio, float distFromLookAt, float rotationX, float rotationY)
+    : m_pWindow(nullptr)
+    , m_fovy(fovy)
+    , m_halfScreenSpaceHeight(std::tan(m_fovy / 2.0f))
+    , m_halfScreenSpaceWidth(aspectRatio * m_halfScreenSpaceHeight)
+    , m_aspectRatio(aspectRatio)
+    , m_distanceFromLookAt(distFromLookAt)
+    , m_rotationEulerAngles(rotationX, rotationY, 0)
+{
+}
+
 void Trackball::printHelp()
 {
     std::cout << "Left button: turn in XY," << std::endl;
@@ -85,7 +97,7 @@ glm::mat4 Trackball::viewMatrix() const
 
 glm::mat4 Trackball::projectionMatrix() const
 {
-    return glm::perspective(m_fovy, m_pWindow->getAspectRatio(), 0.01f, 100.0f);
+    return glm::perspective(m_fovy, aspectRatio(), 0.01f, 100.0f);
 }
 
 glm::vec3 Trackball::rotationEulerAngles() const {
@@ -96,6 +108,16 @@ float Trackball::distanceFromLookAt() const {
     return m_distanceFromLookAt;
 }
 
+float Trackball::fieldOfView() const
+{
+    return m_fovy;
+}
+
+float Trackball::aspectRatio() const
+{
+    return m_pWindow ? m_pWindow->getAspectRatio() : m_aspectRatio;
+}
+
 // Generate a ray with the origin at cameraPos, going through the given pixel (normalized coordinates between -1 and +1)
 // on the virtual image plane in front of the camera.
 Ray Trackball::generateRay(const glm::vec2& pixel) const
@@ -0,0 +1,22 @@
+#version 120
+// Diffuse shading by the first `numLights` fixed function lights, like drawSceneOpenGL() sets them up: point
+// lights without ambient, specular, or attenuation.
+
+uniform vec3 kd;
+uniform int numLights;
+
+varying vec3 fragPosition;
+varying vec3 fragNormal;
+
+void main()
+{
+    vec3 normal = normalize(fragNormal);
+    vec3 color = vec3(0.0);
+    for (int i = 0; i < gl_MaxLights; i++) {
+        if (i >= numLights)
+            break;
+        vec3 toLight = normalize(gl_LightSource[i].position.xyz - fragPosition);
+        color += max(dot(normal, toLight), 0.0) * gl_LightSource[i].diffuse.rgb * kd;
+    }
+    gl_FragColor = vec4(color, 1.0);
+}
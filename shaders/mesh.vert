@@ -0,0 +1,13 @@
+#version 120
+// Meshes of the rasterization view; see `MeshBuffers`. Uses the fixed function matrices and lights, s.t. the
+// view is set up exactly like for the immediate mode draw functions.
+
+varying vec3 fragPosition; // Eye space
+varying vec3 fragNormal; // Eye space
+
+void main()
+{
+    fragPosition = vec3(gl_ModelViewMatrix * gl_Vertex);
+    fragNormal = gl_NormalMatrix * gl_Normal;
+    gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
+}
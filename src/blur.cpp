@@ -0,0 +1,230 @@
+#include "blur.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/vector_relational.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <cmath>
+#ifdef NDEBUG
+#include <omp.h>
+#endif
+
+// Three box blurs are within a few percent of a Gaussian; see e.g. W. M. Wells, "Efficient
+// Synthesis of Gaussian Filters by Cascaded Uniform Filters", IEEE PAMI 8(2), 1986.
+static constexpr int BoxBlurPasses = 3;
+
+// Number of rows blurred together in the horizontal passes
+static constexpr int RowBlockSize = 4;
+
+// Number of floats per column strip in the vertical passes
+static constexpr size_t ColumnStripWidth = 64;
+
+// Given a target standard deviation, compute the radii of the box blurs whose combined variance
+// is closest to it. Boxes have odd widths, so we mix two widths; after P. Kovesi, "Fast Almost-Gaussian
+// Filtering", DICTA 2010.
+static std::array<int, BoxBlurPasses> boxBlurRadii(float sigma)
+{
+    const float n = float(BoxBlurPasses);
+    const float variance12 = 12.0f * sigma * sigma;
+    int lowerWidth = int(std::floor(std::sqrt(variance12 / n + 1.0f)));
+    if (lowerWidth % 2 == 0)
+        lowerWidth--;
+    const float w = float(lowerWidth);
+    const int numLower = int(std::round((variance12 - n * w * w - 4.0f * n * w - 3.0f * n) / (-4.0f * w - 4.0f)));
+
+    std::array<int, BoxBlurPasses> radii;
+    for (size_t i = 0; i < radii.size(); i++)
+        radii[i] = (int(i) < numLower ? lowerWidth : lowerWidth + 2) / 2;
+    return radii;
+}
+
+// Box blur a block of rows with a running sum per row. The rows are interleaved, s.t. the additions of
+// different rows do not wait on each other; outputs and inputs must not overlap.
+static void boxBlurRows(const std::array<const glm::vec3*, RowBlockSize>& inputs, const std::array<glm::vec3*, RowBlockSize>& outputs, int width, int radius)
+{
+    const float invWidth = 1.0f / float(2 * radius + 1);
+    const auto at = [&](size_t row, int x) { return inputs[row][std::clamp(x, 0, width - 1)]; };
+
+    std::array<glm::vec3, RowBlockSize> sums;
+    for (size_t row = 0; row < RowBlockSize; row++) {
+        sums[row] = float(radius + 1) * inputs[row][0];
+        for (int x = 1; x <= radius; x++)
+            sums[row] += at(row, x);
+    }
+
+    // Only the first and last pixels read past the edges of the row
+    const int interiorBegin = std::min(radius, width);
+    const int interiorEnd = std::max(width - radius - 1, interiorBegin);
+    for (int x = 0; x < interiorBegin; x++) {
+        for (size_t row = 0; row < RowBlockSize; row++) {
+            outputs[row][x] = sums[row] * invWidth;
+            sums[row] += at(row, x + radius + 1) - at(row, x - radius);
+        }
+    }
+    for (int x = interiorBegin; x < interiorEnd; x++) {
+        for (size_t row = 0; row < RowBlockSize; row++) {
+            outputs[row][x] = sums[row] * invWidth;
+            sums[row] += inputs[row][x + radius + 1] - inputs[row][x - radius];
+        }
+    }
+    for (int x = interiorEnd; x < width; x++) {
+        for (size_t row = 0; row < RowBlockSize; row++) {
+            outputs[row][x] = sums[row] * invWidth;
+            sums[row] += at(row, x + radius + 1) - at(row, x - radius);
+        }
+    }
+}
+
+// Box blur `count` adjacent columns of floats with a running sum per column. Rows are `stride` floats
+// apart; they are walked top to bottom, s.t. memory is read in row order and the inner loops vectorize.
+static void boxBlurColumns(const float* input, size_t inputStride, float* output, size_t outputStride, size_t count, int height, int radius)
+{
+    const float invWidth = 1.0f / float(2 * radius + 1);
+    const auto row = [&](int y) { return input + size_t(std::clamp(y, 0, height - 1)) * inputStride; };
+
+    std::array<float, ColumnStripWidth> sums;
+    for (size_t i = 0; i < count; i++)
+        sums[i] = float(radius + 1) * row(0)[i];
+    for (int y = 1; y <= radius; y++) {
+        const float* added = row(y);
+        for (size_t i = 0; i < count; i++)
+            sums[i] += added[i];
+    }
+
+    for (int y = 0; y < height; y++) {
+        float* outRow = output + size_t(y) * outputStride;
+        const float* added = row(y + radius + 1);
+        const float* removed = row(y - radius);
+        for (size_t i = 0; i < count; i++) {
+            outRow[i] = sums[i] * invWidth;
+            sums[i] += added[i] - removed[i];
+        }
+    }
+}
+
+void gaussianBlur(std::span<glm::vec3> pixels, glm::ivec2 resolution, float sigma, std::vector<glm::vec3>& scratch)
+{
+    if (resolution.x <= 0 || resolution.y <= 0)
+        return;
+    const std::array<int, BoxBlurPasses> radii = boxBlurRadii(sigma);
+    scratch.resize(pixels.size());
+
+    // Every pass reads outside of its input by clamping, which would clamp the partially blurred image of the
+    // pass before instead of the image itself. So rows and columns are padded with their edge pixels by the
+    // combined radius of all passes first, and the passes run over the padded rows and columns; the pixels inside
+    // of the image then only read the padding, not past it.
+    static_assert(BoxBlurPasses == 3);
+    const int padding = radii[0] + radii[1] + radii[2];
+
+    // All horizontal passes run on a block of rows at a time, while it is in cache; pixels -> scratch
+    const int numRowBlocks = (resolution.y + RowBlockSize - 1) / RowBlockSize;
+    const int paddedWidth = resolution.x + 2 * padding;
+    const size_t blockSize = size_t(RowBlockSize) * size_t(paddedWidth);
+#ifdef NDEBUG // Enable multi threading in Release mode
+#pragma omp parallel
+#endif
+    {
+        std::vector<glm::vec3> blockA(blockSize), blockB(blockSize), blockC(blockSize);
+#ifdef NDEBUG
+#pragma omp for schedule(static)
+#endif
+        for (int block = 0; block < numRowBlocks; block++) {
+            // A partial last block repeats its last row; those rows compute and write the same values
+            std::array<glm::vec3*, RowBlockSize> a, b, c;
+            for (size_t row = 0; row < RowBlockSize; row++) {
+                const int y = std::min(block * RowBlockSize + int(row), resolution.y - 1);
+                const glm::vec3* input = &pixels[size_t(y) * size_t(resolution.x)];
+                a[row] = &blockA[row * size_t(paddedWidth)];
+                b[row] = &blockB[row * size_t(paddedWidth)];
+                c[row] = &blockC[row * size_t(paddedWidth)];
+                std::fill_n(c[row], padding, input[0]);
+                std::copy_n(input, resolution.x, c[row] + padding);
+                std::fill_n(c[row] + padding + resolution.x, padding, input[resolution.x - 1]);
+            }
+            boxBlurRows({ c[0], c[1], c[2], c[3] }, a, paddedWidth, radii[0]);
+            boxBlurRows({ a[0], a[1], a[2], a[3] }, b, paddedWidth, radii[1]);
+            boxBlurRows({ b[0], b[1], b[2], b[3] }, c, paddedWidth, radii[2]);
+            for (size_t row = 0; row < RowBlockSize; row++) {
+                const int y = std::min(block * RowBlockSize + int(row), resolution.y - 1);
+                std::copy_n(c[row] + padding, resolution.x, &scratch[size_t(y) * size_t(resolution.x)]);
+            }
+        }
+    }
+
+    // Likewise, all vertical passes run on a strip of columns at a time, in a compact, padded copy of the strip;
+    // scratch -> pixels
+    const size_t rowWidth = size_t(resolution.x) * 3;
+    const int numStrips = int((rowWidth + ColumnStripWidth - 1) / ColumnStripWidth);
+    const int paddedHeight = resolution.y + 2 * padding;
+    const size_t stripSize = ColumnStripWidth * size_t(paddedHeight);
+#ifdef NDEBUG // Enable multi threading in Release mode
+#pragma omp parallel
+#endif
+    {
+        std::vector<float> stripA(stripSize), stripB(stripSize);
+#ifdef NDEBUG
+#pragma omp for schedule(static)
+#endif
+        for (int strip = 0; strip < numStrips; strip++) {
+            const size_t begin = size_t(strip) * ColumnStripWidth;
+            const size_t count = std::min(ColumnStripWidth, rowWidth - begin);
+            const float* input = &scratch[0].x + begin;
+            for (int y = 0; y < paddedHeight; y++) {
+                const auto inputRow = size_t(std::clamp(y - padding, 0, resolution.y - 1));
+                std::copy_n(input + inputRow * rowWidth, count, &stripA[size_t(y) * ColumnStripWidth]);
+            }
+            boxBlurColumns(stripA.data(), ColumnStripWidth, stripB.data(), ColumnStripWidth, count, paddedHeight, radii[0]);
+            boxBlurColumns(stripB.data(), ColumnStripWidth, stripA.data(), ColumnStripWidth, count, paddedHeight, radii[1]);
+            boxBlurColumns(stripA.data(), ColumnStripWidth, stripB.data(), ColumnStripWidth, count, paddedHeight, radii[2]);
+            float* output = &pixels[0].x + begin;
+            for (size_t y = 0; y < size_t(resolution.y); y++)
+                std::copy_n(&stripB[(y + size_t(padding)) * ColumnStripWidth], count, output + y * rowWidth);
+        }
+    }
+}
+
+glm::ivec2 gaussianBlurDownsampled(std::vector<glm::vec3>& pixels, glm::ivec2 resolution, float sigma, std::vector<glm::vec3>& scratch)
+{
+    while (sigma > DownsampledBlurMaxSigma && glm::all(glm::greaterThan(resolution, glm::ivec2(1)))) {
+        resolution = downsampleImage(pixels, resolution, scratch);
+        std::swap(pixels, scratch);
+        sigma *= 0.5f;
+    }
+    gaussianBlur(pixels, resolution, sigma, scratch);
+    return resolution;
+}
+
+glm::ivec2 downsampleImage(std::span<const glm::vec3> pixels, glm::ivec2 resolution, std::vector<glm::vec3>& output)
+{
+    const glm::ivec2 outResolution = (resolution + 1) / 2;
+    output.resize(size_t(outResolution.x) * size_t(outResolution.y));
+
+#ifdef NDEBUG // Enable multi threading in Release mode
+#pragma omp parallel for schedule(static)
+#endif
+    for (int y = 0; y < outResolution.y; y++) {
+        const glm::vec3* row0 = &pixels[size_t(2 * y) * size_t(resolution.x)];
+        const glm::vec3* row1 = &pixels[size_t(std::min(2 * y + 1, resolution.y - 1)) * size_t(resolution.x)];
+        glm::vec3* outRow = &output[size_t(y) * size_t(outResolution.x)];
+        for (int x = 0; x < outResolution.x; x++) {
+            const int x0 = 2 * x, x1 = std::min(2 * x + 1, resolution.x - 1);
+            outRow[x] = 0.25f * (row0[x0] + row0[x1] + row1[x0] + row1[x1]);
+        }
+    }
+    return outResolution;
+}
+
+glm::vec3 sampleImageBilinear(std::span<const glm::vec3> pixels, glm::ivec2 resolution, glm::vec2 position)
+{
+    position = glm::clamp(position, glm::vec2(0.0f), glm::vec2(resolution - 1));
+    const glm::ivec2 p0 = glm::ivec2(position);
+    const glm::ivec2 p1 = glm::min(p0 + 1, resolution - 1);
+    const glm::vec2 t = position - glm::vec2(p0);
+
+    const auto at = [&](int x, int y) { return pixels[size_t(y) * size_t(resolution.x) + size_t(x)]; };
+    const glm::vec3 top = glm::mix(at(p0.x, p0.y), at(p1.x, p0.y), t.x);
+    const glm::vec3 bottom = glm::mix(at(p0.x, p1.y), at(p1.x, p1.y), t.x);
+    return glm::mix(top, bottom, t.y);
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <span>
+#include <vector>
+
+// Image filters over row-major RGB float buffers, as e.g. stored by `Screen`. All filters read
+// outside of the image by clamping to the nearest edge pixel, and are multithreaded in Release mode.
+
+// Approximates a Gaussian blur with standard deviation `sigma` (in pixels) by a sequence of box blurs,
+// each computed with a running sum, s.t. the cost per pixel does not depend on `sigma`. The image is
+// extended by its edge pixels once, for all box blurs, so that the result near the edges is still that of a
+// Gaussian. The image is blurred in place; `scratch` is resized to the image size and used as temporary storage.
+void gaussianBlur(std::span<glm::vec3> pixels, glm::ivec2 resolution, float sigma, std::vector<glm::vec3>& scratch);
+
+// Largest standard deviation (in pixels) that `gaussianBlurDownsampled()` blurs with at any level
+inline constexpr float DownsampledBlurMaxSigma = 4.0f;
+
+// Like `gaussianBlur()`, but wide blurs move down a mip pyramid of the image first, halving `sigma` per
+// level, as downsampling is cheaper than blurring at full resolution. The blurred image replaces
+// `pixels`, and its resolution is returned; sample it with `sampleImageBilinear()` to upsample it.
+glm::ivec2 gaussianBlurDownsampled(std::vector<glm::vec3>& pixels, glm::ivec2 resolution, float sigma, std::vector<glm::vec3>& scratch);
+
+// Halves the resolution of an image (rounding up) by averaging 2x2 blocks of pixels into `output`,
+// and returns the resolution of the output image.
+glm::ivec2 downsampleImage(std::span<const glm::vec3> pixels, glm::ivec2 resolution, std::vector<glm::vec3>& output);
+
+// Bilinearly samples an image at a continuous position, where pixel (x, y) has its center at (x, y).
+glm::vec3 sampleImageBilinear(std::span<const glm::vec3> pixels, glm::ivec2 resolution, glm::vec2 position);
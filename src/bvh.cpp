@@ -2,39 +2,57 @@
 #include "draw.h"
 #include "interpolate.h"
 #include "intersect.h"
+#include "kernel.h"
 #include "render.h"
 #include "scene.h"
 #include "extra.h"
+#include "geometry_cache.h"
 #include "texture.h"
 #include <algorithm>
 #include <bit>
 #include <chrono>
+#include <cmath>
 #include <framework/opengl_includes.h>
 #include <iostream>
+#include <limits>
+#include <list>
+#include <queue>
 
 // Helper method to fill in hitInfo object. This can be safely ignored (or extended).
 // Note: many of the functions in this helper tie in to standard/extra features you will have
 // to implement separately, see interpolate.h/.cpp for these parts of the project
-void updateHitInfo(RenderState& state, const BVHInterface::Primitive& primitive, const Ray& ray, HitInfo& hitInfo)
+template <uint32_t Mask>
+void kernel::updateHitInfo(RenderState& state, const BVHInterface::Primitive& primitive, const Ray& ray, HitInfo& hitInfo)
 {
     const auto& [v0, v1, v2] = std::tie(primitive.v0, primitive.v1, primitive.v2);
-    const auto& mesh = state.scene.meshes[primitive.meshID];
     const auto n = glm::normalize(glm::cross(v1.position - v0.position, v2.position - v0.position));
     const auto p = ray.origin + ray.t * ray.direction;
 
-    // First, fill in default data, unrelated to separate features
-    hitInfo.material = mesh.material;
+    // First, fill in default data, unrelated to separate features. Kernels only store the material ID;
+    // copying the material per candidate hit is too slow, so only the non-templated functions do so
+    hitInfo.materialID = primitive.meshID;
     hitInfo.normal = n;
     hitInfo.barycentricCoord = computeBarycentricCoord(v0.position, v1.position, v2.position, p);
 
     // Next, if `features.enableNormalMapping` is true, generate smoothly interpolated vertex normals
-    if (state.features.enableNormalInterp) {
+    if (enabled<Mask>(state.features, NormalInterp)) {
         hitInfo.normal = interpolateNormal(v0.normal, v1.normal, v2.normal, hitInfo.barycentricCoord);
     }
 
     // Next, if `features.enableTextureMapping` is true, generate smoothly interpolated vertex uvs
-    if (state.features.enableTextureMapping) {
+    if (enabled<Mask>(state.features, Textures)) {
         hitInfo.texCoord = interpolateTexCoord(v0.texCoord, v1.texCoord, v2.texCoord, hitInfo.barycentricCoord);
+
+        // The ray cone's footprint in texture space is its width at the hit, projected onto the triangle
+        // (divided by the cosine), and scaled by the ratio of the triangle's texture and world space sizes
+        if (enabled<Mask>(state.features, MipmapFiltering)) {
+            const glm::vec2 uv1 = v1.texCoord - v0.texCoord, uv2 = v2.texCoord - v0.texCoord;
+            const float texCoordArea = std::abs(uv1.x * uv2.y - uv1.y * uv2.x);
+            const float worldArea = glm::length(glm::cross(v1.position - v0.position, v2.position - v0.position));
+            const float width = state.rayCone.width + state.rayCone.spreadAngle * ray.t;
+            const float cosine = std::abs(glm::dot(ray.direction, n));
+            hitInfo.texCoordLod = 0.5f * std::log2(texCoordArea / worldArea) + std::log2(width / cosine);
+        }
     }
 
     // Finally, catch flipped normals
@@ -43,6 +61,21 @@ void updateHitInfo(RenderState& state, const BVHInterface::Primitive& primitive,
     }
 }
 
+// Set the material of a hit from its material ID, for callers that read `hitInfo.material`
+static void setHitMaterial(const Scene& scene, HitInfo& hitInfo)
+{
+    if (hitInfo.materialID < scene.meshes.size())
+        hitInfo.material = scene.meshes[hitInfo.materialID].material;
+    else
+        hitInfo.material = scene.spheres[hitInfo.materialID - scene.meshes.size()].material;
+}
+
+void updateHitInfo(RenderState& state, const BVHInterface::Primitive& primitive, const Ray& ray, HitInfo& hitInfo)
+{
+    kernel::updateHitInfo<kernel::Dynamic>(state, primitive, ray, hitInfo);
+    setHitMaterial(state.scene, hitInfo);
+}
+
 // BVH constructor; can be safely ignored. You should not have to touch this
 // NOTE: this constructor is tested, so do not change the function signature.
 BVH::BVH(const Scene& scene, const Features& features)
@@ -213,6 +246,67 @@ size_t splitPrimitivesByMedian(const AxisAlignedBox& aabb, uint32_t axis, std::s
     return (primitives.size() + 1) / 2;
 }
 
+// Visit the leaves of a BVH that a ray enters before `ray.t`, nearest first, calling `intersectLeaf(leaf)`
+// for each; leaves may shorten `ray.t`, which culls the nodes behind the closer hits.
+template <typename F>
+static void traverseNearestFirst(std::span<const BVHInterface::Node> nodes, const Ray& ray, const glm::vec3& inverseDirection, F&& intersectLeaf)
+{
+    constexpr float miss = std::numeric_limits<float>::infinity();
+    if (nodes.empty() || GeometryCache::entryDistance(nodes[BVH::RootIndex].aabb, ray, inverseDirection) == miss)
+        return;
+
+    // The hierarchies of a `GeometryCache` are built by median splits, so they are balanced and shallow
+    std::array<std::pair<uint32_t, float>, 64> stack;
+    size_t stackSize = 0;
+    stack[stackSize++] = { BVH::RootIndex, 0.0f };
+    while (stackSize > 0) {
+        const auto [nodeIndex, entry] = stack[--stackSize];
+        if (entry > ray.t)
+            continue;
+        const BVHInterface::Node& node = nodes[nodeIndex];
+        if (node.isLeaf()) {
+            intersectLeaf(node);
+            continue;
+        }
+
+        const float leftEntry = GeometryCache::entryDistance(nodes[node.leftChild()].aabb, ray, inverseDirection);
+        const float rightEntry = GeometryCache::entryDistance(nodes[node.rightChild()].aabb, ray, inverseDirection);
+        // Push the farther child first, s.t. the nearer one is visited first
+        const bool leftFirst = leftEntry <= rightEntry;
+        const std::pair<uint32_t, float> nearChild { leftFirst ? node.leftChild() : node.rightChild(), std::min(leftEntry, rightEntry) };
+        const std::pair<uint32_t, float> farChild { leftFirst ? node.rightChild() : node.leftChild(), std::max(leftEntry, rightEntry) };
+        if (farChild.second != miss)
+            stack[stackSize++] = farChild;
+        if (nearChild.second != miss)
+            stack[stackSize++] = nearChild;
+    }
+}
+
+// Intersect a ray with the triangles of a `GeometryCache`: the resident top-level BVH leads to the clusters
+// that the ray passes through, which are loaded as needed and traversed nearest first.
+template <uint32_t Mask>
+static bool intersectRayWithGeometryCache(RenderState& state, GeometryCache& geometryCache, Ray& ray, HitInfo& hitInfo)
+{
+    const glm::vec3 inverseDirection = 1.0f / ray.direction;
+    bool isHit = false;
+    traverseNearestFirst(geometryCache.topLevelNodes(), ray, inverseDirection, [&](const BVHInterface::Node& clusterLeaf) {
+        for (uint32_t clusterID = clusterLeaf.primitiveOffset(); clusterID < clusterLeaf.primitiveOffset() + clusterLeaf.primitiveCount(); clusterID++) {
+            const std::shared_ptr<const GeometryCache::Cluster> cluster = geometryCache.cluster(clusterID);
+            const std::span<const glm::u16vec3> triangles = cluster->triangles();
+            traverseNearestFirst(cluster->nodes(), ray, inverseDirection, [&](const BVHInterface::Node& leaf) {
+                for (uint32_t i = leaf.primitiveOffset(); i < leaf.primitiveOffset() + leaf.primitiveCount(); i++) {
+                    const glm::u16vec3 triangle = triangles[i];
+                    if (intersectRayWithTriangle(cluster->position(triangle.x), cluster->position(triangle.y), cluster->position(triangle.z), ray, hitInfo)) {
+                        kernel::updateHitInfo<Mask>(state, cluster->primitive(i), ray, hitInfo);
+                        isHit = true;
+                    }
+                }
+            });
+        }
+    });
+    return isHit;
+}
+
 // TODO: Standard feature
 // Hierarchy traversal routine; called by the BVH's intersect(),
 // you must implement this method and implement it carefully!
@@ -232,7 +326,8 @@ size_t splitPrimitivesByMedian(const AxisAlignedBox& aabb, uint32_t axis, std::s
 // - return;   boolean, if geometry was hit or not
 //
 // This method is unit-tested, so do not change the function signature.
-bool intersectRayWithBVH(RenderState& state, const BVHInterface& bvh, Ray& ray, HitInfo& hitInfo)
+template <uint32_t Mask>
+bool kernel::intersectRayWithBVH(RenderState& state, const BVHInterface& bvh, Ray& ray, HitInfo& hitInfo)
 {
     // ASK: Does this code make sense?
 
@@ -243,7 +338,10 @@ bool intersectRayWithBVH(RenderState& state, const BVHInterface& bvh, Ray& ray,
     // Return value
     bool is_hit = false;
 
-    if (state.features.enableAccelStructure) {
+    if (state.scene.geometryCache) {
+        // The meshes are streamed; the BVH itself holds no triangles
+        is_hit = intersectRayWithGeometryCache<Mask>(state, *state.scene.geometryCache, ray, hitInfo);
+    } else if (enabled<Mask>(state.features, AccelStructure)) {
         // TODO: implement here your (probably stack-based) BVH traversal.
         //
         // Some hints (refer to bvh_interface.h either way). BVH nodes are packed, so the
@@ -340,7 +438,7 @@ bool intersectRayWithBVH(RenderState& state, const BVHInterface& bvh, Ray& ray,
                     const auto& primitive = primitives[i];
                     if (intersectRayWithTriangle(primitive.v0.position, primitive.v1.position, primitive.v2.position, ray, hitInfo)) 
                     {
-                        updateHitInfo(state, primitive, ray, hitInfo);
+                        updateHitInfo<Mask>(state, primitive, ray, hitInfo);
                         is_hit = true;
                     }
                 }
@@ -356,19 +454,31 @@ bool intersectRayWithBVH(RenderState& state, const BVHInterface& bvh, Ray& ray,
             const auto& [v0, v1, v2] = std::tie(prim.v0, prim.v1, prim.v2);
             if (intersectRayWithTriangle(v0.position, v1.position, v2.position, ray, hitInfo)) 
             {
-                updateHitInfo(state, prim, ray, hitInfo);
+                updateHitInfo<Mask>(state, prim, ray, hitInfo);
                 is_hit = true;
             }
         }
     }
 
     // Intersect with spheres.
-    for (const auto& sphere : state.scene.spheres)
-        is_hit |= intersectRayWithShape(sphere, ray, hitInfo);
+    for (size_t i = 0; i < state.scene.spheres.size(); i++) {
+        if (intersectRayWithShape(state.scene.spheres[i], ray, hitInfo)) {
+            hitInfo.materialID = static_cast<uint32_t>(state.scene.meshes.size() + i);
+            is_hit = true;
+        }
+    }
 
     return is_hit;
 }
 
+bool intersectRayWithBVH(RenderState& state, const BVHInterface& bvh, Ray& ray, HitInfo& hitInfo)
+{
+    if (!kernel::intersectRayWithBVH<kernel::Dynamic>(state, bvh, ray, hitInfo))
+        return false;
+    setHitMaterial(state.scene, hitInfo);
+    return true;
+}
+
 // TODO: Standard feature
 // Leaf construction routine; you should reuse this in in `buildRecursive()`
 // Given an axis-aligned bounding box, and a range of triangles, generate a valid leaf object
@@ -765,4 +875,9 @@ void BVH::debugSAHBins(const Features& features, const uint32_t nodeIndex)
     {
         drawAABB(currentNode.aabb, DrawMode::Wireframe, glm::vec3(0.05f, 1.0f, 0.05f), 0.6f);
     }
-}
\ No newline at end of file
+}
+
+#define INSTANTIATE_BVH_KERNEL(Mask)                                                                                                                                                           \
+    template void kernel::updateHitInfo<Mask>(RenderState&, const BVHInterface::Primitive&, const Ray&, HitInfo&);                                                                           \
+    template bool kernel::intersectRayWithBVH<Mask>(RenderState&, const BVHInterface&, Ray&, HitInfo&);
+FOR_EACH_RENDER_KERNEL(INSTANTIATE_BVH_KERNEL)
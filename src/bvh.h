@@ -42,6 +42,9 @@ size_t splitPrimitivesByMedian(const AxisAlignedBox& aabb, uint32_t axis, std::s
 // This method is unit-tested, so do not change the function signature.
 bool intersectRayWithBVH(RenderState& state, const BVHInterface& bvh, Ray& ray, HitInfo& hitInfo);
 
+// Fill in the hit info of a ray hitting a primitive at `ray.t`, including its material.
+void updateHitInfo(RenderState& state, const BVHInterface::Primitive& primitive, const Ray& ray, HitInfo& hitInfo);
+
 // The implementing class where you will put most of the BVH implementation; this class must conform
 // to BVHInterface for grading purposes; see `bvh_interface.h` for details
 struct BVH : public BVHInterface {
@@ -0,0 +1,129 @@
+#include "camera.h"
+#include "config.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/quaternion.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/trackball.h>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+Camera::Camera(const CameraConfig& config, float aspectRatio)
+    : Camera(glm::radians(config.fieldOfView), aspectRatio, config.lookAt, glm::radians(config.rotation), config.distanceFromLookAt)
+{
+}
+
+Camera::Camera(const Trackball& trackball)
+    : Camera(trackball.fieldOfView(), trackball.aspectRatio(), trackball.lookAt(), trackball.rotationEulerAngles(), trackball.distanceFromLookAt())
+{
+}
+
+Camera::Camera(float fovy, float aspectRatio, const glm::vec3& lookAt, const glm::vec3& rotation, float distanceFromLookAt)
+{
+    // Same construction as `Trackball`; a camera space direction (-x * halfWidth, y * halfHeight, 1)
+    // is rotated into world space. We fold the rotation and the scale into three vectors here,
+    // so a ray direction only takes two multiply-adds and a normalization.
+    const glm::quat rotationQuat = glm::quat(rotation);
+    const float halfScreenSpaceHeight = std::tan(fovy / 2.0f);
+    const float halfScreenSpaceWidth = aspectRatio * halfScreenSpaceHeight;
+
+    m_position = lookAt + rotationQuat * glm::vec3(0, 0, -distanceFromLookAt);
+    m_forward = rotationQuat * glm::vec3(0, 0, 1);
+    m_right = rotationQuat * glm::vec3(-halfScreenSpaceWidth, 0, 0);
+    m_up = rotationQuat * glm::vec3(0, halfScreenSpaceHeight, 0);
+}
+
+// Map a sample in [0, 1)^2 to the unit disk, keeping the stratification of the samples intact;
+// P. Shirley and K. Chiu, "A Low Distortion Map Between Disk and Square", 1997.
+static glm::vec2 sampleConcentricDisk(glm::vec2 sample)
+{
+    const glm::vec2 p = 2.0f * sample - 1.0f;
+    if (p.x == 0.0f && p.y == 0.0f)
+        return glm::vec2(0.0f);
+
+    float radius, theta;
+    if (std::abs(p.x) > std::abs(p.y)) {
+        radius = p.x;
+        theta = glm::quarter_pi<float>() * (p.y / p.x);
+    } else {
+        radius = p.y;
+        theta = glm::half_pi<float>() - glm::quarter_pi<float>() * (p.x / p.y);
+    }
+    return radius * glm::vec2(std::cos(theta), std::sin(theta));
+}
+
+glm::vec3 Camera::position() const
+{
+    return m_position;
+}
+
+glm::vec3 Camera::forward() const
+{
+    return m_forward;
+}
+
+float Camera::pixelSpreadAngle(glm::ivec2 screenResolution) const
+{
+    // `m_up` spans half of the image height at unit distance along `m_forward`
+    return std::atan(2.0f * glm::length(m_up) / float(screenResolution.y));
+}
+
+void Camera::setThinLens(float lensRadius, float focusDistance)
+{
+    m_lensRight = lensRadius * glm::normalize(m_right);
+    m_lensUp = lensRadius * glm::normalize(m_up);
+    m_focusDistance = focusDistance;
+}
+
+bool Camera::hasThinLens() const
+{
+    return m_lensRight != glm::vec3(0.0f);
+}
+
+Ray Camera::sampleLens(const Ray& ray, const glm::vec2& sample) const
+{
+    if (!hasThinLens())
+        return ray;
+
+    // The plane of focus is parallel to the image plane, so rays travel further to it away from the center
+    const glm::vec3 focusPoint = ray.origin + ray.direction * (m_focusDistance / glm::dot(ray.direction, m_forward));
+    const glm::vec2 lensPoint = sampleConcentricDisk(sample);
+    const glm::vec3 origin = ray.origin + lensPoint.x * m_lensRight + lensPoint.y * m_lensUp;
+    return Ray { .origin = origin, .direction = glm::normalize(focusPoint - origin), .t = std::numeric_limits<float>::max() };
+}
+
+Ray Camera::generateRay(const glm::vec2& pixel) const
+{
+    return Ray {
+        .origin = m_position,
+        .direction = glm::normalize(m_forward + pixel.x * m_right + pixel.y * m_up),
+        .t = std::numeric_limits<float>::max()
+    };
+}
+
+glm::vec3 Camera::project(const glm::vec3& point) const
+{
+    // The forward axis is a unit vector, orthogonal to the right and up axes
+    const glm::vec3 offset = point - m_position;
+    return { glm::dot(offset, m_right) / glm::dot(m_right, m_right), glm::dot(offset, m_up) / glm::dot(m_up, m_up), glm::dot(offset, m_forward) };
+}
+
+void Camera::generateTileRays(glm::ivec2 tileBegin, glm::ivec2 tileEnd, glm::ivec2 screenResolution, std::span<Ray> rays) const
+{
+    assert(rays.size() >= size_t((tileEnd.x - tileBegin.x) * (tileEnd.y - tileBegin.y)));
+
+    // The vertical part of the direction is shared by a row of pixels, so only add it once per row
+    const glm::vec2 pixelSize = 2.0f / glm::vec2(screenResolution);
+    size_t i = 0;
+    for (int y = tileBegin.y; y < tileEnd.y; y++) {
+        const float ndcY = (float(y) + 0.5f) * pixelSize.y - 1.0f;
+        const glm::vec3 rowDirection = m_forward + ndcY * m_up;
+        for (int x = tileBegin.x; x < tileEnd.x; x++, i++) {
+            const float ndcX = (float(x) + 0.5f) * pixelSize.x - 1.0f;
+            rays[i] = Ray { .origin = m_position, .direction = glm::normalize(rowDirection + ndcX * m_right), .t = std::numeric_limits<float>::max() };
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "fwd.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/ray.h>
+#include <span>
+
+struct CameraConfig;
+
+// A pinhole or thin lens camera that is not tied to a window, such that images can be rendered without
+// initializing GLFW/OpenGL. It follows the same conventions as `Trackball`, but the camera basis
+// and the mapping from normalized device coordinates to ray directions are computed once, on
+// construction, instead of for every generated ray.
+class Camera {
+public:
+    // Build a camera from a config file entry; angles in the config are in degrees
+    Camera(const CameraConfig& config, float aspectRatio);
+    // Snapshot of the current view of an interactive camera
+    explicit Camera(const Trackball& trackball);
+
+    [[nodiscard]] glm::vec3 position() const;
+    [[nodiscard]] glm::vec3 forward() const;
+    // Angle subtended by a pixel at the center of the image, for ray cones of camera rays.
+    [[nodiscard]] float pixelSpreadAngle(glm::ivec2 screenResolution) const;
+
+    // Turn the camera into a thin lens camera, with a disk-shaped lens of radius `lensRadius` around the
+    // camera position, and the plane of focus at `focusDistance` in front of it (both in world units).
+    void setThinLens(float lensRadius, float focusDistance);
+    [[nodiscard]] bool hasThinLens() const;
+
+    // Generate ray given pixel in NDC space (ranging from -1 to +1. (-1,-1) at bottom left, (+1, +1) at top right).
+    [[nodiscard]] Ray generateRay(const glm::vec2& pixel) const;
+
+    // Project a point to homogeneous screen coordinates (x * w, y * w, w), with (x, y) in NDC as for
+    // `generateRay()`, and w the point's depth along the camera's forward axis.
+    [[nodiscard]] glm::vec3 project(const glm::vec3& point) const;
+
+    // Generate one ray through the center of each pixel in the tile [tileBegin, tileEnd), writing
+    // them row by row into `rays`, which must hold at least as many rays as the tile has pixels.
+    void generateTileRays(glm::ivec2 tileBegin, glm::ivec2 tileEnd, glm::ivec2 screenResolution, std::span<Ray> rays) const;
+
+    // Given a ray generated as above and a sample in [0, 1)^2, return the ray from the corresponding point
+    // on the lens that meets the given ray on the plane of focus. Without a lens, returns the given ray.
+    [[nodiscard]] Ray sampleLens(const Ray& ray, const glm::vec2& sample) const;
+
+private:
+    Camera(float fovy, float aspectRatio, const glm::vec3& lookAt, const glm::vec3& rotation, float distanceFromLookAt);
+
+    glm::vec3 m_position;
+    glm::vec3 m_forward; // Unnormalized direction for NDC (0, 0)
+    glm::vec3 m_right; // Change in direction per unit of NDC x
+    glm::vec3 m_up; // Change in direction per unit of NDC y
+
+    glm::vec3 m_lensRight { 0.0f }; // Lens axes, scaled by the lens radius
+    glm::vec3 m_lensUp { 0.0f };
+    float m_focusDistance = 1.0f;
+};
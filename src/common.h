@@ -6,12 +6,22 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/vec3.hpp>
 DISABLE_WARNINGS_POP()
 #include <framework/mesh.h>
+#include <limits>
 
 enum class DrawMode {
     Filled,
     Wireframe
 };
 
+// Sequences of sample points that a `Sampler` draws; see `Sampler`
+enum class SamplerType {
+    Independent, // Independent uniform random samples
+    Sobol, // Owen-scrambled Sobol points, shuffled; scrambled per pixel
+    Halton, // Owen-scrambled Halton points, in two prime bases per dimension; scrambled per pixel
+    BlueNoise, // Sobol points scrambled the same for all pixels, and shifted by a blue noise mask per pixel,
+               // s.t. the error at low sample counts is distributed as blue noise
+};
+
 enum class ShadingModel {
     Lambertian = 0,
     Phong = 1,
@@ -24,6 +34,10 @@ struct HitInfo {
     glm::vec3 barycentricCoord;
     glm::vec2 texCoord;
     Material material;
+    uint32_t materialID { 0 }; // Index of the hit surface's material in `Scene::materials`
+    // Log2 of the width of the ray cone's footprint in texture coordinates; adding log2 of a texture's
+    // size gives its mip level. Only computed with mipmap filtering; -inf selects the full resolution.
+    float texCoordLod { -std::numeric_limits<float>::infinity() };
 };
 
 struct Plane {
@@ -81,16 +95,49 @@ struct ExtraFeatures {
 
     // Parameters for glossy reflection
     uint32_t numGlossySamples = 1;
+    bool enablePrefilteredEnvironmentMap = false; // Resolve glossy lobes that escape the scene with one filtered lookup
 
     int numMotionBlurSamples = 2;
 
     bool enableMotionBlurSampleIsolation = false;
     int numMotionBlurSampleIsolated = 1;
 
-    // Parameters for depth of field
-    float focalLength = 1.8f;
-    float aperture = 10.0f;
-    int depthOfFieldNumSamples = 15;
+    // Parameters for depth of field; a thin lens camera model
+    float focusDistance = 3.0f; // Distance from the camera to the plane of focus, in world units
+    float lensRadius = 0.05f; // In world units
+    int depthOfFieldNumSamples = 15; // Samples across the lens for every pixel sample
+
+    // Rasterise primary hits into a visibility buffer, and ray trace from there on; only used where it
+    // matches ray traced camera rays (see `VisibilityBuffer::supports()`)
+    bool enableVisibilityBuffer = false;
+
+    // Parameters for denoising; see `denoiseImage()`
+    bool enableDenoising = false;
+    int denoiseIterations = 5; // A-trous passes; the filter covers 2^(iterations + 2) - 3 pixels
+    float denoiseColorSigma = 4.0f; // Tolerance of luminance differences, in standard deviations
+
+    SamplerType samplerType = SamplerType::Independent; // Sequence of the samples drawn for a pixel
+
+    // Sample segment and parallelogram lights in proportion to their brightness and the cosine towards them, and
+    // combine parallelogram light samples with samples of the Phong/Blinn-Phong specular lobe by multiple importance
+    // sampling; see `computeContributionParallelogramLight()`
+    bool enableLightImportanceSampling = false;
+
+    // Parameters for adaptive shadow sampling of segment and parallelogram lights; see
+    // `computeContributionSegmentLight()` and `computeContributionParallelogramLight()`
+    bool enableAdaptiveShadowSampling = false;
+    uint32_t adaptiveShadowBatch = 4; // Shadow rays traced per light before the rest may be skipped
+
+    // Parameters for sampling lights through a light tree; see `LightTree`
+    bool enableLightTree = false;
+    uint32_t numLightTreeSamples = 1; // Lights picked at every hit, instead of sampling all of them
+    float lightTreeThreshold = 0.0f; // Relative importance below which subtrees are never picked; 0 is unbiased
+
+    // Parameters for resampling the direct light at camera ray hits (ReSTIR); see `resampleDirectLighting()`
+    bool enableReSTIR = false;
+    int numReSTIRCandidates = 32; // Light samples per pixel, which are shaded, but not shadowed
+    int numReSTIRSpatialNeighbours = 5; // Nearby pixels whose reservoirs are merged into every pixel's
+    bool enableReSTIRTemporalReuse = true; // Merge the previous frame's reservoirs in the interactive view
 };
 
 struct Features {
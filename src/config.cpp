@@ -1,4 +1,5 @@
 #include "config.h"
+#include "extra.h"
 #include "scene.h"
 
 DISABLE_WARNINGS_PUSH()
@@ -102,7 +103,10 @@ std::ostream& operator<<(std::ostream& os, const Config& config)
        << "    - num_pixel_samples: " << config.features.numPixelSamples << std::endl
        << "    - num_shadow_samples: " << config.features.numShadowSamples << std::endl
        << "  + extra_features: " << std::endl
-       << "    - enable_bloom_effect: " << config.features.extra.enableBloomEffect << std::endl;
+       << "    - enable_bloom_effect: " << config.features.extra.enableBloomEffect << std::endl
+       << "    - bloom_filter_size: " << config.features.extra.bloomFilterSize << std::endl
+       << "    - bloom_filter_threshold: " << config.features.extra.bloomFilterThreshold << std::endl
+       << "    - bloom_filter_intensity: " << config.features.extra.bloomFilterIntensity << std::endl;
 
 
     os << "    - enable_jittered_sampling: " << config.features.enableJitteredSampling << std::endl;
@@ -111,9 +115,40 @@ std::ostream& operator<<(std::ostream& os, const Config& config)
 
 
     os << "    - enable_depth_of_field: " << config.features.extra.enableDepthOfField << std::endl;
+    if (config.features.extra.enableDepthOfField) {
+        os << "      focus_distance: " << config.features.extra.focusDistance << ", lens_radius: " << config.features.extra.lensRadius
+           << ", depth_of_field_samples: " << config.features.extra.depthOfFieldNumSamples << std::endl;
+    }
     os << "    - enable_glossy_reflection: " << config.features.extra.enableGlossyReflection << std::endl;
+    if (config.features.extra.enableGlossyReflection) {
+        os << "      num_glossy_samples: " << config.features.extra.numGlossySamples
+           << ", prefiltered_environment_map: " << config.features.extra.enablePrefilteredEnvironmentMap << std::endl;
+    }
 
 
+    os << "    - sampler: " << serialize(config.features.extra.samplerType) << std::endl;
+    os << "    - enable_light_importance_sampling: " << config.features.extra.enableLightImportanceSampling << std::endl;
+    os << "    - enable_adaptive_shadow_sampling: " << config.features.extra.enableAdaptiveShadowSampling << std::endl;
+    if (config.features.extra.enableAdaptiveShadowSampling) {
+        os << "      adaptive_shadow_batch: " << config.features.extra.adaptiveShadowBatch << std::endl;
+    }
+    os << "    - enable_light_tree: " << config.features.extra.enableLightTree << std::endl;
+    if (config.features.extra.enableLightTree) {
+        os << "      num_light_tree_samples: " << config.features.extra.numLightTreeSamples
+           << ", light_tree_threshold: " << config.features.extra.lightTreeThreshold << std::endl;
+    }
+    os << "    - enable_restir: " << config.features.extra.enableReSTIR << std::endl;
+    if (config.features.extra.enableReSTIR) {
+        os << "      restir_candidates: " << config.features.extra.numReSTIRCandidates
+           << ", restir_spatial_neighbours: " << config.features.extra.numReSTIRSpatialNeighbours
+           << ", restir_temporal_reuse: " << config.features.extra.enableReSTIRTemporalReuse << std::endl;
+    }
+    os << "    - enable_denoising: " << config.features.extra.enableDenoising << std::endl;
+    if (config.features.extra.enableDenoising) {
+        os << "      denoise_iterations: " << config.features.extra.denoiseIterations
+           << ", denoise_color_sigma: " << config.features.extra.denoiseColorSigma << std::endl;
+    }
+    os << "    - enable_visibility_buffer: " << config.features.extra.enableVisibilityBuffer << std::endl;
     os << "    - enable_bvh_sah_binning: " << config.features.extra.enableBvhSahBinning << std::endl;
     os << "    - enable_bilinear_texture_filtering: " << config.features.enableBilinearTextureFiltering << std::endl;
     os << "    - enable_mipmap_texture_filtering: " << config.features.extra.enableMipmapTextureFiltering << std::endl;
@@ -147,6 +182,51 @@ std::ostream& operator<<(std::ostream& os, const Config& config)
         },
             elem);
     }
+
+    os << "  + post_process: " << std::endl;
+    for (const auto& elem : config.postProcess) {
+        std::visit([&os](auto&& pass) {
+            using T = std::decay_t<decltype(pass)>;
+            if constexpr (std::is_same_v<T, ThresholdPass>) {
+                os << "    - type: threshold, threshold: " << pass.threshold << ", visualize: " << pass.visualize << std::endl;
+            } else if constexpr (std::is_same_v<T, BlurPass>) {
+                os << "    - type: blur, sigma: " << pass.sigma << std::endl;
+            } else if constexpr (std::is_same_v<T, CompositePass>) {
+                os << "    - type: composite, intensity: " << pass.intensity << ", replace: " << pass.replace << std::endl;
+            } else if constexpr (std::is_same_v<T, ExposurePass>) {
+                os << "    - type: exposure, stops: " << pass.stops << std::endl;
+            } else if constexpr (std::is_same_v<T, ToneMapPass>) {
+                os << "    - type: tone_map, operator: " << (pass.op == ToneMapOperator::Aces ? "aces" : "reinhard") << std::endl;
+            } else if constexpr (std::is_same_v<T, GammaPass>) {
+                os << "    - type: gamma, gamma: " << pass.gamma << std::endl;
+            } else if constexpr (std::is_same_v<T, QuantizePass>) {
+                os << "    - type: quantize" << std::endl;
+            }
+        },
+            elem);
+    }
+
+    if (!config.environmentMap.empty()) {
+        os << "  + environment_map: " << std::endl;
+        for (const auto& file : config.environmentMap)
+            os << "    - " << file << std::endl;
+    }
+    if (config.textureCache) {
+        os << "  + texture_cache: " << std::endl
+           << "    - budget_mb: " << (config.textureCache->budgetBytes >> 20) << std::endl
+           << "    - directory: " << config.textureCache->directory << std::endl;
+    }
+    if (config.geometryCache) {
+        os << "  + geometry_cache: " << std::endl
+           << "    - budget_mb: " << (config.geometryCache->budgetBytes >> 20) << std::endl
+           << "    - cluster_size: " << config.geometryCache->clusterSize << std::endl
+           << "    - compress_attributes: " << config.geometryCache->compressAttributes << std::endl
+           << "    - directory: " << config.geometryCache->directory << std::endl;
+    }
+    if (config.meshCacheDirectory) {
+        os << "  + mesh_cache: " << std::endl
+           << "    - directory: " << *config.meshCacheDirectory << std::endl;
+    }
     return os;
 }
 
@@ -161,7 +241,7 @@ std::optional<glm::vec3> tomlArrayToVec3(const toml::array* array)
             if (elem.is_number()) {
                 if (i > 2)
                     return;
-                output[i] = static_cast<float>(elem.as_floating_point()->get());
+                output[i] = static_cast<float>(static_cast<const toml::node&>(elem).value_or(0.0));
                 i += 1;
             } else {
                 std::cerr << "Error: Expected a number in array, got " << elem.type() << std::endl;
@@ -208,7 +288,7 @@ Config readConfigFile(const std::filesystem::path& config_path)
 
     const auto& table = result.table();
 
-    config.cliRenderingEnabled = table["command_line_rendering"].as_boolean()->value_or(true);
+    config.cliRenderingEnabled = table["command_line_rendering"].value_or(true);
 
     config.windowSize = tomlArrayToIVec2(table["window_size"].as_array()).value_or(glm::ivec2(800, 800));
 
@@ -219,7 +299,7 @@ Config readConfigFile(const std::filesystem::path& config_path)
     config.dataPath = data_path;
 
     auto scene = table["scene"];
-    if (scene.is_number()) {
+    if (scene.is_integer()) {
         auto scene_type = static_cast<SceneType>(scene.as_integer()->get());
         config.scene = scene_type;
     } else {
@@ -259,82 +339,76 @@ Config readConfigFile(const std::filesystem::path& config_path)
         config.outputDir = std::filesystem::absolute(std::filesystem::path(output_dir));
     }
 
-    config.features.enableShading = table["features"]["enable_shading"]
-                                        .as_boolean()
-                                        ->value_or(false);
-    config.features.enableReflections = table["features"]["enable_reflections"]
-                                            .as_boolean()
-                                            ->value_or(false);
-    config.features.enableShadows = table["features"]["enable_shadows"]
-                                        .as_boolean()
-                                        ->value_or(false);
-    config.features.enableNormalInterp = table["features"]["enable_normal_interp"]
-                                             .as_boolean()
-                                             ->value_or(false);
-    config.features.enableTextureMapping = table["features"]["enable_texture_mapping"]
-                                               .as_boolean()
-                                               ->value_or(false);
-    config.features.enableAccelStructure = table["features"]["enable_accel_structure"]
-                                               .as_boolean()
-                                               ->value_or(false);
-    config.features.numPixelSamples = table["features"]["num_pixel_samples"]
-                                          .as_integer()
-                                          ->value_or(1);
-    config.features.shadingModel = static_cast<ShadingModel>(table["features"]["shading_model"]
-                                                                 .as_integer()
-                                                                 ->value_or(0));
-    config.features.numShadowSamples = table["features"]["num_shadow_samples"]
-                                           .as_integer()
-                                           ->value_or(16);
+    config.features.enableShading = table["features"]["enable_shading"].value_or(false);
+    config.features.enableReflections = table["features"]["enable_reflections"].value_or(false);
+    config.features.enableShadows = table["features"]["enable_shadows"].value_or(false);
+    config.features.enableNormalInterp = table["features"]["enable_normal_interp"].value_or(false);
+    config.features.enableTextureMapping = table["features"]["enable_texture_mapping"].value_or(false);
+    config.features.enableAccelStructure = table["features"]["enable_accel_structure"].value_or(false);
+    config.features.numPixelSamples = table["features"]["num_pixel_samples"].value_or(1u);
+    config.features.shadingModel = static_cast<ShadingModel>(table["features"]["shading_model"].value_or(0));
+    config.features.numShadowSamples = table["features"]["num_shadow_samples"].value_or(16u);
     if (table["features"]["enable_bilinear_texture_filtering"]) {
-        config.features.enableBilinearTextureFiltering = table["features"]["enable_bilinear_texture_filtering"]
-                                                             .as_boolean()
-                                                             ->value_or(false);
+        config.features.enableBilinearTextureFiltering = table["features"]["enable_bilinear_texture_filtering"].value_or(false);
     }
 
     if (table["features"]["extra"]["enable_bloom_effect"]) {
-        config.features.extra.enableBloomEffect = table["features"]["extra"]["enable_bloom_effect"]
-                                                      .as_boolean()
-                                                      ->value_or(false);
+        config.features.extra.enableBloomEffect = table["features"]["extra"]["enable_bloom_effect"].value_or(false);
     }
+    config.features.extra.bloomFilterSize = table["features"]["extra"]["bloom_filter_size"].value_or(config.features.extra.bloomFilterSize);
+    config.features.extra.bloomFilterThreshold = table["features"]["extra"]["bloom_filter_threshold"].value_or(config.features.extra.bloomFilterThreshold);
+    config.features.extra.bloomFilterIntensity = table["features"]["extra"]["bloom_filter_intensity"].value_or(config.features.extra.bloomFilterIntensity);
 
-    config.features.extra.enableEnvironmentMap = table["features"]["extra"]["enable_environment_map"]
-                                                     .as_boolean()
-                                                     ->value_or(false);
+    config.features.extra.enableEnvironmentMap = table["features"]["extra"]["enable_environment_map"].value_or(false);
 
-    if (table["features"]["extra"]["enable_multiple_rays_per_pixel"]) {
-        config.features.enableJitteredSampling = table["features"]["enable_jittered_sampling"]
-                                                           .as_boolean()
-                                                           ->value_or(false);
+    if (table["features"]["enable_jittered_sampling"]) {
+        config.features.enableJitteredSampling = table["features"]["enable_jittered_sampling"].value_or(false);
     }
 
     if (table["features"]["extra"]["enable_motion_blur"]) {
-        config.features.extra.enableMotionBlur = table["features"]["extra"]["enable_motion_blur"]
-                                                     .as_boolean()
-                                                     ->value_or(false);
+        config.features.extra.enableMotionBlur = table["features"]["extra"]["enable_motion_blur"].value_or(false);
     }
 
     if (table["features"]["extra"]["enable_depth_of_field"]) {
-        config.features.extra.enableDepthOfField = table["features"]["extra"]["enable_depth_of_field"]
-                                                       .as_boolean()
-                                                       ->value_or(false);
+        config.features.extra.enableDepthOfField = table["features"]["extra"]["enable_depth_of_field"].value_or(false);
     }
+    config.features.extra.focusDistance = table["features"]["extra"]["focus_distance"].value_or(config.features.extra.focusDistance);
+    config.features.extra.lensRadius = table["features"]["extra"]["lens_radius"].value_or(config.features.extra.lensRadius);
+    config.features.extra.depthOfFieldNumSamples = table["features"]["extra"]["depth_of_field_samples"].value_or(config.features.extra.depthOfFieldNumSamples);
     if (table["features"]["extra"]["enable_glossy_reflection"]) {
-        config.features.extra.enableGlossyReflection = table["features"]["extra"]["enable_glossy_reflection"]
-                                                           .as_boolean()
-                                                           ->value_or(false);
-    }
+        config.features.extra.enableGlossyReflection = table["features"]["extra"]["enable_glossy_reflection"].value_or(false);
+    }
+    config.features.extra.numGlossySamples = table["features"]["extra"]["num_glossy_samples"].value_or(config.features.extra.numGlossySamples);
+    config.features.extra.enablePrefilteredEnvironmentMap = table["features"]["extra"]["prefiltered_environment_map"].value_or(config.features.extra.enablePrefilteredEnvironmentMap);
+    if (auto sampler = table["features"]["extra"]["sampler"].value<std::string>()) {
+        if (auto samplerType = deserializeSamplerType(*sampler))
+            config.features.extra.samplerType = *samplerType;
+        else
+            std::cerr << "Unknown sampler: " << *sampler << " -- Using independent" << std::endl;
+    }
+    config.features.extra.enableLightImportanceSampling = table["features"]["extra"]["enable_light_importance_sampling"].value_or(config.features.extra.enableLightImportanceSampling);
+    config.features.extra.enableAdaptiveShadowSampling = table["features"]["extra"]["enable_adaptive_shadow_sampling"].value_or(config.features.extra.enableAdaptiveShadowSampling);
+    config.features.extra.adaptiveShadowBatch = table["features"]["extra"]["adaptive_shadow_batch"].value_or(config.features.extra.adaptiveShadowBatch);
+    config.features.extra.enableLightTree = table["features"]["extra"]["enable_light_tree"].value_or(config.features.extra.enableLightTree);
+    config.features.extra.numLightTreeSamples = std::max(table["features"]["extra"]["num_light_tree_samples"].value_or(config.features.extra.numLightTreeSamples), 1u);
+    config.features.extra.lightTreeThreshold = table["features"]["extra"]["light_tree_threshold"].value_or(config.features.extra.lightTreeThreshold);
+    config.features.extra.enableReSTIR = table["features"]["extra"]["enable_restir"].value_or(config.features.extra.enableReSTIR);
+    config.features.extra.numReSTIRCandidates = table["features"]["extra"]["restir_candidates"].value_or(config.features.extra.numReSTIRCandidates);
+    config.features.extra.numReSTIRSpatialNeighbours = table["features"]["extra"]["restir_spatial_neighbours"].value_or(config.features.extra.numReSTIRSpatialNeighbours);
+    config.features.extra.enableReSTIRTemporalReuse = table["features"]["extra"]["restir_temporal_reuse"].value_or(config.features.extra.enableReSTIRTemporalReuse);
+    config.features.extra.enableDenoising = table["features"]["extra"]["enable_denoising"].value_or(config.features.extra.enableDenoising);
+    config.features.extra.denoiseIterations = table["features"]["extra"]["denoise_iterations"].value_or(config.features.extra.denoiseIterations);
+    config.features.extra.denoiseColorSigma = table["features"]["extra"]["denoise_color_sigma"].value_or(config.features.extra.denoiseColorSigma);
+    config.features.extra.enableVisibilityBuffer = table["features"]["extra"]["enable_visibility_buffer"].value_or(config.features.extra.enableVisibilityBuffer);
     if (table["features"]["extra"]["enable_mipmap_texture_filtering"]) {
-        config.features.extra.enableMipmapTextureFiltering = table["features"]["extra"]["enable_mipmap_texture_filtering"]
-                                                                 .as_boolean()
-                                                                 ->value_or(false);
+        config.features.extra.enableMipmapTextureFiltering = table["features"]["extra"]["enable_mipmap_texture_filtering"].value_or(false);
     }
 
     const toml::array* cameras = table["cameras"].as_array();
     if (cameras) {
         cameras->for_each([&](auto&& camera) {
-            float fieldOfView = camera.at_path("field_of_view").as_floating_point()->value_or(50.0f);
-            float distanceFromLookAt = camera.at_path("distance_from_look_at").as_floating_point()->value_or(3.0f);
+            float fieldOfView = camera.at_path("field_of_view").value_or(50.0f);
+            float distanceFromLookAt = camera.at_path("distance_from_look_at").value_or(3.0f);
             glm::vec3 look_at = tomlArrayToVec3(camera.at_path("look_at").as_array()).value_or(glm::vec3(0.0f));
             glm::vec3 rotation = tomlArrayToVec3(camera.at_path("rotation").as_array()).value_or(glm::vec3(20.0f, 20.0f, 0.0f));
             config.cameras.emplace_back(CameraConfig { fieldOfView, distanceFromLookAt, look_at, rotation });
@@ -344,7 +418,7 @@ Config readConfigFile(const std::filesystem::path& config_path)
     const toml::array* lights = table["lights"].as_array();
     if (lights) {
         lights->for_each([&](auto&& light) {
-            std::string type = light.at_path("type").as_string()->value_or("none");
+            std::string type = light.at_path("type").value_or(std::string("none"));
             if (type == "point") {
                 glm::vec3 position = tomlArrayToVec3(light.at_path("position").as_array())
                                          .value_or(glm::vec3(0.0f));
@@ -352,29 +426,29 @@ Config readConfigFile(const std::filesystem::path& config_path)
                                       .value_or(glm::vec3(0.0f));
                 config.lights.emplace_back(PointLight { position, color });
             } else if (type == "segment") {
-                glm::vec3 endpoint0 = tomlArrayToVec3(light.at_path("endpoints").as_array()->at(0).as_array())
+                glm::vec3 endpoint0 = tomlArrayToVec3(light.at_path("endpoints[0]").as_array())
                                           .value_or(glm::vec3(0.0f));
-                glm::vec3 endpoint1 = tomlArrayToVec3(light.at_path("endpoints").as_array()->at(1).as_array())
+                glm::vec3 endpoint1 = tomlArrayToVec3(light.at_path("endpoints[1]").as_array())
                                           .value_or(glm::vec3(0.0f));
-                glm::vec3 color0 = tomlArrayToVec3(light.at_path("colors").as_array()->at(0).as_array())
+                glm::vec3 color0 = tomlArrayToVec3(light.at_path("colors[0]").as_array())
                                        .value_or(glm::vec3(0.0f));
-                glm::vec3 color1 = tomlArrayToVec3(light.at_path("colors").as_array()->at(1).as_array())
+                glm::vec3 color1 = tomlArrayToVec3(light.at_path("colors[1]").as_array())
                                        .value_or(glm::vec3(0.0f));
                 config.lights.emplace_back(SegmentLight { endpoint0, endpoint1, color0, color1 });
             } else if (type == "parallelogram") {
                 glm::vec3 corner = tomlArrayToVec3(light.at_path("corner").as_array())
                                        .value_or(glm::vec3(0.0f));
-                glm::vec3 edge0 = tomlArrayToVec3(light.at_path("edges").as_array()->at(0).as_array())
+                glm::vec3 edge0 = tomlArrayToVec3(light.at_path("edges[0]").as_array())
                                       .value_or(glm::vec3(0.0f));
-                glm::vec3 edge1 = tomlArrayToVec3(light.at_path("edges").as_array()->at(1).as_array())
+                glm::vec3 edge1 = tomlArrayToVec3(light.at_path("edges[1]").as_array())
                                       .value_or(glm::vec3(0.0f));
-                glm::vec3 color0 = tomlArrayToVec3(light.at_path("colors").as_array()->at(0).as_array())
+                glm::vec3 color0 = tomlArrayToVec3(light.at_path("colors[0]").as_array())
                                        .value_or(glm::vec3(0.0f));
-                glm::vec3 color1 = tomlArrayToVec3(light.at_path("colors").as_array()->at(1).as_array())
+                glm::vec3 color1 = tomlArrayToVec3(light.at_path("colors[1]").as_array())
                                        .value_or(glm::vec3(0.0f));
-                glm::vec3 color2 = tomlArrayToVec3(light.at_path("colors").as_array()->at(2).as_array())
+                glm::vec3 color2 = tomlArrayToVec3(light.at_path("colors[2]").as_array())
                                        .value_or(glm::vec3(0.0f));
-                glm::vec3 color3 = tomlArrayToVec3(light.at_path("colors").as_array()->at(3).as_array())
+                glm::vec3 color3 = tomlArrayToVec3(light.at_path("colors[3]").as_array())
                                        .value_or(glm::vec3(0.0f));
                 config.lights.emplace_back(ParallelogramLight { corner, edge0, edge1, color0, color1, color2, color3 });
             } else {
@@ -386,9 +460,82 @@ Config readConfigFile(const std::filesystem::path& config_path)
         config.lights = {};
     }
 
+    const toml::array* postProcess = table["post_process"].as_array();
+    if (postProcess) {
+        postProcess->for_each([&](auto&& pass) {
+            std::string type = pass.at_path("type").value_or(std::string("none"));
+            if (type == "threshold") {
+                config.postProcess.emplace_back(ThresholdPass { pass.at_path("threshold").value_or(0.5f), pass.at_path("visualize").value_or(false) });
+            } else if (type == "blur") {
+                config.postProcess.emplace_back(BlurPass { pass.at_path("sigma").value_or(4.0f) });
+            } else if (type == "composite") {
+                config.postProcess.emplace_back(CompositePass { pass.at_path("intensity").value_or(0.8f), pass.at_path("replace").value_or(false) });
+            } else if (type == "exposure") {
+                config.postProcess.emplace_back(ExposurePass { pass.at_path("stops").value_or(0.0f) });
+            } else if (type == "tone_map") {
+                std::string op = pass.at_path("operator").value_or(std::string("reinhard"));
+                if (op != "reinhard" && op != "aces")
+                    std::cerr << "Unknown tone map operator: " << op << " -- Using reinhard" << std::endl;
+                config.postProcess.emplace_back(ToneMapPass { op == "aces" ? ToneMapOperator::Aces : ToneMapOperator::Reinhard });
+            } else if (type == "gamma") {
+                config.postProcess.emplace_back(GammaPass { pass.at_path("gamma").value_or(2.2f) });
+            } else if (type == "quantize") {
+                config.postProcess.emplace_back(QuantizePass {});
+            } else {
+                std::cerr << "Unknown post-processing pass type: " << type << " -- Skip" << std::endl;
+            }
+        });
+    }
+
+    if (const toml::table* textureCache = table["texture_cache"].as_table()) {
+        TextureCacheConfig cacheConfig;
+        cacheConfig.budgetBytes = size_t(textureCache->at_path("budget_mb").value_or(int64_t(256))) << 20;
+        cacheConfig.directory = textureCache->at_path("directory").value_or(std::string(""));
+        config.textureCache = cacheConfig;
+    }
+
+    if (const toml::table* geometryCache = table["geometry_cache"].as_table()) {
+        GeometryCacheConfig cacheConfig;
+        cacheConfig.budgetBytes = size_t(geometryCache->at_path("budget_mb").value_or(int64_t(256))) << 20;
+        cacheConfig.clusterSize = geometryCache->at_path("cluster_size").value_or(cacheConfig.clusterSize);
+        cacheConfig.compressAttributes = geometryCache->at_path("compress_attributes").value_or(cacheConfig.compressAttributes);
+        cacheConfig.directory = geometryCache->at_path("directory").value_or(std::string(""));
+        config.geometryCache = cacheConfig;
+    }
+
+    if (const toml::table* meshCache = table["mesh_cache"].as_table()) {
+        if (meshCache->at_path("enabled").value_or(true))
+            config.meshCacheDirectory = meshCache->at_path("directory").value<std::string>();
+        else
+            config.meshCacheDirectory = std::filesystem::path();
+    }
+
+    if (const toml::table* environmentMap = table["environment_map"].as_table()) {
+        // Either a single 4x3 cube cross, or six faces; relative paths are relative to the data path
+        if (std::optional<std::string> file = environmentMap->at_path("file").value<std::string>()) {
+            config.environmentMap = { config.dataPath / *file };
+        } else if (const toml::array* faces = environmentMap->at_path("faces").as_array()) {
+            faces->for_each([&](auto&& face) {
+                config.environmentMap.push_back(config.dataPath / face.value_or(std::string("")));
+            });
+        }
+        if (config.environmentMap.size() != 1 && config.environmentMap.size() != 6) {
+            std::cerr << "Error: An environment map needs either a file or six faces -- Using the default" << std::endl;
+            config.environmentMap.clear();
+        }
+    }
+
     return config;
 }
 
+std::vector<PostProcessPass> postProcessPasses(const Config& config)
+{
+    // The bloom effect works on the rendered radiance, so it runs before e.g. tone mapping
+    std::vector<PostProcessPass> passes = bloomPostProcessPasses(config.features.extra);
+    passes.insert(std::end(passes), std::begin(config.postProcess), std::end(config.postProcess));
+    return passes;
+}
+
 std::string serialize(const SceneType& sceneType)
 {
     switch (sceneType) {
@@ -448,4 +595,37 @@ std::optional<SceneType> deserialize(const std::string& sceneTypeStr)
     } else {
         return std::nullopt;
     }
+}
+
+std::string serialize(const SamplerType& samplerType)
+{
+    switch (samplerType) {
+    case SamplerType::Independent:
+        return "independent";
+    case SamplerType::Sobol:
+        return "sobol";
+    case SamplerType::Halton:
+        return "halton";
+    case SamplerType::BlueNoise:
+        return "blue_noise";
+    default:
+        return "unknown";
+    }
+}
+
+std::optional<SamplerType> deserializeSamplerType(const std::string& samplerTypeStr)
+{
+    std::string lowered;
+    std::transform(std::begin(samplerTypeStr), std::end(samplerTypeStr), std::back_inserter(lowered), [](const char c) { return (char)::tolower(c); });
+    if (lowered == "independent") {
+        return SamplerType::Independent;
+    } else if (lowered == "sobol") {
+        return SamplerType::Sobol;
+    } else if (lowered == "halton") {
+        return SamplerType::Halton;
+    } else if (lowered == "blue_noise" || lowered == "bluenoise" || lowered == "blue-noise") {
+        return SamplerType::BlueNoise;
+    } else {
+        return std::nullopt;
+    }
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 #include "common.h"
+#include "postprocess.h"
 #include "scene.h"
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
@@ -32,11 +33,20 @@ struct Config {
     std::filesystem::path outputDir = "";
     std::vector<CameraConfig> cameras;
     std::vector<std::variant<PointLight, SegmentLight, ParallelogramLight>> lights;
+    std::vector<PostProcessPass> postProcess; // Applied in order to every rendered image
+    std::optional<TextureCacheConfig> textureCache; // If set, textures are streamed through a texture cache
+    std::optional<GeometryCacheConfig> geometryCache; // If set, mesh triangles are streamed through a geometry cache
+    std::vector<std::filesystem::path> environmentMap; // A cube cross or six faces; if empty, the scene's default is kept
+    std::optional<std::filesystem::path> meshCacheDirectory; // If set, where parsed meshes are cached; an empty path disables the cache
 };
 
 std::ostream& operator<<(std::ostream& arg, const Config& config);
 
 Config readConfigFile(const std::filesystem::path& config_path);
+// The post-processing passes of the config; the bloom effect of its features, then the passes in `postProcess`
+std::vector<PostProcessPass> postProcessPasses(const Config& config);
 
 std::string serialize(const SceneType& sceneType);
-std::optional<SceneType> deserialize(const std::string& lowered);
\ No newline at end of file
+std::optional<SceneType> deserialize(const std::string& lowered);
+std::string serialize(const SamplerType& samplerType);
+std::optional<SamplerType> deserializeSamplerType(const std::string& samplerTypeStr);
\ No newline at end of file
@@ -0,0 +1,199 @@
+#include "denoise.h"
+#include "common.h"
+#include "postprocess.h"
+#include "screen.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/vector_relational.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <span>
+
+// Side length of the square tiles that the filter passes sweep over
+static constexpr int DenoiseTileSize = 64;
+
+// Sharpness of the edge-stopping functions; see `denoiseImage()`
+static constexpr int NormalPower = 128; // Normal weight is dot(n_p, n_q)^NormalPower
+static constexpr float DepthSigma = 1.0f; // In units of the expected depth difference along the depth gradient
+static constexpr float RelativeDepthEpsilon = 1e-3f; // Depth tolerance on surfaces facing the camera, relative to the depth
+static constexpr float LuminanceEpsilon = 1e-4f;
+
+// Albedo channels below this are not divided out of the image, as there is no signal to recover
+static constexpr float MinDemodulationAlbedo = 1e-3f;
+
+// Weights of the 1D B3-spline a-trous kernel [1/16, 1/4, 3/8, 1/4, 1/16], indexed by distance to the center
+static constexpr std::array<float, 3> AtrousKernel { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+// Weights of the 1D Gaussian [1/4, 1/2, 1/4] that smooths the variance before it guides a pass
+static constexpr std::array<float, 2> VarianceKernel { 1.0f / 2.0f, 1.0f / 4.0f };
+
+AOVBuffers::AOVBuffers(glm::ivec2 imageResolution)
+    : resolution(imageResolution)
+    , albedo(size_t(imageResolution.x * imageResolution.y), glm::vec3(0.0f))
+    , normal(size_t(imageResolution.x * imageResolution.y), glm::vec3(0.0f))
+    , depth(size_t(imageResolution.x * imageResolution.y), 0.0f)
+    , variance(size_t(imageResolution.x * imageResolution.y), 0.0f)
+{
+}
+
+// Call `f(x, y, index)` for every pixel, multithreaded over tiles in Release mode
+template <typename F>
+static void forEachPixel(glm::ivec2 resolution, F&& f)
+{
+    const glm::ivec2 numTiles = (resolution + DenoiseTileSize - 1) / DenoiseTileSize;
+#ifdef NDEBUG // Enable multi threading in Release mode
+#pragma omp parallel for schedule(static)
+#endif
+    for (int tile = 0; tile < numTiles.x * numTiles.y; tile++) {
+        const glm::ivec2 tileBegin = glm::ivec2(tile % numTiles.x, tile / numTiles.x) * DenoiseTileSize;
+        const glm::ivec2 tileEnd = glm::min(tileBegin + DenoiseTileSize, resolution);
+        for (int y = tileBegin.y; y < tileEnd.y; y++) {
+            for (int x = tileBegin.x; x < tileEnd.x; x++)
+                f(x, y, size_t(y) * size_t(resolution.x) + size_t(x));
+        }
+    }
+}
+
+static glm::vec3 demodulationAlbedo(const glm::vec3& albedo)
+{
+    return glm::mix(glm::vec3(1.0f), albedo, glm::greaterThan(albedo, glm::vec3(MinDemodulationAlbedo)));
+}
+
+// Similarity of pixel q to pixel p, at an offset of `offset` pixels, by normal and depth; the depth weight is
+// an exponent, s.t. it can share an exponential with the luminance weight
+struct GeometryWeight {
+    float normal;
+    float depthExponent;
+};
+static GeometryWeight geometryWeight(const AOVBuffers& aovs, std::span<const glm::vec2> depthGradients, size_t p, size_t q, glm::ivec2 offset)
+{
+    float normalWeight = std::max(glm::dot(aovs.normal[p], aovs.normal[q]), 0.0f);
+    for (int power = 1; power < NormalPower; power *= 2)
+        normalWeight *= normalWeight;
+    // Neighbours on the same surface differ in depth by about the depth gradient times their offset
+    const float expectedDepthDifference = glm::dot(depthGradients[p], glm::abs(glm::vec2(offset))) + RelativeDepthEpsilon * aovs.depth[p];
+    return { normalWeight, std::abs(aovs.depth[p] - aovs.depth[q]) / (DepthSigma * expectedDepthDifference) };
+}
+
+void denoiseImage(const Features& features, const AOVBuffers& aovs, Screen& image)
+{
+    const glm::ivec2 resolution = aovs.resolution;
+    const size_t numPixels = aovs.depth.size();
+    const auto isHit = [&](size_t i) { return aovs.depth[i] > 0.0f; };
+    const auto inside = [&](glm::ivec2 pixel) { return glm::all(glm::greaterThanEqual(pixel, glm::ivec2(0))) && glm::all(glm::lessThan(pixel, resolution)); };
+    const auto indexOf = [&](glm::ivec2 pixel) { return size_t(pixel.y) * size_t(resolution.x) + size_t(pixel.x); };
+
+    // Divide the albedo out of the image; only hits are filtered
+    std::vector<glm::vec3> irradiance(numPixels), filteredIrradiance(numPixels);
+    std::vector<float> variance = aovs.variance, filteredVariance(numPixels);
+    const std::vector<glm::vec3>& pixels = image.pixels();
+    forEachPixel(resolution, [&](int, int, size_t i) {
+        irradiance[i] = pixels[i] / demodulationAlbedo(aovs.albedo[i]);
+        if (variance[i] > 0.0f) {
+            const float albedoLuminance = perceivedLuminance(demodulationAlbedo(aovs.albedo[i]));
+            variance[i] /= albedoLuminance * albedoLuminance;
+        }
+    });
+
+    // Screen space depth gradients, from the smaller one-sided difference to a hit neighbour, s.t. they do
+    // not grow across depth discontinuities
+    std::vector<glm::vec2> depthGradients(numPixels, glm::vec2(0.0f));
+    forEachPixel(resolution, [&](int x, int y, size_t i) {
+        if (!isHit(i))
+            return;
+        for (int axis = 0; axis < 2; axis++) {
+            float gradient = std::numeric_limits<float>::max();
+            for (int direction : { -1, 1 }) {
+                glm::ivec2 neighbour { x, y };
+                neighbour[axis] += direction;
+                if (inside(neighbour) && isHit(indexOf(neighbour)))
+                    gradient = std::min(gradient, std::abs(aovs.depth[indexOf(neighbour)] - aovs.depth[i]));
+            }
+            depthGradients[i][axis] = gradient == std::numeric_limits<float>::max() ? 0.0f : gradient;
+        }
+    });
+
+    // Pixels rendered from one sample have no variance of their own; estimate it from similar neighbours
+    forEachPixel(resolution, [&](int x, int y, size_t i) {
+        if (!isHit(i) || aovs.variance[i] >= 0.0f)
+            return;
+        float sumWeights = 0.0f, sumLuminance = 0.0f, sumSquaredLuminance = 0.0f;
+        for (int dy = -2; dy <= 2; dy++) {
+            for (int dx = -2; dx <= 2; dx++) {
+                const glm::ivec2 neighbour { x + dx, y + dy };
+                if (!inside(neighbour) || !isHit(indexOf(neighbour)))
+                    continue;
+                const size_t j = indexOf(neighbour);
+                const GeometryWeight geometry = geometryWeight(aovs, depthGradients, i, j, { dx, dy });
+                const float weight = geometry.normal * std::exp(-geometry.depthExponent);
+                const float luminance = perceivedLuminance(irradiance[j]);
+                sumWeights += weight;
+                sumLuminance += weight * luminance;
+                sumSquaredLuminance += weight * luminance * luminance;
+            }
+        }
+        const float mean = sumLuminance / sumWeights;
+        variance[i] = std::max(sumSquaredLuminance / sumWeights - mean * mean, 0.0f);
+    });
+
+    for (int iteration = 0; iteration < features.extra.denoiseIterations; iteration++) {
+        const int step = 1 << iteration;
+        forEachPixel(resolution, [&](int x, int y, size_t i) {
+            if (!isHit(i)) {
+                filteredIrradiance[i] = irradiance[i];
+                filteredVariance[i] = variance[i];
+                return;
+            }
+
+            // Luminance differences are measured relative to the standard deviation of the center pixel,
+            // smoothed to be robust against outliers
+            float sumVarianceWeights = 0.0f, smoothedVariance = 0.0f;
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    const glm::ivec2 neighbour { x + dx, y + dy };
+                    if (!inside(neighbour) || !isHit(indexOf(neighbour)))
+                        continue;
+                    const float weight = VarianceKernel[size_t(std::abs(dx))] * VarianceKernel[size_t(std::abs(dy))];
+                    sumVarianceWeights += weight;
+                    smoothedVariance += weight * variance[indexOf(neighbour)];
+                }
+            }
+            const float luminanceScale = 1.0f / (features.extra.denoiseColorSigma * std::sqrt(smoothedVariance / sumVarianceWeights) + LuminanceEpsilon);
+            const float centerLuminance = perceivedLuminance(irradiance[i]);
+
+            glm::vec3 sumIrradiance { 0.0f };
+            float sumWeights = 0.0f, sumVariance = 0.0f;
+            for (int dy = -2; dy <= 2; dy++) {
+                for (int dx = -2; dx <= 2; dx++) {
+                    const glm::ivec2 offset = glm::ivec2(dx, dy) * step;
+                    const glm::ivec2 neighbour = glm::ivec2(x, y) + offset;
+                    if (!inside(neighbour) || !isHit(indexOf(neighbour)))
+                        continue;
+                    const size_t j = indexOf(neighbour);
+                    const GeometryWeight geometry = geometryWeight(aovs, depthGradients, i, j, offset);
+                    const float luminanceExponent = std::abs(centerLuminance - perceivedLuminance(irradiance[j])) * luminanceScale;
+                    const float weight = AtrousKernel[size_t(std::abs(dx))] * AtrousKernel[size_t(std::abs(dy))]
+                        * geometry.normal * std::exp(-geometry.depthExponent - luminanceExponent);
+                    sumIrradiance += weight * irradiance[j];
+                    sumWeights += weight;
+                    sumVariance += weight * weight * variance[j];
+                }
+            }
+            filteredIrradiance[i] = sumIrradiance / sumWeights;
+            filteredVariance[i] = sumVariance / (sumWeights * sumWeights);
+        });
+        std::swap(irradiance, filteredIrradiance);
+        std::swap(variance, filteredVariance);
+    }
+
+    // Multiply the albedo back in
+    std::vector<glm::vec3>& output = image.pixels();
+    forEachPixel(resolution, [&](int, int, size_t i) {
+        if (isHit(i))
+            output[i] = irradiance[i] * demodulationAlbedo(aovs.albedo[i]);
+    });
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "fwd.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <vector>
+
+// Auxiliary buffers of a rendered image (AOVs), stored in the same pixel order as `Screen::pixels()`.
+// The first-hit quantities are averaged over the camera rays of a pixel that hit the scene.
+struct AOVBuffers {
+    explicit AOVBuffers(glm::ivec2 imageResolution);
+
+    glm::ivec2 resolution;
+    std::vector<glm::vec3> albedo; // Diffuse albedo of the first hit, as given by `sampleMaterialKd()`
+    std::vector<glm::vec3> normal; // Shading normal of the first hit; zero where all camera rays missed
+    std::vector<float> depth; // Distance along the camera rays to the first hit; zero where all camera rays missed
+    std::vector<float> variance; // Variance of the pixel's luminance estimate; negative if it was estimated from one sample
+};
+
+// Edge-avoiding a-trous wavelet denoiser, after "Spatiotemporal Variance-Guided Filtering" (Schied et al. 2017),
+// without the temporal part. The image is divided by the albedo, s.t. texture detail is not blurred, and then
+// filtered by `features.extra.denoiseIterations` 5x5 passes of doubling step size. Taps are weighed by the
+// similarity of their normal and depth to the center pixel's, and of their luminance relative to the center
+// pixel's standard deviation; pixels that were estimated from one sample get a spatial variance estimate first.
+// Passes are multithreaded in Release mode, over tiles of the image.
+void denoiseImage(const Features& features, const AOVBuffers& aovs, Screen& image);
@@ -21,9 +21,19 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/mat4x4.hpp>
 DISABLE_WARNINGS_POP()
 #include <algorithm>
+#include <array>
+#include <cstddef>
 
 bool enableDebugDraw = false;
 
+// Overlay geometry recorded since the last `flushOverlays()`
+struct OverlayVertex {
+    glm::vec3 position;
+    glm::vec4 color;
+};
+static std::vector<OverlayVertex> overlayTriangles;
+static std::vector<OverlayVertex> overlayLines;
+
 static void setMaterial(const Material& material)
 {
     // Set the material color of the shape.
@@ -58,15 +68,8 @@ void drawTriangle (const Vertex& v0, const Vertex& v1, const Vertex& v2 ) {
 
 void drawTriangle(const Vertex& v0, const Vertex& v1, const Vertex& v2, const glm::vec3& color)
 {
-    glBegin(GL_TRIANGLES);
-    glColor3f(color.r, color.y, color.z);
-    glNormal3fv(glm::value_ptr(v0.normal));
-    glVertex3fv(glm::value_ptr(v0.position));
-    glNormal3fv(glm::value_ptr(v1.normal));
-    glVertex3fv(glm::value_ptr(v1.position));
-    glNormal3fv(glm::value_ptr(v2.normal));
-    glVertex3fv(glm::value_ptr(v2.position));
-    glEnd();
+    for (const Vertex* vertex : { &v0, &v1, &v2 })
+        overlayTriangles.push_back({ vertex->position, glm::vec4(color, 1.0f) });
 }
 
 void drawMesh(const Mesh& mesh)
@@ -114,70 +117,70 @@ void drawSphere(const glm::vec3& center, float radius, const glm::vec3& color /*
     glPopAttrib();
 }
 
-static void drawAABBInternal(const AxisAlignedBox& box)
+void drawAABB(const AxisAlignedBox& box, DrawMode drawMode, const glm::vec3& color, float transparency)
 {
-    glPushMatrix();
-
     // front      back
     // 3 ----- 2  7 ----- 6
     // |       |  |       |
     // |       |  |       |
     // 0 ------1  4 ------5
-
-    glBegin(GL_QUADS);
-    glNormal3f(0, 0, -1);
-    glVertex3f(box.lower.x, box.upper.y, box.lower.z); //3
-    glVertex3f(box.upper.x, box.upper.y, box.lower.z); //2
-    glVertex3f(box.upper.x, box.lower.y, box.lower.z); //1
-    glVertex3f(box.lower.x, box.lower.y, box.lower.z); //0
-
-    glNormal3f(0, 0, 1);
-    glVertex3f(box.upper.x, box.lower.y, box.upper.z); //5
-    glVertex3f(box.upper.x, box.upper.y, box.upper.z); //6
-    glVertex3f(box.lower.x, box.upper.y, box.upper.z); //7
-    glVertex3f(box.lower.x, box.lower.y, box.upper.z); //4
-
-    glNormal3f(1, 0, 0);
-    glVertex3f(box.upper.x, box.upper.y, box.lower.z); //2
-    glVertex3f(box.upper.x, box.upper.y, box.upper.z); //6
-    glVertex3f(box.upper.x, box.lower.y, box.upper.z); //5
-    glVertex3f(box.upper.x, box.lower.y, box.lower.z); //1
-
-    glNormal3f(-1, 0, 0);
-    glVertex3f(box.lower.x, box.lower.y, box.upper.z); //4
-    glVertex3f(box.lower.x, box.upper.y, box.upper.z); //7
-    glVertex3f(box.lower.x, box.upper.y, box.lower.z); //3
-    glVertex3f(box.lower.x, box.lower.y, box.lower.z); //0
-
-    glNormal3f(0, 1, 0);
-    glVertex3f(box.lower.x, box.upper.y, box.upper.z); //7
-    glVertex3f(box.upper.x, box.upper.y, box.upper.z); //6
-    glVertex3f(box.upper.x, box.upper.y, box.lower.z); //2
-    glVertex3f(box.lower.x, box.upper.y, box.lower.z); //3
-
-    glNormal3f(0, -1, 0);
-    glVertex3f(box.upper.x, box.lower.y, box.lower.z); //1
-    glVertex3f(box.upper.x, box.lower.y, box.upper.z); //5
-    glVertex3f(box.lower.x, box.lower.y, box.upper.z); //4
-    glVertex3f(box.lower.x, box.lower.y, box.lower.z); //0
-    glEnd();
-
-    glPopMatrix();
+    const std::array<glm::vec3, 8> corners {
+        glm::vec3(box.lower.x, box.lower.y, box.lower.z), glm::vec3(box.upper.x, box.lower.y, box.lower.z),
+        glm::vec3(box.upper.x, box.upper.y, box.lower.z), glm::vec3(box.lower.x, box.upper.y, box.lower.z),
+        glm::vec3(box.lower.x, box.lower.y, box.upper.z), glm::vec3(box.upper.x, box.lower.y, box.upper.z),
+        glm::vec3(box.upper.x, box.upper.y, box.upper.z), glm::vec3(box.lower.x, box.upper.y, box.upper.z)
+    };
+    const glm::vec4 color4 { color, transparency };
+    if (drawMode == DrawMode::Filled) {
+        constexpr std::array<glm::ivec4, 6> faces { glm::ivec4(3, 2, 1, 0), glm::ivec4(5, 6, 7, 4), glm::ivec4(2, 6, 5, 1),
+            glm::ivec4(4, 7, 3, 0), glm::ivec4(7, 6, 2, 3), glm::ivec4(1, 5, 4, 0) };
+        for (const glm::ivec4& face : faces) {
+            for (int i : { 0, 1, 2, 0, 2, 3 })
+                overlayTriangles.push_back({ corners[size_t(face[i])], color4 });
+        }
+    } else {
+        constexpr std::array<glm::ivec2, 12> edges { glm::ivec2(0, 1), glm::ivec2(1, 2), glm::ivec2(2, 3), glm::ivec2(3, 0),
+            glm::ivec2(4, 5), glm::ivec2(5, 6), glm::ivec2(6, 7), glm::ivec2(7, 4),
+            glm::ivec2(0, 4), glm::ivec2(1, 5), glm::ivec2(2, 6), glm::ivec2(3, 7) };
+        for (const glm::ivec2& edge : edges) {
+            overlayLines.push_back({ corners[size_t(edge.x)], color4 });
+            overlayLines.push_back({ corners[size_t(edge.y)], color4 });
+        }
+    }
 }
 
-void drawAABB(const AxisAlignedBox& box, DrawMode drawMode, const glm::vec3& color, float transparency)
+void flushOverlays()
 {
+    if (overlayTriangles.empty() && overlayLines.empty())
+        return;
+
+    // Upload the triangles and lines together, triangles first
+    static GLuint overlayBuffer = 0;
+    if (overlayBuffer == 0)
+        glGenBuffers(1, &overlayBuffer);
+    const auto numTriangleVertices = GLsizei(overlayTriangles.size());
+    const auto numLineVertices = GLsizei(overlayLines.size());
+    overlayTriangles.insert(std::end(overlayTriangles), std::begin(overlayLines), std::end(overlayLines));
+    glBindBuffer(GL_ARRAY_BUFFER, overlayBuffer);
+    glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(overlayTriangles.size() * sizeof(OverlayVertex)), overlayTriangles.data(), GL_STREAM_DRAW);
+
     glPushAttrib(GL_ALL_ATTRIB_BITS);
-    glColor4f(color.r, color.g, color.b, transparency);
-    if (drawMode == DrawMode::Filled) {
-        glPolygonMode(GL_FRONT, GL_FILL);
-        glPolygonMode(GL_BACK, GL_FILL);
-    } else {
-        glPolygonMode(GL_FRONT, GL_LINE);
-        glPolygonMode(GL_BACK, GL_LINE);
-    }
-    drawAABBInternal(box);
+    glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+    glDisable(GL_LIGHTING);
+    glPolygonMode(GL_FRONT, GL_FILL);
+    glPolygonMode(GL_BACK, GL_FILL);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(OverlayVertex), reinterpret_cast<const void*>(offsetof(OverlayVertex, position)));
+    glColorPointer(4, GL_FLOAT, sizeof(OverlayVertex), reinterpret_cast<const void*>(offsetof(OverlayVertex, color)));
+    glDrawArrays(GL_TRIANGLES, 0, numTriangleVertices);
+    glDrawArrays(GL_LINES, numTriangleVertices, numLineVertices);
+    glPopClientAttrib();
     glPopAttrib();
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    overlayTriangles.clear();
+    overlayLines.clear();
 }
 
 void drawScene(const Scene& scene)
@@ -196,18 +199,33 @@ void drawRay(const Ray& ray, const glm::vec3& color)
     const glm::vec3 hitPoint = ray.origin + std::clamp(ray.t, 0.0f, 100.0f) * ray.direction;
     const bool hit = (ray.t < std::numeric_limits<float>::max());
 
-    glPushAttrib(GL_ALL_ATTRIB_BITS);
-    glDisable(GL_LIGHTING);
-    glBegin(GL_LINES);
-
-    glColor3fv(glm::value_ptr(color));
-    glVertex3fv(glm::value_ptr(ray.origin));
-    glColor3fv(glm::value_ptr(color));
-    glVertex3fv(glm::value_ptr(hitPoint));
-    glEnd();
-
+    overlayLines.push_back({ ray.origin, glm::vec4(color, 1.0f) });
+    overlayLines.push_back({ hitPoint, glm::vec4(color, 1.0f) });
     if (hit)
         drawSphere(hitPoint, 0.005f, color);
+}
 
-    glPopAttrib();
+void DebugRecording::recordRay(const Ray& ray, const glm::vec3& color)
+{
+    rays.push_back({ ray, color });
+}
+
+void DebugRecording::recordSphere(const glm::vec3& center, float radius, const glm::vec3& color)
+{
+    spheres.push_back({ center, radius, color });
+}
+
+void DebugRecording::clear()
+{
+    rays.clear();
+    spheres.clear();
+}
+
+void DebugRecording::draw() const
+{
+    for (const auto& [ray, color] : rays)
+        drawRay(ray, color);
+    for (const auto& [center, radius, color] : spheres)
+        drawSphere(center, radius, color);
+    flushOverlays();
 }
@@ -3,6 +3,7 @@
 #include <framework/mesh.h>
 #include <framework/ray.h>
 #include <utility> // std::forward
+#include <vector>
 
 // Flag to enable/disable the debug drawing.
 extern bool enableDebugDraw;
@@ -17,14 +18,42 @@ extern bool enableDebugDraw;
 //
 void drawExampleOfCustomVisualDebug();
 
+// Rays, boxes, and colored triangles are overlays: they are collected, and drawn unlit in one batch by
+// `flushOverlays()`, which has to be called before the frame ends.
 void drawRay(const Ray& ray, const glm::vec3& color = glm::vec3(1.0f));
 
 void drawAABB(const AxisAlignedBox& box, DrawMode drawMode = DrawMode::Filled, const glm::vec3& color = glm::vec3(1.0f), float transparency = 1.0f);
 
 void drawTriangle (const Vertex& v0, const Vertex& v1, const Vertex& v2 );
 void drawTriangle(const Vertex& v0, const Vertex& v1, const Vertex& v2, const glm::vec3& color);
+void flushOverlays();
 void drawMesh(const Mesh& mesh);
 void drawSphere(const Sphere& sphere);
 void drawSphere(const glm::vec3& center, float radius, const glm::vec3& color = glm::vec3(1.0f));
 void drawScene(const Scene& scene);
 
+// Debug geometry recorded while tracing the interactive debug ray. The render kernels never draw
+// directly; only the debug kernel (`kernel::DebugDraw`) records into this, and the recording is
+// drawn afterwards from the render loop with `draw()`.
+struct DebugRecording {
+    struct RecordedRay {
+        Ray ray;
+        glm::vec3 color;
+    };
+    struct RecordedSphere {
+        glm::vec3 center;
+        float radius;
+        glm::vec3 color;
+    };
+
+    std::vector<RecordedRay> rays;
+    std::vector<RecordedSphere> spheres;
+
+    void recordRay(const Ray& ray, const glm::vec3& color = glm::vec3(1.0f));
+    void recordSphere(const glm::vec3& center, float radius, const glm::vec3& color = glm::vec3(1.0f));
+    void clear();
+
+    // Draw the recorded geometry; like the other draw functions, this respects `enableDebugDraw`
+    void draw() const;
+};
+
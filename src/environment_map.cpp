@@ -0,0 +1,228 @@
+#include "environment_map.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+#include <glm/gtc/constants.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/image.h>
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#ifdef NDEBUG
+#include <omp.h>
+#endif
+
+// Number of directions averaged for every texel of a prefiltered face
+static constexpr int NumPrefilterSamples = 64;
+
+EnvironmentMap::FaceCoordinates EnvironmentMap::faceCoordinates(const glm::vec3& direction)
+{
+    // Concept + reason for choosing a cube map over a sphere map:
+    // Marschner, S.; Shirley, P. Fundamentals of Computer Graphics, Fourth.; CRC Press, Taylor & Francis Group: Boca Raton, FL, 2015, chapter 11.4.5
+    float x = std::fabs(direction.x), y = std::fabs(direction.y), z = std::fabs(direction.z);
+    float maxComponent = std::max(x, std::max(y, z));
+    glm::vec3 r = direction / maxComponent; // [-1, 1]
+    glm::vec3 coords = (r + glm::vec3(1.0f)) / 2.0f; // [0, 1]
+
+    // +- 1 => choose face
+    // take other 2 coords and sample from face
+    // Source: McGill University Slides - https://www.cim.mcgill.ca/~langer/557/18-slides.pdf
+    float one = 1.0f - FLT_EPSILON;
+
+    // Faces are stored as they appear when the cube is unfolded into a cross (see data/cube2.jpg), so
+    // some 'coords' components need to be flipped (some faces are inverted)
+    if (r.x > one)
+        return { CubeFace::PositiveX, { coords.z, coords.y } };
+    if (r.x < -one)
+        return { CubeFace::NegativeX, { 1 - coords.z, coords.y } };
+    if (r.y > one)
+        return { CubeFace::PositiveY, { coords.x, coords.z } };
+    if (r.y < -one)
+        return { CubeFace::NegativeY, { coords.x, 1 - coords.z } };
+    if (r.z < -one)
+        return { CubeFace::NegativeZ, { coords.x, coords.y } };
+    return { CubeFace::PositiveZ, { 1 - coords.x, coords.y } };
+}
+
+glm::vec3 EnvironmentMap::faceDirection(CubeFace face, const glm::vec2& texCoord)
+{
+    const glm::vec2 c = 2.0f * texCoord - 1.0f; // [-1, 1]
+    switch (face) {
+    case CubeFace::PositiveX:
+        return { 1.0f, c.y, c.x };
+    case CubeFace::NegativeX:
+        return { -1.0f, c.y, -c.x };
+    case CubeFace::PositiveY:
+        return { c.x, 1.0f, c.y };
+    case CubeFace::NegativeY:
+        return { c.x, -1.0f, -c.y };
+    case CubeFace::PositiveZ:
+        return { -c.x, c.y, 1.0f };
+    case CubeFace::NegativeZ:
+    default:
+        return { c.x, c.y, -1.0f };
+    }
+}
+
+std::shared_ptr<const EnvironmentMap> EnvironmentMap::get(const std::vector<std::filesystem::path>& files)
+{
+    // Maps are only referenced weakly here, s.t. a map is freed once no scene uses it anymore
+    static std::mutex mutex;
+    static std::unordered_map<std::string, std::weak_ptr<const EnvironmentMap>> maps;
+
+    std::string key;
+    for (const std::filesystem::path& file : files)
+        key += std::filesystem::absolute(file).lexically_normal().string() + "|";
+
+    std::scoped_lock lock { mutex };
+    std::weak_ptr<const EnvironmentMap>& entry = maps[key];
+    std::shared_ptr<const EnvironmentMap> map = entry.lock();
+    if (!map) {
+        map = std::make_shared<const EnvironmentMap>(files);
+        entry = map;
+    }
+    return map;
+}
+
+EnvironmentMap::EnvironmentMap(std::vector<std::filesystem::path> files)
+    : m_files(std::move(files))
+{
+}
+
+const std::vector<Texture>& EnvironmentMap::faces() const
+{
+    std::call_once(m_loadFlag, [this]() { load(); });
+    return m_faces;
+}
+
+void EnvironmentMap::load() const
+{
+    // Faces are read from the image they are found in, in the order of `CubeFace`
+    std::vector<Image> faceImages;
+    try {
+        if (m_files.size() == 1) {
+            const Image cross { m_files[0] };
+            const int faceSize = cross.width / 4;
+            if (faceSize == 0 || cross.width != faceSize * 4 || cross.height != faceSize * 3) {
+                std::cerr << "Environment map " << m_files[0] << " is not a 4x3 cube cross" << std::endl;
+                return;
+            }
+
+            // Position of every face in the cross, in faces, with rows from the top
+            constexpr std::array<glm::ivec2, 6> crossPositions { glm::ivec2(2, 1), glm::ivec2(0, 1), glm::ivec2(1, 0), glm::ivec2(1, 2), glm::ivec2(3, 1), glm::ivec2(1, 1) };
+            for (const glm::ivec2& position : crossPositions) {
+                Image& face = faceImages.emplace_back(faceSize, faceSize);
+                for (int y = 0; y < faceSize; y++) {
+                    const glm::vec3* row = &cross.pixels[size_t(position.y * faceSize + y) * size_t(cross.width) + size_t(position.x * faceSize)];
+                    std::copy_n(row, faceSize, &face.pixels[size_t(y) * size_t(faceSize)]);
+                }
+            }
+        } else if (m_files.size() == 6) {
+            for (const std::filesystem::path& file : m_files) {
+                const Image& face = faceImages.emplace_back(file);
+                if (face.width != face.height || face.width != faceImages[0].width) {
+                    std::cerr << "Environment map face " << file << " is not square, or differs in size from the other faces" << std::endl;
+                    return;
+                }
+            }
+        } else {
+            std::cerr << "An environment map needs either one cube cross or six faces, got " << m_files.size() << " files" << std::endl;
+            return;
+        }
+    } catch (const std::exception&) {
+        // `Image` has already reported the error; render without the environment map
+        return;
+    }
+
+    m_faces.reserve(faceImages.size());
+    for (const Image& face : faceImages)
+        m_faces.emplace_back(face);
+}
+
+glm::vec3 EnvironmentMap::sampleTrilinear(const glm::vec3& direction, float lod) const
+{
+    const auto [face, texCoord] = faceCoordinates(direction);
+    return m_faces[size_t(face)].sampleTrilinear(texCoord, lod);
+}
+
+void EnvironmentMap::prefilter() const
+{
+    // Glossy lobes spread directions uniformly over a disk in the plane orthogonal to the reflected
+    // direction (see `renderRayGlossyComponent()`), so every texel averages the map over such a disk,
+    // with directions placed on a Fibonacci spiral. Each direction is looked up with a footprint of the
+    // spacing between directions, s.t. together they cover the disk without gaps.
+    const std::vector<Texture>& baseFaces = faces();
+    if (baseFaces.empty())
+        return;
+    const float baseTexelAngle = glm::half_pi<float>() / float(baseFaces[0].width());
+
+    std::array<glm::vec2, NumPrefilterSamples> disk;
+    for (int i = 0; i < NumPrefilterSamples; i++) {
+        const float radius = std::sqrt((float(i) + 0.5f) / float(NumPrefilterSamples));
+        const float angle = float(i) * glm::pi<float>() * (3.0f - std::sqrt(5.0f));
+        disk[size_t(i)] = radius * glm::vec2(std::cos(angle), std::sin(angle));
+    }
+
+    m_prefilteredFaces.resize(NumPrefilteredLevels);
+    for (int level = 0; level < NumPrefilteredLevels; level++) {
+        const float coneAngle = PrefilteredBaseAngle * float(1 << level);
+        const float diskRadius = std::tan(coneAngle);
+        const float lod = std::log2(diskRadius * std::sqrt(glm::pi<float>() / float(NumPrefilterSamples)) / baseTexelAngle);
+        // Three texels per cone angle; the filter is smooth, so this loses little
+        const int resolution = std::min(baseFaces[0].width(), int(std::ceil(3.0f * glm::half_pi<float>() / coneAngle)));
+
+        for (int face = 0; face < 6; face++) {
+            Image image { resolution, resolution };
+#ifdef NDEBUG // Enable multi threading in Release mode
+#pragma omp parallel for schedule(static)
+#endif
+            for (int y = 0; y < resolution; y++) {
+                for (int x = 0; x < resolution; x++) {
+                    const glm::vec2 texCoord = (glm::vec2(x, y) + 0.5f) / float(resolution);
+                    const glm::vec3 direction = glm::normalize(faceDirection(CubeFace(face), texCoord));
+                    // Orthonormal basis around the direction
+                    const glm::vec3 helper = std::fabs(direction.x) > 0.5f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+                    const glm::vec3 tangent = glm::normalize(glm::cross(helper, direction));
+                    const glm::vec3 bitangent = glm::cross(direction, tangent);
+
+                    glm::vec3 sum { 0.0f };
+                    for (const glm::vec2& point : disk)
+                        sum += sampleTrilinear(direction + diskRadius * (point.x * tangent + point.y * bitangent), lod);
+                    // Rows of an `Image` are top-down
+                    image.pixels[size_t(resolution - y - 1) * size_t(resolution) + size_t(x)] = sum / float(NumPrefilterSamples);
+                }
+            }
+            m_prefilteredFaces[size_t(level)].emplace_back(image, TextureFormat::Unorm8, MipmapFilter::None);
+        }
+    }
+}
+
+glm::vec3 EnvironmentMap::sampleCone(const glm::vec3& direction, float coneAngle) const
+{
+    const std::vector<Texture>& baseFaces = faces();
+    if (baseFaces.empty())
+        return glm::vec3(0.0f);
+
+    // Cones narrower than the first prefiltered level are approximated by the mip levels of the faces. A
+    // footprint of the disk's radius, rather than its diameter, matched the lobe best, as the lobe's
+    // weight is spread over the whole disk instead of concentrated in its center like a mip level's
+    if (coneAngle <= PrefilteredBaseAngle) {
+        const float texelAngle = glm::half_pi<float>() / float(baseFaces[0].width());
+        return sampleTrilinear(direction, std::log2(std::tan(coneAngle) / texelAngle));
+    }
+
+    std::call_once(m_prefilterFlag, [this]() { prefilter(); });
+    const auto [face, texCoord] = faceCoordinates(direction);
+    // Interpolate between the two prefiltered levels around the cone angle
+    const float level = std::min(std::log2(coneAngle / PrefilteredBaseAngle), float(NumPrefilteredLevels - 1));
+    const int level0 = int(level);
+    const int level1 = std::min(level0 + 1, NumPrefilteredLevels - 1);
+    const glm::vec3 sample0 = m_prefilteredFaces[size_t(level0)][size_t(face)].sampleBilinear(texCoord);
+    const glm::vec3 sample1 = m_prefilteredFaces[size_t(level1)][size_t(face)].sampleBilinear(texCoord);
+    return glm::mix(sample0, sample1, level - float(level0));
+}
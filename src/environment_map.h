@@ -0,0 +1,83 @@
+#pragma once
+#include "texture.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Faces of a cube map, in the order of `EnvironmentMap::faces()`.
+enum class CubeFace {
+    PositiveX, // right
+    NegativeX, // left
+    PositiveY, // up
+    NegativeY, // down
+    PositiveZ, // back
+    NegativeZ, // front
+};
+
+// Cube map environment, shared between all scenes that use the same files and loaded on first use.
+//
+// The map is read from either a single image with the faces laid out in a 4x3 cross (see data/cube2.jpg):
+//
+//            UP
+//     LEFT FRONT RIGHT BACK
+//           DOWN
+//
+// or from six images, one per face in the order of `CubeFace`, each oriented as it appears in the cross.
+// Either way, only the six faces are kept, as square textures; the empty half of a cross is dropped.
+//
+// For glossy reflections, the map can also be looked up over a cone of directions. Wide cones read from
+// copies of the faces that are prefiltered for a fixed set of cone angles, computed on first use.
+class EnvironmentMap {
+public:
+    struct FaceCoordinates {
+        CubeFace face;
+        glm::vec2 texCoord;
+    };
+    // Return the face that `direction` points at, and the texture coordinates on that face.
+    static FaceCoordinates faceCoordinates(const glm::vec3& direction);
+    // Inverse of `faceCoordinates()`; the returned direction is not normalized.
+    static glm::vec3 faceDirection(CubeFace face, const glm::vec2& texCoord);
+
+    // Return the environment map stored in `files` (one cross or six faces), without reading them. Maps are
+    // shared: as long as a map is in use, asking for the same files returns the same map.
+    static std::shared_ptr<const EnvironmentMap> get(const std::vector<std::filesystem::path>& files);
+
+    explicit EnvironmentMap(std::vector<std::filesystem::path> files);
+    EnvironmentMap(const EnvironmentMap&) = delete;
+    EnvironmentMap& operator=(const EnvironmentMap&) = delete;
+
+    [[nodiscard]] const std::vector<std::filesystem::path>& files() const { return m_files; }
+
+    // The six faces, indexed by `CubeFace`; reads the files on the first call. Empty if they could not be
+    // read, or do not form a cube map.
+    [[nodiscard]] const std::vector<Texture>& faces() const;
+
+    // Average radiance over the cone of directions within `coneAngle` radians of `direction`, weighting
+    // directions as a glossy lobe of that width does; reads or prefilters the map on the first call. Narrow
+    // cones are looked up in the mip levels of the faces, wider ones in the prefiltered faces.
+    [[nodiscard]] glm::vec3 sampleCone(const glm::vec3& direction, float coneAngle) const;
+
+    // The prefiltered faces are computed for cone angles of `PrefilteredBaseAngle * 2^i` radians, for
+    // 0 <= i < `NumPrefilteredLevels`; i.e. from about 0.9 up to 29 degrees.
+    static constexpr float PrefilteredBaseAngle = 1.0f / 64.0f;
+    static constexpr int NumPrefilteredLevels = 6;
+
+private:
+    void load() const;
+    void prefilter() const;
+    [[nodiscard]] glm::vec3 sampleTrilinear(const glm::vec3& direction, float lod) const;
+
+private:
+    std::vector<std::filesystem::path> m_files;
+    mutable std::once_flag m_loadFlag;
+    mutable std::vector<Texture> m_faces;
+    // For every prefiltered cone angle, the six faces
+    mutable std::once_flag m_prefilterFlag;
+    mutable std::vector<std::vector<Texture>> m_prefilteredFaces;
+};
@@ -1,12 +1,24 @@
 #include "extra.h"
+#include "blur.h"
 #include "bvh.h"
+#include "camera.h"
 #include "light.h"
+#include "light_tree.h"
+#include "postprocess.h"
 #include "recursive.h"
 #include "shading.h"
 #include "draw.h"
+#include "kernel.h"
 #include <framework/trackball.h>
 #include "texture.h"
+#include "environment_map.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/gtc/constants.hpp>
+DISABLE_WARNINGS_POP()
+#include <cmath>
 #include <iostream>
+#include <optional>
 
 // TODO; Extra feature
 // Given the same input as for `renderImage()`, instead render an image with your own implementation
@@ -15,6 +27,11 @@
 // This method is not unit-tested, but we do expect to find it **exactly here**, and we'd rather
 // not go on a hunting expedition for your implementation, so please keep it here!
 void renderImageWithDepthOfField(const Scene& scene, const BVHInterface& bvh, const Features& features, const Trackball& camera, Screen& screen)
+{
+    renderImageWithDepthOfField(scene, bvh, features, Camera(camera), screen);
+}
+
+void renderImageWithDepthOfField(const Scene& scene, const BVHInterface& bvh, const Features& features, const Camera& camera, Screen& screen)
 {
     // Concept: Marschner, S.; Shirley, P. Fundamentals of Computer Graphics, Fourth.; CRC Press, Taylor & Francis Group: Boca Raton, FL, 2015, chapter 13.4.3
 
@@ -22,57 +39,9 @@ void renderImageWithDepthOfField(const Scene& scene, const BVHInterface& bvh, co
         return;
     }
 
-    float width = screen.resolution().x, height = screen.resolution().y;
-    float focalLength = features.extra.focalLength;
-    float aperture = features.extra.aperture;
-
-
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            std::vector<Ray> rays;
-
-            // find NDC space x and y s.t. they give the coordinates of the center of pixel (x,y)
-            float ndcX = ((x + 0.5f) / width) * 2.0f - 1.0f; // in [-1, 1]
-            float ndcY = ((y + 0.5f) / height) * 2.0f - 1.0f; 
-            glm::vec2 pixel = glm::vec2(ndcX, ndcY);
-
-            RenderState state = {
-                .scene = scene,
-                .features = features,
-                .bvh = bvh,
-                .sampler = { static_cast<uint32_t>(screen.resolution().y * x + y) }
-            };
-
-            for (int i = 0; i < features.extra.depthOfFieldNumSamples; i++) {
-                glm::vec2 sample = state.sampler.next_2d(); // in [0, 1]
-                sample -= glm::vec2(0.5f); // in [-0.5, 0.5], to allow for negative offsets as well
-
-                // offset by some random amount of pixels proportional to aperture
-                float offsetX = aperture * sample.x / width;
-                float offsetY = aperture * sample.y / height; 
-
-                // Calculate new origin with offset (treat camera as a (square) lens instead of a point)
-                glm::vec3 offset = glm::vec3(offsetX, offsetY, 0.0f) ;
-
-                // Ray from camera to pixel
-                Ray ray = camera.generateRay(pixel);
-                
-                // Intersection point on focal plane
-                glm::vec3 focusPoint = ray.origin + focalLength * ray.direction;
-
-                ray.origin = ray.origin + offset;
-                glm::clamp(ray.origin, glm::vec3(-1, -1, 0), glm::vec3(1, 1, 0)); // don't exit NDC space
-
-                ray.direction = glm::normalize(focusPoint - ray.origin);
-
-                rays.push_back(ray);
-            }
-
-            glm::vec3 avgColor = renderRays(state, rays);
-
-            screen.setPixel(x, y, avgColor);
-        }
-    }
+    // The thin lens model is part of camera ray generation (see `Camera::sampleLens()` and `generateCameraRays()`),
+    // s.t. depth of field shares the regular render loop, and combines with pixel sampling and motion blur
+    renderImage(scene, bvh, features, camera, screen);
 }
 
 // TODO; Extra feature
@@ -82,12 +51,23 @@ void renderImageWithDepthOfField(const Scene& scene, const BVHInterface& bvh, co
 // This method is not unit-tested, but we do expect to find it **exactly here**, and we'd rather
 // not go on a hunting expedition for your implementation, so please keep it here!
 void renderImageWithMotionBlur(const Scene& scene, const BVHInterface& bvh, const Features& features, const Trackball& camera, Screen& screen)
+{
+    renderImageWithMotionBlur(scene, bvh, features, Camera(camera), screen);
+}
+
+void renderImageWithMotionBlur(const Scene& scene, const BVHInterface& bvh, const Features& features, const Camera& camera, Screen& screen)
 {
     if (!features.extra.enableMotionBlur) {
         return;
     }
 
     std::vector<glm::vec3> pixels(screen.resolution().x * screen.resolution().y, glm::vec3 { 0.f, 0.f, 0.f });
+    kernel::RenderKernel renderKernel = kernel::selectRenderKernel(scene, features);
+    const RayCone rayCone = cameraRayCone(features, camera, screen.resolution());
+    // Only geometry moves, so all time samples share the light tree
+    std::optional<LightTree> lightTree;
+    if (features.extra.enableLightTree)
+        lightTree.emplace(scene.lights);
     
     if (!features.extra.enableMotionBlurSampleIsolation) {
 
@@ -117,10 +97,12 @@ void renderImageWithMotionBlur(const Scene& scene, const BVHInterface& bvh, cons
                         .scene = newScene,
                         .features = features,
                         .bvh = newBVH,
-                        .sampler = { static_cast<uint32_t>(screen.resolution().y * x + y) }
+                        .sampler = { features.extra.samplerType, { x, y }, static_cast<uint32_t>(screen.resolution().y * x + y) },
+                        .rayCone = rayCone,
+                        .lightTree = lightTree ? &*lightTree : nullptr
                     };
-                    auto rays = generatePixelRays(state, camera, { x, y }, screen.resolution());
-                    auto L = renderRays(state, rays);
+                    auto rays = generateCameraRays(state, camera, { x, y }, screen.resolution());
+                    auto L = renderKernel(state, rays, 0);
                     pixels[screen.resolution().x * y + x] += L;
             }
         }
@@ -164,255 +146,76 @@ void renderImageWithMotionBlur(const Scene& scene, const BVHInterface& bvh, cons
                     .scene = newScene,
                     .features = features,
                     .bvh = newBVH,
-                    .sampler = { static_cast<uint32_t>(screen.resolution().y * x + y) }
+                    .sampler = { features.extra.samplerType, { x, y }, static_cast<uint32_t>(screen.resolution().y * x + y) },
+                    .rayCone = rayCone,
+                    .lightTree = lightTree ? &*lightTree : nullptr
                 };
-                auto rays = generatePixelRays(state, camera, { x, y }, screen.resolution());
-                auto L = renderRays(state, rays);
+                auto rays = generateCameraRays(state, camera, { x, y }, screen.resolution());
+                auto L = renderKernel(state, rays, 0);
                 screen.setPixel(x, y, L);
             }
         }
     }
 }
 
-float perceivedLuminance(glm::vec3 colors)
-{
-    // Coefficients for calculation of perceived luminance
-    const float c_R = 0.2126f;
-    const float c_G = 0.7152f;
-    const float c_B = 0.0722f;
-    return c_R * colors.r + c_G * colors.g + c_B * colors.b;
-}
-
-void applyThreshold(Screen& image, const float threshold)
-{
-    std::vector<glm::vec3>& img = image.pixels();
-    for (size_t i = 0; i < img.size(); i++)
-    {
-        if (perceivedLuminance(img[i]) < threshold)
-        {
-            img[i] = glm::vec3 { 0.0f };
-        }
-    }
-}
-
-void renderBloomAboveThreshold(Screen& image, const float threshold)
-{
-    // Renders the pixels which are above the threshold in red-white gradient.
-    // All other values are set to dark blue.
-    std::vector<glm::vec3>& img = image.pixels();
-    for (size_t i = 0; i < img.size(); i++) 
-    {
-        const float luminance = perceivedLuminance(img[i]);
-        if (luminance >= threshold) 
-        {
-            const float mapped = (luminance - threshold) / (1 - threshold);
-            img[i] = (1 - mapped) * glm::vec3 { 0.8f, 0.0f, 0.0f } + (mapped) * glm::vec3 { 0.85f, 0.85f, 0.85f };
-        } 
-        else 
-        {
-            img[i] = glm::vec3 { 0.0f, 0.0f, 0.2f };
-        }
-    }
-}
-
-void renderBloomBlurredMask(Screen& image, const Screen& mask, const uint32_t filterSize)
-{
-    std::vector<glm::vec3>& img = image.pixels();
-    const std::vector<glm::vec3>& msk = mask.pixels();
-
-    const uint32_t width = image.resolution().x;
-    const uint32_t height = image.resolution().y;
-
-    for (size_t x = 0; x < width; x++)
-    {
-        for (size_t y = 0; y < height; y++) 
-        {
-            const int indexPadded = mask.indexAt(x + filterSize, y + filterSize);
-            image.setPixel(x, y, msk[indexPadded]);
-        }
-    }
-}
-
-Screen padBorders(const Screen& image, const uint32_t filterSize)
+// TODO; Extra feature
+// Given a rendered image, compute and apply a bloom post-processing effect to increase bright areas.
+// This method is not unit-tested, but we do expect to find it **exactly here**, and we'd rather
+// not go on a hunting expedition for your implementation, so please keep it here!
+void postprocessImageWithBloom(const Scene& scene, const Features& features, const Trackball& camera, Screen& image)
 {
-    // Padding borders with black color (default color in Screen constructor)
-    const uint32_t newWidth = image.resolution().x + 2 * filterSize;
-    const uint32_t newHeight = image.resolution().y + 2 * filterSize;
-
-    Screen padded(glm::ivec2(newWidth, newHeight), false);
-
-    for (size_t x = 0; x < newWidth; x++)
-    {
-        for (size_t y = 0; y < newHeight; y++)
-        {
-            if ((x >= filterSize) && (x < newWidth - filterSize) && (y >= filterSize) && (y < newHeight - filterSize))
-            {
-                const size_t index = image.indexAt(x - filterSize, y - filterSize);
-                padded.setPixel(x, y, image.pixels()[index]);
-            }
-        }
-    }
-    return padded;
+    postprocessImageWithBloom(features, image);
 }
 
-uint64_t binomial(const uint32_t n, const uint32_t k)
+void postprocessImageWithBloom(const Features& features, Screen& image)
 {
-    uint32_t k_min = k > n - k ? n - k : k;
-    uint64_t coef = 1;
-
-    // Multiplicative formula
-    for (uint32_t i = 1; i <= k_min; i++) 
-    {
-        coef = (coef * (n - i + 1)) / i;
-    }
-
-    return coef; 
+    PostProcessPipeline(bloomPostProcessPasses(features.extra)).apply(image);
 }
 
-std::vector<glm::vec3> generateGaussianFilter(const uint32_t filterSize)
-{
-    const uint32_t radius = filterSize * 2 + 1;
-    std::vector<glm::vec3> filter;
-    filter.reserve(radius);
-    glm::vec3 sum { 0.0f };
+// Number of blurs of the bright parts of the image that the bloom adds up; the widest has the configured filter size
+static constexpr int BloomLevels = 4;
 
-    for (size_t i = 0; i < radius; i++)
-    {
-        const glm::vec3 computed = glm::vec3 { float(binomial(radius - 1, i)) };
-        filter.push_back(computed);
-        sum += computed;
-    }
-
-    for (size_t i = 0; i < radius; i++) 
-    {
-        filter[i] /= sum;
-    }
-
-    return filter;
-}
-
-void applyFilter1dToPixel(const size_t xOriginal, 
-                        const size_t yOriginal,
-                        const Screen& imagePadded,
-                        Screen& imageCopy,
-                        const std::vector<glm::vec3>& filter,
-                        const uint32_t filterSize,
-                        const bool toRow)
-{
-    const size_t x = xOriginal + filterSize;
-    const size_t y = yOriginal + filterSize;
-    const std::vector<glm::vec3>& imgPadded = imagePadded.pixels();
-
-    glm::vec3 updated { 0.0f };
-    if (toRow)
-    {
-        for (size_t col = x - filterSize; col <= x + filterSize; col++) 
-        {
-            const size_t index = imagePadded.indexAt(col, y);
-            updated += imgPadded[index] * filter[col - x + filterSize];
-        }
-    }
-    else
-    {
-        for (size_t row = y - filterSize; row <= y + filterSize; row++) 
-        {
-            const size_t index = imagePadded.indexAt(x, row);
-            updated += imgPadded[index] * filter[row - y + filterSize];
-        }
-    }
-    imageCopy.setPixel(x, y, updated);
-}
-
-// TODO; Extra feature
-// Given a rendered image, compute and apply a bloom post-processing effect to increase bright areas.
-// This method is not unit-tested, but we do expect to find it **exactly here**, and we'd rather
-// not go on a hunting expedition for your implementation, so please keep it here!
-void postprocessImageWithBloom(const Scene& scene, const Features& features, const Trackball& camera, Screen& image)
+std::vector<PostProcessPass> bloomPostProcessPasses(const ExtraFeatures& extra)
 {
     /*
         SOURCES:
         Perceived luminance: https://stackoverflow.com/a/596243/15236567
-        
-        Multiplicative formula for binomial coefficients: https://stackoverflow.com/a/15302394/15236567
-        
+
         Convolution filters: Marschner, S.; Shirley, P. Fundamentals of Computer Graphics, Fourth.; 
         CRC Press, Taylor & Francis Group: Boca Raton, FL, 2015, p. 190
-        
+
         Binomial filters: http://www.cse.yorku.ca/~kosta/CompVis_Notes/binomial_filters.pdf.old
     */
 
-    if (!features.extra.enableBloomEffect) 
-    {
-        return;
-    }
-
-    const float threshold = features.extra.bloomFilterThreshold;
+    if (!extra.enableBloomEffect)
+        return {};
 
     // Visual debug
-    if (features.extra.enableBloomShowAboveThreshold) 
-    {
-        renderBloomAboveThreshold(image, threshold);
-        return;
-    }
-
-    // This value MUST be limited by 31, otherwise integer overflow happens. I limit it to 30.
-    const uint32_t filterSize = features.extra.bloomFilterSize;
-
-    // imagePadded is used as an untouched copy in filtering
-    Screen imagePadded = padBorders(image, filterSize);
-
-    // Set all values below threshold to 0
-    applyThreshold(imagePadded, threshold);
-
-    // imageCopy is the one that changes
-    Screen imageCopy = imagePadded;
-    
-    // One-dimensional binomial (Gaussian) filter
-    std::vector<glm::vec3> filter1d = generateGaussianFilter(filterSize);
-
-    const uint32_t width = image.resolution().x;
-    const uint32_t height = image.resolution().y;
-
-    // Filter is separable, so we can first go through all rows, then all columns
-    for (size_t y = 0; y < height; y++)
-    {
-        for (size_t x = 0; x < width; x++)
-        {
-            applyFilter1dToPixel(x, y, imagePadded, imageCopy, filter1d, filterSize, true);
-        }
-    }
-
-    // Second traversal should be done on the result of the first one
-    imagePadded = imageCopy;
-
-    for (size_t x = 0; x < width; x++) 
-    {
-        for (size_t y = 0; y < height; y++) 
-        {
-            applyFilter1dToPixel(x, y, imagePadded, imageCopy, filter1d, filterSize, false);
-        }
-    }
-
-    // Visual debug
-    if (features.extra.enableBloomShowBlurredMask) 
-    {
-        renderBloomBlurredMask(image, imageCopy, filterSize);
-        return;
-    }
-
-    const float bloomFactor = features.extra.bloomFilterIntensity;
-    for (int x = 0; x < width; x++) 
-    {
-        for (int y = 0; y < height; y++) 
-        {
-            const int indexOriginal = image.indexAt(x, y);
-            const int indexPadded = imageCopy.indexAt(x + filterSize, y + filterSize);
-            const glm::vec3 combined = image.pixels()[indexOriginal] + imageCopy.pixels()[indexPadded] * bloomFactor;
-            image.setPixel(x, y, combined);
-        }
-    }
-
-    //image.writeBitmapToFile("D:/final_image.bmp");
+    if (extra.enableBloomShowAboveThreshold)
+        return { ThresholdPass { .threshold = extra.bloomFilterThreshold, .visualize = true } };
+
+    // The filter size is the radius of a binomial filter with 2 * size + 1 taps, which has a variance
+    // of size / 2; the widest level is blurred with a Gaussian of the same variance, so there is no upper
+    // bound on the size.
+    const float sigma = std::sqrt(0.5f * float(extra.bloomFilterSize));
+
+    // The bloom is the mean of several blurs of the mask, each twice as wide as the one before, s.t. bright
+    // spots get a sharp core and a wide halo. Blurs add up, so every level blurs the one before it by the
+    // difference in variance, and is added to the image before the next; the blur passes downsample the mask
+    // as it widens.
+    std::vector<PostProcessPass> passes { ThresholdPass { .threshold = extra.bloomFilterThreshold } };
+    float previousSigma = 0.0f;
+    for (int level = 0; level < BloomLevels; level++) {
+        const float levelSigma = sigma * std::exp2(float(level - (BloomLevels - 1)));
+        passes.emplace_back(BlurPass { .sigma = std::sqrt(levelSigma * levelSigma - previousSigma * previousSigma) });
+        previousSigma = levelSigma;
+        // Visual debug: show the bloom instead of adding it
+        if (extra.enableBloomShowBlurredMask)
+            passes.emplace_back(CompositePass { .intensity = 1.0f / float(BloomLevels), .replace = level == 0 });
+        else
+            passes.emplace_back(CompositePass { .intensity = extra.bloomFilterIntensity / float(BloomLevels) });
+    }
+    return passes;
 }
 
 std::array<glm::vec3, 3> constructOrthonormalBasis(const glm::vec3& r)
@@ -442,8 +245,9 @@ std::array<glm::vec3, 3> constructOrthonormalBasis(const glm::vec3& r)
 
 std::array<float, 2> sampleDisk(RenderState& state, const float radius = 1.0f)
 {
-    const float r = radius * glm::sqrt(state.sampler.next_1d());
-    const float angle = state.sampler.next_1d() * 2 * glm::pi<float>();
+    const glm::vec2 sample = state.sampler.next_2d(SampleDimension::Bounce);
+    const float r = radius * glm::sqrt(sample.x);
+    const float angle = sample.y * 2 * glm::pi<float>();
     const float x = r * glm::cos(angle);
     const float y = r * glm::sin(angle);
     return { x, y };
@@ -461,7 +265,8 @@ std::array<float, 2> sampleDisk(RenderState& state, const float radius = 1.0f)
 // - rayDepth; current recursive ray depth
 // This method is not unit-tested, but we do expect to find it **exactly here**, and we'd rather
 // not go on a hunting expedition for your implementation, so please keep it here!
-void renderRayGlossyComponent(RenderState& state, Ray ray, const HitInfo& hitInfo, glm::vec3& hitColor, int rayDepth)
+template <uint32_t Mask>
+void kernel::renderRayGlossyComponent(RenderState& state, Ray ray, const HitInfo& hitInfo, glm::vec3& hitColor, int rayDepth)
 {
     /*
         SOURCES:
@@ -478,7 +283,8 @@ void renderRayGlossyComponent(RenderState& state, Ray ray, const HitInfo& hitInf
     if (numSamples <= 0) return;
     
     // Radius of the disk. 64 / shininess was too high for the provided scenes.
-    const float radius = 0.5f / hitInfo.material.shininess;
+    const Material& material = materialOf<Mask>(state, hitInfo);
+    const float radius = 0.5f / material.shininess;
 
     // "Normally" reflected ray
     Ray r = generateReflectionRay(ray, hitInfo);
@@ -486,7 +292,22 @@ void renderRayGlossyComponent(RenderState& state, Ray ray, const HitInfo& hitInf
 
     glm::vec3 accumulatedColor {};
 
-    for (int i = 0; i < numSamples; i++)
+    // If the environment map is prefiltered, a lobe whose central ray escapes the scene is assumed to
+    // escape as a whole, and is resolved with a single lookup over the lobe's cone instead of `numSamples` rays.
+    // Lobes that are only partially occluded are therefore treated as fully escaping, and miss the geometry
+    // that the central ray passes. If the central ray hits, its hit is shaded as the first of the lobe's samples.
+    uint32_t firstSample = 0;
+    if (enabled<Mask>(state.features, EnvironmentMap) && state.features.extra.enablePrefilteredEnvironmentMap && state.scene.environmentMap) {
+        HitInfo centralHitInfo;
+        if (!intersect<Mask>(state, r, centralHitInfo)) {
+            hitColor += material.ks * state.scene.environmentMap->sampleCone(r.direction, std::atan(radius));
+            return;
+        }
+        accumulatedColor += material.ks * shadeHit<Mask>(state, r, centralHitInfo, rayDepth + 1);
+        firstSample = 1;
+    }
+
+    for (uint32_t i = firstSample; i < numSamples; i++)
     {
         const std::array<float, 2> point = sampleDisk(state, radius);
 
@@ -501,19 +322,26 @@ void renderRayGlossyComponent(RenderState& state, Ray ray, const HitInfo& hitInf
         perturbedRay.origin = r.origin + 0.0001f * perturbedRay.direction;
         perturbedRay.t = std::numeric_limits<float>::max();
 
-        accumulatedColor += hitInfo.material.ks * renderRay(state, perturbedRay, rayDepth + 1);
+        accumulatedColor += material.ks * renderRay<Mask>(state, perturbedRay, rayDepth + 1);
     }
     
     hitColor += accumulatedColor / float(numSamples);
 
-    // Visual debug
-    HitInfo hitInfoCopy = hitInfo;
-    state.bvh.intersect(state, r, hitInfoCopy);
-    drawRay(r, glm::vec3 { 0.5f, 0.0f, 0.8f });
+    // Visual debug; only the debug kernel traces the extra ray
+    if constexpr ((Mask & DebugDraw) != 0) {
+        HitInfo hitInfoCopy;
+        (void)intersect<Mask>(state, r, hitInfoCopy);
+        recordRay<Mask>(state, r, glm::vec3 { 0.5f, 0.0f, 0.8f });
 
-    const float sphereDistFactor = 0.3f;
-    const glm::vec3 sphereColor = glm::vec3 { 0.75f, 0.85f, 0.0f };
-    drawSphere(r.origin + sphereDistFactor * basis[0], sphereDistFactor * radius, sphereColor);
+        const float sphereDistFactor = 0.3f;
+        const glm::vec3 sphereColor = glm::vec3 { 0.75f, 0.85f, 0.0f };
+        recordSphere<Mask>(state, r.origin + sphereDistFactor * basis[0], sphereDistFactor * radius, sphereColor);
+    }
+}
+
+void renderRayGlossyComponent(RenderState& state, Ray ray, const HitInfo& hitInfo, glm::vec3& hitColor, int rayDepth)
+{
+    kernel::renderRayGlossyComponent<kernel::Dynamic>(state, ray, hitInfo, hitColor, rayDepth);
 }
 
 // TODO; Extra feature
@@ -524,61 +352,38 @@ void renderRayGlossyComponent(RenderState& state, Ray ray, const HitInfo& hitInf
 // - ray;   ray object
 // This method is not unit-tested, but we do expect to find it **exactly here**, and we'd rather
 // not go on a hunting expedition for your implementation, so please keep it here!
-glm::vec3 sampleEnvironmentMap(RenderState& state, Ray ray)
+template <uint32_t Mask>
+glm::vec3 kernel::sampleEnvironmentMap(RenderState& state, Ray ray)
 {
     // Concept + reason for choosing a cube map over a sphere map: 
     // Marschner, S.; Shirley, P. Fundamentals of Computer Graphics, Fourth.; CRC Press, Taylor & Francis Group: Boca Raton, FL, 2015, chapter 11.4.5
-    if (state.features.extra.enableEnvironmentMap) {
-        float x = std::fabs(ray.direction.x), y = std::fabs(ray.direction.y), z = std::fabs(ray.direction.z);
-        float maxComponent = std::max(x, std::max(y, z));
-        glm::vec3 r = ray.direction / maxComponent; // [-1, 1]
-        glm::vec3 coords = (r + glm::vec3(1.0f)) / 2.0f; // [0, 1]
-
-        // +- 1 => choose face
-        // take other 2 coords and sample from face
-        // Source: McGill University Slides - https://www.cim.mcgill.ca/~langer/557/18-slides.pdf
-        float one = 1.0f - FLT_EPSILON;
-        float u, v;
-        
-        /* texture is 4 squares wide and 3 squares: (see data/cube2.jpg)
-
-                   UP
-            LEFT FRONT RIGHT BACK
-                  DOWN
-        */
-        // Some 'coords' components need to be flipped to account for the way a cube is unfolded onto a flat plane (some faces are inverted)
-        if (r.x > one) { // right
-            u = coords.z / 4.0f + 2.0f / 4.0f;
-            v = coords.y / 3.0f + 1.0f / 3.0f;
-        } else if (r.x < -one) { // left
-            u = (1 - coords.z) / 4.0f;
-            v = coords.y / 3.0f + 1.0f / 3.0f;
-        } else if (r.y > one) { // up
-            u = coords.x / 4.0f + 1.0f / 4.0f;
-            v = coords.z / 3.0f + 2.0f / 3.0f;
-        } else if (r.y < -one) { // down
-            u = coords.x / 4.0f + 1.0f / 4.0f;
-            v = (1 - coords.z) / 3.0f;
-        } else if (r.z < -one) { // front
-            u = coords.x / 4.0f + 1.0f / 4.0f;
-            v = coords.y / 3.0f + 1.0f / 3.0f;
-        } else /*if (r.z > one)*/ { // back
-            u = (1 - coords.x) / 4.0f + 3.0f / 4.0f;
-            v = coords.y / 3.0f + 1.0f / 3.0f;
+    if (enabled<Mask>(state.features, EnvironmentMap)) {
+        if (!state.scene.environmentMap || state.scene.environmentMap->faces().empty())
+            return glm::vec3(0.f);
+        // Choose the face the ray points at, and where on the face
+        const auto [face, faceTexCoords] = EnvironmentMap::faceCoordinates(ray.direction);
+        const Texture& faceTexture = state.scene.environmentMap->faces()[size_t(face)];
+
+        // Escaped rays have a footprint of `spreadAngle` radians; a cube face spans 90 degrees
+        if (enabled<Mask>(state.features, MipmapFiltering)) {
+            const float texelAngle = glm::half_pi<float>() / float(faceTexture.width());
+            return faceTexture.sampleTrilinear(faceTexCoords, std::log2(state.rayCone.spreadAngle / texelAngle));
         }
+        if (enabled<Mask>(state.features, BilinearFiltering))
+            return faceTexture.sampleBilinear(faceTexCoords);
 
-        glm::vec2 mapTexCoords = glm::vec2(u, v);
-
-        if (state.features.enableBilinearTextureFiltering) 
-            return sampleTextureBilinear(state.scene.environmentMap, mapTexCoords);
-
-        return sampleTextureNearest(state.scene.environmentMap, mapTexCoords);
+        return faceTexture.sampleNearest(faceTexCoords);
 
     } else {
         return glm::vec3(0.f);
     }
 }
 
+glm::vec3 sampleEnvironmentMap(RenderState& state, Ray ray)
+{
+    return kernel::sampleEnvironmentMap<kernel::Dynamic>(state, ray);
+}
+
 size_t determineBucketIndex(const size_t i, const size_t nBins, uint32_t axis, std::span<BVH::Primitive> primitives)
 {
     const glm::vec3 subintervalLen = computePrimitiveCentroid(primitives[i]) - computePrimitiveCentroid(primitives[0]);
@@ -696,4 +501,9 @@ size_t splitPrimitivesBySAHBin(const AxisAlignedBox& aabb, uint32_t axis, std::s
     }
 
     return minIndex;
-}
\ No newline at end of file
+}
+
+#define INSTANTIATE_EXTRA_KERNEL(Mask)                                                                                                                                                         \
+    template void kernel::renderRayGlossyComponent<Mask>(RenderState&, Ray, const HitInfo&, glm::vec3&, int);                                                                                \
+    template glm::vec3 kernel::sampleEnvironmentMap<Mask>(RenderState&, Ray);
+FOR_EACH_RENDER_KERNEL(INSTANTIATE_EXTRA_KERNEL)
@@ -6,6 +6,7 @@
 #include "scene.h"
 #include "screen.h"
 #include "bvh.h"
+#include "postprocess.h"
 
 // TODO; Extra feature
 // Given the same input as for `renderImage()`, instead render an image with your own implementation
@@ -14,6 +15,7 @@
 // This method is not unit-tested, but we do expect to find it **exactly here**, and we'd rather
 // not go on a hunting expedition for your implementation, so please keep it here!
 void renderImageWithDepthOfField(const Scene& scene, const BVHInterface& bvh, const Features& features, const Trackball& camera, Screen& screen);
+void renderImageWithDepthOfField(const Scene& scene, const BVHInterface& bvh, const Features& features, const Camera& camera, Screen& screen);
 
 // TODO; Extra feature
 // Given the same input as for `renderImage()`, instead render an image with your own implementation
@@ -22,6 +24,7 @@ void renderImageWithDepthOfField(const Scene& scene, const BVHInterface& bvh, co
 // This method is not unit-tested, but we do expect to find it **exactly here**, and we'd rather
 // not go on a hunting expedition for your implementation, so please keep it here!
 void renderImageWithMotionBlur(const Scene& scene, const BVHInterface& bvh, const Features& features, const Trackball& camera, Screen& screen);
+void renderImageWithMotionBlur(const Scene& scene, const BVHInterface& bvh, const Features& features, const Camera& camera, Screen& screen);
 
 // TODO; Extra feature
 // Given a rendered image, compute and apply a bloom post-processing effect to increase bright areas.
@@ -30,6 +33,11 @@ void renderImageWithMotionBlur(const Scene& scene, const BVHInterface& bvh, cons
 // This method is not unit-tested, but we do expect to find it **exactly here**, and we'd rather
 // not go on a hunting expedition for your implementation, so please keep it here!
 void postprocessImageWithBloom(const Scene& scene, const Features& features, const Trackball& camera, Screen& screen);
+// The bloom effect only depends on the image, so it does not need a scene or camera
+void postprocessImageWithBloom(const Features& features, Screen& screen);
+// The bloom effect as post-processing passes (a threshold, then blurs and composites), which run before the
+// configured passes; empty if bloom is disabled
+std::vector<PostProcessPass> bloomPostProcessPasses(const ExtraFeatures& extra);
 
 // TODO; Extra feature
 // Given a camera ray (or reflected camera ray) and an intersection, evaluates the contribution of a set of
@@ -0,0 +1,47 @@
+#include "file_io.h"
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#include <mutex>
+#else
+#include <unistd.h>
+#endif
+
+int openReadOnly(const std::filesystem::path& path)
+{
+#ifdef _WIN32
+    return _wopen(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    return ::open(path.c_str(), O_RDONLY);
+#endif
+}
+
+void closeFile(int fd)
+{
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+bool readAt(int fd, uint64_t offset, void* buffer, size_t size)
+{
+#ifdef _WIN32
+    // The CRT has no positional reads, so seek and read under a lock
+    static std::mutex mutex;
+    std::scoped_lock lock { mutex };
+    return _lseeki64(fd, int64_t(offset), SEEK_SET) >= 0 && _read(fd, buffer, unsigned(size)) == int(size);
+#else
+    auto* bytes = static_cast<char*>(buffer);
+    while (size > 0) {
+        const ssize_t numRead = pread(fd, bytes, size, off_t(offset));
+        if (numRead <= 0)
+            return false;
+        bytes += numRead;
+        offset += uint64_t(numRead);
+        size -= size_t(numRead);
+    }
+    return true;
+#endif
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// Unbuffered reads at arbitrary offsets of files, for the out-of-core caches. Several threads can read
+// from the same file descriptor at once.
+
+// Open a file for reading; returns -1 on failure.
+int openReadOnly(const std::filesystem::path& path);
+void closeFile(int fd);
+// Read `size` bytes at `offset` of a file, without moving a shared file position.
+bool readAt(int fd, uint64_t offset, void* buffer, size_t size);
@@ -2,10 +2,17 @@
 
 // Forward declarations used throughout the program
 struct BVHInterface;
+struct DebugRecording;
 struct Image;
 struct Features;
 struct RenderState;
+struct Reservoir;
+struct ReservoirHistory;
 struct Scene;
+class Camera;
+class LightTree;
 class Sampler;
 class Screen;
-class Trackball;
\ No newline at end of file
+class Texture;
+class Trackball;
+class VisibilityBuffer;
\ No newline at end of file
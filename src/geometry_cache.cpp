@@ -0,0 +1,610 @@
+#include "geometry_cache.h"
+#include "bvh.h"
+#include "file_io.h"
+#include "vertex_encoding.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/vector_relational.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+
+// Paged files start with a header of one page, followed by the clusters, each starting at a page, and
+// finally the table of clusters
+static constexpr uint32_t PagedFileMagic = 0x43475452; // "RTGC"
+static constexpr uint32_t PagedFileVersion = 2;
+static constexpr uint64_t PageSize = 4096;
+
+// Positions are only quantised if the grid's step is at most this fraction of the mesh's mean edge length
+static constexpr float MaxGridStepPerEdge = 1.0f / 1024.0f;
+
+// Clusters are only requested for the first few boxes that a prefetch ray enters, and only this many
+// clusters wait to be prefetched at a time; older requests are dropped, as their tiles are likely done
+static constexpr size_t PrefetchClustersPerRay = 2;
+static constexpr size_t MaxQueuedPrefetches = 1024;
+
+struct PagedFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t geometryHash;
+    uint64_t numClusters;
+    uint64_t tableOffset;
+};
+
+enum ClusterFlags : uint32_t {
+    CompressedAttributes = 1u << 0, // Vertices are stored as position and attribute streams, instead of `Vertex`es
+    QuantisedPositions = 1u << 1, // Positions are grid cells as `glm::u16vec3` offsets from the base cell, instead of `glm::vec3`s
+    UnormTexCoords = 1u << 2, // Texture coordinates are encoded as UNORMs, instead of halfs
+};
+
+// A cluster is its header, followed by its nodes, triangles, and vertices (see `clusterLayout()`)
+struct ClusterHeader {
+    uint32_t meshID;
+    uint32_t numNodes, numVertices, numTriangles;
+    uint32_t flags; // `ClusterFlags`
+    glm::uvec3 baseCell;
+    glm::vec3 gridOrigin, gridStep;
+};
+
+struct ClusterLayout {
+    size_t triangles, positions, attributes, size;
+};
+
+// How the vertices of a mesh are stored
+struct MeshEncoding {
+    uint32_t flags = 0; // `ClusterFlags`
+    glm::vec3 gridOrigin { 0.0f }, gridStep { 1.0f };
+};
+
+struct ClusterTableEntry {
+    AxisAlignedBox bounds;
+    uint64_t fileOffset;
+    uint64_t size;
+};
+
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+{
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i += 8) {
+        uint64_t word = 0;
+        std::memcpy(&word, bytes + i, std::min<size_t>(8, size - i));
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+static uint64_t hashGeometry(std::span<const Mesh> meshes, uint32_t clusterSize, bool compressAttributes)
+{
+    const uint32_t options[2] { clusterSize, compressAttributes };
+    uint64_t hash = hashBytes(0, options, sizeof(options));
+    for (const Mesh& mesh : meshes) {
+        const uint64_t sizes[2] { mesh.vertices.size(), mesh.triangles.size() };
+        hash = hashBytes(hash, sizes, sizeof(sizes));
+        hash = hashBytes(hash, mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+        hash = hashBytes(hash, mesh.triangles.data(), mesh.triangles.size() * sizeof(glm::uvec3));
+    }
+    return hash;
+}
+
+// Build a hierarchy over a set of boxes by median splits along the longest axis of their centers, s.t.
+// subtrees stay spatially coherent. Reorders `items` (indices into `boxes`), s.t. every leaf refers to a
+// contiguous range of at most `leafSize` of them. The root is node 0; children are allocated in pairs.
+static std::vector<BVHInterface::Node> buildHierarchy(std::span<const AxisAlignedBox> boxes, std::span<uint32_t> items, uint32_t leafSize)
+{
+    std::vector<BVHInterface::Node> nodes(1);
+    const auto build = [&](const auto& self, uint32_t nodeIndex, uint32_t begin, uint32_t end) -> void {
+        AxisAlignedBox bounds { glm::vec3(std::numeric_limits<float>::max()), glm::vec3(std::numeric_limits<float>::lowest()) };
+        AxisAlignedBox centers = bounds;
+        for (uint32_t i = begin; i < end; i++) {
+            const AxisAlignedBox& box = boxes[items[i]];
+            bounds = { glm::min(bounds.lower, box.lower), glm::max(bounds.upper, box.upper) };
+            const glm::vec3 center = 0.5f * (box.lower + box.upper);
+            centers = { glm::min(centers.lower, center), glm::max(centers.upper, center) };
+        }
+
+        if (end - begin <= leafSize) {
+            nodes[nodeIndex] = { bounds, { BVHInterface::Node::LeafBit | begin, end - begin } };
+            return;
+        }
+
+        const glm::vec3 extent = centers.upper - centers.lower;
+        const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+        const uint32_t middle = begin + (end - begin) / 2;
+        std::nth_element(std::begin(items) + begin, std::begin(items) + middle, std::begin(items) + end, [&](uint32_t lhs, uint32_t rhs) {
+            return boxes[lhs].lower[axis] + boxes[lhs].upper[axis] < boxes[rhs].lower[axis] + boxes[rhs].upper[axis];
+        });
+
+        const auto leftChild = uint32_t(nodes.size());
+        nodes.resize(nodes.size() + 2);
+        nodes[nodeIndex] = { bounds, { leftChild, leftChild + 1 } };
+        self(self, leftChild, begin, middle);
+        self(self, leftChild + 1, middle, end);
+    };
+    if (!items.empty())
+        build(build, 0, 0, uint32_t(items.size()));
+    return nodes;
+}
+
+// Byte offsets of the blocks of a cluster; every block starts 8 byte aligned
+static ClusterLayout clusterLayout(const ClusterHeader& header)
+{
+    const auto align = [](size_t offset) { return (offset + 7) & ~size_t(7); };
+    ClusterLayout layout;
+    layout.triangles = align(sizeof(ClusterHeader) + header.numNodes * sizeof(BVHInterface::Node));
+    layout.positions = align(layout.triangles + header.numTriangles * sizeof(glm::u16vec3));
+    if (!(header.flags & CompressedAttributes)) {
+        layout.attributes = layout.size = layout.positions + header.numVertices * sizeof(Vertex);
+        return layout;
+    }
+    const size_t positionSize = header.flags & QuantisedPositions ? sizeof(glm::u16vec3) : sizeof(glm::vec3);
+    layout.attributes = align(layout.positions + header.numVertices * positionSize);
+    layout.size = layout.attributes + header.numVertices * sizeof(glm::uvec2);
+    return layout;
+}
+
+// Decoding a grid cell only depends on the cell's index in the mesh's grid, s.t. a vertex decodes to the
+// same position in every cluster that stores it
+static glm::vec3 gridPosition(const glm::vec3& gridOrigin, const glm::vec3& gridStep, const glm::uvec3& cell)
+{
+    return gridOrigin + glm::vec3(cell) * gridStep;
+}
+
+static glm::uvec3 gridCell(const MeshEncoding& encoding, const glm::vec3& position)
+{
+    const glm::dvec3 cell = glm::round(glm::dvec3(position - encoding.gridOrigin) / glm::dvec3(encoding.gridStep));
+    return glm::uvec3(glm::clamp(cell, 0.0, double(std::numeric_limits<uint32_t>::max())));
+}
+
+// Choose the grid of a mesh, s.t. the cells of a cluster are within 16 bits of each other, and the cells of
+// the mesh fit in 32 bits. Texture coordinates use UNORMs if they are all in [0, 1].
+static MeshEncoding chooseEncoding(const Mesh& mesh, std::span<const BVHInterface::Node> clusterNodes)
+{
+    MeshEncoding encoding { CompressedAttributes };
+    const bool unitTexCoords = std::all_of(std::begin(mesh.vertices), std::end(mesh.vertices), [](const Vertex& vertex) {
+        return glm::all(glm::greaterThanEqual(vertex.texCoord, glm::vec2(0.0f))) && glm::all(glm::lessThanEqual(vertex.texCoord, glm::vec2(1.0f)));
+    });
+    if (unitTexCoords)
+        encoding.flags |= UnormTexCoords;
+    if (mesh.triangles.empty())
+        return encoding;
+
+    glm::vec3 maxClusterExtent { 0.0f };
+    for (const BVHInterface::Node& node : clusterNodes) {
+        if (node.isLeaf() && node.primitiveCount() > 0)
+            maxClusterExtent = glm::max(maxClusterExtent, node.aabb.upper - node.aabb.lower);
+    }
+    const AxisAlignedBox& meshBounds = clusterNodes[0].aabb;
+    glm::vec3 gridStep = glm::max((meshBounds.upper - meshBounds.lower) / float(std::numeric_limits<uint32_t>::max()), maxClusterExtent / 65534.0f);
+
+    double edgeLength = 0.0;
+    for (const glm::uvec3& triangle : mesh.triangles) {
+        const glm::vec3 &p0 = mesh.vertices[triangle.x].position, &p1 = mesh.vertices[triangle.y].position, &p2 = mesh.vertices[triangle.z].position;
+        edgeLength += double(glm::distance(p0, p1) + glm::distance(p1, p2) + glm::distance(p2, p0));
+    }
+    const float meanEdgeLength = float(edgeLength / (3.0 * double(mesh.triangles.size())));
+    if (std::max(std::max(gridStep.x, gridStep.y), gridStep.z) > meanEdgeLength * MaxGridStepPerEdge)
+        return encoding;
+
+    // Axes on which the mesh is flat only have cell 0
+    for (int axis = 0; axis < 3; axis++) {
+        if (!(gridStep[axis] > 0.0f))
+            gridStep[axis] = 1.0f;
+    }
+    encoding.flags |= QuantisedPositions;
+    encoding.gridOrigin = meshBounds.lower;
+    encoding.gridStep = gridStep;
+    return encoding;
+}
+
+std::span<const BVHInterface::Node> GeometryCache::Cluster::nodes() const
+{
+    return { reinterpret_cast<const BVHInterface::Node*>(m_data.data() + sizeof(ClusterHeader)), m_numNodes };
+}
+
+std::span<const glm::u16vec3> GeometryCache::Cluster::triangles() const
+{
+    return { reinterpret_cast<const glm::u16vec3*>(m_data.data() + m_trianglesOffset), m_numTriangles };
+}
+
+glm::vec3 GeometryCache::Cluster::position(uint32_t vertex) const
+{
+    if (!(m_flags & CompressedAttributes))
+        return reinterpret_cast<const Vertex*>(m_data.data() + m_positionsOffset)[vertex].position;
+    if (!(m_flags & QuantisedPositions))
+        return reinterpret_cast<const glm::vec3*>(m_data.data() + m_positionsOffset)[vertex];
+    const glm::u16vec3 offset = reinterpret_cast<const glm::u16vec3*>(m_data.data() + m_positionsOffset)[vertex];
+    return gridPosition(m_gridOrigin, m_gridStep, m_baseCell + glm::uvec3(offset));
+}
+
+Vertex GeometryCache::Cluster::vertex(uint32_t vertex) const
+{
+    if (!(m_flags & CompressedAttributes))
+        return reinterpret_cast<const Vertex*>(m_data.data() + m_positionsOffset)[vertex];
+    const glm::uvec2 attributes = reinterpret_cast<const glm::uvec2*>(m_data.data() + m_attributesOffset)[vertex];
+    return { position(vertex), decodeOctahedral(attributes.x), decodeTexCoord(attributes.y, m_flags & UnormTexCoords) };
+}
+
+BVHInterface::Primitive GeometryCache::Cluster::primitive(uint32_t triangle) const
+{
+    const glm::u16vec3 indices = triangles()[triangle];
+    return { meshID, vertex(indices.x), vertex(indices.y), vertex(indices.z) };
+}
+
+GeometryCache::GeometryCache(const GeometryCacheConfig& config, std::span<const Mesh> meshes)
+    : m_config(config)
+{
+    // Clusters index their vertices with 16 bits, and have at most three vertices per triangle
+    m_config.clusterSize = std::clamp(m_config.clusterSize, BVH::LeafSize, uint32_t(65536 / 3));
+    if (m_config.directory.empty())
+        m_config.directory = std::filesystem::temp_directory_path() / "ray-tracer-geometry-cache";
+    m_shardBudget = m_config.budgetBytes / m_shards.size();
+
+    const uint64_t geometryHash = hashGeometry(meshes, m_config.clusterSize, m_config.compressAttributes);
+    const std::filesystem::path path = m_config.directory / (std::to_string(geometryHash) + ".clusters");
+    if (!openPagedFile(path, geometryHash) && !(writePagedFile(path, geometryHash, meshes) && openPagedFile(path, geometryHash)))
+        std::cerr << "Failed to write paged geometry file " << path << "; rendering without meshes" << std::endl;
+
+    m_prefetchThread = std::thread([this]() { prefetchLoop(); });
+}
+
+GeometryCache::~GeometryCache()
+{
+    {
+        std::scoped_lock lock { m_prefetchMutex };
+        m_stopPrefetching = true;
+    }
+    m_prefetchCondition.notify_one();
+    m_prefetchThread.join();
+    if (m_fd >= 0)
+        closeFile(m_fd);
+}
+
+bool GeometryCache::writePagedFile(const std::filesystem::path& path, uint64_t geometryHash, std::span<const Mesh> meshes) const
+{
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+    // Write to a temporary file first, s.t. other processes never see a partial file
+    const std::filesystem::path tempPath = path.string() + ".tmp";
+    std::ofstream out { tempPath, std::ios::binary };
+    if (!out)
+        return false;
+
+    uint64_t offset = PageSize;
+    out.write(std::vector<char>(PageSize, 0).data(), std::streamsize(PageSize));
+
+    std::vector<ClusterTableEntry> table;
+    std::vector<char> blob;
+    std::vector<uint32_t> localVertices; // Index of every mesh vertex in the current cluster, or ~0u
+    for (uint32_t meshID = 0; meshID < meshes.size(); meshID++) {
+        const Mesh& mesh = meshes[meshID];
+        std::vector<AxisAlignedBox> triangleBounds(mesh.triangles.size());
+        for (size_t i = 0; i < mesh.triangles.size(); i++) {
+            const glm::uvec3& triangle = mesh.triangles[i];
+            const glm::vec3 &p0 = mesh.vertices[triangle.x].position, &p1 = mesh.vertices[triangle.y].position, &p2 = mesh.vertices[triangle.z].position;
+            triangleBounds[i] = { glm::min(glm::min(p0, p1), p2), glm::max(glm::max(p0, p1), p2) };
+        }
+        std::vector<uint32_t> order(mesh.triangles.size());
+        std::iota(std::begin(order), std::end(order), 0u);
+
+        // The leaves of a hierarchy with clusters as leaves are the clusters
+        const std::vector<BVHInterface::Node> clusterNodes = buildHierarchy(triangleBounds, order, m_config.clusterSize);
+        const MeshEncoding encoding = m_config.compressAttributes ? chooseEncoding(mesh, clusterNodes) : MeshEncoding {};
+        std::vector<glm::uvec3> cells;
+        if (encoding.flags & QuantisedPositions) {
+            // Bound the triangles as they are decoded, s.t. traversal does not miss them at the edges of boxes
+            cells.reserve(mesh.vertices.size());
+            std::transform(std::begin(mesh.vertices), std::end(mesh.vertices), std::back_inserter(cells), [&](const Vertex& vertex) { return gridCell(encoding, vertex.position); });
+            for (size_t i = 0; i < mesh.triangles.size(); i++) {
+                const glm::uvec3& triangle = mesh.triangles[i];
+                const glm::vec3 p0 = gridPosition(encoding.gridOrigin, encoding.gridStep, cells[triangle.x]);
+                const glm::vec3 p1 = gridPosition(encoding.gridOrigin, encoding.gridStep, cells[triangle.y]);
+                const glm::vec3 p2 = gridPosition(encoding.gridOrigin, encoding.gridStep, cells[triangle.z]);
+                triangleBounds[i] = { glm::min(glm::min(p0, p1), p2), glm::max(glm::max(p0, p1), p2) };
+            }
+        }
+
+        localVertices.assign(mesh.vertices.size(), ~0u);
+        for (const BVHInterface::Node& clusterNode : clusterNodes) {
+            if (!clusterNode.isLeaf() || clusterNode.primitiveCount() == 0)
+                continue;
+
+            // Build the cluster's BVH over its triangles
+            std::span<uint32_t> clusterTriangles { &order[clusterNode.primitiveOffset()], clusterNode.primitiveCount() };
+            std::vector<AxisAlignedBox> clusterBounds(clusterTriangles.size());
+            std::vector<uint32_t> clusterOrder(clusterTriangles.size());
+            for (uint32_t i = 0; i < clusterTriangles.size(); i++) {
+                clusterBounds[i] = triangleBounds[clusterTriangles[i]];
+                clusterOrder[i] = i;
+            }
+            const std::vector<BVHInterface::Node> nodes = buildHierarchy(clusterBounds, clusterOrder, BVH::LeafSize);
+
+            // Gather the vertices it uses, in the order the triangles use them
+            std::vector<uint32_t> vertices;
+            std::vector<glm::u16vec3> triangles;
+            triangles.reserve(clusterTriangles.size());
+            for (uint32_t local : clusterOrder) {
+                const glm::uvec3& triangle = mesh.triangles[clusterTriangles[local]];
+                glm::u16vec3 localTriangle;
+                for (int j = 0; j < 3; j++) {
+                    if (localVertices[triangle[j]] == ~0u) {
+                        localVertices[triangle[j]] = uint32_t(vertices.size());
+                        vertices.push_back(triangle[j]);
+                    }
+                    localTriangle[j] = uint16_t(localVertices[triangle[j]]);
+                }
+                triangles.push_back(localTriangle);
+            }
+            for (uint32_t vertex : vertices)
+                localVertices[vertex] = ~0u;
+
+            ClusterHeader header { meshID, uint32_t(nodes.size()), uint32_t(vertices.size()), uint32_t(triangles.size()), encoding.flags, glm::uvec3(0), encoding.gridOrigin, encoding.gridStep };
+            if (encoding.flags & QuantisedPositions) {
+                header.baseCell = glm::uvec3(std::numeric_limits<uint32_t>::max());
+                for (uint32_t vertex : vertices)
+                    header.baseCell = glm::min(header.baseCell, cells[vertex]);
+            }
+            const ClusterLayout layout = clusterLayout(header);
+            const size_t paddedSize = (layout.size + PageSize - 1) / PageSize * PageSize;
+            blob.assign(paddedSize, 0);
+            std::memcpy(blob.data(), &header, sizeof(header));
+            std::memcpy(blob.data() + sizeof(header), nodes.data(), nodes.size() * sizeof(BVHInterface::Node));
+            std::memcpy(blob.data() + layout.triangles, triangles.data(), triangles.size() * sizeof(glm::u16vec3));
+            for (size_t i = 0; i < vertices.size(); i++) {
+                const Vertex& vertex = mesh.vertices[vertices[i]];
+                if (!(encoding.flags & CompressedAttributes)) {
+                    std::memcpy(blob.data() + layout.positions + i * sizeof(Vertex), &vertex, sizeof(Vertex));
+                    continue;
+                }
+                if (encoding.flags & QuantisedPositions) {
+                    // Cells of a cluster span at most 65535 steps (see `chooseEncoding()`)
+                    const glm::u16vec3 cellOffset { glm::min(cells[vertices[i]] - header.baseCell, glm::uvec3(65535)) };
+                    std::memcpy(blob.data() + layout.positions + i * sizeof(cellOffset), &cellOffset, sizeof(cellOffset));
+                } else {
+                    std::memcpy(blob.data() + layout.positions + i * sizeof(glm::vec3), &vertex.position, sizeof(glm::vec3));
+                }
+                const glm::uvec2 attributes { encodeOctahedral(vertex.normal), encodeTexCoord(vertex.texCoord, encoding.flags & UnormTexCoords) };
+                std::memcpy(blob.data() + layout.attributes + i * sizeof(attributes), &attributes, sizeof(attributes));
+            }
+            out.write(blob.data(), std::streamsize(blob.size()));
+
+            // The root of the cluster's BVH bounds its triangles as they are decoded
+            table.push_back({ nodes[0].aabb, offset, layout.size });
+            offset += paddedSize;
+        }
+    }
+
+    out.write(reinterpret_cast<const char*>(table.data()), std::streamsize(table.size() * sizeof(ClusterTableEntry)));
+    const PagedFileHeader header { PagedFileMagic, PagedFileVersion, geometryHash, table.size(), offset };
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.close();
+    if (!out)
+        return false;
+    std::filesystem::rename(tempPath, path, error);
+    return !error;
+}
+
+bool GeometryCache::openPagedFile(const std::filesystem::path& path, uint64_t geometryHash)
+{
+    m_fd = openReadOnly(path);
+    PagedFileHeader header {};
+    std::vector<ClusterTableEntry> table;
+    const auto readTable = [&]() {
+        if (m_fd < 0 || !readAt(m_fd, 0, &header, sizeof(header)) || header.magic != PagedFileMagic || header.version != PagedFileVersion || header.geometryHash != geometryHash)
+            return false;
+        table.resize(header.numClusters);
+        return readAt(m_fd, header.tableOffset, table.data(), table.size() * sizeof(ClusterTableEntry));
+    };
+    if (!readTable()) {
+        if (m_fd >= 0)
+            closeFile(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    // Build the top-level BVH, and store the clusters in the order of its leaves
+    std::vector<AxisAlignedBox> bounds(table.size());
+    std::transform(std::begin(table), std::end(table), std::begin(bounds), [](const ClusterTableEntry& entry) { return entry.bounds; });
+    std::vector<uint32_t> order(table.size());
+    std::iota(std::begin(order), std::end(order), 0u);
+    m_topLevelNodes = buildHierarchy(bounds, order, 1);
+    for (uint32_t clusterID : order) {
+        m_clusterBounds.push_back(table[clusterID].bounds);
+        m_clusterRecords.push_back({ table[clusterID].fileOffset, table[clusterID].size });
+    }
+    return true;
+}
+
+std::shared_ptr<const GeometryCache::Cluster> GeometryCache::readCluster(uint32_t clusterID)
+{
+    const ClusterRecord& record = m_clusterRecords[clusterID];
+    auto cluster = std::make_shared<Cluster>();
+    cluster->m_data.resize(record.size);
+    ClusterHeader header {};
+    if (!readAt(m_fd, record.fileOffset, cluster->m_data.data(), record.size) || record.size < sizeof(header)) {
+        // Treat an unreadable cluster as empty
+        std::cerr << "Failed to read cluster " << clusterID << " of the paged geometry file" << std::endl;
+        cluster->m_data.assign(sizeof(header), std::byte(0));
+    }
+    std::memcpy(&header, cluster->m_data.data(), sizeof(header));
+    const ClusterLayout layout = clusterLayout(header);
+    cluster->meshID = header.meshID;
+    cluster->m_flags = header.flags;
+    cluster->m_numNodes = header.numNodes;
+    cluster->m_numVertices = header.numVertices;
+    cluster->m_numTriangles = header.numTriangles;
+    cluster->m_trianglesOffset = layout.triangles;
+    cluster->m_positionsOffset = layout.positions;
+    cluster->m_attributesOffset = layout.attributes;
+    cluster->m_baseCell = header.baseCell;
+    cluster->m_gridOrigin = header.gridOrigin;
+    cluster->m_gridStep = header.gridStep;
+    m_bytesRead += record.size;
+    return cluster;
+}
+
+GeometryCache::Shard& GeometryCache::shardOf(uint32_t clusterID)
+{
+    static_assert(std::tuple_size_v<decltype(m_shards)> == 16);
+    return m_shards[(uint64_t(clusterID) * 0x9E3779B97F4A7C15ull) >> 60];
+}
+
+std::shared_ptr<const GeometryCache::Cluster> GeometryCache::cluster(uint32_t clusterID)
+{
+    Shard& shard = shardOf(clusterID);
+    {
+        std::scoped_lock lock { shard.mutex };
+        if (auto iter = shard.clusters.find(clusterID); iter != std::end(shard.clusters)) {
+            shard.lru.splice(std::begin(shard.lru), shard.lru, iter->second.second);
+            shard.hits++;
+            return iter->second.first;
+        }
+    }
+
+    // Miss; read the cluster without holding the lock, s.t. other lookups in this shard are not blocked
+    std::shared_ptr<const Cluster> cluster = readCluster(clusterID);
+    std::scoped_lock lock { shard.mutex };
+    shard.misses++;
+    insert(shard, clusterID, cluster);
+    return cluster;
+}
+
+void GeometryCache::insert(Shard& shard, uint32_t clusterID, std::shared_ptr<const Cluster> cluster)
+{
+    if (shard.clusters.contains(clusterID))
+        return; // Another thread read the same cluster in the meantime
+
+    const size_t size = cluster->m_data.size();
+    shard.lru.push_front(clusterID);
+    shard.clusters.emplace(clusterID, std::pair { std::move(cluster), std::begin(shard.lru) });
+    shard.numBytes += size;
+    size_t residentBytes = (m_residentBytes += size);
+    while (shard.numBytes > m_shardBudget && shard.lru.size() > 1) {
+        const auto iter = shard.clusters.find(shard.lru.back());
+        const size_t evictedSize = iter->second.first->m_data.size();
+        shard.clusters.erase(iter);
+        shard.lru.pop_back();
+        shard.numBytes -= evictedSize;
+        shard.evictions++;
+        residentBytes = (m_residentBytes -= evictedSize);
+    }
+    size_t peak = m_peakResidentBytes.load();
+    while (residentBytes > peak && !m_peakResidentBytes.compare_exchange_weak(peak, residentBytes)) { }
+}
+
+void GeometryCache::prefetch(std::span<const Ray> rays)
+{
+    if (m_topLevelNodes.empty() || m_clusterRecords.empty())
+        return;
+
+    // Find the clusters whose bounds every ray enters first
+    std::vector<uint32_t> requests;
+    for (const Ray& ray : rays) {
+        const glm::vec3 inverseDirection = 1.0f / ray.direction;
+        std::array<std::pair<float, uint32_t>, PrefetchClustersPerRay> nearest;
+        nearest.fill({ std::numeric_limits<float>::infinity(), 0 });
+        std::vector<uint32_t> stack { 0 };
+        while (!stack.empty()) {
+            const BVHInterface::Node& node = m_topLevelNodes[stack.back()];
+            stack.pop_back();
+            if (entryDistance(node.aabb, ray, inverseDirection) >= nearest.back().first)
+                continue;
+            if (node.isLeaf()) {
+                for (uint32_t i = node.primitiveOffset(); i < node.primitiveOffset() + node.primitiveCount(); i++) {
+                    nearest.back() = { entryDistance(m_clusterBounds[i], ray, inverseDirection), i };
+                    std::sort(std::begin(nearest), std::end(nearest));
+                }
+            } else {
+                stack.push_back(node.leftChild());
+                stack.push_back(node.rightChild());
+            }
+        }
+        for (const auto& [distance, clusterID] : nearest) {
+            if (distance != std::numeric_limits<float>::infinity())
+                requests.push_back(clusterID);
+        }
+    }
+
+    // Only queue clusters that are not resident yet
+    std::erase_if(requests, [&](uint32_t clusterID) {
+        Shard& shard = shardOf(clusterID);
+        std::scoped_lock lock { shard.mutex };
+        return shard.clusters.contains(clusterID);
+    });
+    if (requests.empty())
+        return;
+    {
+        std::scoped_lock lock { m_prefetchMutex };
+        for (uint32_t clusterID : requests) {
+            if (!m_queued.insert(clusterID).second)
+                continue;
+            m_prefetchQueue.push_back(clusterID);
+            if (m_prefetchQueue.size() > MaxQueuedPrefetches) {
+                m_queued.erase(m_prefetchQueue.front());
+                m_prefetchQueue.pop_front();
+            }
+        }
+    }
+    m_prefetchCondition.notify_one();
+}
+
+void GeometryCache::prefetchLoop()
+{
+    while (true) {
+        uint32_t clusterID;
+        {
+            std::unique_lock lock { m_prefetchMutex };
+            m_prefetchCondition.wait(lock, [&]() { return m_stopPrefetching || !m_prefetchQueue.empty(); });
+            if (m_stopPrefetching)
+                return;
+            clusterID = m_prefetchQueue.front();
+            m_prefetchQueue.pop_front();
+            m_queued.erase(clusterID);
+        }
+
+        Shard& shard = shardOf(clusterID);
+        {
+            std::scoped_lock lock { shard.mutex };
+            if (shard.clusters.contains(clusterID))
+                continue;
+        }
+        std::shared_ptr<const Cluster> cluster = readCluster(clusterID);
+        m_prefetches++;
+        std::scoped_lock lock { shard.mutex };
+        insert(shard, clusterID, std::move(cluster));
+    }
+}
+
+GeometryCache::Stats GeometryCache::stats() const
+{
+    Stats stats {};
+    for (const Shard& shard : m_shards) {
+        std::scoped_lock lock { shard.mutex };
+        stats.hits += shard.hits;
+        stats.misses += shard.misses;
+        stats.evictions += shard.evictions;
+    }
+    stats.prefetches = m_prefetches;
+    stats.bytesRead = m_bytesRead;
+    stats.residentBytes = m_residentBytes;
+    stats.peakResidentBytes = m_peakResidentBytes;
+    return stats;
+}
+
+void GeometryCache::resetStats()
+{
+    for (Shard& shard : m_shards) {
+        std::scoped_lock lock { shard.mutex };
+        shard.hits = shard.misses = shard.evictions = 0;
+    }
+    m_prefetches = 0;
+    m_bytesRead = 0;
+    m_peakResidentBytes = m_residentBytes.load();
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include "bvh_interface.h"
+#include "common.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/gtc/type_precision.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/mesh.h>
+#include <framework/ray.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct GeometryCacheConfig {
+    size_t budgetBytes = size_t(256) << 20; // Upper bound on the memory held by resident clusters
+    std::filesystem::path directory; // Where paged geometry files are kept; empty for a temp directory
+    uint32_t clusterSize = 4096; // Maximum nr. of triangles per cluster
+    bool compressAttributes = false; // Store quantised positions and encoded normals/texture coordinates
+};
+
+// Out-of-core triangle storage, shared by all render threads.
+//
+// The triangles of every mesh are split into spatially coherent clusters of at most `clusterSize`
+// triangles, by recursive median splits. Every cluster stores its own vertices, indexed by 16-bit
+// triangles, and a BVH over those triangles. Clusters are written once, page aligned, to a paged file in
+// the cache directory, named after a hash of the geometry; files written in an earlier run are reused.
+//
+// With `compressAttributes`, clusters store their vertices as separate streams (see vertex_encoding.h):
+// positions as 16-bit offsets on a grid over their mesh's bounds, and normals and texture coordinates in 32
+// bits each. Every mesh uses a single grid, s.t. vertices shared between clusters decode to the same point
+// and the surface stays watertight. Meshes whose grid would be too coarse (relative to their edges) keep
+// float positions. Traversal only decodes positions; the other attributes are decoded for hits.
+//
+// Only a top-level BVH over the clusters' bounds stays resident. Traversal loads the clusters it reaches
+// on demand, and keeps them in an LRU pool that holds at most the byte budget (but at least one cluster
+// per shard). The pool is split into shards with a lock each, like the pages of `TextureCache`. A
+// background thread loads clusters ahead of time when asked to by `prefetch()`, s.t. render threads find
+// them resident.
+class GeometryCache {
+public:
+    // A loaded cluster. Its BVH's leaves refer to ranges of `triangles()`, and the nodes' children are
+    // indices into `nodes()`, as in `BVHInterface`; the root is node 0.
+    class Cluster {
+    public:
+        uint32_t meshID;
+        [[nodiscard]] std::span<const BVHInterface::Node> nodes() const;
+        [[nodiscard]] std::span<const glm::u16vec3> triangles() const;
+        [[nodiscard]] glm::vec3 position(uint32_t vertex) const;
+        [[nodiscard]] Vertex vertex(uint32_t vertex) const;
+
+        // Construct the triangle as a BVH primitive, for `updateHitInfo()`
+        [[nodiscard]] BVHInterface::Primitive primitive(uint32_t triangle) const;
+
+    private:
+        friend class GeometryCache;
+        std::vector<std::byte> m_data; // Exactly as stored in the paged file
+        uint32_t m_flags;
+        uint32_t m_numNodes, m_numVertices, m_numTriangles;
+        size_t m_trianglesOffset, m_positionsOffset, m_attributesOffset; // Byte offsets into `m_data`
+        glm::uvec3 m_baseCell; // Grid cell that quantised positions are relative to
+        glm::vec3 m_gridOrigin, m_gridStep;
+    };
+
+    struct Stats {
+        uint64_t hits = 0; // Cluster lookups served from memory
+        uint64_t misses = 0; // Cluster lookups that read the paged file
+        uint64_t evictions = 0; // Clusters dropped to stay within the budget
+        uint64_t prefetches = 0; // Clusters read by the prefetch thread
+        uint64_t bytesRead = 0; // Bytes read from the paged file
+        size_t residentBytes = 0; // Bytes of clusters currently held
+        size_t peakResidentBytes = 0;
+    };
+
+    // Cluster the meshes and write them to the paged file, or open the file if it already exists. This
+    // processes one mesh at a time; the meshes' geometry is not referenced afterwards.
+    GeometryCache(const GeometryCacheConfig& config, std::span<const Mesh> meshes);
+    ~GeometryCache();
+    GeometryCache(const GeometryCache&) = delete;
+    GeometryCache& operator=(const GeometryCache&) = delete;
+
+    // Resident top-level BVH; its leaves refer to ranges of cluster IDs (of `clusterBounds()`).
+    [[nodiscard]] std::span<const BVHInterface::Node> topLevelNodes() const { return m_topLevelNodes; }
+    [[nodiscard]] std::span<const AxisAlignedBox> clusterBounds() const { return m_clusterBounds; }
+
+    // Return a cluster, reading it if it is not resident. The cluster stays alive while the pointer is
+    // held, even if it is evicted in the meantime.
+    [[nodiscard]] std::shared_ptr<const Cluster> cluster(uint32_t clusterID);
+
+    // Distance at which a ray enters a box (zero if it starts inside), or infinity if it misses the box
+    // before `ray.t`; `inverseDirection` is `1.0f / ray.direction`.
+    [[nodiscard]] static float entryDistance(const AxisAlignedBox& box, const Ray& ray, const glm::vec3& inverseDirection)
+    {
+        const glm::vec3 t0 = (box.lower - ray.origin) * inverseDirection;
+        const glm::vec3 t1 = (box.upper - ray.origin) * inverseDirection;
+        const glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+        const float entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        const float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, ray.t));
+        return entry <= exit ? entry : std::numeric_limits<float>::infinity();
+    }
+
+    // Ask the prefetch thread to load the clusters that the rays enter first, if they are not resident.
+    void prefetch(std::span<const Ray> rays);
+
+    [[nodiscard]] Stats stats() const;
+    void resetStats();
+
+private:
+    struct ClusterRecord {
+        uint64_t fileOffset;
+        uint64_t size;
+    };
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<uint32_t> lru; // Cluster IDs, most recently used first
+        std::unordered_map<uint32_t, std::pair<std::shared_ptr<const Cluster>, std::list<uint32_t>::iterator>> clusters;
+        size_t numBytes = 0;
+        uint64_t hits = 0, misses = 0, evictions = 0;
+    };
+
+    bool openPagedFile(const std::filesystem::path& path, uint64_t geometryHash);
+    bool writePagedFile(const std::filesystem::path& path, uint64_t geometryHash, std::span<const Mesh> meshes) const;
+    std::shared_ptr<const Cluster> readCluster(uint32_t clusterID);
+    Shard& shardOf(uint32_t clusterID);
+    // Add a cluster to its shard, evicting the least recently used ones beyond the budget; needs the shard's lock.
+    void insert(Shard& shard, uint32_t clusterID, std::shared_ptr<const Cluster> cluster);
+    void prefetchLoop();
+
+private:
+    GeometryCacheConfig m_config;
+    size_t m_shardBudget;
+    int m_fd = -1;
+
+    std::vector<BVHInterface::Node> m_topLevelNodes;
+    std::vector<AxisAlignedBox> m_clusterBounds;
+    std::vector<ClusterRecord> m_clusterRecords;
+
+    std::array<Shard, 16> m_shards;
+
+    // Clusters waiting to be prefetched; `m_queued` holds the same IDs, to skip duplicate requests
+    std::mutex m_prefetchMutex;
+    std::condition_variable m_prefetchCondition;
+    std::deque<uint32_t> m_prefetchQueue;
+    std::unordered_set<uint32_t> m_queued;
+    bool m_stopPrefetching = false;
+    std::thread m_prefetchThread;
+
+    // Only updated on misses
+    std::atomic<uint64_t> m_bytesRead { 0 }, m_prefetches { 0 };
+    std::atomic<size_t> m_residentBytes { 0 }, m_peakResidentBytes { 0 };
+};
@@ -0,0 +1,136 @@
+#include "kernel.h"
+#include "bvh.h"
+#include "recursive.h"
+
+uint32_t kernel::maskFromFeatures(const Features& features)
+{
+    uint32_t mask = 0;
+    for (Flag flag : { Shading, Shadows, Transparency, Textures, BilinearFiltering, NormalInterp, Reflections, GlossyReflection, EnvironmentMap, AccelStructure, MipmapFiltering, LightImportanceSampling, LightTree, AdaptiveShadowSampling }) {
+        if (featureEnabled(features, flag)) {
+            mask |= flag;
+        }
+    }
+
+    // The shading model is only evaluated if shading is enabled
+    if (features.enableShading) {
+        mask |= static_cast<uint32_t>(features.shadingModel) << 10;
+    } else {
+        mask &= ~Shading;
+    }
+
+    // Bilinear and mipmap filtering only affect textures and the environment map, and trilinear
+    // mipmap lookups replace bilinear ones
+    if (!(mask & (Textures | EnvironmentMap))) {
+        mask &= ~(BilinearFiltering | MipmapFiltering);
+    }
+    if (mask & MipmapFiltering) {
+        mask &= ~BilinearFiltering;
+    }
+
+    // Shadow rays can only be skipped if they are traced
+    if (!(mask & Shadows)) {
+        mask &= ~AdaptiveShadowSampling;
+    }
+
+    // Glossy reflections replace specular reflections, so they require reflections
+    if (!(mask & Reflections)) {
+        mask &= ~GlossyReflection;
+    }
+
+    return mask;
+}
+
+bool kernel::featureEnabled(const Features& features, Flag flag)
+{
+    switch (flag) {
+        case Shading:
+            return features.enableShading;
+        case Shadows:
+            return features.enableShadows;
+        case Transparency:
+            return features.enableTransparency;
+        case Textures:
+            return features.enableTextureMapping;
+        case BilinearFiltering:
+            return features.enableBilinearTextureFiltering;
+        case NormalInterp:
+            return features.enableNormalInterp;
+        case Reflections:
+            return features.enableReflections;
+        case GlossyReflection:
+            return features.extra.enableGlossyReflection;
+        case EnvironmentMap:
+            return features.extra.enableEnvironmentMap;
+        case AccelStructure:
+            return features.enableAccelStructure;
+        case MipmapFiltering:
+            return features.extra.enableMipmapTextureFiltering;
+        case LightImportanceSampling:
+            return features.extra.enableLightImportanceSampling;
+        case LightTree:
+            return features.extra.enableLightTree;
+        case AdaptiveShadowSampling:
+            return features.extra.enableAdaptiveShadowSampling;
+        default:
+            return false;
+    }
+}
+
+glm::vec3 kernel::renderDebugRays(RenderState& state, std::span<const Ray> rays, DebugRecording& recording)
+{
+    state.debugRecording = &recording;
+    glm::vec3 L = renderRays<Dynamic | DebugDraw>(state, rays, 0);
+    state.debugRecording = nullptr;
+    return L;
+}
+
+kernel::RenderKernel kernel::selectRenderKernel(const Scene& scene, const Features& features)
+{
+    if (!hasMaterialTable(scene)) {
+        return &renderRays<Dynamic>;
+    }
+
+    switch (maskFromFeatures(features)) {
+#define SELECT_RENDER_KERNEL(Mask) \
+    case (Mask):                   \
+        return &renderRays<(Mask)>;
+        FOR_EACH_SPECIALISED_RENDER_KERNEL(SELECT_RENDER_KERNEL)
+#undef SELECT_RENDER_KERNEL
+        default:
+            return &renderRays<Dynamic | MaterialTable>;
+    }
+}
+
+kernel::HitKernel kernel::selectHitKernel(const Scene& scene, const Features& features)
+{
+    if (!hasMaterialTable(scene)) {
+        return &renderRayFromHit<Dynamic>;
+    }
+
+    switch (maskFromFeatures(features)) {
+#define SELECT_HIT_KERNEL(Mask) \
+    case (Mask):                \
+        return &renderRayFromHit<(Mask)>;
+        FOR_EACH_SPECIALISED_RENDER_KERNEL(SELECT_HIT_KERNEL)
+#undef SELECT_HIT_KERNEL
+        default:
+            return &renderRayFromHit<Dynamic | MaterialTable>;
+    }
+}
+
+kernel::ResamplingKernel kernel::selectResamplingKernel(const Scene& scene, const Features& features)
+{
+    if (!hasMaterialTable(scene)) {
+        return { &intersect<Dynamic>, &::updateHitInfo, &computeShading<Dynamic> };
+    }
+
+    switch (maskFromFeatures(features)) {
+#define SELECT_RESAMPLING_KERNEL(Mask) \
+    case (Mask):                       \
+        return { &intersect<(Mask)>, &updateHitInfo<(Mask)>, &computeShading<(Mask)> };
+        FOR_EACH_SPECIALISED_RENDER_KERNEL(SELECT_RESAMPLING_KERNEL)
+#undef SELECT_RESAMPLING_KERNEL
+        default:
+            return { &intersect<Dynamic | MaterialTable>, &updateHitInfo<Dynamic | MaterialTable>, &computeShading<Dynamic | MaterialTable> };
+    }
+}
@@ -0,0 +1,294 @@
+#pragma once
+
+#include "bvh_interface.h"
+#include "common.h"
+#include "draw.h"
+#include "fwd.h"
+#include "render.h"
+#include "scene.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/ray.h>
+#include <cstdint>
+#include <span>
+
+// Render kernels are specialisations of the ray tracing code for a fixed set of features.
+//
+// Every `Features` toggle that the renderer branches on per ray, per hit or per light sample maps to a bit
+// in a kernel mask. The templated functions below take such a mask as their template argument, and test
+// the bits with `kernel::enabled<Mask>()`, which is a compile-time constant for specialised kernels. So a
+// specialised kernel only contains the code for the features it was built for, and none of the branches.
+//
+// `renderImage()` computes the mask for the active features once per frame, and looks up a matching
+// specialised kernel with `kernel::selectRenderKernel()`. Combinations that are not in the list below fall
+// back to the generic `kernel::Dynamic` kernel, which reads the `Features` object at runtime instead.
+//
+// The non-templated (unit-tested) functions in `shading.h`, `light.h`, `recursive.h` and `extra.h` simply
+// forward to the `kernel::Dynamic` instantiation of their counterparts here.
+namespace kernel {
+    enum Flag : uint32_t {
+        Shading = 1u << 0,
+        Shadows = 1u << 1,
+        Transparency = 1u << 2,
+        Textures = 1u << 3,
+        BilinearFiltering = 1u << 4,
+        NormalInterp = 1u << 5,
+        Reflections = 1u << 6,
+        GlossyReflection = 1u << 7,
+        EnvironmentMap = 1u << 8,
+        AccelStructure = 1u << 9,
+        MipmapFiltering = 1u << 12,
+        LightImportanceSampling = 1u << 13,
+        LightTree = 1u << 14,
+        AdaptiveShadowSampling = 1u << 15,
+
+        // Two bits storing the `ShadingModel`; only meaningful together with `Shading`
+        Lambertian = static_cast<uint32_t>(ShadingModel::Lambertian) << 10,
+        Phong = static_cast<uint32_t>(ShadingModel::Phong) << 10,
+        BlinnPhong = static_cast<uint32_t>(ShadingModel::BlinnPhong) << 10,
+        LinearGradient = static_cast<uint32_t>(ShadingModel::LinearGradient) << 10,
+        ShadingModelBits = 3u << 10,
+
+        // Not a feature; marks the generic kernel for scenes with an up-to-date material table (see `hasMaterialTable()`),
+        // which looks up materials in it, like the specialised kernels do
+        MaterialTable = 1u << 29,
+
+        // Not a feature; marks the kernel traced for the interactive debug ray, which records debug
+        // geometry into `RenderState::debugRecording`. No other kernel contains any debug code
+        DebugDraw = 1u << 30,
+
+        // Not a feature; marks the generic kernel, which reads all feature toggles at runtime
+        Dynamic = 1u << 31,
+    };
+
+    // Compute the kernel mask for a feature config. Toggles that have no effect given the other
+    // toggles (e.g. glossy reflections without reflections) are cleared, so that equivalent
+    // configurations map to the same specialised kernel.
+    uint32_t maskFromFeatures(const Features& features);
+
+    // Read a single feature toggle from a runtime feature config.
+    bool featureEnabled(const Features& features, Flag flag);
+
+    // Return whether `flag` is enabled in kernel `Mask`; this folds to a constant in specialised kernels.
+    template <uint32_t Mask>
+    [[nodiscard]] inline bool enabled(const Features& features, Flag flag)
+    {
+        if constexpr ((Mask & Dynamic) != 0) {
+            return featureEnabled(features, flag);
+        } else {
+            return (Mask & flag) != 0;
+        }
+    }
+
+    // Return the shading model of kernel `Mask`; this folds to a constant in specialised kernels.
+    template <uint32_t Mask>
+    [[nodiscard]] inline ShadingModel shadingModel(const Features& features)
+    {
+        if constexpr ((Mask & Dynamic) != 0) {
+            return features.shadingModel;
+        } else {
+            return static_cast<ShadingModel>((Mask & ShadingModelBits) >> 10);
+        }
+    }
+
+    // Return whether kernel `Mask` looks up materials in the scene's material table. Only the generic kernel for
+    // scenes without one reads `hitInfo.material` instead, which is filled in by the non-templated functions only.
+    template <uint32_t Mask>
+    inline constexpr bool usesMaterialTable = (Mask & Dynamic) == 0 || (Mask & MaterialTable) != 0;
+
+    // Return the material of a hit. Kernels that use the material table resolve `hitInfo.materialID` through it,
+    // and leave `hitInfo.material` empty, so no `Material` (and its texture's refcount) is copied per hit. The
+    // others read `hitInfo.material`, which callers in tests may set to any material.
+    template <uint32_t Mask>
+    [[nodiscard]] inline const Material& materialOf(const RenderState& state, const HitInfo& hitInfo)
+    {
+        if constexpr (!usesMaterialTable<Mask>) {
+            return hitInfo.material;
+        } else {
+            return state.scene.materials[hitInfo.materialID];
+        }
+    }
+
+    // Return the compact texture of a hit's material, or null if it has none. All kernels sample these instead
+    // of the material's `Image`, whose pixels are released once its texture exists (see `buildMaterialTable()`).
+    // Kernels that read `hitInfo.material` only use them if it is the table's material, and sample the `Image`
+    // of other materials.
+    template <uint32_t Mask>
+    [[nodiscard]] inline const Texture* textureOf(const RenderState& state, const HitInfo& hitInfo)
+    {
+        if constexpr (!usesMaterialTable<Mask>) {
+            const uint32_t id = hitInfo.materialID;
+            if (id >= state.scene.textures.size() || state.scene.materials[id].kdTexture != hitInfo.material.kdTexture)
+                return nullptr;
+            return state.scene.textures[id].get();
+        } else {
+            return state.scene.textures[hitInfo.materialID].get();
+        }
+    }
+
+    // Return the ID of a hit's material's texture in the scene's texture cache, or `TextureCache::InvalidTexture`
+    // if the texture is not streamed. Streamed materials have no `kdTexture`, so hits that do are never streamed.
+    template <uint32_t Mask>
+    [[nodiscard]] inline TextureCache::TextureID cachedTextureOf(const RenderState& state, const HitInfo& hitInfo)
+    {
+        if constexpr (!usesMaterialTable<Mask>) {
+            if (hitInfo.material.kdTexture || hitInfo.materialID >= state.scene.cachedTextures.size())
+                return TextureCache::InvalidTexture;
+        }
+        return state.scene.cachedTextures[hitInfo.materialID];
+    }
+
+    // Record a debug ray/sphere; this compiles to nothing in all kernels but the debug kernel.
+    template <uint32_t Mask>
+    inline void recordRay(RenderState& state, const Ray& ray, const glm::vec3& color)
+    {
+        if constexpr ((Mask & DebugDraw) != 0) {
+            state.debugRecording->recordRay(ray, color);
+        }
+    }
+    template <uint32_t Mask>
+    inline void recordSphere(RenderState& state, const glm::vec3& center, float radius, const glm::vec3& color)
+    {
+        if constexpr ((Mask & DebugDraw) != 0) {
+            state.debugRecording->recordSphere(center, radius, color);
+        }
+    }
+
+    // Trace rays for the interactive debug ray, recording debug geometry into `recording`.
+    glm::vec3 renderDebugRays(RenderState& state, std::span<const Ray> rays, DebugRecording& recording);
+
+    // Signature of a kernel's entry point; renders a set of rays and averages the result.
+    using RenderKernel = glm::vec3 (*)(RenderState& state, std::span<const Ray> rays, int rayDepth);
+
+    // Return the specialised kernel matching the features, or the generic kernel if there is none
+    // or the scene has no up-to-date material table; the latter reads materials from the hits.
+    RenderKernel selectRenderKernel(const Scene& scene, const Features& features);
+
+    // Signature of a kernel's entry point for rays whose first hit is already known, e.g. from a
+    // `VisibilityBuffer`; `ray.t` is the distance to the hit on `primitive`.
+    using HitKernel = glm::vec3 (*)(RenderState& state, const Ray& ray, const BVHInterface::Primitive& primitive, int rayDepth);
+
+    // Return the hit kernel of the same specialisation as `selectRenderKernel()`.
+    HitKernel selectHitKernel(const Scene& scene, const Features& features);
+
+    // Entry points of a kernel for resampling the direct light at camera ray hits, without rendering them; see
+    // `resampleDirectLighting()`. The hits and their shading match those of the render kernel.
+    struct ResamplingKernel {
+        bool (*intersect)(RenderState& state, Ray& ray, HitInfo& hitInfo);
+        void (*updateHitInfo)(RenderState& state, const BVHInterface::Primitive& primitive, const Ray& ray, HitInfo& hitInfo);
+        glm::vec3 (*computeShading)(RenderState& state, const glm::vec3& cameraDirection, const glm::vec3& lightDirection, const glm::vec3& lightColor, const HitInfo& hitInfo);
+    };
+
+    // Return the resampling kernel of the same specialisation as `selectRenderKernel()`.
+    ResamplingKernel selectResamplingKernel(const Scene& scene, const Features& features);
+
+    /* Templated counterparts of the render functions; see the non-templated versions for documentation */
+
+    // bvh.cpp
+    template <uint32_t Mask>
+    void updateHitInfo(RenderState& state, const BVHInterface::Primitive& primitive, const Ray& ray, HitInfo& hitInfo);
+    template <uint32_t Mask>
+    bool intersectRayWithBVH(RenderState& state, const BVHInterface& bvh, Ray& ray, HitInfo& hitInfo);
+
+    // Intersect a ray with the scene. The generic kernel calls through `BVHInterface::intersect()`, so that
+    // any BVH implementation is respected; specialised kernels traverse `state.bvh` directly.
+    template <uint32_t Mask>
+    [[nodiscard]] inline bool intersect(RenderState& state, Ray& ray, HitInfo& hitInfo)
+    {
+        if constexpr ((Mask & Dynamic) != 0) {
+            return state.bvh.intersect(state, ray, hitInfo);
+        } else {
+            return intersectRayWithBVH<Mask>(state, state.bvh, ray, hitInfo);
+        }
+    }
+
+    // shading.cpp
+    template <uint32_t Mask>
+    glm::vec3 sampleMaterialKd(RenderState& state, const HitInfo& hitInfo);
+    template <uint32_t Mask>
+    glm::vec3 computeShading(RenderState& state, const glm::vec3& cameraDirection, const glm::vec3& lightDirection, const glm::vec3& lightColor, const HitInfo& hitInfo);
+    template <uint32_t Mask>
+    glm::vec3 computeLambertianModel(RenderState& state, const glm::vec3& cameraDirection, const glm::vec3& lightDirection, const glm::vec3& lightColor, const HitInfo& hitInfo);
+    template <uint32_t Mask>
+    glm::vec3 computePhongModel(RenderState& state, const glm::vec3& cameraDirection, const glm::vec3& lightDirection, const glm::vec3& lightColor, const HitInfo& hitInfo);
+    template <uint32_t Mask>
+    glm::vec3 computeBlinnPhongModel(RenderState& state, const glm::vec3& cameraDirection, const glm::vec3& lightDirection, const glm::vec3& lightColor, const HitInfo& hitInfo);
+
+    // light.cpp
+    template <uint32_t Mask>
+    bool visibilityOfLightSampleBinary(RenderState& state, const glm::vec3& lightPosition, const glm::vec3& lightColor, const Ray& ray, const HitInfo& hitInfo);
+    template <uint32_t Mask>
+    glm::vec3 visibilityOfLightSampleTransparency(RenderState& state, const glm::vec3& lightPosition, const glm::vec3& lightColor, const Ray& ray, const HitInfo& hitInfo);
+    template <uint32_t Mask>
+    glm::vec3 visibilityOfLightSample(RenderState& state, const glm::vec3& lightPosition, const glm::vec3& lightColor, const Ray& ray, const HitInfo& hitInfo);
+    template <uint32_t Mask>
+    glm::vec3 computeContributionPointLight(RenderState& state, const PointLight& light, const Ray& ray, const HitInfo& hitInfo);
+    template <uint32_t Mask>
+    glm::vec3 computeContributionSegmentLight(RenderState& state, const SegmentLight& light, const Ray& ray, const HitInfo& hitInfo, uint32_t numSamples);
+    template <uint32_t Mask>
+    glm::vec3 computeContributionParallelogramLight(RenderState& state, const ParallelogramLight& light, const Ray& ray, const HitInfo& hitInfo, uint32_t numSamples);
+    template <uint32_t Mask>
+    glm::vec3 computeLightContribution(RenderState& state, const Ray& ray, const HitInfo& hitInfo);
+
+    // recursive.cpp
+    template <uint32_t Mask>
+    glm::vec3 renderRays(RenderState& state, std::span<const Ray> rays, int rayDepth);
+    template <uint32_t Mask>
+    glm::vec3 renderRay(RenderState& state, Ray ray, int rayDepth);
+    // The part of `renderRay()` after the intersection: shading and secondary rays
+    template <uint32_t Mask>
+    glm::vec3 shadeHit(RenderState& state, const Ray& ray, const HitInfo& hitInfo, int rayDepth);
+    template <uint32_t Mask>
+    glm::vec3 renderRayFromHit(RenderState& state, const Ray& ray, const BVHInterface::Primitive& primitive, int rayDepth);
+    template <uint32_t Mask>
+    void renderRaySpecularComponent(RenderState& state, Ray ray, const HitInfo& hitInfo, glm::vec3& hitColor, int rayDepth);
+    template <uint32_t Mask>
+    void renderRayTransparentComponent(RenderState& state, Ray ray, const HitInfo& hitInfo, glm::vec3& hitColor, int rayDepth);
+
+    // extra.cpp
+    template <uint32_t Mask>
+    void renderRayGlossyComponent(RenderState& state, Ray ray, const HitInfo& hitInfo, glm::vec3& hitColor, int rayDepth);
+    template <uint32_t Mask>
+    glm::vec3 sampleEnvironmentMap(RenderState& state, Ray ray);
+}
+
+// The feature combinations that get a specialised kernel, in addition to the generic `kernel::Dynamic` one.
+// Every entry is a full instantiation of the renderer, so only list combinations that are used often.
+// Masks must be normalized in the same way as `kernel::maskFromFeatures()` does, or they are never selected.
+#define FOR_EACH_SPECIALISED_RENDER_KERNEL(X)                                                                                                                                                    \
+    X(kernel::AccelStructure | kernel::Shading | kernel::Lambertian)                                                                                                                           \
+    X(kernel::AccelStructure | kernel::Shading | kernel::Lambertian | kernel::Shadows)                                                                                                         \
+    X(kernel::AccelStructure | kernel::Shading | kernel::Phong)                                                                                                                                \
+    X(kernel::AccelStructure | kernel::Shading | kernel::Phong | kernel::Shadows)                                                                                                              \
+    X(kernel::AccelStructure | kernel::Shading | kernel::Phong | kernel::Shadows | kernel::NormalInterp)                                                                                       \
+    X(kernel::AccelStructure | kernel::Shading | kernel::Phong | kernel::Shadows | kernel::Reflections)                                                                                        \
+    X(kernel::AccelStructure | kernel::Shading | kernel::Phong | kernel::Shadows | kernel::Reflections | kernel::NormalInterp)                                                                 \
+    X(kernel::AccelStructure | kernel::Shading | kernel::Phong | kernel::Shadows | kernel::Reflections | kernel::NormalInterp | kernel::Textures)                                              \
+    X(kernel::AccelStructure | kernel::Shading | kernel::Phong | kernel::Shadows | kernel::Reflections | kernel::NormalInterp | kernel::Textures | kernel::BilinearFiltering)                  \
+    X(kernel::AccelStructure | kernel::Shading | kernel::Phong | kernel::Shadows | kernel::Reflections | kernel::NormalInterp | kernel::Textures | kernel::MipmapFiltering)                    \
+    X(kernel::AccelStructure | kernel::Shading | kernel::Phong | kernel::Shadows | kernel::Reflections | kernel::NormalInterp | kernel::Transparency)                                          \
+    X(kernel::AccelStructure | kernel::Shading | kernel::Phong | kernel::Shadows | kernel::Reflections | kernel::NormalInterp | kernel::LightImportanceSampling)                               \
+    X(kernel::AccelStructure | kernel::Shading | kernel::Phong | kernel::Shadows | kernel::Reflections | kernel::NormalInterp | kernel::AdaptiveShadowSampling)                                \
+    X(kernel::AccelStructure | kernel::Shading | kernel::Phong | kernel::Shadows | kernel::Reflections | kernel::NormalInterp | kernel::LightImportanceSampling | kernel::AdaptiveShadowSampling) \
+    X(kernel::AccelStructure | kernel::Shading | kernel::Phong | kernel::Shadows | kernel::Reflections | kernel::NormalInterp | kernel::LightTree)                                             \
+    X(kernel::AccelStructure | kernel::Shading | kernel::Phong | kernel::Shadows | kernel::Reflections | kernel::NormalInterp | kernel::LightImportanceSampling | kernel::LightTree)            \
+    X(kernel::AccelStructure | kernel::Shading | kernel::BlinnPhong)                                                                                                                           \
+    X(kernel::AccelStructure | kernel::Shading | kernel::BlinnPhong | kernel::Shadows)                                                                                                         \
+    X(kernel::AccelStructure | kernel::Shading | kernel::BlinnPhong | kernel::Shadows | kernel::NormalInterp)                                                                                  \
+    X(kernel::AccelStructure | kernel::Shading | kernel::BlinnPhong | kernel::Shadows | kernel::Reflections)                                                                                   \
+    X(kernel::AccelStructure | kernel::Shading | kernel::BlinnPhong | kernel::Shadows | kernel::Reflections | kernel::NormalInterp)                                                            \
+    X(kernel::AccelStructure | kernel::Shading | kernel::BlinnPhong | kernel::Shadows | kernel::Reflections | kernel::NormalInterp | kernel::LightImportanceSampling)                          \
+    X(kernel::AccelStructure | kernel::Shading | kernel::BlinnPhong | kernel::Shadows | kernel::Reflections | kernel::NormalInterp | kernel::Textures | kernel::BilinearFiltering)             \
+    X(kernel::AccelStructure | kernel::Shading | kernel::BlinnPhong | kernel::Shadows | kernel::Reflections | kernel::NormalInterp | kernel::Textures | kernel::MipmapFiltering)               \
+    X(kernel::AccelStructure | kernel::Shading | kernel::LinearGradient)                                                                                                                       \
+    X(kernel::AccelStructure | kernel::Shading | kernel::LinearGradient | kernel::Shadows)                                                                                                     \
+    X(kernel::AccelStructure | kernel::Shading | kernel::LinearGradient | kernel::Shadows | kernel::NormalInterp)
+
+// All kernels that are instantiated; the specialised ones plus the generic fallbacks.
+#define FOR_EACH_RENDER_KERNEL(X)          \
+    FOR_EACH_SPECIALISED_RENDER_KERNEL(X) \
+    X(kernel::Dynamic)                    \
+    X(kernel::Dynamic | kernel::MaterialTable) \
+    X(kernel::Dynamic | kernel::DebugDraw)
@@ -3,14 +3,27 @@
 #include "config.h"
 #include "draw.h"
 #include "intersect.h"
+#include "kernel.h"
+#include "light_tree.h"
 #include "render.h"
+#include "reservoir.h"
 #include "scene.h"
 #include "shading.h"
+#include "shadow_packet.h"
 // Suppress warnings in third-party code.
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
 #include <glm/geometric.hpp>
+#include <glm/gtc/constants.hpp>
 DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <initializer_list>
+#include <limits>
+#include <optional>
+#include <span>
+#include <utility>
 
 
 // TODO: Standard feature
@@ -63,9 +76,10 @@ void sampleParallelogramLight(const glm::vec2& sample, const ParallelogramLight&
 // - hitInfo;       information about the current intersection
 // - return;        whether the light is visible (true) or not (false)
 // This method is unit-tested, so do not change the function signature.
-bool visibilityOfLightSampleBinary(RenderState& state, const glm::vec3& lightPosition, const glm::vec3 &lightColor, const Ray& ray, const HitInfo& hitInfo)
+template <uint32_t Mask>
+bool kernel::visibilityOfLightSampleBinary(RenderState& state, const glm::vec3& lightPosition, const glm::vec3& lightColor, const Ray& ray, const HitInfo& hitInfo)
 {
-    if (!state.features.enableShadows) {
+    if (!enabled<Mask>(state.features, Shadows)) {
         // Shadows are disabled in the renderer
         return true;
     } else {
@@ -82,13 +96,18 @@ bool visibilityOfLightSampleBinary(RenderState& state, const glm::vec3& lightPos
         // If it hits a different point, the light is not visible from the intersection point
 
         HitInfo lightRayHitInfo;
-        bool intersects = state.bvh.intersect(state, lightRay, lightRayHitInfo);
+        bool intersects = intersect<Mask>(state, lightRay, lightRayHitInfo);
         bool expectedRayT = std::fabs(lightRay.t - glm::length(intersectionPoint - lightPosition)) <= 5e-4f;
 
         return intersects && expectedRayT;
     }
 }
 
+bool visibilityOfLightSampleBinary(RenderState& state, const glm::vec3& lightPosition, const glm::vec3& lightColor, const Ray& ray, const HitInfo& hitInfo)
+{
+    return kernel::visibilityOfLightSampleBinary<kernel::Dynamic>(state, lightPosition, lightColor, ray, hitInfo);
+}
+
 // TODO: Standard feature
 // Given a sampled position on some light, and the emitted color at this position, return the actual
 // light that is visible from the provided ray/intersection, or 0 if this is not the case.
@@ -104,7 +123,8 @@ bool visibilityOfLightSampleBinary(RenderState& state, const glm::vec3& lightPos
 // - return;        the visible light color that reaches the intersection
 //
 // This method is unit-tested, so do not change the function signature.
-glm::vec3 visibilityOfLightSampleTransparency(RenderState& state, const glm::vec3& lightPosition, const glm::vec3& lightColor, const Ray& ray, const HitInfo& hitInfo)
+template <uint32_t Mask>
+glm::vec3 kernel::visibilityOfLightSampleTransparency(RenderState& state, const glm::vec3& lightPosition, const glm::vec3& lightColor, const Ray& ray, const HitInfo& hitInfo)
 {
     glm::vec3 incomingLightColor = lightColor;
     glm::vec3 prevLight = lightColor;
@@ -122,12 +142,13 @@ glm::vec3 visibilityOfLightSampleTransparency(RenderState& state, const glm::vec
         };
 
         HitInfo lightRayHitInfo;
-        intersects = state.bvh.intersect(state, lightRay, lightRayHitInfo);
+        intersects = intersect<Mask>(state, lightRay, lightRayHitInfo);
         finalRayT = std::fabs(lightRay.t - glm::length(intersectionPoint - lightRay.origin)) <= 1e-5f;
 
         if (intersects) {
             prevLight = incomingLightColor;
-            incomingLightColor = incomingLightColor * lightRayHitInfo.material.kd * (1.0f - lightRayHitInfo.material.transparency); // light that remains
+            const Material& material = materialOf<Mask>(state, lightRayHitInfo);
+            incomingLightColor = incomingLightColor * material.kd * (1.0f - material.transparency); // light that remains
             lightRayOrigin = lightRay.origin + (lightRay.t + 1e-6f) * lightRay.direction;
         }
     }
@@ -135,6 +156,11 @@ glm::vec3 visibilityOfLightSampleTransparency(RenderState& state, const glm::vec
     return prevLight;
 }
 
+glm::vec3 visibilityOfLightSampleTransparency(RenderState& state, const glm::vec3& lightPosition, const glm::vec3& lightColor, const Ray& ray, const HitInfo& hitInfo)
+{
+    return kernel::visibilityOfLightSampleTransparency<kernel::Dynamic>(state, lightPosition, lightColor, ray, hitInfo);
+}
+
 // TODO: Standard feature
 // Given a single point light, compute its contribution towards an incident ray at an intersection point.
 //
@@ -148,14 +174,404 @@ glm::vec3 visibilityOfLightSampleTransparency(RenderState& state, const glm::vec
 // - return;  reflected light along the incident ray, based on `computeShading()`
 //
 // This method is unit-tested, so do not change the function signature.
-glm::vec3 computeContributionPointLight(RenderState& state, const PointLight& light, const Ray& ray, const HitInfo& hitInfo)
+template <uint32_t Mask>
+glm::vec3 kernel::computeContributionPointLight(RenderState& state, const PointLight& light, const Ray& ray, const HitInfo& hitInfo)
 {
-    glm::vec3 visibleLight = visibilityOfLightSample(state, light.position, light.color, ray, hitInfo);
+    glm::vec3 visibleLight = visibilityOfLightSample<Mask>(state, light.position, light.color, ray, hitInfo);
     glm::vec3 p = ray.origin + ray.t * ray.direction;
     glm::vec3 l = glm::normalize(light.position - p);
     glm::vec3 v = -ray.direction;
     
-    return computeShading(state, v, l, visibleLight, hitInfo);
+    return computeShading<Mask>(state, v, l, visibleLight, hitInfo);
+}
+
+glm::vec3 computeContributionPointLight(RenderState& state, const PointLight& light, const Ray& ray, const HitInfo& hitInfo)
+{
+    return kernel::computeContributionPointLight<kernel::Dynamic>(state, light, ray, hitInfo);
+}
+
+// Transform a uniformly distributed 1d sample in [0, 1) into a sample of the linear density on [0, 1) that is
+// proportional to `a` at 0 and to `b` at 1; after pbrt-v4's `SampleLinear()`
+float sampleLinear(float sample, float a, float b)
+{
+    if (a + b == 0.0f)
+        return sample;
+    if (sample == 0.0f && a == 0.0f)
+        return 0.0f;
+    const float x = sample * (a + b) / (a + std::sqrt(glm::mix(a * a, b * b, sample)));
+    return std::min(x, 0x1.fffffep-1f);
+}
+float linearPdf(float x, float a, float b)
+{
+    return 2.0f * glm::mix(a, b, x) / (a + b);
+}
+
+// Transform a uniformly distributed 2d sample in [0, 1) into a sample of the bilinear density on [0, 1)^2 that
+// is proportional to `weights` at (0, 0), (1, 0), (0, 1) and (1, 1), by sampling y from its marginal first
+glm::vec2 sampleBilinear(const glm::vec2& sample, const glm::vec4& weights)
+{
+    const float y = sampleLinear(sample.y, weights[0] + weights[1], weights[2] + weights[3]);
+    return { sampleLinear(sample.x, glm::mix(weights[0], weights[2], y), glm::mix(weights[1], weights[3], y)), y };
+}
+float bilinearPdf(const glm::vec2& p, const glm::vec4& weights)
+{
+    const float sum = weights[0] + weights[1] + weights[2] + weights[3];
+    return 4.0f * glm::mix(glm::mix(weights[0], weights[1], p.x), glm::mix(weights[2], weights[3], p.x), p.y) / sum;
+}
+
+// Return whether the shading at a hit is zero for lights behind it, and falls off with the cosine towards
+// them; this holds for the Lambertian, Phong and Blinn-Phong models, except on transparent surfaces, which are
+// also lit from behind
+template <uint32_t Mask>
+static bool isShadingCosineWeighted(RenderState& state, const HitInfo& hitInfo)
+{
+    if (!kernel::enabled<Mask>(state.features, kernel::Shading) || kernel::shadingModel<Mask>(state.features) == ShadingModel::LinearGradient)
+        return false;
+    return !kernel::enabled<Mask>(state.features, kernel::Transparency) || kernel::materialOf<Mask>(state, hitInfo).transparency >= 1.0f;
+}
+
+// Importance of a point on a light for sampling: its brightness, times the cosine towards it at the hit
+static float lightSampleWeight(const glm::vec3& point, const glm::vec3& normal, const glm::vec3& position, const glm::vec3& color)
+{
+    return std::max(glm::dot(normal, glm::normalize(position - point)), 0.0f) * (color.x + color.y + color.z);
+}
+
+// Lights whose contribution at a hit may reach this value get the full number of shadow samples under adaptive
+// shadow sampling; dimmer lights get proportionally fewer
+static constexpr float FullShadowSamplingContribution = 0.25f;
+
+// Shadow rays towards the samples of a single light at a hit. Without adaptive shadow sampling, every sample traces
+// its own ray. With it, fewer samples are taken of lights that can only contribute little at the hit, and once the
+// first batch of rays agrees, i.e. they are all unoccluded or all occluded, the hit is taken to be fully lit or
+// fully in shadow, and the remaining samples reuse that visibility without tracing a ray. So only penumbrae get the
+// full budget. A batch may agree even if a small occluder lies between its rays; this bias shrinks as batches grow.
+struct ShadowSampling {
+    uint32_t numSamples; // Samples to take of the light
+    uint32_t batchSize; // Rays traced before the rest may be skipped
+    uint32_t numTraced = 0;
+    uint32_t numVisible = 0; // Traced rays whose light was not attenuated at all
+    uint32_t numOccluded = 0; // Traced rays whose light was blocked completely
+
+    // Whether all samples are known to be visible, or known to be occluded, if the first batch agreed
+    [[nodiscard]] std::optional<bool> agreement() const
+    {
+        if (numTraced < batchSize || (numVisible != numTraced && numOccluded != numTraced))
+            return {};
+        return numVisible == numTraced;
+    }
+};
+
+// Largest component of any of a light's colors
+static float maxComponent(std::initializer_list<glm::vec3> colors)
+{
+    float result = 0.0f;
+    for (const glm::vec3& color : colors)
+        result = std::max({ result, color.x, color.y, color.z });
+    return result;
+}
+
+// Plan the shadow sampling of a light with the given corners (or endpoints), and largest color component
+template <uint32_t Mask>
+static ShadowSampling planShadowSampling(RenderState& state, const Ray& ray, const HitInfo& hitInfo, uint32_t numSamples, std::span<const glm::vec3> corners, float maxColor)
+{
+    if (!kernel::enabled<Mask>(state.features, kernel::AdaptiveShadowSampling))
+        return { .numSamples = numSamples, .batchSize = std::numeric_limits<uint32_t>::max() };
+
+    // Bound the light's contribution by its brightness, times the peak of the shading model, if any part of the light
+    // may be in front of the hit; lights do not fall off with distance, so their solid angle does not matter here
+    const glm::vec3 p = ray.origin + ray.t * ray.direction;
+    const glm::vec3 n = glm::normalize(hitInfo.normal);
+    float bound = maxColor;
+    if (isShadingCosineWeighted<Mask>(state, hitInfo) && std::all_of(corners.begin(), corners.end(), [&](const glm::vec3& corner) { return glm::dot(corner - p, n) <= 0.0f; }))
+        bound = 0.0f;
+    if (!kernel::enabled<Mask>(state.features, kernel::Shading) || kernel::shadingModel<Mask>(state.features) != ShadingModel::LinearGradient) {
+        glm::vec3 peak = kernel::sampleMaterialKd<Mask>(state, hitInfo);
+        if (kernel::enabled<Mask>(state.features, kernel::Shading) && kernel::shadingModel<Mask>(state.features) != ShadingModel::Lambertian)
+            peak += kernel::materialOf<Mask>(state, hitInfo).ks;
+        bound *= std::max({ peak.x, peak.y, peak.z });
+    }
+
+    const uint32_t batchSize = std::clamp(state.features.extra.adaptiveShadowBatch, 1u, std::max(numSamples, 1u));
+    const auto scaledSamples = static_cast<uint32_t>(std::ceil(float(numSamples) * std::min(bound / FullShadowSamplingContribution, 1.0f)));
+    return { .numSamples = std::max(scaledSamples, std::min(batchSize, numSamples)), .batchSize = batchSize };
+}
+
+// A sample on a light, and the light from it that reaches a hit, as set by `traceShadowRays()`
+struct ShadowedLightSample {
+    glm::vec3 position;
+    glm::vec3 color;
+    glm::vec3 visibleColor { 0.0f };
+};
+
+// Return whether a kernel traces the shadow rays of area lights in packets, with `traceShadowPacket()`. This takes
+// binary visibility, and a BVH that holds the triangles. The generic kernel always traces through
+// `BVHInterface::intersect()`, and the debug kernel records every shadow ray.
+template <uint32_t Mask>
+static bool useShadowPackets(const RenderState& state)
+{
+    if constexpr ((Mask & (kernel::Dynamic | kernel::DebugDraw)) != 0) {
+        return false;
+    } else {
+        return kernel::enabled<Mask>(state.features, kernel::Shadows) && !kernel::enabled<Mask>(state.features, kernel::Transparency)
+            && kernel::enabled<Mask>(state.features, kernel::AccelStructure) && !state.scene.geometryCache;
+    }
+}
+
+// Set the light that is visible from a hit for samples of a single light, like `visibilityOfLightSample()` for
+// each of them in order, but skip the shadow rays once the first batch of the light's samples agreed. Shadow
+// rays are traced in packets if the kernel supports it, where the first batch ends a packet.
+template <uint32_t Mask>
+static void traceShadowRays(RenderState& state, ShadowSampling& shadows, std::span<ShadowedLightSample> samples, const Ray& ray, const HitInfo& hitInfo)
+{
+    const auto record = [&](ShadowedLightSample& sample, const glm::vec3& visibleColor) {
+        sample.visibleColor = visibleColor;
+        shadows.numTraced++;
+        shadows.numVisible += visibleColor == sample.color;
+        shadows.numOccluded += visibleColor == glm::vec3(0.0f);
+    };
+
+    const glm::vec3 p = ray.origin + ray.t * ray.direction;
+    for (size_t first = 0; first < samples.size();) {
+        if (const std::optional<bool> visible = shadows.agreement()) {
+            for (ShadowedLightSample& sample : samples.subspan(first))
+                sample.visibleColor = *visible ? sample.color : glm::vec3(0.0f);
+            return;
+        }
+
+        if (!useShadowPackets<Mask>(state)) {
+            ShadowedLightSample& sample = samples[first++];
+            record(sample, kernel::visibilityOfLightSample<Mask>(state, sample.position, sample.color, ray, hitInfo));
+            continue;
+        }
+        const size_t remainingBatch = shadows.numTraced < shadows.batchSize ? size_t(shadows.batchSize - shadows.numTraced) : ShadowPacketSize;
+        const size_t count = std::min({ samples.size() - first, remainingBatch, ShadowPacketSize });
+        std::array<glm::vec3, ShadowPacketSize> targets;
+        std::array<bool, ShadowPacketSize> visible;
+        for (size_t i = 0; i < count; i++)
+            targets[i] = samples[first + i].position;
+        traceShadowPacket(state.scene, state.bvh, p, std::span(targets).first(count), visible);
+        for (size_t i = 0; i < count; i++)
+            record(samples[first + i], visible[i] ? samples[first + i].color : glm::vec3(0.0f));
+        first += count;
+    }
+}
+
+// Return where a ray from `point` along `direction` hits a parallelogram light, in the [0, 1)^2 parametrization
+// of `sampleParallelogramLight()`, if it does
+static std::optional<glm::vec2> intersectParallelogramLight(const ParallelogramLight& light, const glm::vec3& point, const glm::vec3& direction)
+{
+    const glm::vec3 normal = glm::cross(light.edge01, light.edge02);
+    const float cosine = glm::dot(direction, normal);
+    if (cosine == 0.0f)
+        return {};
+    const float t = glm::dot(light.v0 - point, normal) / cosine;
+    if (t <= 0.0f)
+        return {};
+    const glm::vec3 offset = point + t * direction - light.v0;
+    const float squaredArea = glm::dot(normal, normal);
+    const glm::vec2 parameters { glm::dot(glm::cross(offset, light.edge02), normal) / squaredArea, glm::dot(glm::cross(light.edge01, offset), normal) / squaredArea };
+    if (glm::any(glm::lessThan(parameters, glm::vec2(0.0f))) || glm::any(glm::greaterThanEqual(parameters, glm::vec2(1.0f))))
+        return {};
+    return parameters;
+}
+
+// Transform a uniformly distributed 2d sample in [0, 1) into a direction whose cosine to `axis` is distributed
+// as cos^exponent
+static glm::vec3 sampleCosinePower(const glm::vec3& axis, float exponent, const glm::vec2& sample)
+{
+    const float cosTheta = std::pow(1.0f - sample.x, 1.0f / (exponent + 1.0f));
+    const float sinTheta = std::sqrt(std::max(1.0f - cosTheta * cosTheta, 0.0f));
+    const float phi = 2.0f * glm::pi<float>() * sample.y;
+    const glm::vec3 helper = std::abs(axis.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+    const glm::vec3 tangent = glm::normalize(glm::cross(helper, axis));
+    const glm::vec3 bitangent = glm::cross(axis, tangent);
+    return sinTheta * std::cos(phi) * tangent + sinTheta * std::sin(phi) * bitangent + cosTheta * axis;
+}
+static float cosinePowerPdf(float cosTheta, float exponent)
+{
+    return cosTheta <= 0.0f ? 0.0f : (exponent + 1.0f) * std::pow(cosTheta, exponent) / (2.0f * glm::pi<float>());
+}
+
+// The specular lobe of the Phong/Blinn-Phong model at a hit, as a distribution of directions towards the lights:
+// cos^shininess around the mirrored view direction (Phong), or of half vectors around the normal (Blinn-Phong)
+struct SpecularLobe {
+    glm::vec3 normal;
+    glm::vec3 view;
+    glm::vec3 reflection;
+    float shininess;
+    bool halfVector;
+
+    [[nodiscard]] glm::vec3 sample(const glm::vec2& sample) const
+    {
+        if (!halfVector)
+            return sampleCosinePower(reflection, shininess, sample);
+        const glm::vec3 h = sampleCosinePower(normal, shininess, sample);
+        return 2.0f * glm::dot(view, h) * h - view;
+    }
+
+    // Probability density per unit solid angle
+    [[nodiscard]] float pdf(const glm::vec3& direction) const
+    {
+        if (!halfVector)
+            return cosinePowerPdf(glm::dot(reflection, direction), shininess);
+        const glm::vec3 h = glm::normalize(direction + view);
+        // Reflecting the view direction about h doubles angles, which spreads the density by 4 (v . h)
+        return glm::dot(view, h) <= 0.0f ? 0.0f : cosinePowerPdf(glm::dot(normal, h), shininess) / (4.0f * glm::dot(view, h));
+    }
+};
+
+// Return the specular lobe of the shading model at a hit, if it is Phong or Blinn-Phong and has one
+template <uint32_t Mask>
+static std::optional<SpecularLobe> specularLobe(RenderState& state, const glm::vec3& view, const HitInfo& hitInfo)
+{
+    if (!kernel::enabled<Mask>(state.features, kernel::Shading))
+        return {};
+    const ShadingModel model = kernel::shadingModel<Mask>(state.features);
+    const Material& material = kernel::materialOf<Mask>(state, hitInfo);
+    if ((model != ShadingModel::Phong && model != ShadingModel::BlinnPhong) || material.ks == glm::vec3(0.0f))
+        return {};
+    const glm::vec3 n = glm::normalize(hitInfo.normal);
+    return SpecularLobe {
+        .normal = n,
+        .view = view,
+        .reflection = 2.0f * glm::dot(view, n) * n - view,
+        .shininess = material.shininess,
+        .halfVector = model == ShadingModel::BlinnPhong,
+    };
+}
+
+// Weight of a sample in multiple importance sampling by the power heuristic (Veach 1997), given its density
+// under the strategy that drew it, and under the other strategy
+static float powerHeuristic(float pdf, float otherPdf)
+{
+    return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+// Estimate the same average as `computeContributionSegmentLight()`, but with samples drawn along the segment in
+// proportion to a linear fit of `lightSampleWeight()` at its endpoints, s.t. fewer samples are spent on the parts
+// of the light that are dim or at a grazing angle to the hit
+template <uint32_t Mask>
+static glm::vec3 computeContributionSegmentLightImportanceSampled(RenderState& state, const SegmentLight& light, const Ray& ray, const HitInfo& hitInfo, uint32_t numSamples)
+{
+    const glm::vec3 p = ray.origin + ray.t * ray.direction;
+    const glm::vec3 n = glm::normalize(hitInfo.normal);
+    glm::vec2 weights { 1.0f };
+    if (isShadingCosineWeighted<Mask>(state, hitInfo)) {
+        weights = { lightSampleWeight(p, n, light.endpoint0, light.color0), lightSampleWeight(p, n, light.endpoint1, light.color1) };
+        // The light is behind the hit, or black
+        if (weights.x + weights.y == 0.0f)
+            return glm::vec3(0.0f);
+    }
+
+    const std::array endpoints { light.endpoint0, light.endpoint1 };
+    ShadowSampling shadows = planShadowSampling<Mask>(state, ray, hitInfo, numSamples, endpoints, maxComponent({ light.color0, light.color1 }));
+    glm::vec3 contribution { 0.0f };
+    std::array<ShadowedLightSample, ShadowPacketSize> samples;
+    std::array<float, ShadowPacketSize> pdfs;
+    for (uint32_t first = 0; first < shadows.numSamples; first += uint32_t(ShadowPacketSize)) {
+        // Draw a packet's worth of samples, trace their shadow rays, and then shade them
+        size_t count = 0;
+        for (uint32_t i = first; i < std::min(first + uint32_t(ShadowPacketSize), shadows.numSamples); i++) {
+            const float sample = sampleLinear(state.sampler.next_1d(SampleDimension::Light), weights.x, weights.y);
+            // Endpoints of zero weight are only sampled by rounding; their shading is zero
+            if (const float pdf = linearPdf(sample, weights.x, weights.y); pdf > 0.0f) {
+                sampleSegmentLight(sample, light, samples[count].position, samples[count].color);
+                pdfs[count++] = pdf;
+            }
+        }
+        traceShadowRays<Mask>(state, shadows, std::span(samples).first(count), ray, hitInfo);
+        for (size_t i = 0; i < count; i++)
+            contribution += kernel::computeShading<Mask>(state, -ray.direction, glm::normalize(samples[i].position - p), samples[i].visibleColor, hitInfo) / pdfs[i];
+    }
+    return shadows.numSamples > 0 ? contribution / float(shadows.numSamples) : contribution;
+}
+
+// Estimate the same average as `computeContributionParallelogramLight()`, but with samples drawn on the light in
+// proportion to a bilinear fit of `lightSampleWeight()` at its corners. With the Phong and Blinn-Phong models,
+// every light sample is paired with a sample of the specular lobe, which finds the highlights of large lights on
+// glossy surfaces, and the two are combined by multiple importance sampling.
+template <uint32_t Mask>
+static glm::vec3 computeContributionParallelogramLightImportanceSampled(RenderState& state, const ParallelogramLight& light, const Ray& ray, const HitInfo& hitInfo, uint32_t numSamples)
+{
+    const glm::vec3 p = ray.origin + ray.t * ray.direction;
+    const glm::vec3 n = glm::normalize(hitInfo.normal);
+    const glm::vec3 view = -glm::normalize(ray.direction);
+    const glm::vec3 lightNormal = glm::cross(light.edge01, light.edge02); // Its length is the light's area
+
+    // Weights at the corners (0, 0), (1, 0), (0, 1) and (1, 1) of the light's parametrization
+    glm::vec4 weights { 1.0f };
+    if (isShadingCosineWeighted<Mask>(state, hitInfo)) {
+        weights = { lightSampleWeight(p, n, light.v0, light.color0), lightSampleWeight(p, n, light.v0 + light.edge01, light.color2),
+            lightSampleWeight(p, n, light.v0 + light.edge02, light.color1), lightSampleWeight(p, n, light.v0 + light.edge01 + light.edge02, light.color3) };
+        // The light is behind the hit, or black
+        if (weights == glm::vec4(0.0f))
+            return glm::vec3(0.0f);
+    }
+    const std::array corners { light.v0, light.v0 + light.edge01, light.v0 + light.edge02, light.v0 + light.edge01 + light.edge02 };
+    ShadowSampling shadows = planShadowSampling<Mask>(state, ray, hitInfo, numSamples, corners, maxComponent({ light.color0, light.color1, light.color2, light.color3 }));
+    const std::optional<SpecularLobe> lobe = specularLobe<Mask>(state, view, hitInfo);
+    // Density of sampling a position on the light through the specular lobe, in the light's [0, 1)^2 parametrization,
+    // whose unit square has the light's area
+    const auto lobePdf = [&](const glm::vec3& position) {
+        const glm::vec3 toLight = position - p;
+        const float squaredDistance = glm::dot(toLight, toLight);
+        const glm::vec3 direction = toLight / std::sqrt(squaredDistance);
+        return lobe->pdf(direction) * std::abs(glm::dot(direction, lightNormal)) / squaredDistance;
+    };
+    // Shade a sample on the light; with a specular lobe, the diffuse and specular parts are returned separately,
+    // as only the latter is combined with samples of the lobe; the lobe would add noise to the diffuse part
+    struct Shading {
+        glm::vec3 diffuse { 0.0f }, specular { 0.0f };
+    };
+    const auto shade = [&](const ShadowedLightSample& sample) {
+        const glm::vec3 l = glm::normalize(sample.position - p);
+        const glm::vec3& lightColor = sample.visibleColor;
+        const glm::vec3 shading = kernel::computeShading<Mask>(state, view, l, lightColor, hitInfo);
+        if (!lobe)
+            return Shading { shading };
+        const glm::vec3 diffuse = kernel::computeLambertianModel<Mask>(state, view, l, lightColor, hitInfo);
+        return Shading { diffuse, shading - diffuse };
+    };
+
+    // Samples of the light, and of the lobe, with the density they were drawn with, and their MIS weight
+    struct WeightedSample {
+        float pdf;
+        float misWeight;
+        bool fromLobe;
+    };
+    glm::vec3 contribution { 0.0f };
+    std::array<ShadowedLightSample, 2 * ShadowPacketSize> samples;
+    std::array<WeightedSample, 2 * ShadowPacketSize> weightedSamples;
+    for (uint32_t first = 0; first < shadows.numSamples; first += uint32_t(ShadowPacketSize)) {
+        // Draw a packet's worth of samples of both strategies, trace their shadow rays, and then shade them
+        size_t count = 0;
+        for (uint32_t i = first; i < std::min(first + uint32_t(ShadowPacketSize), shadows.numSamples); i++) {
+            const glm::vec2 sample = sampleBilinear(state.sampler.next_2d(SampleDimension::Light), weights);
+            // Edges between corners of zero weight are only sampled by rounding; their shading is zero
+            if (const float lightPdf = bilinearPdf(sample, weights); lightPdf > 0.0f) {
+                sampleParallelogramLight(sample, light, samples[count].position, samples[count].color);
+                weightedSamples[count] = { lightPdf, lobe ? powerHeuristic(lightPdf, lobePdf(samples[count].position)) : 1.0f, false };
+                count++;
+            }
+
+            if (!lobe)
+                continue;
+            const glm::vec3 direction = lobe->sample(state.sampler.next_2d(SampleDimension::Brdf));
+            if (const std::optional<glm::vec2> hit = intersectParallelogramLight(light, p, direction)) {
+                sampleParallelogramLight(*hit, light, samples[count].position, samples[count].color);
+                if (const float pdf = lobePdf(samples[count].position); pdf > 0.0f)
+                    weightedSamples[count++] = { pdf, powerHeuristic(pdf, bilinearPdf(*hit, weights)), true };
+            }
+        }
+
+        traceShadowRays<Mask>(state, shadows, std::span(samples).first(count), ray, hitInfo);
+        for (size_t i = 0; i < count; i++) {
+            const Shading shading = shade(samples[i]);
+            const WeightedSample& weighted = weightedSamples[i];
+            contribution += ((weighted.fromLobe ? glm::vec3(0.0f) : shading.diffuse) + shading.specular * weighted.misWeight) / weighted.pdf;
+        }
+    }
+    return shadows.numSamples > 0 ? contribution / float(shadows.numSamples) : contribution;
 }
 
 // TODO: Standard feature
@@ -175,25 +591,40 @@ glm::vec3 computeContributionPointLight(RenderState& state, const PointLight& li
 // - return;     accumulated light along the incident ray, based on `computeShading()`
 //
 // This method is unit-tested, so do not change the function signature.
-glm::vec3 computeContributionSegmentLight(RenderState& state, const SegmentLight& light, const Ray& ray, const HitInfo& hitInfo, uint32_t numSamples)
+template <uint32_t Mask>
+glm::vec3 kernel::computeContributionSegmentLight(RenderState& state, const SegmentLight& light, const Ray& ray, const HitInfo& hitInfo, uint32_t numSamples)
 {
     // implement this function; repeat numSamples times:
     // - sample the segment light
     // - test the sample's visibility
     // - then evaluate the phong model
 
+    if (enabled<Mask>(state.features, LightImportanceSampling))
+        return computeContributionSegmentLightImportanceSampled<Mask>(state, light, ray, hitInfo, numSamples);
+
     glm::vec3 contribution = glm::vec3(0);
+    glm::vec3 p = ray.origin + ray.t * ray.direction;
 
-    for (int i = 0; i < numSamples; i++) {
-        glm::vec3 position, color;
-        sampleSegmentLight(state.sampler.next_1d(), light, position, color);
-        glm::vec3 lightColor = visibilityOfLightSample(state, position, color, ray, hitInfo);
-        contribution += computeShading(state, -ray.direction, position, lightColor, hitInfo) / (1.0f * numSamples);
+    const std::array endpoints { light.endpoint0, light.endpoint1 };
+    ShadowSampling shadows = planShadowSampling<Mask>(state, ray, hitInfo, numSamples, endpoints, maxComponent({ light.color0, light.color1 }));
+    std::array<ShadowedLightSample, ShadowPacketSize> samples;
+    for (uint32_t first = 0; first < shadows.numSamples; first += uint32_t(ShadowPacketSize)) {
+        const size_t count = std::min(size_t(shadows.numSamples - first), ShadowPacketSize);
+        for (size_t i = 0; i < count; i++)
+            sampleSegmentLight(state.sampler.next_1d(SampleDimension::Light), light, samples[i].position, samples[i].color);
+        traceShadowRays<Mask>(state, shadows, std::span(samples).first(count), ray, hitInfo);
+        for (size_t i = 0; i < count; i++)
+            contribution += computeShading<Mask>(state, -ray.direction, glm::normalize(samples[i].position - p), samples[i].visibleColor, hitInfo) / float(shadows.numSamples);
     }
 
     return contribution;
 }
 
+glm::vec3 computeContributionSegmentLight(RenderState& state, const SegmentLight& light, const Ray& ray, const HitInfo& hitInfo, uint32_t numSamples)
+{
+    return kernel::computeContributionSegmentLight<kernel::Dynamic>(state, light, ray, hitInfo, numSamples);
+}
+
 // TODO: Standard feature
 // Given a single parralelogram light, compute its contribution towards an incident ray at an intersection point
 // by integrating over the parralelogram, taking `numSamples` samples from the light source, and applying
@@ -212,25 +643,40 @@ glm::vec3 computeContributionSegmentLight(RenderState& state, const SegmentLight
 // - return;     accumulated light along the incident ray, based on `computeShading()`
 //
 // This method is unit-tested, so do not change the function signature.
-glm::vec3 computeContributionParallelogramLight(RenderState& state, const ParallelogramLight& light, const Ray& ray, const HitInfo& hitInfo, uint32_t numSamples)
+template <uint32_t Mask>
+glm::vec3 kernel::computeContributionParallelogramLight(RenderState& state, const ParallelogramLight& light, const Ray& ray, const HitInfo& hitInfo, uint32_t numSamples)
 {
     // implement this function; repeat numSamples times:
     // - sample the parallellogram light
     // - test the sample's visibility
     // - then evaluate the phong model
 
+    if (enabled<Mask>(state.features, LightImportanceSampling))
+        return computeContributionParallelogramLightImportanceSampled<Mask>(state, light, ray, hitInfo, numSamples);
+
     glm::vec3 contribution = glm::vec3(0);
+    glm::vec3 p = ray.origin + ray.t * ray.direction;
 
-    for (int i = 0; i < numSamples; i++) {
-        glm::vec3 position, color;
-        sampleParallelogramLight(state.sampler.next_2d(), light, position, color);
-        glm::vec3 lightColor = visibilityOfLightSample(state, position, color, ray, hitInfo);
-        contribution += computeShading(state, -ray.direction, position, lightColor, hitInfo) / (1.0f * numSamples);
+    const std::array corners { light.v0, light.v0 + light.edge01, light.v0 + light.edge02, light.v0 + light.edge01 + light.edge02 };
+    ShadowSampling shadows = planShadowSampling<Mask>(state, ray, hitInfo, numSamples, corners, maxComponent({ light.color0, light.color1, light.color2, light.color3 }));
+    std::array<ShadowedLightSample, ShadowPacketSize> samples;
+    for (uint32_t first = 0; first < shadows.numSamples; first += uint32_t(ShadowPacketSize)) {
+        const size_t count = std::min(size_t(shadows.numSamples - first), ShadowPacketSize);
+        for (size_t i = 0; i < count; i++)
+            sampleParallelogramLight(state.sampler.next_2d(SampleDimension::Light), light, samples[i].position, samples[i].color);
+        traceShadowRays<Mask>(state, shadows, std::span(samples).first(count), ray, hitInfo);
+        for (size_t i = 0; i < count; i++)
+            contribution += computeShading<Mask>(state, -ray.direction, glm::normalize(samples[i].position - p), samples[i].visibleColor, hitInfo) / float(shadows.numSamples);
     }
 
     return contribution;
 }
 
+glm::vec3 computeContributionParallelogramLight(RenderState& state, const ParallelogramLight& light, const Ray& ray, const HitInfo& hitInfo, uint32_t numSamples)
+{
+    return kernel::computeContributionParallelogramLight<kernel::Dynamic>(state, light, ray, hitInfo, numSamples);
+}
+
 // This function is provided as-is. You do not have to implement it.
 // Given a sampled position on some light, and the emitted color at this position, return the actual
 // light that is visible from the provided ray/intersection, or 0 if this is not the case.
@@ -244,33 +690,87 @@ glm::vec3 computeContributionParallelogramLight(RenderState& state, const Parall
 // - return;        the visible light color that reaches the intersection
 //
 // This method is unit-tested, so do not change the function signature.
-glm::vec3 visibilityOfLightSample(RenderState& state, const glm::vec3& lightPosition, const glm::vec3& lightColor, const Ray& ray, const HitInfo& hitInfo)
+template <uint32_t Mask>
+glm::vec3 kernel::visibilityOfLightSample(RenderState& state, const glm::vec3& lightPosition, const glm::vec3& lightColor, const Ray& ray, const HitInfo& hitInfo)
 {
-    if (!state.features.enableShadows) {
+    if (!enabled<Mask>(state.features, Shadows)) {
         // Shadows are disabled in the renderer
         return lightColor;
-    } else if (!state.features.enableTransparency) {
+    } else if (!enabled<Mask>(state.features, Transparency)) {
         // Shadows are enabled but transparency is disabled
-        return visibilityOfLightSampleBinary(state, lightPosition, lightColor, ray, hitInfo) ? lightColor : glm::vec3(0);
+        return visibilityOfLightSampleBinary<Mask>(state, lightPosition, lightColor, ray, hitInfo) ? lightColor : glm::vec3(0);
     } else {
         // Shadows and transparency are enabled
-        return visibilityOfLightSampleTransparency(state, lightPosition, lightColor, ray, hitInfo);
+        return visibilityOfLightSampleTransparency<Mask>(state, lightPosition, lightColor, ray, hitInfo);
     }
 }
 
+glm::vec3 visibilityOfLightSample(RenderState& state, const glm::vec3& lightPosition, const glm::vec3& lightColor, const Ray& ray, const HitInfo& hitInfo)
+{
+    return kernel::visibilityOfLightSample<kernel::Dynamic>(state, lightPosition, lightColor, ray, hitInfo);
+}
+
 // This function is provided as-is. You do not have to implement it.
-glm::vec3 computeLightContribution(RenderState& state, const Ray& ray, const HitInfo& hitInfo)
+template <uint32_t Mask>
+static glm::vec3 computeContributionLight(RenderState& state, const Scene::SceneLight& light, const Ray& ray, const HitInfo& hitInfo)
 {
-    // Iterate over all lights
-    glm::vec3 Lo { 0.0f };
-    for (const auto& light : state.scene.lights) {
-        if (std::holds_alternative<PointLight>(light)) {
-            Lo += computeContributionPointLight(state, std::get<PointLight>(light), ray, hitInfo);
-        } else if (std::holds_alternative<SegmentLight>(light)) {
-            Lo += computeContributionSegmentLight(state, std::get<SegmentLight>(light), ray, hitInfo, state.features.numShadowSamples);
-        } else if (std::holds_alternative<ParallelogramLight>(light)) {
-            Lo += computeContributionParallelogramLight(state, std::get<ParallelogramLight>(light), ray, hitInfo, state.features.numShadowSamples);
+    if (std::holds_alternative<PointLight>(light)) {
+        return kernel::computeContributionPointLight<Mask>(state, std::get<PointLight>(light), ray, hitInfo);
+    } else if (std::holds_alternative<SegmentLight>(light)) {
+        return kernel::computeContributionSegmentLight<Mask>(state, std::get<SegmentLight>(light), ray, hitInfo, state.features.numShadowSamples);
+    } else {
+        return kernel::computeContributionParallelogramLight<Mask>(state, std::get<ParallelogramLight>(light), ray, hitInfo, state.features.numShadowSamples);
+    }
+}
+
+template <uint32_t Mask>
+glm::vec3 kernel::computeLightContribution(RenderState& state, const Ray& ray, const HitInfo& hitInfo)
+{
+    // The direct light at a camera ray's hit may have been resampled up front
+    if (state.reservoir) {
+        const Reservoir& reservoir = *std::exchange(state.reservoir, nullptr);
+        if (reservoir.weight == 0.0f)
+            return glm::vec3 { 0.0f };
+        const glm::vec3 p = ray.origin + ray.t * ray.direction;
+        const glm::vec3 lightColor = visibilityOfLightSample<Mask>(state, reservoir.sample.position, reservoir.sample.color, ray, hitInfo);
+        return computeShading<Mask>(state, -ray.direction, glm::normalize(reservoir.sample.position - p), lightColor, hitInfo) * reservoir.weight;
+    }
+
+    // Pick a few lights through the light tree, and divide their contribution by the probability of picking them
+    if (enabled<Mask>(state.features, LightTree) && state.lightTree) {
+        const glm::vec3 p = ray.origin + ray.t * ray.direction;
+        const glm::vec3 n = glm::normalize(hitInfo.normal);
+        const bool cosineWeighted = isShadingCosineWeighted<Mask>(state, hitInfo);
+        const uint32_t numSamples = state.features.extra.numLightTreeSamples;
+        if (numSamples == 0)
+            return glm::vec3 { 0.0f };
+        glm::vec3 Lo { 0.0f };
+        for (uint32_t i = 0; i < numSamples; i++) {
+            const float sample = state.sampler.next_1d(SampleDimension::LightSelection);
+            if (const auto selection = state.lightTree->sample(sample, p, n, cosineWeighted, state.features.extra.lightTreeThreshold))
+                Lo += computeContributionLight<Mask>(state, state.scene.lights[selection->light], ray, hitInfo) / selection->probability;
         }
+        return Lo / float(numSamples);
     }
+
+    // Iterate over all lights
+    glm::vec3 Lo { 0.0f };
+    for (const auto& light : state.scene.lights)
+        Lo += computeContributionLight<Mask>(state, light, ray, hitInfo);
     return Lo;
-}
\ No newline at end of file
+}
+
+glm::vec3 computeLightContribution(RenderState& state, const Ray& ray, const HitInfo& hitInfo)
+{
+    return kernel::computeLightContribution<kernel::Dynamic>(state, ray, hitInfo);
+}
+
+#define INSTANTIATE_LIGHT_KERNEL(Mask)                                                                                                                                                         \
+    template bool kernel::visibilityOfLightSampleBinary<Mask>(RenderState&, const glm::vec3&, const glm::vec3&, const Ray&, const HitInfo&);                                                 \
+    template glm::vec3 kernel::visibilityOfLightSampleTransparency<Mask>(RenderState&, const glm::vec3&, const glm::vec3&, const Ray&, const HitInfo&);                                      \
+    template glm::vec3 kernel::visibilityOfLightSample<Mask>(RenderState&, const glm::vec3&, const glm::vec3&, const Ray&, const HitInfo&);                                                  \
+    template glm::vec3 kernel::computeContributionPointLight<Mask>(RenderState&, const PointLight&, const Ray&, const HitInfo&);                                                             \
+    template glm::vec3 kernel::computeContributionSegmentLight<Mask>(RenderState&, const SegmentLight&, const Ray&, const HitInfo&, uint32_t);                                                \
+    template glm::vec3 kernel::computeContributionParallelogramLight<Mask>(RenderState&, const ParallelogramLight&, const Ray&, const HitInfo&, uint32_t);                                    \
+    template glm::vec3 kernel::computeLightContribution<Mask>(RenderState&, const Ray&, const HitInfo&);
+FOR_EACH_RENDER_KERNEL(INSTANTIATE_LIGHT_KERNEL)
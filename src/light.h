@@ -4,7 +4,9 @@
 #include "fwd.h"
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
 DISABLE_WARNINGS_POP()
 #include <framework/ray.h>
 
@@ -63,6 +65,18 @@ glm::vec3 computeContributionSegmentLight(RenderState& state, const SegmentLight
 // This method is unit-tested, so do not change the function signature.
 glm::vec3 computeContributionParallelogramLight(RenderState& state, const ParallelogramLight& parallelogramLight, const Ray& ray, const HitInfo& hitInfo, uint32_t numSamples);
 
+/* Importance sampling */
+
+// Transform a uniformly distributed 1d sample in [0, 1) into a sample of the linear density on [0, 1) that is
+// proportional to `a` at 0 and to `b` at 1, and return that density at a point.
+float sampleLinear(float sample, float a, float b);
+float linearPdf(float x, float a, float b);
+
+// Transform a uniformly distributed 2d sample in [0, 1) into a sample of the bilinear density on [0, 1)^2 that is
+// proportional to `weights` at (0, 0), (1, 0), (0, 1) and (1, 1), and return that density at a point.
+glm::vec2 sampleBilinear(const glm::vec2& sample, const glm::vec4& weights);
+float bilinearPdf(const glm::vec2& p, const glm::vec4& weights);
+
 /* Provided functions */
 
 // This function is provided as-is. You do not have to implement it.
@@ -0,0 +1,216 @@
+#include "light_tree.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <variant>
+
+// The lights of a node are split at one of the boundaries between this many bins along each axis
+static constexpr int NumBins = 12;
+
+namespace {
+struct BuildLight {
+    AxisAlignedBox bounds;
+    glm::vec3 centroid;
+    float power;
+    uint32_t index;
+};
+}
+
+float lightPower(const Scene::SceneLight& light)
+{
+    const auto brightness = [](const glm::vec3& color) { return color.x + color.y + color.z; };
+    if (std::holds_alternative<PointLight>(light)) {
+        return brightness(std::get<PointLight>(light).color);
+    } else if (std::holds_alternative<SegmentLight>(light)) {
+        const auto& segment = std::get<SegmentLight>(light);
+        return brightness(segment.color0 + segment.color1) / 2.0f;
+    } else {
+        const auto& parallelogram = std::get<ParallelogramLight>(light);
+        return brightness(parallelogram.color0 + parallelogram.color1 + parallelogram.color2 + parallelogram.color3) / 4.0f;
+    }
+}
+
+static AxisAlignedBox lightBounds(const Scene::SceneLight& light)
+{
+    if (std::holds_alternative<PointLight>(light)) {
+        const glm::vec3 position = std::get<PointLight>(light).position;
+        return { position, position };
+    } else if (std::holds_alternative<SegmentLight>(light)) {
+        const auto& segment = std::get<SegmentLight>(light);
+        return { glm::min(segment.endpoint0, segment.endpoint1), glm::max(segment.endpoint0, segment.endpoint1) };
+    } else {
+        const auto& parallelogram = std::get<ParallelogramLight>(light);
+        const glm::vec3 v3 = parallelogram.v0 + parallelogram.edge01 + parallelogram.edge02;
+        return { glm::min(glm::min(parallelogram.v0, v3), glm::min(parallelogram.v0 + parallelogram.edge01, parallelogram.v0 + parallelogram.edge02)),
+            glm::max(glm::max(parallelogram.v0, v3), glm::max(parallelogram.v0 + parallelogram.edge01, parallelogram.v0 + parallelogram.edge02)) };
+    }
+}
+
+static AxisAlignedBox merge(const AxisAlignedBox& lhs, const AxisAlignedBox& rhs)
+{
+    return { glm::min(lhs.lower, rhs.lower), glm::max(lhs.upper, rhs.upper) };
+}
+
+// Cost of a node for the build: its power times the radius of its bounding sphere, which is what widens the cone
+// of directions towards it, and so loosens the cosine bound of its importance
+static float nodeCost(const AxisAlignedBox& bounds, float power)
+{
+    return power * glm::length(bounds.upper - bounds.lower);
+}
+
+// Build the subtree over `lights` at the end of `nodes`, and return the index of its root
+static uint32_t buildNode(std::vector<LightTree::Node>& nodes, std::span<BuildLight> lights)
+{
+    AxisAlignedBox bounds = lights.front().bounds;
+    AxisAlignedBox centroidBounds { lights.front().centroid, lights.front().centroid };
+    float power = 0.0f;
+    for (const BuildLight& light : lights) {
+        bounds = merge(bounds, light.bounds);
+        centroidBounds = merge(centroidBounds, { light.centroid, light.centroid });
+        power += light.power;
+    }
+
+    const auto index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back({ .bounds = bounds, .power = power, .lightOrSecondChild = lights.front().index, .isLeaf = lights.size() == 1 });
+    if (lights.size() == 1)
+        return index;
+
+    // Pick the bin boundary with the lowest summed cost of both sides, over all axes
+    float bestCost = std::numeric_limits<float>::infinity();
+    int bestAxis = -1, bestSplit = 0;
+    const glm::vec3 extent = centroidBounds.upper - centroidBounds.lower;
+    const auto binOf = [&](const BuildLight& light, int axis) {
+        return std::min(int(float(NumBins) * (light.centroid[axis] - centroidBounds.lower[axis]) / extent[axis]), NumBins - 1);
+    };
+    for (int axis = 0; axis < 3; axis++) {
+        if (extent[axis] <= 0.0f)
+            continue;
+        std::array<AxisAlignedBox, NumBins> binBounds;
+        std::array<float, NumBins> binPower {};
+        std::array<bool, NumBins> binUsed {};
+        for (const BuildLight& light : lights) {
+            const int bin = binOf(light, axis);
+            binBounds[size_t(bin)] = binUsed[size_t(bin)] ? merge(binBounds[size_t(bin)], light.bounds) : light.bounds;
+            binPower[size_t(bin)] += light.power;
+            binUsed[size_t(bin)] = true;
+        }
+        // Costs of all bins below every boundary, swept from the bottom, and then those above it from the top
+        std::array<float, NumBins - 1> belowCost;
+        std::optional<AxisAlignedBox> sweptBounds;
+        float sweptPower = 0.0f;
+        for (int split = 0; split < NumBins - 1; split++) {
+            if (binUsed[size_t(split)])
+                sweptBounds = sweptBounds ? merge(*sweptBounds, binBounds[size_t(split)]) : binBounds[size_t(split)];
+            sweptPower += binPower[size_t(split)];
+            belowCost[size_t(split)] = sweptBounds ? nodeCost(*sweptBounds, sweptPower) : 0.0f;
+        }
+        sweptBounds.reset();
+        sweptPower = 0.0f;
+        for (int split = NumBins - 2; split >= 0; split--) {
+            if (binUsed[size_t(split + 1)])
+                sweptBounds = sweptBounds ? merge(*sweptBounds, binBounds[size_t(split + 1)]) : binBounds[size_t(split + 1)];
+            sweptPower += binPower[size_t(split + 1)];
+            const float cost = belowCost[size_t(split)] + (sweptBounds ? nodeCost(*sweptBounds, sweptPower) : 0.0f);
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = split;
+            }
+        }
+    }
+
+    // Split after the best bin, or into halves if that leaves one side empty, e.g. if all lights share a centroid
+    auto middle = lights.begin();
+    if (bestAxis >= 0)
+        middle = std::partition(lights.begin(), lights.end(), [&](const BuildLight& light) { return binOf(light, bestAxis) <= bestSplit; });
+    if (middle == lights.begin() || middle == lights.end()) {
+        const int axis = int(std::max_element(&extent[0], &extent[0] + 3) - &extent[0]);
+        middle = lights.begin() + std::ptrdiff_t(lights.size() / 2);
+        std::nth_element(lights.begin(), middle, lights.end(), [&](const BuildLight& lhs, const BuildLight& rhs) { return lhs.centroid[axis] < rhs.centroid[axis]; });
+    }
+
+    buildNode(nodes, std::span(lights.begin(), middle));
+    const uint32_t secondChild = buildNode(nodes, std::span(middle, lights.end()));
+    nodes[index].lightOrSecondChild = secondChild;
+    return index;
+}
+
+LightTree::LightTree(std::span<const Scene::SceneLight> lights)
+{
+    if (lights.empty())
+        return;
+    std::vector<BuildLight> buildLights;
+    buildLights.reserve(lights.size());
+    for (size_t i = 0; i < lights.size(); i++) {
+        const AxisAlignedBox bounds = lightBounds(lights[i]);
+        buildLights.push_back({ bounds, (bounds.lower + bounds.upper) / 2.0f, lightPower(lights[i]), static_cast<uint32_t>(i) });
+    }
+    m_nodes.reserve(2 * lights.size() - 1);
+    buildNode(m_nodes, buildLights);
+}
+
+// Importance of a node at a shading point: its power, times the largest cosine between the normal and the
+// directions into the node's bounding sphere, if lights behind the normal do not contribute
+static float importance(const LightTree::Node& node, const glm::vec3& point, const glm::vec3& normal, bool cosineWeighted)
+{
+    if (!cosineWeighted || node.power == 0.0f)
+        return node.power;
+
+    const glm::vec3 toCenter = (node.bounds.lower + node.bounds.upper) / 2.0f - point;
+    const float radius = glm::length(node.bounds.upper - node.bounds.lower) / 2.0f;
+    const float squaredDistance = glm::dot(toCenter, toCenter);
+    if (squaredDistance <= radius * radius)
+        return node.power;
+
+    // The cosine of the angle between the normal and the sphere's center, minus the sphere's half angle
+    const float distance = std::sqrt(squaredDistance);
+    const float cosNormal = glm::dot(normal, toCenter) / distance;
+    const float sinBounds = radius / distance;
+    const float cosBounds = std::sqrt(1.0f - sinBounds * sinBounds);
+    if (cosNormal >= cosBounds)
+        return node.power;
+    const float sinNormal = std::sqrt(std::max(1.0f - cosNormal * cosNormal, 0.0f));
+    return node.power * std::max(cosNormal * cosBounds + sinNormal * sinBounds, 0.0f);
+}
+
+std::optional<LightTree::Selection> LightTree::sample(float sample, const glm::vec3& point, const glm::vec3& normal, bool cosineWeighted, float threshold) const
+{
+    if (m_nodes.empty() || importance(m_nodes.front(), point, normal, cosineWeighted) == 0.0f)
+        return {};
+
+    // Descend to a leaf, and reuse the part of the sample within the chosen child's interval for the next choice
+    uint32_t index = 0;
+    float probability = 1.0f;
+    while (!m_nodes[index].isLeaf) {
+        const std::array children { index + 1, m_nodes[index].lightOrSecondChild };
+        float importance0 = importance(m_nodes[children[0]], point, normal, cosineWeighted);
+        float importance1 = importance(m_nodes[children[1]], point, normal, cosineWeighted);
+        if (threshold > 0.0f) {
+            const float original0 = importance0;
+            importance0 = importance0 < threshold * importance1 ? 0.0f : importance0;
+            importance1 = importance1 < threshold * original0 ? 0.0f : importance1;
+        }
+        // Both children may face away from the normal, even if their parent's bounds did not
+        if (importance0 + importance1 == 0.0f)
+            return {};
+
+        const float probability0 = importance0 / (importance0 + importance1);
+        if (sample < probability0) {
+            index = children[0];
+            sample = std::min(sample / probability0, 0x1.fffffep-1f);
+            probability *= probability0;
+        } else {
+            index = children[1];
+            sample = std::min((sample - probability0) / (1.0f - probability0), 0x1.fffffep-1f);
+            probability *= 1.0f - probability0;
+        }
+    }
+    return Selection { m_nodes[index].lightOrSecondChild, probability };
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "common.h"
+#include "scene.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+// A bounding volume hierarchy over a scene's lights, for picking lights at a shading point in proportion to an
+// estimate of their contribution there; after A. Conty Estevez and C. Kulla, "Importance Sampling of Many Lights
+// with Adaptive Tree Splitting", 2018. Picking a light walks from the root to a leaf, and takes one child at
+// every node, with a probability proportional to its importance; so it takes time logarithmic in the number
+// of lights.
+//
+// Every node stores the bounds and the total power of the lights below it. The importance of a node is its
+// power, times a bound on the cosine between the shading normal and the directions towards the node's bounds.
+// Lights in this renderer emit the same in every direction and do not fall off with distance (the contribution
+// of an area light is the mean over its surface), so nodes need no orientation cone, and there is no distance term.
+class LightTree {
+public:
+    struct Node {
+        AxisAlignedBox bounds;
+        float power; // Sum of the brightness of the lights below the node; see `lightPower()`
+        // Leaves hold a light; inner nodes are followed by their first child, and hold the index of the second
+        uint32_t lightOrSecondChild;
+        bool isLeaf;
+    };
+
+    struct Selection {
+        uint32_t light; // Index into `Scene::lights`
+        float probability;
+    };
+
+    explicit LightTree(std::span<const Scene::SceneLight> lights);
+
+    // Pick a light for a shading point, with a uniformly distributed sample in [0, 1). If `cosineWeighted` is set,
+    // lights behind the shading normal are taken to contribute nothing; see `isShadingCosineWeighted()`.
+    //
+    // With a `threshold` of 0, every light that may contribute is picked with a nonzero probability, so dividing
+    // its contribution by the probability is unbiased. Otherwise, a subtree is never picked if its importance is
+    // less than `threshold` times that of its sibling; this drops the contribution of the dimmest lights, but spends
+    // all samples on the lights that matter. Returns nothing if no light may contribute.
+    [[nodiscard]] std::optional<Selection> sample(float sample, const glm::vec3& point, const glm::vec3& normal, bool cosineWeighted, float threshold) const;
+
+    [[nodiscard]] std::span<const Node> nodes() const { return m_nodes; }
+
+private:
+    std::vector<Node> m_nodes;
+};
+
+// Brightness of a light, for comparing lights; the sum of its mean color's components
+float lightPower(const Scene::SceneLight& light);
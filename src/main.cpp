@@ -1,8 +1,15 @@
 #include "bvh.h"
+#include "camera.h"
 #include "config.h"
 #include "draw.h"
+#include "environment_map.h"
+#include "kernel.h"
 #include "light.h"
+#include "light_tree.h"
+#include "mesh_buffers.h"
+#include "postprocess.h"
 #include "render.h"
+#include "reservoir.h"
 #include "sampler.h"
 #include "recursive.h"
 #include "screen.h"
@@ -22,6 +29,7 @@ DISABLE_WARNINGS_POP()
 #include <cstdlib>
 #include <filesystem>
 #include <framework/imguizmo.h>
+#include <framework/mesh.h>
 #include <framework/trackball.h>
 #include <framework/variant_helper.h>
 #include <framework/window.h>
@@ -43,7 +51,7 @@ uint32_t debugRaySeed = 4; // Chosen by fair dice roll
 
 static void setOpenGLMatrices(const Trackball& camera);
 static void drawLightsOpenGL(const Scene& scene, const Trackball& camera, int selectedLight);
-static void drawSceneOpenGL(const Scene& scene);
+static void drawSceneOpenGL(const Scene& scene, MeshBuffers& meshBuffers);
 bool sliderIntSquarePower(const char* label, int* v, int v_min, int v_max);
 
 int main(int argc, char** argv)
@@ -55,6 +63,8 @@ int main(int argc, char** argv)
         // Add a default camera if no config file is given.
         config.cameras.emplace_back(CameraConfig {});
     }
+    if (config.meshCacheDirectory)
+        setMeshCacheDirectory(*config.meshCacheDirectory);
 
     if (!config.cliRenderingEnabled) {
         Trackball::printHelp();
@@ -69,14 +79,25 @@ int main(int argc, char** argv)
         SceneType sceneType { SceneType::SingleTriangle };
         std::vector<Ray> debugRays;
 
-        Scene scene = loadScenePrebuilt(sceneType, config.dataPath);
+        std::shared_ptr<TextureCache> textureCache = config.textureCache ? std::make_shared<TextureCache>(*config.textureCache) : nullptr;
+        // Environment maps are only read once sampled, and then shared between all scenes
+        const auto setEnvironmentMap = [&](Scene& newScene) {
+            if (!config.environmentMap.empty())
+                newScene.environmentMap = EnvironmentMap::get(config.environmentMap);
+        };
+        Scene scene = loadScenePrebuilt(sceneType, config.dataPath, textureCache);
+        setEnvironmentMap(scene);
         BVH bvh(scene, config.features);
+        PostProcessPipeline postProcess { postProcessPasses(config) };
+        MeshBuffers meshBuffers;
 
         int bvhDebugLevel = 0;
         int bvhDebugLeaf = 0;
         bool debugBVHLevel { false };
         bool debugBVHLeaf { false };
         ViewMode viewMode { ViewMode::Rasterization };
+        // Successive frames of the ray traced view reuse each other's resampled direct light
+        ReservoirHistory reservoirHistory;
 
         window.registerKeyCallback([&](int key, int /* scancode */, int action, int /* mods */) {
             if (action == GLFW_PRESS) {
@@ -124,7 +145,10 @@ int main(int argc, char** argv)
                 };
                 if (ImGui::Combo("Scenes", reinterpret_cast<int*>(&sceneType), items.data(), int(items.size()))) {
                     debugRays.clear();
-                    scene = loadScenePrebuilt(sceneType, config.dataPath);
+                    scene = loadScenePrebuilt(sceneType, config.dataPath, textureCache);
+                    setEnvironmentMap(scene);
+                    meshBuffers.invalidate();
+                    reservoirHistory.reset();
                     selectedLightIdx = scene.lights.empty() ? -1 : 0;
                     bvh = BVH(scene, config.features);
 
@@ -194,8 +218,8 @@ int main(int argc, char** argv)
                 if (config.features.extra.enableBloomEffect) {
                     ImGui::Indent();
                     // Add bloom settings here, if necessary
-                    uint32_t minSize = 1, maxSize = 30;
-                    ImGui::SliderScalar("Filter size", ImGuiDataType_U32, &config.features.extra.bloomFilterSize, &minSize, &maxSize);
+                    uint32_t minSize = 1, maxSize = 2048;
+                    ImGui::SliderScalar("Filter size", ImGuiDataType_U32, &config.features.extra.bloomFilterSize, &minSize, &maxSize, nullptr, ImGuiSliderFlags_Logarithmic);
                     ImGui::SliderFloat("Threshold", &config.features.extra.bloomFilterThreshold, 0.0f, 1.0f);
                     ImGui::SliderFloat("Intensity", &config.features.extra.bloomFilterIntensity, 0.0f, 1.0f);
                     ImGui::Unindent();
@@ -204,9 +228,9 @@ int main(int argc, char** argv)
                 if (config.features.extra.enableDepthOfField) {
                     ImGui::Indent();
                     // Add DOF settings here, if necessary
-                    ImGui::SliderFloat("Focal Length", &config.features.extra.focalLength, 1, 20);
-                    ImGui::SliderFloat("Aperture", &config.features.extra.aperture, 1, 50);
-                    ImGui::SliderInt("Ray samples", &config.features.extra.depthOfFieldNumSamples, 2, 64);
+                    ImGui::SliderFloat("Focus distance", &config.features.extra.focusDistance, 0.1f, 20.0f);
+                    ImGui::SliderFloat("Lens radius", &config.features.extra.lensRadius, 0.0f, 0.5f);
+                    ImGui::SliderInt("Lens samples", &config.features.extra.depthOfFieldNumSamples, 1, 64);
                     ImGui::Unindent();
                 }
                 ImGui::Checkbox("Motion blur", &config.features.extra.enableMotionBlur);
@@ -221,10 +245,47 @@ int main(int argc, char** argv)
                     uint32_t minSamples = 1u, maxSamples = 64u;
                     ImGui::Indent();
                     ImGui::SliderScalar("Glossy samples", ImGuiDataType_U32, &config.features.extra.numGlossySamples, &minSamples, &maxSamples);
+                    ImGui::Checkbox("Prefiltered environment map", &config.features.extra.enablePrefilteredEnvironmentMap);
                     ImGui::Unindent();
                 }
                 ImGui::Checkbox("Environment maps", &config.features.extra.enableEnvironmentMap);
                 ImGui::Checkbox("Texture filtering (mipmap)", &config.features.extra.enableMipmapTextureFiltering);
+                {
+                    constexpr std::array items { "Independent", "Sobol", "Halton", "Blue noise" };
+                    ImGui::Combo("Sampler", reinterpret_cast<int*>(&config.features.extra.samplerType), items.data(), int(items.size()));
+                }
+                ImGui::Checkbox("Light importance sampling", &config.features.extra.enableLightImportanceSampling);
+                ImGui::Checkbox("Adaptive shadow sampling", &config.features.extra.enableAdaptiveShadowSampling);
+                if (config.features.extra.enableAdaptiveShadowSampling) {
+                    uint32_t minBatch = 1u, maxBatch = 16u;
+                    ImGui::Indent();
+                    ImGui::SliderScalar("First batch", ImGuiDataType_U32, &config.features.extra.adaptiveShadowBatch, &minBatch, &maxBatch);
+                    ImGui::Unindent();
+                }
+                ImGui::Checkbox("Light tree", &config.features.extra.enableLightTree);
+                if (config.features.extra.enableLightTree) {
+                    uint32_t minSamples = 1u, maxSamples = 16u;
+                    ImGui::Indent();
+                    ImGui::SliderScalar("Lights per hit", ImGuiDataType_U32, &config.features.extra.numLightTreeSamples, &minSamples, &maxSamples);
+                    ImGui::SliderFloat("Light tree threshold", &config.features.extra.lightTreeThreshold, 0.0f, 0.5f);
+                    ImGui::Unindent();
+                }
+                ImGui::Checkbox("Resampled direct lighting (ReSTIR)", &config.features.extra.enableReSTIR);
+                if (config.features.extra.enableReSTIR) {
+                    ImGui::Indent();
+                    ImGui::SliderInt("Candidates", &config.features.extra.numReSTIRCandidates, 1, 128);
+                    ImGui::SliderInt("Spatial neighbours", &config.features.extra.numReSTIRSpatialNeighbours, 0, 16);
+                    ImGui::Checkbox("Temporal reuse", &config.features.extra.enableReSTIRTemporalReuse);
+                    ImGui::Unindent();
+                }
+                ImGui::Checkbox("Denoising", &config.features.extra.enableDenoising);
+                if (config.features.extra.enableDenoising) {
+                    ImGui::Indent();
+                    ImGui::SliderInt("Denoise iterations", &config.features.extra.denoiseIterations, 1, 8);
+                    ImGui::SliderFloat("Color sigma", &config.features.extra.denoiseColorSigma, 0.5f, 16.0f);
+                    ImGui::Unindent();
+                }
+                ImGui::Checkbox("Visibility buffer (rasterised primary hits)", &config.features.extra.enableVisibilityBuffer);
             }
 
             if (ImGui::TreeNode("Camera(read only)")) {
@@ -254,10 +315,12 @@ int main(int argc, char** argv)
                     using clock = std::chrono::high_resolution_clock;
                     const auto start = clock::now();
                     renderImage(scene, bvh, config.features, camera, screen);
+                    postProcess.setPasses(postProcessPasses(config)); // The bloom settings can be changed in the UI
+                    postProcess.apply(screen);
                     const auto end = clock::now();
                     std::cout << "Time to render image: " << std::chrono::duration<float, std::milli>(end - start).count() << " milliseconds" << std::endl;
                     // Store the new image.
-                    screen.writeBitmapToFile(outPath);
+                    postProcess.writeBitmapToFile(screen, outPath);
                 }
             }
 
@@ -416,21 +479,27 @@ int main(int argc, char** argv)
                     glEnable(GL_POLYGON_OFFSET_FILL);
                     // To ensure that debug draw is always visible, adjust the scale used to calculate the depth value.
                     glPolygonOffset(float(1.4), 1.0);
-                    drawSceneOpenGL(scene);
+                    drawSceneOpenGL(scene, meshBuffers);
                     glDisable(GL_POLYGON_OFFSET_FILL);
                 } else {
-                    drawSceneOpenGL(scene);
+                    drawSceneOpenGL(scene, meshBuffers);
                 }
 
                 {
                     if (!debugRays.empty()) {
-                        // Call renderRay for the debug ray. Ignore the result but tell the function that it should
-                        // draw the rays instead.
+                        // Trace the debug ray with the debug kernel. Ignore the result, but draw the
+                        // debug geometry it recorded along the way.
+                        DebugRecording recording;
+                        std::optional<LightTree> lightTree;
+                        if (config.features.extra.enableLightTree)
+                            lightTree.emplace(scene.lights);
+                        RenderState state = { .scene = scene, .features = config.features, .bvh = bvh, .sampler = { debugRaySeed }, .lightTree = lightTree ? &*lightTree : nullptr };
+                        (void)kernel::renderDebugRays(state, debugRays, recording);
+
                         enableDebugDraw = true;
                         glDisable(GL_LIGHTING);
                         glDepthFunc(GL_LEQUAL);
-                        RenderState state = { .scene = scene, .features = config.features, .bvh = bvh, .sampler = { debugRaySeed } };
-                        (void)renderRays(state, debugRays);
+                        recording.draw();
                         enableDebugDraw = false;
                     }
                 }
@@ -455,6 +524,7 @@ int main(int argc, char** argv)
                         bvh.debugDrawLeaf(bvhDebugLeaf);
                     if (config.features.extra.enableSahBinningDebug)
                         bvh.debugSAHBins(config.features, config.features.extra.debugSAHNodeIndex);
+                    flushOverlays();
                     enableDebugDraw = false;
                     glPopAttrib();
                 }
@@ -464,7 +534,9 @@ int main(int argc, char** argv)
 
                 using clock = std::chrono::high_resolution_clock;
                 const auto start = clock::now();
-                renderImage(scene, bvh, config.features, camera, screen);
+                renderImage(scene, bvh, config.features, Camera(camera), screen, &reservoirHistory);
+                postProcess.setPasses(postProcessPasses(config)); // The bloom settings can be changed in the UI
+                postProcess.apply(screen);
                 const auto end = clock::now();
                 const auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
                 fmt::print("Rendering took {} ms.\n", duration);
@@ -481,28 +553,31 @@ int main(int argc, char** argv)
     } else {
         // Command-line rendering.
         std::cout << config;
-        // NOTE(Yang): Trackball is highly coupled with the window,
-        // so we need to create a dummy window here but not show it.
-        // In this case, GLEW will not be initialized, OpenGL functions
-        // will not be loaded, and the window will not be shown.
-        // All debug draw calls will be disabled.
+        // No window is created here, so GLFW/OpenGL are never initialized and this also runs
+        // on machines without a display. All debug draw calls will be disabled.
         enableDebugDraw = false;
-        Window window { "Final Project", config.windowSize, OpenGLVersion::GL2, false };
         // Load scene.
+        std::shared_ptr<TextureCache> textureCache = config.textureCache ? std::make_shared<TextureCache>(*config.textureCache) : nullptr;
         Scene scene;
         std::string sceneName;
         std::visit(make_visitor(
                        [&](const std::filesystem::path& path) {
-                           scene = loadSceneFromFile(path, config.lights);
+                           scene = loadSceneFromFile(path, config.lights, textureCache);
                            sceneName = path.stem().string();
                        },
                        [&](const SceneType& type) {
-                           scene = loadScenePrebuilt(type, config.dataPath);
+                           scene = loadScenePrebuilt(type, config.dataPath, textureCache);
                            sceneName = serialize(type);
                        }),
             config.scene);
+        // The environment map is only read if the render samples it
+        if (!config.environmentMap.empty())
+            scene.environmentMap = EnvironmentMap::get(config.environmentMap);
+        if (config.geometryCache)
+            streamGeometry(scene, *config.geometryCache);
 
         BVH bvh(scene, config.features);
+        PostProcessPipeline postProcess { postProcessPasses(config) };
 
         using clock = std::chrono::high_resolution_clock;
         // Create output directory if it does not exist.
@@ -516,17 +591,27 @@ int main(int argc, char** argv)
             const auto& cameraConfig = config.cameras[i];
             Screen screen { config.windowSize, false };
             screen.clear(glm::vec3(0.0f));
-            Trackball camera { &window, glm::radians(cameraConfig.fieldOfView), cameraConfig.distanceFromLookAt };
-            camera.setCamera(cameraConfig.lookAt, glm::radians(cameraConfig.rotation), cameraConfig.distanceFromLookAt);
+            const Camera camera { cameraConfig, float(config.windowSize.x) / float(config.windowSize.y) };
             renderImage(scene, bvh, config.features, camera, screen);
+            postProcess.apply(screen);
             const auto filename_base = fmt::format("{}_{}_cam_{}", sceneName, start_time_string, i);
             const auto filepath = config.outputDir / (filename_base + ".bmp");
             fmt::print("Image {} saved to {}\n", i, filepath.string());
-            screen.writeBitmapToFile(filepath);
+            postProcess.writeBitmapToFile(screen, filepath);
         }
         const auto end = clock::now();
         const auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
         fmt::print("Rendering took {} ms, {} images rendered.\n", duration, config.cameras.size());
+        if (textureCache) {
+            const TextureCache::Stats stats = textureCache->stats();
+            fmt::print("Texture cache: {} hits, {} misses, {} evictions, {} MiB read, {} MiB peak resident.\n",
+                stats.hits, stats.misses, stats.evictions, stats.bytesRead >> 20, stats.peakResidentBytes >> 20);
+        }
+        if (scene.geometryCache) {
+            const GeometryCache::Stats stats = scene.geometryCache->stats();
+            fmt::print("Geometry cache: {} hits, {} misses, {} prefetched, {} evictions, {} MiB read, {} MiB peak resident.\n",
+                stats.hits, stats.misses, stats.prefetches, stats.evictions, stats.bytesRead >> 20, stats.peakResidentBytes >> 20);
+        }
     }
 
     return 0;
@@ -600,7 +685,7 @@ static void drawLightsOpenGL(const Scene& scene, const Trackball& camera, int /*
     drawSphere(camera.lookAt(), 0.01f, glm::vec3(0.2f, 0.2f, 1.0f));
 }
 
-void drawSceneOpenGL(const Scene& scene)
+void drawSceneOpenGL(const Scene& scene, MeshBuffers& meshBuffers)
 {
     // Activate the light in the legacy OpenGL mode.
     glEnable(GL_LIGHTING);
@@ -647,8 +732,10 @@ void drawSceneOpenGL(const Scene& scene)
             light);
     }
 
-    // Draw the scene and the ray (if any).
-    drawScene(scene);
+    // Draw the scene; meshes from their buffers, spheres in immediate mode.
+    meshBuffers.draw(scene);
+    for (const auto& sphere : scene.spheres)
+        drawSphere(sphere);
 }
 
 bool sliderIntSquarePower(const char* label, int* v, int v_min, int v_max)
@@ -0,0 +1,103 @@
+#include "mesh_buffers.h"
+#include "draw.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/gtc/type_ptr.hpp>
+DISABLE_WARNINGS_POP()
+#include <iostream>
+
+MeshBuffers::MeshBuffers()
+{
+    try {
+        m_shader = ShaderBuilder()
+                       .addStage(GL_VERTEX_SHADER, SHADER_DIR "mesh.vert")
+                       .addStage(GL_FRAGMENT_SHADER, SHADER_DIR "mesh.frag")
+                       .build();
+        m_kdLocation = m_shader.uniformLocation("kd");
+        m_numLightsLocation = m_shader.uniformLocation("numLights");
+        m_hasShader = true;
+    } catch (const ShaderLoadingException& e) {
+        std::cerr << e.what() << "; drawing meshes in immediate mode" << std::endl;
+    }
+}
+
+MeshBuffers::~MeshBuffers()
+{
+    invalidate();
+}
+
+void MeshBuffers::invalidate()
+{
+    for (const MeshBuffer& buffer : m_buffers) {
+        glDeleteBuffers(1, &buffer.vertexBuffer);
+        glDeleteBuffers(1, &buffer.indexBuffer);
+    }
+    m_buffers.clear();
+}
+
+void MeshBuffers::upload(MeshBuffer& buffer, const Mesh& mesh)
+{
+    if (buffer.vertexBuffer == 0) {
+        glGenBuffers(1, &buffer.vertexBuffer);
+        glGenBuffers(1, &buffer.indexBuffer);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, buffer.vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(mesh.vertices.size() * sizeof(Vertex)), mesh.vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer.indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, GLsizeiptr(mesh.triangles.size() * sizeof(glm::uvec3)), mesh.triangles.data(), GL_STATIC_DRAW);
+
+    buffer.vertices = mesh.vertices.data();
+    buffer.numVertices = mesh.vertices.size();
+    buffer.triangles = mesh.triangles.data();
+    buffer.numTriangles = mesh.triangles.size();
+}
+
+void MeshBuffers::draw(const Scene& scene)
+{
+    if (!m_hasShader) {
+        for (const Mesh& mesh : scene.meshes)
+            drawMesh(mesh);
+        return;
+    }
+
+    // Upload the meshes that are new, or whose geometry changed
+    while (m_buffers.size() > scene.meshes.size()) {
+        glDeleteBuffers(1, &m_buffers.back().vertexBuffer);
+        glDeleteBuffers(1, &m_buffers.back().indexBuffer);
+        m_buffers.pop_back();
+    }
+    m_buffers.resize(scene.meshes.size());
+    for (size_t i = 0; i < scene.meshes.size(); i++) {
+        const Mesh& mesh = scene.meshes[i];
+        const MeshBuffer& buffer = m_buffers[i];
+        if (buffer.vertexBuffer == 0 || buffer.vertices != mesh.vertices.data() || buffer.numVertices != mesh.vertices.size()
+            || buffer.triangles != mesh.triangles.data() || buffer.numTriangles != mesh.triangles.size())
+            upload(m_buffers[i], mesh);
+    }
+
+    // Shade with the lights that are enabled, which drawSceneOpenGL() enables from GL_LIGHT0 onwards
+    GLint maxLights = 0, numLights = 0;
+    glGetIntegerv(GL_MAX_LIGHTS, &maxLights);
+    while (numLights < maxLights && glIsEnabled(GLenum(GL_LIGHT0 + numLights)))
+        numLights++;
+
+    m_shader.bind();
+    glUniform1i(m_numLightsLocation, numLights);
+    glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    for (size_t i = 0; i < scene.meshes.size(); i++) {
+        if (m_buffers[i].numTriangles == 0)
+            continue;
+        glUniform3fv(m_kdLocation, 1, glm::value_ptr(scene.meshes[i].material.kd));
+        glBindBuffer(GL_ARRAY_BUFFER, m_buffers[i].vertexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_buffers[i].indexBuffer);
+        glVertexPointer(3, GL_FLOAT, sizeof(Vertex), reinterpret_cast<const void*>(offsetof(Vertex, position)));
+        glNormalPointer(GL_FLOAT, sizeof(Vertex), reinterpret_cast<const void*>(offsetof(Vertex, normal)));
+        glDrawElements(GL_TRIANGLES, GLsizei(3 * m_buffers[i].numTriangles), GL_UNSIGNED_INT, nullptr);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glPopClientAttrib();
+    glUseProgram(0);
+}
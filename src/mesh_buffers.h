@@ -0,0 +1,45 @@
+#pragma once
+#include "scene.h"
+#include <framework/opengl_includes.h>
+#include <framework/shader.h>
+#include <cstddef>
+#include <vector>
+
+// Retained mode drawing of the meshes of a scene, for the rasterization view.
+//
+// Every mesh is uploaded once into a vertex and an index buffer, and only uploaded again when its geometry
+// changes (when its vertex or triangle arrays are reallocated or resized). Materials are uniforms, so
+// editing them needs no upload. Meshes are shaded by shaders/mesh.{vert,frag} with the fixed function
+// matrices and lights, like drawSceneOpenGL() sets them up; if the shader fails to load, the meshes are
+// drawn in immediate mode by `drawMesh()` instead.
+//
+// Needs a current OpenGL context during its whole lifetime.
+class MeshBuffers {
+public:
+    MeshBuffers();
+    MeshBuffers(const MeshBuffers&) = delete;
+    MeshBuffers& operator=(const MeshBuffers&) = delete;
+    ~MeshBuffers();
+
+    void draw(const Scene& scene);
+    // Upload all meshes again on the next draw, e.g. after loading another scene
+    void invalidate();
+
+private:
+    struct MeshBuffer {
+        GLuint vertexBuffer = 0, indexBuffer = 0;
+        // The geometry that was uploaded
+        const Vertex* vertices = nullptr;
+        size_t numVertices = 0;
+        const glm::uvec3* triangles = nullptr;
+        size_t numTriangles = 0;
+    };
+
+    void upload(MeshBuffer& buffer, const Mesh& mesh);
+
+private:
+    Shader m_shader;
+    bool m_hasShader = false;
+    GLint m_kdLocation = -1, m_numLightsLocation = -1;
+    std::vector<MeshBuffer> m_buffers;
+};
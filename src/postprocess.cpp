@@ -0,0 +1,196 @@
+#include "postprocess.h"
+#include "blur.h"
+#include "screen.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/exponential.hpp>
+#include <stb/stb_image_write.h>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <span>
+#include <string>
+#ifdef NDEBUG
+#include <omp.h>
+#endif
+
+// Side length of the square tiles that fused passes sweep over
+static constexpr int PostProcessTileSize = 64;
+
+float perceivedLuminance(glm::vec3 colors)
+{
+    // Coefficients for calculation of perceived luminance
+    const float c_R = 0.2126f;
+    const float c_G = 0.7152f;
+    const float c_B = 0.0722f;
+    return c_R * colors.r + c_G * colors.g + c_B * colors.b;
+}
+
+// A row of pixels inside a tile, as seen by the per-pixel passes
+struct PostProcessSpan {
+    int x, y; // Position of the first pixel
+    size_t index; // Index of the first pixel in the image buffers
+    std::span<glm::vec3> colors;
+    glm::ivec2 maskResolution;
+    glm::ivec2 resolution;
+};
+
+static void applyPass(const ThresholdPass& pass, PostProcessSpan& span, std::vector<glm::vec3>& mask, std::vector<glm::u8vec4>&)
+{
+    for (size_t i = 0; i < span.colors.size(); i++) {
+        const glm::vec3 color = span.colors[i];
+        const float luminance = perceivedLuminance(color);
+        mask[span.index + i] = luminance < pass.threshold ? glm::vec3(0.0f) : color;
+        if (pass.visualize) {
+            const float mapped = (luminance - pass.threshold) / (1.0f - pass.threshold);
+            span.colors[i] = luminance < pass.threshold ? glm::vec3(0.0f, 0.0f, 0.2f) : glm::mix(glm::vec3(0.8f, 0.0f, 0.0f), glm::vec3(0.85f), mapped);
+        }
+    }
+}
+
+static void applyPass(const BlurPass&, PostProcessSpan&, std::vector<glm::vec3>&, std::vector<glm::u8vec4>&)
+{
+    // Blur passes are not per-pixel; they are applied between sweeps
+}
+
+static void applyPass(const CompositePass& pass, PostProcessSpan& span, std::vector<glm::vec3>& mask, std::vector<glm::u8vec4>&)
+{
+    const auto composite = [&](glm::vec3& color, const glm::vec3& masked) { color = pass.replace ? pass.intensity * masked : color + pass.intensity * masked; };
+    if (span.maskResolution == span.resolution) {
+        for (size_t i = 0; i < span.colors.size(); i++)
+            composite(span.colors[i], mask[span.index + i]);
+    } else {
+        // The mask was blurred at a lower resolution
+        const glm::vec2 scale = glm::vec2(span.maskResolution) / glm::vec2(span.resolution);
+        for (size_t i = 0; i < span.colors.size(); i++) {
+            const glm::vec2 position = (glm::vec2(span.x + int(i), span.y) + 0.5f) * scale - 0.5f;
+            composite(span.colors[i], sampleImageBilinear(mask, span.maskResolution, position));
+        }
+    }
+}
+
+static void applyPass(const ExposurePass& pass, PostProcessSpan& span, std::vector<glm::vec3>&, std::vector<glm::u8vec4>&)
+{
+    const float scale = std::exp2(pass.stops);
+    for (glm::vec3& color : span.colors)
+        color *= scale;
+}
+
+static void applyPass(const ToneMapPass& pass, PostProcessSpan& span, std::vector<glm::vec3>&, std::vector<glm::u8vec4>&)
+{
+    switch (pass.op) {
+    case ToneMapOperator::Reinhard: {
+        for (glm::vec3& color : span.colors)
+            color = color / (1.0f + color);
+    } break;
+    case ToneMapOperator::Aces: {
+        // Fit of the ACES filmic curve by K. Narkowicz, "ACES Filmic Tone Mapping Curve", 2015
+        for (glm::vec3& color : span.colors)
+            color = glm::clamp((color * (2.51f * color + 0.03f)) / (color * (2.43f * color + 0.59f) + 0.14f), 0.0f, 1.0f);
+    } break;
+    }
+}
+
+static void applyPass(const GammaPass& pass, PostProcessSpan& span, std::vector<glm::vec3>&, std::vector<glm::u8vec4>&)
+{
+    const float invGamma = 1.0f / pass.gamma;
+    for (glm::vec3& color : span.colors)
+        color = glm::pow(glm::max(color, 0.0f), glm::vec3(invGamma));
+}
+
+static void applyPass(const QuantizePass&, PostProcessSpan& span, std::vector<glm::vec3>&, std::vector<glm::u8vec4>& quantized)
+{
+    for (size_t i = 0; i < span.colors.size(); i++) {
+        const glm::vec3 clampedColor = glm::clamp(span.colors[i], 0.0f, 1.0f);
+        quantized[span.index + i] = glm::u8vec4(glm::vec4(clampedColor, 1.0f) * 255.0f);
+    }
+}
+
+PostProcessPipeline::PostProcessPipeline(std::vector<PostProcessPass> passes)
+    : m_passes(std::move(passes))
+{
+}
+
+bool PostProcessPipeline::empty() const
+{
+    return m_passes.empty();
+}
+
+void PostProcessPipeline::setPasses(std::vector<PostProcessPass> passes)
+{
+    m_passes = std::move(passes);
+}
+
+void PostProcessPipeline::apply(Screen& image)
+{
+    const glm::ivec2 resolution = image.resolution();
+    const size_t numPixels = image.pixels().size();
+    m_hasQuantized = std::any_of(std::begin(m_passes), std::end(m_passes),
+        [](const PostProcessPass& pass) { return std::holds_alternative<QuantizePass>(pass); });
+    if (m_hasQuantized)
+        m_quantized.resize(numPixels);
+    // Resizing keeps the capacity of the buffers, which the blur passes swap between
+    m_mask.resize(numPixels);
+    m_maskResolution = resolution;
+
+    // Blur passes split the pipeline into sweeps of per-pixel passes
+    auto sweepBegin = std::begin(m_passes);
+    for (auto it = std::begin(m_passes); it != std::end(m_passes); ++it) {
+        if (const auto* blur = std::get_if<BlurPass>(&*it)) {
+            applySweep(std::span(sweepBegin, it), image);
+            const float maskScale = float(m_maskResolution.x) / float(resolution.x); // Mask pixels per image pixel
+            m_maskResolution = gaussianBlurDownsampled(m_mask, m_maskResolution, blur->sigma * maskScale, m_blurScratch);
+            sweepBegin = std::next(it);
+        }
+    }
+    applySweep(std::span(sweepBegin, std::end(m_passes)), image);
+}
+
+void PostProcessPipeline::applySweep(std::span<const PostProcessPass> passes, Screen& image)
+{
+    if (passes.empty())
+        return;
+    // A threshold pass writes a full resolution mask, also after a blur pass downsampled it
+    if (std::any_of(std::begin(passes), std::end(passes), [](const PostProcessPass& pass) { return std::holds_alternative<ThresholdPass>(pass); })) {
+        m_mask.resize(image.pixels().size());
+        m_maskResolution = image.resolution();
+    }
+
+    const glm::ivec2 resolution = image.resolution();
+    const glm::ivec2 numTiles = (resolution + PostProcessTileSize - 1) / PostProcessTileSize;
+    std::vector<glm::vec3>& pixels = image.pixels();
+
+#ifdef NDEBUG // Enable multi threading in Release mode
+#pragma omp parallel for schedule(static)
+#endif
+    for (int tile = 0; tile < numTiles.x * numTiles.y; tile++) {
+        const glm::ivec2 tileBegin = glm::ivec2(tile % numTiles.x, tile / numTiles.x) * PostProcessTileSize;
+        const glm::ivec2 tileEnd = glm::min(tileBegin + PostProcessTileSize, resolution);
+        for (int y = tileBegin.y; y < tileEnd.y; y++) {
+            // Rows are addressed as stored; all passes are symmetric under flipping the image vertically
+            const size_t index = size_t(y) * size_t(resolution.x) + size_t(tileBegin.x);
+            PostProcessSpan span {
+                .x = tileBegin.x,
+                .y = y,
+                .index = index,
+                .colors = std::span(pixels).subspan(index, size_t(tileEnd.x - tileBegin.x)),
+                .maskResolution = m_maskResolution,
+                .resolution = resolution
+            };
+            // Run all passes over a row of the tile while it is in cache
+            for (const PostProcessPass& pass : passes)
+                std::visit([&](const auto& p) { applyPass(p, span, m_mask, m_quantized); }, pass);
+        }
+    }
+}
+
+void PostProcessPipeline::writeBitmapToFile(Screen& image, const std::filesystem::path& filePath) const
+{
+    if (!m_hasQuantized || m_quantized.size() != image.pixels().size()) {
+        image.writeBitmapToFile(filePath);
+        return;
+    }
+
+    std::string filePathString = filePath.string();
+    stbi_write_bmp(filePathString.c_str(), image.resolution().x, image.resolution().y, 4, m_quantized.data());
+}
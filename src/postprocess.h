@@ -0,0 +1,89 @@
+#pragma once
+#include "fwd.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <variant>
+#include <vector>
+
+// Passes of a post-processing pipeline. Next to the image, passes share a second buffer, the mask,
+// which e.g. holds the bright parts of the image for a bloom effect (threshold -> blur -> composite).
+
+// Set the mask to the pixels of the image whose perceived luminance is at least `threshold`. For debugging,
+// `visualize` also replaces those pixels by a red to white ramp over their luminance, and the others by dark blue.
+struct ThresholdPass {
+    float threshold = 0.5f;
+    bool visualize = false;
+};
+// Blur the mask with a Gaussian of standard deviation `sigma`, in pixels of the image, also if an earlier blur
+// pass left the mask at a lower resolution; consecutive blur passes add up like a single Gaussian would
+struct BlurPass {
+    float sigma = 4.0f;
+};
+// Add the mask times `intensity` to the image, or with `replace`, set the image to it, e.g. to view the mask
+struct CompositePass {
+    float intensity = 0.8f;
+    bool replace = false;
+};
+// Scale the image by 2^stops
+struct ExposurePass {
+    float stops = 0.0f;
+};
+enum class ToneMapOperator {
+    Reinhard,
+    Aces,
+};
+// Map the image from high dynamic range to [0, 1]
+struct ToneMapPass {
+    ToneMapOperator op = ToneMapOperator::Reinhard;
+};
+// Gamma-encode the image, i.e. raise it to the power of 1 / gamma
+struct GammaPass {
+    float gamma = 2.2f;
+};
+// Clamp the image to [0, 1] and store it as 8-bit color, which is what is written to image files
+struct QuantizePass {
+};
+
+using PostProcessPass = std::variant<ThresholdPass, BlurPass, CompositePass, ExposurePass, ToneMapPass, GammaPass, QuantizePass>;
+
+// Coefficients for calculation of perceived luminance; see https://stackoverflow.com/a/596243/15236567
+float perceivedLuminance(glm::vec3 colors);
+
+// Runs an ordered list of passes over a rendered image. Consecutive per-pixel passes are fused into a
+// single multithreaded sweep over the image in tiles, s.t. every pixel is only loaded and stored once
+// for all of them; only blur passes need a sweep of their own. Buffers are kept between calls to
+// `apply()`, so rendering a sequence of frames does not allocate.
+class PostProcessPipeline {
+public:
+    PostProcessPipeline() = default;
+    explicit PostProcessPipeline(std::vector<PostProcessPass> passes);
+
+    [[nodiscard]] bool empty() const;
+    // Replace the passes, but keep the buffers; e.g. when the passes are edited between frames
+    void setPasses(std::vector<PostProcessPass> passes);
+
+    // Apply all passes to the image in place
+    void apply(Screen& image);
+
+    // Write the image processed by the last `apply()` to a bitmap. If the pipeline quantized the image,
+    // the quantized image is written; otherwise this falls back to `Screen::writeBitmapToFile()`.
+    void writeBitmapToFile(Screen& image, const std::filesystem::path& filePath) const;
+
+private:
+    void applySweep(std::span<const PostProcessPass> passes, Screen& image);
+
+    std::vector<PostProcessPass> m_passes;
+
+    std::vector<glm::vec3> m_mask;
+    glm::ivec2 m_maskResolution { 0 };
+    std::vector<glm::vec3> m_blurScratch;
+    std::vector<glm::u8vec4> m_quantized;
+    bool m_hasQuantized = false;
+};
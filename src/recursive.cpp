@@ -2,86 +2,132 @@
 #include "draw.h"
 #include "bvh_interface.h"
 #include "intersect.h"
+#include "kernel.h"
 #include "extra.h"
 #include "light.h"
 
 // This function is provided as-is. You do not have to implement it.
 // Given a range of rays, render out all rays and average the result
-glm::vec3 renderRays(RenderState& state, std::span<const Ray> rays, int rayDepth)
+template <uint32_t Mask>
+glm::vec3 kernel::renderRays(RenderState& state, std::span<const Ray> rays, int rayDepth)
 {
     glm::vec3 L { 0.f };
     for (const auto& ray : rays) {
-        L += renderRay(state, ray, rayDepth);
+        L += renderRay<Mask>(state, ray, rayDepth);
     }
     return L / static_cast<float>(rays.size());
 }
 
+glm::vec3 renderRays(RenderState& state, std::span<const Ray> rays, int rayDepth)
+{
+    return kernel::renderRays<kernel::Dynamic>(state, rays, rayDepth);
+}
+
 // This method is provided as-is. You do not have to implement it.
 // Given a camera ray (or secondary ray), tests for a scene intersection, and
 // dependent on the results, evaluates the following functions which you must
 // implement yourself:
 // - `computeLightContribution()` and its submethods
 // - `renderRaySpecularComponent()`, `renderRayTransparentComponent()`, `renderRayGlossyComponent()`
-glm::vec3 renderRay(RenderState& state, Ray ray, int rayDepth)
+template <uint32_t Mask>
+glm::vec3 kernel::renderRay(RenderState& state, Ray ray, int rayDepth)
 {
     // Trace the ray into the scene. If nothing was hit, return early
     HitInfo hitInfo;
-    if (!state.bvh.intersect(state, ray, hitInfo)) {
-        drawRay(ray, glm::vec3(1, 0, 0));
-        return sampleEnvironmentMap(state, ray);
+    if (!intersect<Mask>(state, ray, hitInfo)) {
+        recordRay<Mask>(state, ray, glm::vec3(1, 0, 0));
+        return sampleEnvironmentMap<Mask>(state, ray);
     }
+    return shadeHit<Mask>(state, ray, hitInfo, rayDepth);
+}
 
+template <uint32_t Mask>
+glm::vec3 kernel::renderRayFromHit(RenderState& state, const Ray& ray, const BVHInterface::Primitive& primitive, int rayDepth)
+{
+    HitInfo hitInfo;
+    if constexpr (usesMaterialTable<Mask>)
+        updateHitInfo<Mask>(state, primitive, ray, hitInfo);
+    else
+        ::updateHitInfo(state, primitive, ray, hitInfo);
+    return shadeHit<Mask>(state, ray, hitInfo, rayDepth);
+}
+
+template <uint32_t Mask>
+glm::vec3 kernel::shadeHit(RenderState& state, const Ray& ray, const HitInfo& hitInfo, int rayDepth)
+{
     // Return value: the light along the ray
     // Given an intersection, estimate the contribution of scene lights at this intersection
-    glm::vec3 Lo = computeLightContribution(state, ray, hitInfo);
+    glm::vec3 Lo = computeLightContribution<Mask>(state, ray, hitInfo);
+
+    // The first hit of a camera ray also goes into the denoiser's auxiliary buffers
+    if (rayDepth == 0 && state.firstHits) {
+        state.firstHits->albedo += sampleMaterialKd<Mask>(state, hitInfo);
+        state.firstHits->normal += hitInfo.normal;
+        state.firstHits->depth += ray.t;
+        state.firstHits->numHits++;
+    }
 
     // DEBUG CODE v
-    // Draw an example debug ray for the incident ray (feel free to modify this for yourself)
-    // drawRay(ray, glm::vec3(1.0f));
-    glm::vec3 colors[] = {
-        { 1.f, 1.f, 1.f },
-        { 1.f, 0.f, 0.f },
-        { 0.5f, 0.5f, 0.f },
-        { 0.f, 1.f, 0.f },
-        { 0.f, 0.5f, 0.5f },
-        { 0.f, 0.f, 1.f },
-    };
-
-    Ray normalRay {};
-    normalRay.origin = ray.origin + ray.direction * ray.t;
-    normalRay.direction = hitInfo.normal;
-    normalRay.t = 0.5f;
-    drawRay(normalRay, glm::vec3(0.8f));
-
-    drawRay(ray, colors[rayDepth]); // changes color of debug ray in rasterization mode depending on the ray depth at each intersection
-
+    // Record debug rays for the incident ray and the normal; only the debug kernel contains this
+    if constexpr ((Mask & DebugDraw) != 0) {
+        const glm::vec3 colors[] = {
+            { 1.f, 1.f, 1.f },
+            { 1.f, 0.f, 0.f },
+            { 0.5f, 0.5f, 0.f },
+            { 0.f, 1.f, 0.f },
+            { 0.f, 0.5f, 0.5f },
+            { 0.f, 0.f, 1.f },
+        };
+
+        Ray normalRay {};
+        normalRay.origin = ray.origin + ray.direction * ray.t;
+        normalRay.direction = hitInfo.normal;
+        normalRay.t = 0.5f;
+        recordRay<Mask>(state, normalRay, glm::vec3(0.8f));
+
+        recordRay<Mask>(state, ray, colors[rayDepth]); // changes color of debug ray in rasterization mode depending on the ray depth at each intersection
+    }
     // DEBUG CODE ^
 
     // Given that recursive components are enabled, and we have not exceeded maximum depth,
     // estimate the contribution along these components
     if (rayDepth < 6) {
-        bool isReflective = glm::any(glm::notEqual(hitInfo.material.ks, glm::vec3(0.0f)));
-        bool isTransparent = hitInfo.material.transparency != 1.f;
+        // Secondary rays start with the footprint of this ray at the hit. We treat surfaces as locally
+        // flat, which keeps the spread angle of mirror reflections unchanged
+        const RayCone rayCone = state.rayCone;
+        if (enabled<Mask>(state.features, MipmapFiltering))
+            state.rayCone.width += state.rayCone.spreadAngle * ray.t;
+
+        const Material& material = materialOf<Mask>(state, hitInfo);
+        bool isReflective = glm::any(glm::notEqual(material.ks, glm::vec3(0.0f)));
+        bool isTransparent = material.transparency != 1.f;
 
         // Default, specular reflections
-        if (state.features.enableReflections && !state.features.extra.enableGlossyReflection && isReflective) {
-            renderRaySpecularComponent(state, ray, hitInfo, Lo, rayDepth);
+        if (enabled<Mask>(state.features, Reflections) && !enabled<Mask>(state.features, GlossyReflection) && isReflective) {
+            renderRaySpecularComponent<Mask>(state, ray, hitInfo, Lo, rayDepth);
         }
 
         // Alternative, glossy reflections
-        if (state.features.enableReflections && state.features.extra.enableGlossyReflection && isReflective) {
-            renderRayGlossyComponent(state, ray, hitInfo, Lo, rayDepth);
+        if (enabled<Mask>(state.features, Reflections) && enabled<Mask>(state.features, GlossyReflection) && isReflective) {
+            renderRayGlossyComponent<Mask>(state, ray, hitInfo, Lo, rayDepth);
         }
 
         // Transparency passthrough
-        if (state.features.enableTransparency && isTransparent) {
-            renderRayTransparentComponent(state, ray, hitInfo, Lo, rayDepth);
+        if (enabled<Mask>(state.features, Transparency) && isTransparent) {
+            renderRayTransparentComponent<Mask>(state, ray, hitInfo, Lo, rayDepth);
         }
+
+        state.rayCone = rayCone;
     }
 
     return Lo;
 }
 
+glm::vec3 renderRay(RenderState& state, Ray ray, int rayDepth)
+{
+    return kernel::renderRay<kernel::Dynamic>(state, ray, rayDepth);
+}
+
 // TODO: Standard feature
 // Given an incident ray and a intersection point, generate a mirrored ray
 // - Ray;     the indicent ray
@@ -132,14 +178,20 @@ Ray generatePassthroughRay(Ray ray, HitInfo hitInfo)
 // - hitColor; current color at the current intersection, which this function modifies
 // - rayDepth; current recursive ray depth
 // This method is unit-tested, so do not change the function signature.
-void renderRaySpecularComponent(RenderState& state, Ray ray, const HitInfo& hitInfo, glm::vec3& hitColor, int rayDepth)
+template <uint32_t Mask>
+void kernel::renderRaySpecularComponent(RenderState& state, Ray ray, const HitInfo& hitInfo, glm::vec3& hitColor, int rayDepth)
 {
     // TODO; you should first implement generateReflectionRay()
     Ray r = generateReflectionRay(ray, hitInfo);
 
-    glm::vec3 specularColor = renderRay(state, r, rayDepth + 1);
+    glm::vec3 specularColor = renderRay<Mask>(state, r, rayDepth + 1);
+
+    hitColor += specularColor * materialOf<Mask>(state, hitInfo).ks;
+}
 
-    hitColor += specularColor * hitInfo.material.ks;
+void renderRaySpecularComponent(RenderState& state, Ray ray, const HitInfo& hitInfo, glm::vec3& hitColor, int rayDepth)
+{
+    kernel::renderRaySpecularComponent<kernel::Dynamic>(state, ray, hitInfo, hitColor, rayDepth);
 }
 
 // TODO: standard feature
@@ -152,12 +204,28 @@ void renderRaySpecularComponent(RenderState& state, Ray ray, const HitInfo& hitI
 // - hitColor; current color at the current intersection, which this function modifies
 // - rayDepth; current recursive ray depth
 // This method is unit-tested, so do not change the function signature.
-void renderRayTransparentComponent(RenderState& state, Ray ray, const HitInfo& hitInfo, glm::vec3& hitColor, int rayDepth)
+template <uint32_t Mask>
+void kernel::renderRayTransparentComponent(RenderState& state, Ray ray, const HitInfo& hitInfo, glm::vec3& hitColor, int rayDepth)
 {
     // TODO; you should first implement generatePassthroughRay()
     Ray r = generatePassthroughRay(ray, hitInfo);
 
-    glm::vec3 passthroughColor = renderRay(state, r, rayDepth + 1);
+    glm::vec3 passthroughColor = renderRay<Mask>(state, r, rayDepth + 1);
+
+    const float transparency = materialOf<Mask>(state, hitInfo).transparency;
+    hitColor = hitColor * (1.f - transparency) + passthroughColor * transparency;
+}
+
+void renderRayTransparentComponent(RenderState& state, Ray ray, const HitInfo& hitInfo, glm::vec3& hitColor, int rayDepth)
+{
+    kernel::renderRayTransparentComponent<kernel::Dynamic>(state, ray, hitInfo, hitColor, rayDepth);
+}
 
-    hitColor = hitColor * (1.f - hitInfo.material.transparency) + passthroughColor * hitInfo.material.transparency;
-}
\ No newline at end of file
+#define INSTANTIATE_RECURSIVE_KERNEL(Mask)                                                                                                                                                     \
+    template glm::vec3 kernel::renderRays<Mask>(RenderState&, std::span<const Ray>, int);                                                                                                    \
+    template glm::vec3 kernel::renderRay<Mask>(RenderState&, Ray, int);                                                                                                                      \
+    template glm::vec3 kernel::renderRayFromHit<Mask>(RenderState&, const Ray&, const BVHInterface::Primitive&, int);                                                                        \
+    template glm::vec3 kernel::shadeHit<Mask>(RenderState&, const Ray&, const HitInfo&, int);                                                                                                \
+    template void kernel::renderRaySpecularComponent<Mask>(RenderState&, Ray, const HitInfo&, glm::vec3&, int);                                                                              \
+    template void kernel::renderRayTransparentComponent<Mask>(RenderState&, Ray, const HitInfo&, glm::vec3&, int);
+FOR_EACH_RENDER_KERNEL(INSTANTIATE_RECURSIVE_KERNEL)
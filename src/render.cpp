@@ -1,52 +1,216 @@
 #include "render.h"
 #include "bvh_interface.h"
+#include "camera.h"
+#include "denoise.h"
 #include "draw.h"
 #include "extra.h"
+#include "geometry_cache.h"
+#include "kernel.h"
 #include "light.h"
+#include "light_tree.h"
+#include "postprocess.h"
 #include "recursive.h"
+#include "reservoir.h"
 #include "sampler.h"
 #include "screen.h"
 #include "shading.h"
+#include "visibility_buffer.h"
 #include <framework/trackball.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <optional>
 #ifdef NDEBUG
 #include <omp.h>
 #endif
 
+// Side length of the square tiles in which `renderImage()` distributes work over threads
+static constexpr int RenderTileSize = 16;
+
+// Ask the scene's geometry cache to load the clusters that a tile's rays see first, by tracing a coarse grid
+// of rays over the tile through its top-level BVH
+static void prefetchTileGeometry(GeometryCache& geometryCache, const Camera& camera, int tile, glm::ivec2 numTiles, glm::ivec2 resolution)
+{
+    if (tile >= numTiles.x * numTiles.y)
+        return;
+    constexpr int gridSize = 4;
+    const glm::ivec2 tileBegin = glm::ivec2(tile % numTiles.x, tile / numTiles.x) * RenderTileSize;
+    const glm::vec2 tileSize = glm::vec2(glm::min(tileBegin + RenderTileSize, resolution) - tileBegin);
+    std::array<Ray, gridSize * gridSize> rays;
+    for (int y = 0; y < gridSize; y++) {
+        for (int x = 0; x < gridSize; x++) {
+            const glm::vec2 pixel = glm::vec2(tileBegin) + (glm::vec2(x, y) + 0.5f) / float(gridSize) * tileSize;
+            rays[size_t(y * gridSize + x)] = camera.generateRay(pixel / glm::vec2(resolution) * 2.0f - 1.0f);
+        }
+    }
+    geometryCache.prefetch(rays);
+}
+
+// Render the camera rays of a pixel one at a time and return their mean, like `renderRays()`, and the variance
+// of the mean's luminance; the variance is -1 if there is only one ray to estimate it from
+static glm::vec3 renderPixelWithVariance(RenderState& state, kernel::RenderKernel renderKernel, std::span<const Ray> rays, float& variance)
+{
+    glm::vec3 L { 0.0f };
+    float sumLuminance = 0.0f, sumSquaredLuminance = 0.0f;
+    for (size_t i = 0; i < rays.size(); i++) {
+        const glm::vec3 sample = renderKernel(state, rays.subspan(i, 1), 0);
+        const float luminance = perceivedLuminance(sample);
+        L += sample;
+        sumLuminance += luminance;
+        sumSquaredLuminance += luminance * luminance;
+    }
+    const auto numRays = float(rays.size());
+    if (rays.size() > 1) {
+        const float sampleVariance = std::max(sumSquaredLuminance - sumLuminance * sumLuminance / numRays, 0.0f) / (numRays - 1.0f);
+        variance = sampleVariance / numRays;
+    } else {
+        variance = -1.0f;
+    }
+    return L / numRays;
+}
+
+// Write the first hits of a pixel's camera rays, as summed while rendering the pixel, to the auxiliary buffers
+static void recordPixelAOVs(const FirstHitSums& firstHits, AOVBuffers& aovs, size_t index)
+{
+    if (firstHits.numHits == 0)
+        return;
+    aovs.albedo[index] = firstHits.albedo / float(firstHits.numHits);
+    aovs.normal[index] = glm::length(firstHits.normal) > 0.0f ? glm::normalize(firstHits.normal) : firstHits.normal;
+    aovs.depth[index] = firstHits.depth / float(firstHits.numHits);
+}
+
 // This function is provided as-is. You do not have to implement it.
 // Given relevant objects (scene, bvh, camera, etc) and an output screen, multithreaded fills
 // each of the pixels using one of the below `renderPixel*()` functions, dependent on scene
 // configuration. By default, `renderPixelNaive()` is called.
 void renderImage(const Scene& scene, const BVHInterface& bvh, const Features& features, const Trackball& camera, Screen& screen)
 {
+    renderImage(scene, bvh, features, Camera(camera), screen);
+}
+
+void renderImage(const Scene& scene, const BVHInterface& bvh, const Features& features, const Camera& pinholeCamera, Screen& screen, ReservoirHistory* history)
+{
+    // Depth of field is part of camera ray generation
+    Camera camera = pinholeCamera;
+    if (features.extra.enableDepthOfField)
+        camera.setThinLens(features.extra.lensRadius, features.extra.focusDistance);
+
     // Either directly render the image, or pass through to extra.h methods
-    if (features.extra.enableDepthOfField) {
-        renderImageWithDepthOfField(scene, bvh, features, camera, screen);
-    } else if (features.extra.enableMotionBlur) {
+    if (features.extra.enableMotionBlur) {
         renderImageWithMotionBlur(scene, bvh, features, camera, screen);
     } else {
+        // Pick the render kernel specialised for the active features once, instead of per ray
+        kernel::RenderKernel renderKernel = kernel::selectRenderKernel(scene, features);
+
+        const glm::ivec2 resolution = screen.resolution();
+        const glm::ivec2 numTiles = (resolution + RenderTileSize - 1) / RenderTileSize;
+        const RayCone rayCone = cameraRayCone(features, camera, resolution);
+
+        // Rasterise primary hits up front, where that gives the same hits as tracing the camera rays; shading
+        // then starts from the buffer, and pixels that it left empty are traced as usual
+        std::optional<VisibilityBuffer> visibilityBuffer;
+        kernel::HitKernel hitKernel = nullptr;
+        if (features.extra.enableVisibilityBuffer && VisibilityBuffer::supports(scene, bvh, features, camera)) {
+            visibilityBuffer.emplace(bvh.primitives(), camera, resolution);
+            hitKernel = kernel::selectHitKernel(scene, features);
+        }
+
+        // Lights may be edited between frames, so the light tree is built for every frame
+        std::optional<LightTree> lightTree;
+        if (features.extra.enableLightTree)
+            lightTree.emplace(scene.lights);
+
+        // Resample the direct light at the camera rays' hits up front, s.t. pixels can share their samples; every
+        // pixel then traces a single shadow ray for its direct light
+        std::vector<Reservoir> reservoirs;
+        if (supportsReservoirResampling(scene, features, camera))
+            reservoirs = resampleDirectLighting(scene, bvh, features, camera, resolution, visibilityBuffer ? &*visibilityBuffer : nullptr, history);
+        else if (history)
+            history->reset();
+
+        // The denoiser is guided by auxiliary buffers, which are written next to the image
+        std::optional<AOVBuffers> aovs;
+        if (features.extra.enableDenoising)
+            aovs.emplace(resolution);
+
+        // With streamed geometry, every thread prefetches for the tile that will be started once all threads
+        // have moved on; tiles are handed out in order
+#ifdef NDEBUG
+        const int prefetchDistance = omp_get_max_threads();
+#else
+        const int prefetchDistance = 1;
+#endif
+        if (scene.geometryCache) {
+            for (int tile = 0; tile < prefetchDistance; tile++)
+                prefetchTileGeometry(*scene.geometryCache, camera, tile, numTiles, resolution);
+        }
+
 #ifdef NDEBUG // Enable multi threading in Release mode
-#pragma omp parallel for schedule(guided)
+#pragma omp parallel for schedule(dynamic)
 #endif
-        for (int y = 0; y < screen.resolution().y; y++) {
-            for (int x = 0; x != screen.resolution().x; x++) {
-                // Assemble useful objects on a per-pixel basis; e.g. a per-thread sampler
-                // Note; we seed the sampler for consistenct behavior across frames
-                RenderState state = {
-                    .scene = scene,
-                    .features = features,
-                    .bvh = bvh,
-                    .sampler = { static_cast<uint32_t>(screen.resolution().y * x + y) }
-                };
-                auto rays = generatePixelRays(state, camera, { x, y }, screen.resolution());
-                auto L = renderRays(state, rays);
-                screen.setPixel(x, y, L);
+        for (int tile = 0; tile < numTiles.x * numTiles.y; tile++) {
+            if (scene.geometryCache)
+                prefetchTileGeometry(*scene.geometryCache, camera, tile + prefetchDistance, numTiles, resolution);
+
+            const glm::ivec2 tileBegin = glm::ivec2(tile % numTiles.x, tile / numTiles.x) * RenderTileSize;
+            const glm::ivec2 tileEnd = glm::min(tileBegin + RenderTileSize, resolution);
+
+            // With a single pinhole sample per pixel, generate the camera rays of the whole tile up front
+            std::array<Ray, RenderTileSize * RenderTileSize> tileRays;
+            const bool batchedRays = features.numPixelSamples <= 1 && !camera.hasThinLens();
+            if (batchedRays)
+                camera.generateTileRays(tileBegin, tileEnd, resolution, tileRays);
+
+            for (int y = tileBegin.y, i = 0; y < tileEnd.y; y++) {
+                for (int x = tileBegin.x; x < tileEnd.x; x++, i++) {
+                    // Assemble useful objects on a per-pixel basis; e.g. a per-thread sampler
+                    // Note; we seed the sampler for consistenct behavior across frames
+                    RenderState state = {
+                        .scene = scene,
+                        .features = features,
+                        .bvh = bvh,
+                        .sampler = { features.extra.samplerType, { x, y }, static_cast<uint32_t>(resolution.y * x + y) },
+                        .rayCone = rayCone,
+                        .lightTree = lightTree ? &*lightTree : nullptr
+                    };
+                    FirstHitSums firstHits;
+                    if (aovs)
+                        state.firstHits = &firstHits;
+                    if (!reservoirs.empty() && reservoirs[size_t(y) * size_t(resolution.x) + size_t(x)].numCandidates > 0.0f)
+                        state.reservoir = &reservoirs[size_t(y) * size_t(resolution.x) + size_t(x)];
+                    std::vector<Ray> pixelRays;
+                    std::span<const Ray> rays;
+                    if (batchedRays) {
+                        rays = std::span<const Ray>(&tileRays[size_t(i)], 1);
+                    } else {
+                        pixelRays = generateCameraRays(state, camera, { x, y }, resolution);
+                        rays = pixelRays;
+                    }
+
+                    const auto index = size_t(screen.indexAt(x, y));
+                    glm::vec3 L;
+                    if (visibilityBuffer && visibilityBuffer->sample({ x, y }).primitiveID != VisibilityBuffer::NoHit) {
+                        const VisibilityBuffer::Sample& sample = visibilityBuffer->sample({ x, y });
+                        const BVHInterface::Primitive& primitive = bvh.primitives()[sample.primitiveID];
+                        Ray ray = rays[0];
+                        ray.t = VisibilityBuffer::hitDistance(ray, primitive, sample);
+                        L = hitKernel(state, ray, primitive, 0);
+                        if (aovs)
+                            aovs->variance[index] = -1.0f;
+                    } else if (aovs) {
+                        L = renderPixelWithVariance(state, renderKernel, rays, aovs->variance[index]);
+                    } else {
+                        L = renderKernel(state, rays, 0);
+                    }
+                    if (aovs)
+                        recordPixelAOVs(firstHits, *aovs, index);
+                    screen.setPixel(x, y, L);
+                }
             }
         }
-    }
 
-    // Pass through to extra.h for post processing
-    if (features.extra.enableBloomEffect) {
-        postprocessImageWithBloom(scene, features, camera, screen);
+        if (aovs)
+            denoiseImage(features, *aovs, screen);
     }
 }
 
@@ -54,6 +218,12 @@ void renderImage(const Scene& scene, const BVHInterface& bvh, const Features& fe
 // Given a render state, camera, pixel position, and output resolution, generates a set of camera ray samples for this pixel.
 // This method forwards to `generatePixelRaysMultisampled` and `generatePixelRaysStratified` when necessary.
 std::vector<Ray> generatePixelRays(RenderState& state, const Trackball& camera, glm::ivec2 pixel, glm::ivec2 screenResolution)
+{
+    return generatePixelRays<Trackball>(state, camera, pixel, screenResolution);
+}
+
+template <typename CameraT>
+std::vector<Ray> generatePixelRays(RenderState& state, const CameraT& camera, glm::ivec2 pixel, glm::ivec2 screenResolution)
 {
     if (state.features.numPixelSamples > 1) {
         if (state.features.enableJitteredSampling) {
@@ -70,6 +240,29 @@ std::vector<Ray> generatePixelRays(RenderState& state, const Trackball& camera,
     }
 }
 
+std::vector<Ray> generateCameraRays(RenderState& state, const Camera& camera, glm::ivec2 pixel, glm::ivec2 screenResolution)
+{
+    std::vector<Ray> rays = generatePixelRays(state, camera, pixel, screenResolution);
+    if (!camera.hasThinLens())
+        return rays;
+
+    // Split every pixel sample into samples across the lens
+    const int numLensSamples = std::max(state.features.extra.depthOfFieldNumSamples, 1);
+    std::vector<Ray> lensRays;
+    lensRays.reserve(rays.size() * size_t(numLensSamples));
+    for (const Ray& ray : rays) {
+        for (int i = 0; i < numLensSamples; i++)
+            lensRays.push_back(camera.sampleLens(ray, state.sampler.next_2d(SampleDimension::Lens)));
+    }
+    return lensRays;
+}
+
+RayCone cameraRayCone(const Features& features, const Camera& camera, glm::ivec2 screenResolution)
+{
+    const float numPixelSamples = float(std::max(features.numPixelSamples, 1u));
+    return { 0.0f, camera.pixelSpreadAngle(screenResolution) / std::sqrt(numPixelSamples) };
+}
+
 // TODO: standard feature
 // Given a render state, camera, pixel position, and output resolution, generates a set of camera ray samples placed
 // uniformly throughout this pixel.
@@ -80,13 +273,19 @@ std::vector<Ray> generatePixelRays(RenderState& state, const Trackball& camera,
 // - return;           a vector of camera rays into the pixel
 // This method is unit-tested, so do not change the function signature.
 std::vector<Ray> generatePixelRaysMultisampled(RenderState& state, const Trackball& camera, glm::ivec2 pixel, glm::ivec2 screenResolution)
+{
+    return generatePixelRaysMultisampled<Trackball>(state, camera, pixel, screenResolution);
+}
+
+template <typename CameraT>
+std::vector<Ray> generatePixelRaysMultisampled(RenderState& state, const CameraT& camera, glm::ivec2 pixel, glm::ivec2 screenResolution)
 {
     // Generate numSamples camera rays uniformly distributed across the pixel. Use
     // Hint; use `state.sampler.next*d()` to generate random samples in [0, 1).
     auto numSamples = state.features.numPixelSamples;
     std::vector<Ray> rays;
     for (auto i = 0; i < numSamples; i++) {
-        glm::vec2 randomOffset = state.sampler.next_2d();
+        glm::vec2 randomOffset = state.sampler.next_2d(SampleDimension::Pixel);
         glm::vec2 position = (glm::vec2(pixel) + randomOffset) / glm::vec2(screenResolution) * 2.f - 1.f;
         rays.push_back(camera.generateRay(position));
     }
@@ -105,6 +304,12 @@ std::vector<Ray> generatePixelRaysMultisampled(RenderState& state, const Trackba
 // This method is not unit-tested, but we do expect to find it **exactly here**, and we'd rather
 // not go on a hunting expedition for your implementation, so please keep it here!
 std::vector<Ray> generatePixelRaysStratified(RenderState& state, const Trackball& camera, glm::ivec2 pixel, glm::ivec2 screenResolution)
+{
+    return generatePixelRaysStratified<Trackball>(state, camera, pixel, screenResolution);
+}
+
+template <typename CameraT>
+std::vector<Ray> generatePixelRaysStratified(RenderState& state, const CameraT& camera, glm::ivec2 pixel, glm::ivec2 screenResolution)
 {
     // Generate numSamples * numSamples camera rays as jittered samples across the pixel.
     // Hint; use `state.sampler.next*d()` to generate random samples in [0, 1).
@@ -112,7 +317,7 @@ std::vector<Ray> generatePixelRaysStratified(RenderState& state, const Trackball
     std::vector<Ray> rays;
     for (auto i = 0; i < numSamples; i++)
         for (auto j = 0; j < numSamples; j++) {
-            glm::vec2 randomOffset = state.sampler.next_2d();
+            glm::vec2 randomOffset = state.sampler.next_2d(SampleDimension::Pixel);
             randomOffset[0] /= numSamples;
             randomOffset[1] /= numSamples;
             glm::vec2 cellOffset = {i / numSamples, j / numSamples};
@@ -120,4 +325,11 @@ std::vector<Ray> generatePixelRaysStratified(RenderState& state, const Trackball
             rays.push_back(camera.generateRay(position));
         }
     return rays;
-}
\ No newline at end of file
+}
+
+#define INSTANTIATE_PIXEL_RAY_GENERATORS(CameraT)                                                                                 \
+    template std::vector<Ray> generatePixelRays<CameraT>(RenderState&, const CameraT&, glm::ivec2, glm::ivec2);             \
+    template std::vector<Ray> generatePixelRaysMultisampled<CameraT>(RenderState&, const CameraT&, glm::ivec2, glm::ivec2); \
+    template std::vector<Ray> generatePixelRaysStratified<CameraT>(RenderState&, const CameraT&, glm::ivec2, glm::ivec2);
+INSTANTIATE_PIXEL_RAY_GENERATORS(Trackball)
+INSTANTIATE_PIXEL_RAY_GENERATORS(Camera)
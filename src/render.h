@@ -10,6 +10,24 @@ DISABLE_WARNINGS_PUSH()
 DISABLE_WARNINGS_POP()
 #include <framework/ray.h>
 
+// Footprint of the ray being traced, approximated as a cone; after T. Akenine-Moller et al., "Texture Level of
+// Detail Strategies for Real-Time Ray Tracing", Ray Tracing Gems, 2019. At distance t along the ray, the cone
+// is `width + spreadAngle * t` wide. Camera rays start with zero width and the angle subtended by a pixel;
+// secondary rays start with the width at their origin. The default cone has no footprint.
+struct RayCone {
+    float width = 0.0f;
+    float spreadAngle = 0.0f;
+};
+
+// First-hit quantities of a pixel's camera rays, summed by `kernel::shadeHit()` while the pixel is rendered; the
+// auxiliary buffers of the denoiser are written from these
+struct FirstHitSums {
+    glm::vec3 albedo { 0.0f }; // Sum of `sampleMaterialKd()` at the first hits
+    glm::vec3 normal { 0.0f };
+    float depth = 0.0f;
+    int numHits = 0;
+};
+
 // The configurative state inside renderer; collects
 // handles to e.g. the BVH and the scene, and holds
 // a per-thread random sampler and other things you
@@ -23,6 +41,21 @@ struct RenderState {
     // Small per-thread objects kept alive throughout the renderer
     // You can add your own objects here ...
     Sampler sampler; // 1d/2d sampler on the range [0, 1)
+    RayCone rayCone {}; // Footprint of the ray currently being traced; used for mipmap filtering
+
+    // Debug geometry output; only set for the interactive debug ray, and only used by `kernel::DebugDraw`
+    DebugRecording* debugRecording = nullptr;
+
+    // Hierarchy over the scene's lights, which picks the lights that are sampled at every hit; only set while
+    // rendering with the light tree enabled, all lights are sampled otherwise
+    const LightTree* lightTree = nullptr;
+
+    // Resampled light sample for the direct light at the first hit of the pixel's camera ray; see
+    // `resampleDirectLighting()`. `computeLightContribution()` uses it instead of sampling lights, and clears it.
+    const Reservoir* reservoir = nullptr;
+
+    // Sums of the first hits of the pixel's camera rays; only set while rendering with denoising enabled
+    FirstHitSums* firstHits = nullptr;
 };
 
 /* Baseline render code; you do not have to implement the following methods */
@@ -33,11 +66,33 @@ struct RenderState {
 // configuration. By default, `renderPixelNaive()` is called.
 void renderImage(const Scene& scene, const BVHInterface& bvh, const Features& features, const Trackball& camera, Screen& screen);
 
+// Same as above, but for a standalone camera that does not require a window. The image is rendered
+// in square tiles; with one sample per pixel, the camera rays of a whole tile are generated at once.
+// Reservoirs of resampled direct lighting are reused across the frames that share a `history`, if any.
+void renderImage(const Scene& scene, const BVHInterface& bvh, const Features& features, const Camera& camera, Screen& screen, ReservoirHistory* history = nullptr);
+
 // This function is provided as-is. You do not have to implement it.
 // Given a render state, camera, pixel position, and output resolution, generates a set of camera ray samples for this pixel.
 // This method forwards to `generatePixelRaysMultisampled` and `generatePixelRaysStratified` when necessary.
 std::vector<Ray> generatePixelRays(RenderState &state, const Trackball& camera, glm::ivec2 pixel, glm::ivec2 screenResolution);
 
+// Camera-type generic versions of the ray generation functions in this file, instantiated for
+// `Trackball` and `Camera`; the `Trackball` overloads forward to these.
+template <typename CameraT>
+std::vector<Ray> generatePixelRays(RenderState& state, const CameraT& camera, glm::ivec2 pixel, glm::ivec2 screenResolution);
+template <typename CameraT>
+std::vector<Ray> generatePixelRaysMultisampled(RenderState& state, const CameraT& camera, glm::ivec2 pixel, glm::ivec2 screenResolution);
+template <typename CameraT>
+std::vector<Ray> generatePixelRaysStratified(RenderState& state, const CameraT& camera, glm::ivec2 pixel, glm::ivec2 screenResolution);
+
+// Generates the camera rays for a pixel as `generatePixelRays()`; if the camera has a thin lens, every
+// pixel sample is then split into `depthOfFieldNumSamples` samples across the lens.
+std::vector<Ray> generateCameraRays(RenderState& state, const Camera& camera, glm::ivec2 pixel, glm::ivec2 screenResolution);
+
+// Returns the ray cone of the camera rays of a pixel; with several samples per pixel, each sample
+// covers a correspondingly smaller part of the pixel.
+RayCone cameraRayCone(const Features& features, const Camera& camera, glm::ivec2 screenResolution);
+
 /* Unfinished render code; you have to implement the following method */
 
 // TODO: standard feature
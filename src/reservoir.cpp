@@ -0,0 +1,292 @@
+#include "reservoir.h"
+#include "bvh_interface.h"
+#include "kernel.h"
+#include "light.h"
+#include "light_tree.h"
+#include "postprocess.h"
+#include "render.h"
+#include "scene.h"
+#include "shading.h"
+#include "visibility_buffer.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtc/constants.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <span>
+#include <variant>
+
+// Neighbours for spatial reuse are picked in a disk of this radius around a pixel, in pixels
+static constexpr float SpatialReuseRadius = 30.0f;
+
+// The previous frame's reservoir of a pixel stands for at most this many times as many candidates as the pixel's
+// own, s.t. old samples are phased out, and the light follows changes in the image
+static constexpr float MaxHistoryLength = 20.0f;
+
+// Pixels reuse each other's samples only if their hits' normals are within ~25 degrees, and their depths within 10%
+static constexpr float MinNormalSimilarity = 0.9f;
+static constexpr float MaxRelativeDepthDifference = 0.1f;
+
+bool Reservoir::update(const LightSample& candidate, float candidateWeight, float u)
+{
+    weightSum += candidateWeight;
+    if (candidateWeight > 0.0f && u * weightSum < candidateWeight) {
+        sample = candidate;
+        return true;
+    }
+    return false;
+}
+
+void ReservoirHistory::reset()
+{
+    camera.reset();
+    resolution = glm::ivec2(0);
+    numLights = 0;
+    pixels.clear();
+    frame = 0;
+}
+
+bool supportsReservoirResampling(const Scene& scene, const Features& features, const Camera& camera)
+{
+    return features.extra.enableReSTIR && features.numPixelSamples <= 1 && !camera.hasThinLens() && !features.extra.enableMotionBlur && !scene.lights.empty();
+}
+
+namespace {
+// First hit of a pixel's camera ray
+struct PixelHit {
+    Ray ray;
+    HitInfo hitInfo;
+    glm::vec3 normal { 0.0f }; // Normalized shading normal; zero if the ray missed
+};
+
+// A reservoir to merge into a pixel's, and the hit it was resampled for
+struct ReservoirSource {
+    Reservoir reservoir;
+    const PixelHit* hit;
+};
+}
+
+static bool isSimilarHit(const glm::vec3& normal, float depth, const glm::vec3& otherNormal, float otherDepth)
+{
+    return glm::dot(normal, otherNormal) >= MinNormalSimilarity && std::abs(depth - otherDepth) <= MaxRelativeDepthDifference * otherDepth;
+}
+
+// Target density of the resampling, up to a constant: the luminance of a light sample's shading at a hit, without
+// its shadow ray, as shaded by the frame's kernel
+static float targetDensity(RenderState& state, const kernel::ResamplingKernel& resamplingKernel, const PixelHit& hit, const LightSample& sample)
+{
+    const glm::vec3 direction = sample.position - (hit.ray.origin + hit.ray.t * hit.ray.direction);
+    if (glm::dot(direction, direction) == 0.0f)
+        return 0.0f;
+    return std::max(perceivedLuminance(resamplingKernel.computeShading(state, -hit.ray.direction, glm::normalize(direction), sample.color, hit.hitInfo)), 0.0f);
+}
+
+// Set the position and color of a light sample from its light and its position on it
+static void resolveLightSample(const Scene& scene, LightSample& sample)
+{
+    const Scene::SceneLight& light = scene.lights[sample.light];
+    if (std::holds_alternative<PointLight>(light)) {
+        sample.position = std::get<PointLight>(light).position;
+        sample.color = std::get<PointLight>(light).color;
+    } else if (std::holds_alternative<SegmentLight>(light)) {
+        sampleSegmentLight(sample.uv.x, std::get<SegmentLight>(light), sample.position, sample.color);
+    } else {
+        sampleParallelogramLight(sample.uv, std::get<ParallelogramLight>(light), sample.position, sample.color);
+    }
+}
+
+// Draw a light from the cumulative distribution of the lights' power, and a uniformly distributed point on it;
+// `probability` is set to the probability of drawing the light
+static LightSample sampleLight(const Scene& scene, std::span<const float> lightCdf, Sampler& sampler, float& probability)
+{
+    const float u = sampler.next_1d(SampleDimension::LightSelection) * lightCdf.back();
+    const auto light = std::min(size_t(std::upper_bound(lightCdf.begin(), lightCdf.end(), u) - lightCdf.begin()), lightCdf.size() - 1);
+    probability = (lightCdf[light] - (light > 0 ? lightCdf[light - 1] : 0.0f)) / lightCdf.back();
+
+    LightSample sample { .light = static_cast<uint32_t>(light), .uv = sampler.next_2d(SampleDimension::Light) };
+    resolveLightSample(scene, sample);
+    return sample;
+}
+
+// Set the contribution weight of a reservoir, given the target density of its sample, and the number of
+// candidates that could have been picked (Z in the paper)
+static void finalizeReservoir(Reservoir& reservoir, float target, float numCandidates, float numEligibleCandidates)
+{
+    reservoir.numCandidates = numCandidates;
+    reservoir.weight = target > 0.0f && numEligibleCandidates > 0.0f ? reservoir.weightSum / (numEligibleCandidates * target) : 0.0f;
+}
+
+// Merge reservoirs into a new one for a hit. Each source's sample is weighed by its target density at the hit, and
+// the number of candidates that the source stands for; the candidates of a source only count towards the kept
+// sample's weight if the sample has a nonzero target density at the source's own hit.
+static Reservoir mergeReservoirs(RenderState& state, const kernel::ResamplingKernel& resamplingKernel, const PixelHit& hit, std::span<const ReservoirSource> sources)
+{
+    Reservoir merged;
+    float selectedTarget = 0.0f, numCandidates = 0.0f;
+    for (const ReservoirSource& source : sources) {
+        const float target = targetDensity(state, resamplingKernel, hit, source.reservoir.sample);
+        const float weight = target * source.reservoir.weight * source.reservoir.numCandidates;
+        if (merged.update(source.reservoir.sample, weight, state.sampler.next_1d(SampleDimension::Resampling)))
+            selectedTarget = target;
+        numCandidates += source.reservoir.numCandidates;
+    }
+
+    float numEligibleCandidates = 0.0f;
+    for (const ReservoirSource& source : sources) {
+        const float target = source.hit == &hit ? selectedTarget : targetDensity(state, resamplingKernel, *source.hit, merged.sample);
+        if (target > 0.0f)
+            numEligibleCandidates += source.reservoir.numCandidates;
+    }
+    finalizeReservoir(merged, selectedTarget, numCandidates, numEligibleCandidates);
+    return merged;
+}
+
+std::vector<Reservoir> resampleDirectLighting(const Scene& scene, const BVHInterface& bvh, const Features& features, const Camera& camera, glm::ivec2 resolution, const VisibilityBuffer* visibilityBuffer, ReservoirHistory* history)
+{
+    const kernel::ResamplingKernel resamplingKernel = kernel::selectResamplingKernel(scene, features);
+    const RayCone rayCone = cameraRayCone(features, camera, resolution);
+    const size_t numPixels = size_t(resolution.x) * size_t(resolution.y);
+    std::vector<Reservoir> reservoirs(numPixels);
+    std::vector<PixelHit> hits(numPixels);
+
+    // Start over if the history belongs to another image or to other lights
+    const bool temporalReuse = history && features.extra.enableReSTIRTemporalReuse;
+    if (history && (!temporalReuse || history->resolution != resolution || history->numLights != scene.lights.size()))
+        history->reset();
+    const bool hasHistory = temporalReuse && history->camera.has_value();
+
+    // Every pass seeds its pixels' samplers differently, and so does every frame of a history
+    const uint32_t frame = history ? history->frame : 0;
+    const auto makeState = [&](int x, int y, uint32_t pass) {
+        const auto seed = static_cast<uint32_t>(resolution.y * x + y) + (3 * frame + pass) * static_cast<uint32_t>(numPixels);
+        return RenderState { .scene = scene, .features = features, .bvh = bvh, .sampler = { features.extra.samplerType, { x, y }, seed }, .rayCone = rayCone };
+    };
+
+    // Lights are drawn in proportion to their power, or uniformly if they are all black
+    std::vector<float> lightCdf(scene.lights.size());
+    float totalPower = 0.0f;
+    for (size_t i = 0; i < scene.lights.size(); i++)
+        lightCdf[i] = totalPower += lightPower(scene.lights[i]);
+    if (totalPower == 0.0f) {
+        for (size_t i = 0; i < lightCdf.size(); i++)
+            lightCdf[i] = float(i + 1);
+    }
+
+    // Find the camera rays' hits, and stream fresh candidates into every pixel's reservoir. Hits are taken from the
+    // visibility buffer where it has one, and traced otherwise, as `renderImage()` does
+    const auto numInitialCandidates = static_cast<uint32_t>(std::max(features.extra.numReSTIRCandidates, 1));
+#ifdef NDEBUG // Enable multi threading in Release mode
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int y = 0; y < resolution.y; y++) {
+        for (int x = 0; x < resolution.x; x++) {
+            const size_t index = size_t(y) * size_t(resolution.x) + size_t(x);
+            RenderState state = makeState(x, y, 0);
+            PixelHit& hit = hits[index];
+            hit.ray = camera.generateRay((glm::vec2(x, y) + 0.5f) / glm::vec2(resolution) * 2.0f - 1.0f);
+            if (visibilityBuffer && visibilityBuffer->sample({ x, y }).primitiveID != VisibilityBuffer::NoHit) {
+                const VisibilityBuffer::Sample& sample = visibilityBuffer->sample({ x, y });
+                const BVHInterface::Primitive& primitive = bvh.primitives()[sample.primitiveID];
+                hit.ray.t = VisibilityBuffer::hitDistance(hit.ray, primitive, sample);
+                resamplingKernel.updateHitInfo(state, primitive, hit.ray, hit.hitInfo);
+            } else if (!resamplingKernel.intersect(state, hit.ray, hit.hitInfo)) {
+                continue;
+            }
+            hit.normal = glm::normalize(hit.hitInfo.normal);
+
+            Reservoir& reservoir = reservoirs[index];
+            float selectedTarget = 0.0f;
+            for (uint32_t i = 0; i < numInitialCandidates; i++) {
+                float probability;
+                const LightSample candidate = sampleLight(scene, lightCdf, state.sampler, probability);
+                const float target = targetDensity(state, resamplingKernel, hit, candidate);
+                if (reservoir.update(candidate, target / probability, state.sampler.next_1d(SampleDimension::Resampling)))
+                    selectedTarget = target;
+            }
+            finalizeReservoir(reservoir, selectedTarget, float(numInitialCandidates), float(numInitialCandidates));
+        }
+    }
+
+    // Merge every pixel's reservoir with the previous frame's at the same point. The previous hit is not kept, so the
+    // current hit stands in for it; the similarity test makes sure that they are close.
+    if (hasHistory) {
+#ifdef NDEBUG // Enable multi threading in Release mode
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int y = 0; y < resolution.y; y++) {
+            for (int x = 0; x < resolution.x; x++) {
+                const size_t index = size_t(y) * size_t(resolution.x) + size_t(x);
+                const PixelHit& hit = hits[index];
+                if (hit.normal == glm::vec3(0.0f))
+                    continue;
+                const glm::vec3 point = hit.ray.origin + hit.ray.t * hit.ray.direction;
+                const glm::vec3 projected = history->camera->project(point);
+                if (projected.z <= 0.0f)
+                    continue;
+                const glm::ivec2 previousPixel { glm::floor((glm::vec2(projected) / projected.z + 1.0f) / 2.0f * glm::vec2(resolution)) };
+                if (glm::any(glm::lessThan(previousPixel, glm::ivec2(0))) || glm::any(glm::greaterThanEqual(previousPixel, resolution)))
+                    continue;
+                const ReservoirHistory::Pixel& previous = history->pixels[size_t(previousPixel.y) * size_t(resolution.x) + size_t(previousPixel.x)];
+                if (!isSimilarHit(hit.normal, glm::length(point - history->camera->position()), previous.normal, previous.depth))
+                    continue;
+
+                // Lights may have been edited since, so the previous sample is moved along with its light
+                RenderState state = makeState(x, y, 1);
+                std::array<ReservoirSource, 2> sources { ReservoirSource { reservoirs[index], &hit }, ReservoirSource { previous.reservoir, &hit } };
+                resolveLightSample(scene, sources[1].reservoir.sample);
+                sources[1].reservoir.numCandidates = std::min(sources[1].reservoir.numCandidates, MaxHistoryLength * reservoirs[index].numCandidates);
+                reservoirs[index] = mergeReservoirs(state, resamplingKernel, hit, sources);
+            }
+        }
+    }
+
+    // Merge every pixel's reservoir with those of random pixels nearby with a similar hit
+    const auto numNeighbours = std::max(features.extra.numReSTIRSpatialNeighbours, 0);
+    if (numNeighbours > 0) {
+        std::vector<Reservoir> spatialReservoirs(numPixels);
+#ifdef NDEBUG // Enable multi threading in Release mode
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int y = 0; y < resolution.y; y++) {
+            std::vector<ReservoirSource> sources;
+            for (int x = 0; x < resolution.x; x++) {
+                const size_t index = size_t(y) * size_t(resolution.x) + size_t(x);
+                const PixelHit& hit = hits[index];
+                if (hit.normal == glm::vec3(0.0f))
+                    continue;
+
+                RenderState state = makeState(x, y, 2);
+                sources.assign(1, ReservoirSource { reservoirs[index], &hit });
+                for (int i = 0; i < numNeighbours; i++) {
+                    const glm::vec2 sample = state.sampler.next_2d(SampleDimension::Resampling);
+                    const float radius = SpatialReuseRadius * std::sqrt(sample.x), angle = 2.0f * glm::pi<float>() * sample.y;
+                    const glm::ivec2 neighbour = glm::ivec2(x, y) + glm::ivec2(glm::round(radius * glm::vec2(std::cos(angle), std::sin(angle))));
+                    if (neighbour == glm::ivec2(x, y) || glm::any(glm::lessThan(neighbour, glm::ivec2(0))) || glm::any(glm::greaterThanEqual(neighbour, resolution)))
+                        continue;
+                    const size_t neighbourIndex = size_t(neighbour.y) * size_t(resolution.x) + size_t(neighbour.x);
+                    const PixelHit& neighbourHit = hits[neighbourIndex];
+                    if (neighbourHit.normal == glm::vec3(0.0f) || !isSimilarHit(hit.normal, hit.ray.t, neighbourHit.normal, neighbourHit.ray.t))
+                        continue;
+                    sources.push_back({ reservoirs[neighbourIndex], &neighbourHit });
+                }
+                spatialReservoirs[index] = sources.size() > 1 ? mergeReservoirs(state, resamplingKernel, hit, sources) : reservoirs[index];
+            }
+        }
+        reservoirs = std::move(spatialReservoirs);
+    }
+
+    if (temporalReuse) {
+        history->camera = camera;
+        history->resolution = resolution;
+        history->numLights = scene.lights.size();
+        history->pixels.resize(numPixels);
+        for (size_t i = 0; i < numPixels; i++)
+            history->pixels[i] = { reservoirs[i], hits[i].normal, hits[i].ray.t };
+        history->frame++;
+    }
+    return reservoirs;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include "camera.h"
+#include "common.h"
+#include "fwd.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// A point on one of the scene's lights, and the color it emits there
+struct LightSample {
+    uint32_t light = 0; // Index into `Scene::lights`
+    glm::vec2 uv { 0.0f }; // Position on the light, as passed to `sampleSegmentLight()`/`sampleParallelogramLight()`
+    glm::vec3 position { 0.0f };
+    glm::vec3 color { 0.0f };
+};
+
+// A weighted reservoir of light samples, for resampled importance sampling of the direct light at a hit; after
+// B. Bitterli et al., "Spatiotemporal Reservoir Resampling for Real-Time Ray Tracing with Dynamic Direct
+// Lighting", 2020 (ReSTIR). Of all candidates streamed into it, the reservoir keeps one, picked in proportion
+// to the candidates' resampling weights; the shading of that sample (with its shadow ray) times `weight` is an
+// estimate of the light from all of the scene's lights, like `computeLightContribution()`.
+struct Reservoir {
+    LightSample sample;
+    float weightSum = 0.0f; // Sum of the resampling weights of all candidates
+    float numCandidates = 0.0f; // Number of candidates that the reservoir stands for (M)
+    float weight = 0.0f; // Unbiased contribution weight of `sample` (W); 0 if no candidate can contribute
+
+    // Stream a candidate into the reservoir, which replaces `sample` with probability `candidateWeight / weightSum`
+    // given a uniformly distributed sample in [0, 1); returns whether it did
+    bool update(const LightSample& candidate, float candidateWeight, float u);
+};
+
+// What `resampleDirectLighting()` keeps of a frame for the next one, for temporal reuse; an empty history
+// (after construction or `reset()`) is never reused. Reuse needs a static scene, but not a static camera:
+// hits are reprojected into the previous frame, and the history is not reused where the surface differs.
+struct ReservoirHistory {
+    struct Pixel {
+        Reservoir reservoir;
+        glm::vec3 normal { 0.0f }; // Shading normal of the camera ray's hit; zero if it missed
+        float depth = 0.0f; // Distance from the camera to the hit
+    };
+
+    std::optional<Camera> camera;
+    glm::ivec2 resolution { 0 };
+    size_t numLights = 0;
+    std::vector<Pixel> pixels; // Row by row, from the bottom
+    uint32_t frame = 0; // Number of frames rendered since the last reset, which decorrelates their samples
+
+    void reset();
+};
+
+// Whether the direct light at camera ray hits may be resampled; this requires one ray through the center of
+// every pixel, from a pinhole camera.
+[[nodiscard]] bool supportsReservoirResampling(const Scene& scene, const Features& features, const Camera& camera);
+
+// Resample the direct light at the first hit of every pixel's camera ray, and return a reservoir per pixel, row by
+// row from the bottom; empty for pixels whose ray misses. Hits are read from `visibilityBuffer` where it has one,
+// and traced otherwise. Every pixel streams `numReSTIRCandidates` light samples into its reservoir; lights are
+// picked in proportion to their power, and points on them uniformly, and they are weighed by their unshadowed
+// shading, as evaluated by the kernel that `renderImage()` renders the frame with. The reservoir is then merged with that of the pixel's hit in the previous
+// frame, if temporal reuse is enabled and a history is given, and then with those of `numReSTIRSpatialNeighbours`
+// random pixels nearby whose hit has a similar normal and depth. Candidates from merged reservoirs are counted only
+// if they could have been picked at their own pixel, s.t. the spatial merge does not darken edges.
+//
+// No shadow rays are traced here, so the cost per candidate is that of shading only; the renderer traces a single
+// shadow ray per pixel, to the sample that the reservoir kept (see `RenderState::reservoir`).
+std::vector<Reservoir> resampleDirectLighting(const Scene& scene, const BVHInterface& bvh, const Features& features, const Camera& camera, glm::ivec2 resolution, const VisibilityBuffer* visibilityBuffer, ReservoirHistory* history);
@@ -0,0 +1,225 @@
+#include "sampler.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+// Side length of the tileable blue noise mask
+static constexpr int BlueNoiseSize = 64;
+
+// Hash of a 32-bit integer with low bias; https://nullprogram.com/blog/2018/07/31/
+static uint32_t hashInteger(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static uint32_t hashCombine(uint32_t seed, uint32_t value)
+{
+    return hashInteger(seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+static uint32_t reverseBits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Owen scrambling of a 32-bit fixed point number in [0, 1), after "Practical Hash-based Owen Scrambling"
+// (Burley 2020), with the improved permutation by Vegdahl. Every bit is flipped depending on the bits that
+// are more significant than it, and on the seed.
+static uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+{
+    x = reverseBits(x);
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1u;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return reverseBits(x);
+}
+
+// First two dimensions of the Sobol sequence, as 32-bit fixed point numbers
+static uint32_t sobolDimension0(uint32_t index)
+{
+    return reverseBits(index);
+}
+static uint32_t sobolDimension1(uint32_t index)
+{
+    uint32_t result = 0;
+    for (uint32_t direction = 1u << 31; index != 0; index >>= 1, direction ^= direction >> 1) {
+        if (index & 1u)
+            result ^= direction;
+    }
+    return result;
+}
+
+// Owen-scrambled radical inverse in a prime base: every digit is permuted by an affine permutation
+// d -> (a * d + b) mod base, with a and b chosen by a hash of the more significant digits
+static float scrambledRadicalInverse(uint32_t base, uint32_t index, uint32_t seed)
+{
+    double result = 0.0, digitWeight = 1.0 / double(base);
+    uint32_t prefixHash = seed;
+    // The digits after the index runs out are scrambled too, until they are below float precision
+    while (digitWeight > 0x1p-25) {
+        const uint32_t digit = index % base;
+        index /= base;
+        const uint32_t hash = hashInteger(prefixHash);
+        result += double(((1 + hash % (base - 1)) * digit + (hash >> 16) % base) % base) * digitWeight;
+        digitWeight /= double(base);
+        prefixHash = hashCombine(prefixHash, digit);
+    }
+    return std::min(float(result), 0x1.fffffep-1f);
+}
+
+// Convert a 32-bit fixed point number to a float in [0, 1), dropping the bits that floats cannot represent
+static float fixedToFloat(uint32_t x)
+{
+    return float(x >> 8) * 0x1p-24f;
+}
+
+// A tileable blue noise mask of values in (0, 1), made by the void-and-cluster method (Ulichney 1993): pixels
+// are ranked by repeatedly adding a pixel in the largest void of a pattern, or removing it from the tightest
+// cluster, where voids and clusters are measured by a Gaussian filter of the pattern
+static std::vector<float> generateBlueNoise()
+{
+    constexpr int numPixels = BlueNoiseSize * BlueNoiseSize;
+    constexpr int radius = 6;
+    constexpr float sigma = 1.5f;
+    std::array<float, (2 * radius + 1) * (2 * radius + 1)> kernel;
+    for (int dy = -radius; dy <= radius; dy++) {
+        for (int dx = -radius; dx <= radius; dx++)
+            kernel[size_t((dy + radius) * (2 * radius + 1) + dx + radius)] = std::exp(-float(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+    }
+
+    std::vector<bool> pattern(numPixels, false);
+    std::vector<float> energy(numPixels, 0.0f);
+    const auto toggle = [&](int pixel) {
+        pattern[size_t(pixel)] = !pattern[size_t(pixel)];
+        const float sign = pattern[size_t(pixel)] ? 1.0f : -1.0f;
+        const int x = pixel % BlueNoiseSize, y = pixel / BlueNoiseSize;
+        for (int dy = -radius; dy <= radius; dy++) {
+            for (int dx = -radius; dx <= radius; dx++) {
+                const int neighbour = ((y + dy + BlueNoiseSize) % BlueNoiseSize) * BlueNoiseSize + (x + dx + BlueNoiseSize) % BlueNoiseSize;
+                energy[size_t(neighbour)] += sign * kernel[size_t((dy + radius) * (2 * radius + 1) + dx + radius)];
+            }
+        }
+    };
+    const auto tightestCluster = [&]() {
+        int result = -1;
+        for (int pixel = 0; pixel < numPixels; pixel++) {
+            if (pattern[size_t(pixel)] && (result < 0 || energy[size_t(pixel)] > energy[size_t(result)]))
+                result = pixel;
+        }
+        return result;
+    };
+    const auto largestVoid = [&]() {
+        int result = -1;
+        for (int pixel = 0; pixel < numPixels; pixel++) {
+            if (!pattern[size_t(pixel)] && (result < 0 || energy[size_t(pixel)] < energy[size_t(result)]))
+                result = pixel;
+        }
+        return result;
+    };
+
+    // Start from a random pattern of a tenth of the pixels, and move pixels from clusters to voids until
+    // the pattern is evenly spread
+    constexpr int numInitialPixels = numPixels / 10;
+    uint32_t state = 1;
+    for (int numPlaced = 0; numPlaced < numInitialPixels;) {
+        state = hashInteger(state);
+        const int pixel = int(state % uint32_t(numPixels));
+        if (!pattern[size_t(pixel)]) {
+            toggle(pixel);
+            numPlaced++;
+        }
+    }
+    for (;;) {
+        const int cluster = tightestCluster();
+        toggle(cluster);
+        const int gap = largestVoid();
+        toggle(gap);
+        if (gap == cluster)
+            break;
+    }
+
+    // Rank the initial pixels from the tightest cluster down, and then all others by filling the largest
+    // void; once the pattern is more than half full, the largest void of the pattern is the tightest cluster
+    // of its complement, so this also covers the last phase of the method
+    std::vector<int> ranks(numPixels);
+    const std::vector<bool> initialPattern = pattern;
+    const std::vector<float> initialEnergy = energy;
+    for (int rank = numInitialPixels - 1; rank >= 0; rank--) {
+        const int cluster = tightestCluster();
+        toggle(cluster);
+        ranks[size_t(cluster)] = rank;
+    }
+    pattern = initialPattern;
+    energy = initialEnergy;
+    for (int rank = numInitialPixels; rank < numPixels; rank++) {
+        const int gap = largestVoid();
+        toggle(gap);
+        ranks[size_t(gap)] = rank;
+    }
+
+    std::vector<float> mask(numPixels);
+    for (int pixel = 0; pixel < numPixels; pixel++)
+        mask[size_t(pixel)] = (float(ranks[size_t(pixel)]) + 0.5f) / float(numPixels);
+    return mask;
+}
+
+// Value of the blue noise mask at a pixel; `channel` shifts the mask by a point of the R2 sequence, s.t.
+// different channels are decorrelated
+static float blueNoise(glm::ivec2 pixel, uint32_t channel)
+{
+    static const std::vector<float> mask = generateBlueNoise();
+    const glm::vec2 r2 = glm::fract(float(channel + 1) * glm::vec2(0.7548776662f, 0.5698402910f));
+    const glm::ivec2 offset = glm::ivec2(r2 * float(BlueNoiseSize));
+    const glm::ivec2 position = ((pixel + offset) % BlueNoiseSize + BlueNoiseSize) % BlueNoiseSize;
+    return mask[size_t(position.y * BlueNoiseSize + position.x)];
+}
+
+glm::vec2 Sampler::sample_2d(SampleDimension dimension, uint32_t index) const
+{
+    switch (m_type) {
+        case SamplerType::Sobol: {
+            const uint32_t seed = hashCombine(m_seed, uint32_t(dimension));
+            // Shuffle the order of the points, which keeps every power-of-two prefix stratified
+            const uint32_t shuffledIndex = nestedUniformScramble(index, hashCombine(seed, 0));
+            return { fixedToFloat(nestedUniformScramble(sobolDimension0(shuffledIndex), hashCombine(seed, 1))),
+                fixedToFloat(nestedUniformScramble(sobolDimension1(shuffledIndex), hashCombine(seed, 2))) };
+        }
+        case SamplerType::Halton: {
+            // Every dimension takes the next two primes as its bases, s.t. the dimensions do not correlate
+            constexpr std::array<uint32_t, 2 * size_t(SampleDimension::Count)> primes { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53 };
+            const uint32_t seed = hashCombine(m_seed, uint32_t(dimension));
+            return { scrambledRadicalInverse(primes[2 * size_t(dimension)], index, hashCombine(seed, 1)),
+                scrambledRadicalInverse(primes[2 * size_t(dimension) + 1], index, hashCombine(seed, 2)) };
+        }
+        case SamplerType::BlueNoise: {
+            // The same scrambled points for every pixel, shifted by the blue noise mask (Cranley-Patterson rotation)
+            const uint32_t seed = hashCombine(0, uint32_t(dimension));
+            const uint32_t shuffledIndex = nestedUniformScramble(index, hashCombine(seed, 0));
+            const glm::vec2 point { fixedToFloat(nestedUniformScramble(sobolDimension0(shuffledIndex), hashCombine(seed, 1))),
+                fixedToFloat(nestedUniformScramble(sobolDimension1(shuffledIndex), hashCombine(seed, 2))) };
+            const glm::vec2 shift { blueNoise(m_pixel, 2 * uint32_t(dimension)), blueNoise(m_pixel, 2 * uint32_t(dimension) + 1) };
+            return glm::min(glm::fract(point + shift), glm::vec2(0x1.fffffep-1f));
+        }
+        default: {
+            const uint32_t state = hashCombine(hashCombine(m_seed, uint32_t(dimension)), index);
+            return { fixedToFloat(hashInteger(state)), fixedToFloat(hashInteger(state + 1)) };
+        }
+    }
+}
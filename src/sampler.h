@@ -1,17 +1,44 @@
 #pragma once
 
+#include "common.h"
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
 #include <glm/vec2.hpp>
 DISABLE_WARNINGS_POP()
+#include <array>
+#include <cstdint>
 #include <random>
 #include <utility>
 
+// Quantities that a renderer draws samples for. Every dimension draws from a sequence of its own, s.t.
+// successive draws of e.g. light samples are stratified, and do not correlate with the pixel samples.
+enum class SampleDimension : uint32_t {
+    Generic, // Draws that do not name a dimension
+    Pixel, // Position of a camera ray in the pixel
+    Lens, // Position of a camera ray on the lens
+    Light, // Position on an area light
+    Bounce, // Direction of a secondary ray
+    Brdf, // Direction drawn from a surface's BRDF, towards an area light
+    LightSelection, // Choice of a light to sample
+    Resampling, // Choices between resampled candidates, and of neighbours to resample from
+    Count
+};
+
 // Simple fast 1d/2d sampler for drawing uniformly distributed samples in [0, 1),
 // based on the pcg integer hash; https://www.pcg-random.org/
 // - Not thread-safe, do not share across threads.
+//
+// Besides independent samples, it draws points of low-discrepancy sequences (see `SamplerType`). These
+// sequences are 2D, and every dimension of the sampler walks through a sequence of its own, with its own
+// random scramble; a 1d draw takes the first coordinate of a 2D point. The Sobol points are stratified over
+// every power-of-two number of draws from a dimension, e.g. over all shadow samples of a pixel.
 class Sampler {
     uint32_t m_state;
+    uint32_t m_seed;
+
+    SamplerType m_type = SamplerType::Independent;
+    glm::ivec2 m_pixel { 0 };
+    std::array<uint32_t, size_t(SampleDimension::Count)> m_sampleIndices {};
 
     uint32_t pcg_hash(uint32_t& state)
     {
@@ -28,19 +55,47 @@ public:
     // Seeded constructor, by default draws from std::random_device
     Sampler(uint32_t seed = std::random_device()())
         : m_state(seed)
+        , m_seed(seed)
     {
         // ...
     }
+    // Sampler for one pixel of an image; low-discrepancy samplers scramble their sequences by `seed`, except
+    // for the blue noise sampler, which shifts them by the pixel's value in a blue noise mask instead
+    Sampler(SamplerType type, glm::ivec2 pixel, uint32_t seed)
+        : m_state(seed)
+        , m_seed(seed)
+        , m_type(type)
+        , m_pixel(pixel)
+    {
+    }
 
     // Draw a 1d sample in [a, b)
     float next_1d()
     {
-        return static_cast<float>(pcg_hash(m_state)) / 4294967295.f;
+        return next_1d(SampleDimension::Generic);
     }
 
     // Draw a 2d sample in [a, b)
     glm::vec2 next_2d()
     {
-        return { next_1d(), next_1d() };
+        return next_2d(SampleDimension::Generic);
     }
-};
\ No newline at end of file
+
+    // Draw the next sample of a dimension
+    float next_1d(SampleDimension dimension)
+    {
+        if (m_type == SamplerType::Independent)
+            return static_cast<float>(pcg_hash(m_state)) / 4294967295.f;
+        return sample_2d(dimension, m_sampleIndices[size_t(dimension)]++).x;
+    }
+    glm::vec2 next_2d(SampleDimension dimension)
+    {
+        if (m_type == SamplerType::Independent)
+            return { next_1d(dimension), next_1d(dimension) };
+        return sample_2d(dimension, m_sampleIndices[size_t(dimension)]++);
+    }
+
+    // Return the `index`th sample of a dimension, regardless of the samples drawn so far; e.g. to split
+    // the samples of a pixel over threads. Takes constant time for any index.
+    [[nodiscard]] glm::vec2 sample_2d(SampleDimension dimension, uint32_t index) const;
+};
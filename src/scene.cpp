@@ -1,22 +1,26 @@
 #include "scene.h"
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <unordered_map>
 
-Scene loadScenePrebuilt(SceneType type, const std::filesystem::path& dataDir)
+Scene loadScenePrebuilt(SceneType type, const std::filesystem::path& dataDir, std::shared_ptr<TextureCache> textureCache)
 {
     Scene scene;
     scene.type = type;
+    scene.textureCache = std::move(textureCache);
+    const bool loadTextures = !scene.textureCache;
     switch (type) {
     case SingleTriangle: {
         // Load a 3D model with a single triangle
-        auto subMeshes = loadMesh(dataDir / "triangle.obj");
+        auto subMeshes = loadMesh(dataDir / "triangle.obj", false, loadTextures);
         subMeshes[0].material.kd = glm::vec3(1.0f);
         std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
         scene.lights.emplace_back(PointLight { glm::vec3(-1, 1, -1), glm::vec3(1) });
     } break;
     case Cube: {
         // Load a 3D model of a cube with 12 triangles
-        auto subMeshes = loadMesh(dataDir / "cube.obj");
+        auto subMeshes = loadMesh(dataDir / "cube.obj", false, loadTextures);
         std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
         // scene.lights.push_back(PointLight { glm::vec3(-1, 1, -1), glm::vec3(1) });
         scene.lights.emplace_back(SegmentLight {
@@ -27,19 +31,19 @@ Scene loadScenePrebuilt(SceneType type, const std::filesystem::path& dataDir)
         });
     } break;
     case CubeTextured: {
-        auto subMeshes = loadMesh(dataDir / "cube-textured.obj");
+        auto subMeshes = loadMesh(dataDir / "cube-textured.obj", false, loadTextures);
         std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
         scene.lights.emplace_back(PointLight { glm::vec3(-1.0, 1.5, -1.0), glm::vec3(1) });
     } break;
     case CornellBox: {
         // Load a 3D model of a Cornell Box
-        auto subMeshes = loadMesh(dataDir / "CornellBox-Mirror-Rotated.obj", true);
+        auto subMeshes = loadMesh(dataDir / "CornellBox-Mirror-Rotated.obj", true, loadTextures);
         std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
         scene.lights.emplace_back(PointLight { glm::vec3(0, 0.58f, 0), glm::vec3(1) }); // Light at the top of the box
     } break;
     case CornellBoxTransparency: {
         // Load a 3D model of a Cornell Box
-        auto subMeshes = loadMesh(dataDir / "CornellBox-Mirror-Rotated.obj", true);
+        auto subMeshes = loadMesh(dataDir / "CornellBox-Mirror-Rotated.obj", true, loadTextures);
         // for (auto &mesh : subMeshes)
         //     mesh.material.transparency = 0.5f;
         subMeshes[6].material = Material {
@@ -59,7 +63,7 @@ Scene loadScenePrebuilt(SceneType type, const std::filesystem::path& dataDir)
     } break;
     case CornellBoxParallelogramLight: {
         // Load a 3D model of a Cornell Box
-        auto subMeshes = loadMesh(dataDir / "CornellBox-Mirror-Rotated.obj", true);
+        auto subMeshes = loadMesh(dataDir / "CornellBox-Mirror-Rotated.obj", true, loadTextures);
         std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
         // Light at the top of the box.
         scene.lights.emplace_back(ParallelogramLight {
@@ -74,20 +78,20 @@ Scene loadScenePrebuilt(SceneType type, const std::filesystem::path& dataDir)
     } break;
     case Monkey: {
         // Load a 3D model of a Monkey
-        auto subMeshes = loadMesh(dataDir / "monkey.obj", true);
+        auto subMeshes = loadMesh(dataDir / "monkey.obj", true, loadTextures);
         std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
         scene.lights.emplace_back(PointLight { glm::vec3(-1, 1, -1), glm::vec3(1) });
         scene.lights.emplace_back(PointLight { glm::vec3(1, -1, -1), glm::vec3(1) });
     } break;
     case Teapot: {
         // Load a 3D model of a Teapot
-        auto subMeshes = loadMesh(dataDir / "teapot.obj", true);
+        auto subMeshes = loadMesh(dataDir / "teapot.obj", true, loadTextures);
         std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
         scene.lights.emplace_back(PointLight { glm::vec3(-1, 1, -1), glm::vec3(1) });
     } break;
     case Dragon: {
         // Load a 3D model of a Dragon
-        auto subMeshes = loadMesh(dataDir / "dragon.obj", true);
+        auto subMeshes = loadMesh(dataDir / "dragon.obj", true, loadTextures);
         std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
         scene.lights.emplace_back(PointLight { glm::vec3(-1, 1, -1), glm::vec3(1) });
     } break;
@@ -99,7 +103,7 @@ Scene loadScenePrebuilt(SceneType type, const std::filesystem::path& dataDir)
     } break;
     case Custom: {
         // === Replace custom.obj by your own 3D model (or call your 3D model custom.obj) ===
-        auto subMeshes = loadMesh(dataDir / "custom.obj");
+        auto subMeshes = loadMesh(dataDir / "custom.obj", false, loadTextures);
         std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
         // === CHANGE THE LIGHTING IF DESIRED ===
         scene.lights.emplace_back(PointLight { glm::vec3(-1, 1, -1), glm::vec3(1) });
@@ -108,16 +112,76 @@ Scene loadScenePrebuilt(SceneType type, const std::filesystem::path& dataDir)
     } break;
     };
 
+    buildMaterialTable(scene);
     return scene;
 }
 
-Scene loadSceneFromFile(const std::filesystem::path& path, const std::vector<std::variant<PointLight, SegmentLight, ParallelogramLight>>& lights)
+Scene loadSceneFromFile(const std::filesystem::path& path, const std::vector<std::variant<PointLight, SegmentLight, ParallelogramLight>>& lights, std::shared_ptr<TextureCache> textureCache)
 {
     Scene scene;
     scene.lights = std::move(lights);
+    scene.textureCache = std::move(textureCache);
 
-    auto subMeshes = loadMesh(path);
+    auto subMeshes = loadMesh(path, false, !scene.textureCache);
     std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
 
+    buildMaterialTable(scene);
     return scene;
 }
+
+void buildMaterialTable(Scene& scene)
+{
+    // Images that were converted by an earlier call have released their pixels, so their textures are kept
+    std::unordered_map<const Image*, std::shared_ptr<const Texture>> texturesByImage;
+    for (size_t i = 0; i < std::min(scene.materials.size(), scene.textures.size()); i++) {
+        if (scene.textures[i])
+            texturesByImage[scene.materials[i].kdTexture.get()] = scene.textures[i];
+    }
+
+    scene.materials.clear();
+    scene.materials.reserve(scene.meshes.size() + scene.spheres.size());
+    for (const auto& mesh : scene.meshes)
+        scene.materials.push_back(mesh.material);
+    for (const auto& sphere : scene.spheres)
+        scene.materials.push_back(sphere.material);
+
+    // The kernels only sample the textures, so the images' pixels are released; the images themselves are kept,
+    // as a material's `kdTexture` tells whether it is textured, and which texture is its own
+    scene.textures.clear();
+    scene.textures.reserve(scene.materials.size());
+    for (const auto& material : scene.materials) {
+        std::shared_ptr<const Texture> texture;
+        if (material.kdTexture) {
+            auto& shared = texturesByImage[material.kdTexture.get()];
+            if (!shared) {
+                shared = std::make_shared<const Texture>(*material.kdTexture);
+                std::vector<glm::vec3>().swap(material.kdTexture->pixels);
+            }
+            texture = shared;
+        }
+        scene.textures.push_back(std::move(texture));
+    }
+
+    scene.cachedTextures.assign(scene.materials.size(), TextureCache::InvalidTexture);
+    if (scene.textureCache) {
+        for (size_t i = 0; i < scene.meshes.size(); i++) {
+            if (!scene.meshes[i].material.kdTexture && !scene.meshes[i].kdTexturePath.empty())
+                scene.cachedTextures[i] = scene.textureCache->addTexture(scene.meshes[i].kdTexturePath);
+        }
+    }
+}
+
+void streamGeometry(Scene& scene, const GeometryCacheConfig& config)
+{
+    scene.geometryCache = std::make_shared<GeometryCache>(config, scene.meshes);
+    for (Mesh& mesh : scene.meshes) {
+        mesh.vertices = {};
+        mesh.triangles = {};
+    }
+}
+
+bool hasMaterialTable(const Scene& scene)
+{
+    const size_t numMaterials = scene.meshes.size() + scene.spheres.size();
+    return scene.materials.size() == numMaterials && scene.textures.size() == numMaterials && scene.cachedTextures.size() == numMaterials;
+}
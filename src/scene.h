@@ -7,10 +7,15 @@ DISABLE_WARNINGS_POP()
 #include <filesystem>
 #include <framework/mesh.h>
 #include <framework/ray.h>
+#include <memory>
 #include <optional>
 #include <variant>
 #include <vector>
 #include "common.h"
+#include "environment_map.h"
+#include "geometry_cache.h"
+#include "texture.h"
+#include "texture_cache.h"
 
 enum SceneType {
     SingleTriangle,
@@ -34,13 +39,42 @@ struct Scene {
     std::vector<Sphere> spheres;
     std::vector<SceneLight> lights;
 
+    // Flat table of all materials in the scene, filled by `buildMaterialTable()`. The material ID
+    // of a triangle is the index of its mesh, and that of the i'th sphere is `meshes.size() + i`.
+    // Render kernels look materials up here by ID, instead of copying them into every hit.
+    std::vector<Material> materials;
+    // Compact copies of the materials' textures, by material ID; null for untextured materials.
+    // Materials that share an image share its texture. The images keep their size, but not their pixels.
+    std::vector<std::shared_ptr<const Texture>> textures;
+
+    // If set, the meshes' textures are not loaded, but streamed through this cache; `cachedTextures` holds
+    // the cache's texture ID for every material ID, or `TextureCache::InvalidTexture`.
+    std::shared_ptr<TextureCache> textureCache;
+    std::vector<TextureCache::TextureID> cachedTextures;
+
+    // If set, the meshes' triangles are streamed through this cache; the meshes keep their materials, but
+    // have no vertices or triangles. See `streamGeometry()`.
+    std::shared_ptr<GeometryCache> geometryCache;
+
     // You can add your own objects (e.g. environment maps) here
     // ...
-    Image environmentMap = Image(DATA_DIR / std::filesystem::path("cube2.jpg")); // hard-coded
+    // Shared with all other scenes using the same map, and only read once it is sampled; may be null
+    std::shared_ptr<const EnvironmentMap> environmentMap = EnvironmentMap::get({ DATA_DIR / std::filesystem::path("cube2.jpg") });
 };
 
-// Load a prebuilt scene.
-Scene loadScenePrebuilt(SceneType type, const std::filesystem::path& dataDir);
+// (Re)build the scene's material and texture tables from its meshes and spheres; call this after modifying either.
+// This releases the pixels of the materials' images, which are only sampled through their textures afterwards.
+void buildMaterialTable(Scene& scene);
+
+// Return whether the scene's material and texture tables match its meshes and spheres.
+bool hasMaterialTable(const Scene& scene);
+
+// Move the triangles of the scene's meshes into a geometry cache, and free the meshes' vertices and
+// triangles. Build the BVH afterwards; it is then empty, and BVH traversal streams the meshes' triangles instead.
+void streamGeometry(Scene& scene, const GeometryCacheConfig& config);
+
+// Load a prebuilt scene. If a texture cache is given, textures are streamed through it instead of loaded.
+Scene loadScenePrebuilt(SceneType type, const std::filesystem::path& dataDir, std::shared_ptr<TextureCache> textureCache = nullptr);
 
-// Load a scene from a file.
-Scene loadSceneFromFile(const std::filesystem::path& path, const std::vector<std::variant<PointLight, SegmentLight, ParallelogramLight>>& lights);
+// Load a scene from a file. If a texture cache is given, textures are streamed through it instead of loaded.
+Scene loadSceneFromFile(const std::filesystem::path& path, const std::vector<std::variant<PointLight, SegmentLight, ParallelogramLight>>& lights, std::shared_ptr<TextureCache> textureCache = nullptr);
@@ -44,11 +44,13 @@ void Screen::setPixel(int x, int y, const glm::vec3& color)
 void Screen::writeBitmapToFile(const std::filesystem::path& filePath)
 {
     std::vector<glm::u8vec4> textureData8Bits(m_textureData.size());
-    std::transform(std::begin(m_textureData), std::end(m_textureData), std::begin(textureData8Bits),
-        [](const glm::vec3& color) {
-            const glm::vec3 clampedColor = glm::clamp(color, 0.0f, 1.0f);
-            return glm::u8vec4(glm::vec4(clampedColor, 1.0f) * 255.0f);
-        });
+#ifdef NDEBUG // Enable multi threading in Release mode
+#pragma omp parallel for schedule(static)
+#endif
+    for (size_t i = 0; i < m_textureData.size(); i++) {
+        const glm::vec3 clampedColor = glm::clamp(m_textureData[i], 0.0f, 1.0f);
+        textureData8Bits[i] = glm::u8vec4(glm::vec4(clampedColor, 1.0f) * 255.0f);
+    }
 
     std::string filePathString = filePath.string();
     stbi_write_bmp(filePathString.c_str(), m_resolution.x, m_resolution.y, 4, textureData8Bits.data());
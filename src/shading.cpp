@@ -1,77 +1,131 @@
+#include "kernel.h"
 #include "render.h"
 #include "texture.h"
+#include <algorithm>
 #include <cmath>
 #include <fmt/core.h>
 #include <glm/geometric.hpp>
 #include <glm/gtx/string_cast.hpp>
 #include <shading.h>
+#include <span>
 
 // This function is provided as-is. You do not have to implement it (unless
 // you need to for some extra feature).
 // Given render state and an intersection, based on render settings, sample
 // the underlying material data in the expected manner.
-glm::vec3 sampleMaterialKd(RenderState& state, const HitInfo& hitInfo)
+template <uint32_t Mask>
+glm::vec3 kernel::sampleMaterialKd(RenderState& state, const HitInfo& hitInfo)
 {
-    if (state.features.enableTextureMapping && hitInfo.material.kdTexture) {
-        if (state.features.enableBilinearTextureFiltering) {
-            return sampleTextureBilinear(*hitInfo.material.kdTexture, hitInfo.texCoord);
+    const Material& material = materialOf<Mask>(state, hitInfo);
+    if (enabled<Mask>(state.features, Textures) && material.kdTexture) {
+        if (const Texture* texture = textureOf<Mask>(state, hitInfo)) {
+            if (enabled<Mask>(state.features, MipmapFiltering)) {
+                const float lod = hitInfo.texCoordLod + 0.5f * std::log2(float(texture->width()) * float(texture->height()));
+                return texture->sampleTrilinear(hitInfo.texCoord, lod);
+            }
+            if (enabled<Mask>(state.features, BilinearFiltering))
+                return texture->sampleBilinear(hitInfo.texCoord);
+            return texture->sampleNearest(hitInfo.texCoord);
+        }
+        // Materials that are not in the scene's table, e.g. in tests, still have their image
+        if (enabled<Mask>(state.features, BilinearFiltering)) {
+            return sampleTextureBilinear(*material.kdTexture, hitInfo.texCoord);
         } else {
-            return sampleTextureNearest(*hitInfo.material.kdTexture, hitInfo.texCoord);
+            return sampleTextureNearest(*material.kdTexture, hitInfo.texCoord);
+        }
+    }
+
+    // Textures that are streamed through the scene's texture cache
+    if (enabled<Mask>(state.features, Textures)) {
+        if (const TextureCache::TextureID texture = cachedTextureOf<Mask>(state, hitInfo); texture != TextureCache::InvalidTexture) {
+            TextureCache& cache = *state.scene.textureCache;
+            if (enabled<Mask>(state.features, MipmapFiltering)) {
+                const glm::ivec2 resolution = cache.resolution(texture);
+                const float lod = hitInfo.texCoordLod + 0.5f * std::log2(float(resolution.x) * float(resolution.y));
+                return cache.sampleTrilinear(texture, hitInfo.texCoord, lod);
+            }
+            if (enabled<Mask>(state.features, BilinearFiltering))
+                return cache.sampleBilinear(texture, hitInfo.texCoord);
+            return cache.sampleNearest(texture, hitInfo.texCoord);
         }
-    } else {
-        return hitInfo.material.kd;
     }
+    return material.kd;
 }
 
+glm::vec3 sampleMaterialKd(RenderState& state, const HitInfo& hitInfo)
+{
+    return kernel::sampleMaterialKd<kernel::Dynamic>(state, hitInfo);
+}
+
+// Hardcoded linear gradient. Feel free to modify this
+static const LinearGradient defaultGradient = {
+    .components = {
+        { 0.1f, glm::vec3(215.f / 256.f, 210.f / 256.f, 203.f / 256.f) },
+        { 0.22f, glm::vec3(250.f / 256.f, 250.f / 256.f, 240.f / 256.f) },
+        { 0.5f, glm::vec3(145.f / 256.f, 170.f / 256.f, 175.f / 256.f) },
+        { 0.78f, glm::vec3(255.f / 256.f, 250.f / 256.f, 205.f / 256.f) },
+        { 0.9f, glm::vec3(170.f / 256.f, 170.f / 256.f, 170.f / 256.f) },
+    }
+};
+
+// The hardcoded gradient, baked into a lookup table once s.t. the specialised kernels do not walk its components
+static const LinearGradientTable defaultGradientTable { defaultGradient };
+
 // This function is provided as-is. You do not have to implement it.
 // Given a camera direction, a light direction, a relevant intersection, and a color coming in
 // from the light, evaluate the scene-selected shading model, returning the reflected light towards the target.
-glm::vec3 computeShading(RenderState& state, const glm::vec3& cameraDirection, const glm::vec3& lightDirection, const glm::vec3& lightColor, const HitInfo& hitInfo)
+template <uint32_t Mask>
+glm::vec3 kernel::computeShading(RenderState& state, const glm::vec3& cameraDirection, const glm::vec3& lightDirection, const glm::vec3& lightColor, const HitInfo& hitInfo)
 {
-    // Hardcoded linear gradient. Feel free to modify this
-    static LinearGradient gradient = {
-        .components = {
-            { 0.1f, glm::vec3(215.f / 256.f, 210.f / 256.f, 203.f / 256.f) },
-            { 0.22f, glm::vec3(250.f / 256.f, 250.f / 256.f, 240.f / 256.f) },
-            { 0.5f, glm::vec3(145.f / 256.f, 170.f / 256.f, 175.f / 256.f) },
-            { 0.78f, glm::vec3(255.f / 256.f, 250.f / 256.f, 205.f / 256.f) },
-            { 0.9f, glm::vec3(170.f / 256.f, 170.f / 256.f, 170.f / 256.f) },
-        }
-    };
-
-    if (state.features.enableShading) {
-        switch (state.features.shadingModel) {
+    if (enabled<Mask>(state.features, Shading)) {
+        switch (shadingModel<Mask>(state.features)) {
             case ShadingModel::Lambertian:
-                return computeLambertianModel(state, cameraDirection, lightDirection, lightColor, hitInfo);
+                return computeLambertianModel<Mask>(state, cameraDirection, lightDirection, lightColor, hitInfo);
             case ShadingModel::Phong:
-                return computePhongModel(state, cameraDirection, lightDirection, lightColor, hitInfo);
+                return computePhongModel<Mask>(state, cameraDirection, lightDirection, lightColor, hitInfo);
             case ShadingModel::BlinnPhong:
-                return computeBlinnPhongModel(state, cameraDirection, lightDirection, lightColor, hitInfo);
-            case ShadingModel::LinearGradient:
-                return computeLinearGradientModel(state, cameraDirection, lightDirection, lightColor, hitInfo, gradient);
+                return computeBlinnPhongModel<Mask>(state, cameraDirection, lightDirection, lightColor, hitInfo);
+            case ShadingModel::LinearGradient: {
+                // The generic kernel evaluates the gradient exactly; specialised kernels interpolate it from the table
+                if constexpr ((Mask & Dynamic) != 0)
+                    return computeLinearGradientModel(state, cameraDirection, lightDirection, lightColor, hitInfo, defaultGradient);
+                float cosTheta = glm::dot(glm::normalize(lightDirection), glm::normalize(hitInfo.normal));
+                return lightColor * defaultGradientTable.sample(cosTheta);
+            }
         };
     }
 
-    return lightColor * sampleMaterialKd(state, hitInfo);
+    return lightColor * sampleMaterialKd<Mask>(state, hitInfo);
+}
+
+glm::vec3 computeShading(RenderState& state, const glm::vec3& cameraDirection, const glm::vec3& lightDirection, const glm::vec3& lightColor, const HitInfo& hitInfo)
+{
+    return kernel::computeShading<kernel::Dynamic>(state, cameraDirection, lightDirection, lightColor, hitInfo);
 }
 
 // Given a camera direction, a light direction, a relevant intersection, and a color coming in
 // from the light, evaluate a Lambertian diffuse shading, returning the reflected light towards the target.
-glm::vec3 computeLambertianModel(RenderState& state, const glm::vec3& cameraDirection, const glm::vec3& lightDirection, const glm::vec3& lightColor, const HitInfo& hitInfo)
+template <uint32_t Mask>
+glm::vec3 kernel::computeLambertianModel(RenderState& state, const glm::vec3& cameraDirection, const glm::vec3& lightDirection, const glm::vec3& lightColor, const HitInfo& hitInfo)
 {
     glm::vec3 l = glm::normalize(lightDirection);
     glm::vec3 n = glm::normalize(hitInfo.normal);
 
     float dot = glm::dot(l, n);
 
-    if (state.features.enableTransparency && hitInfo.material.transparency < 1.0f && dot < 0) {
+    if (enabled<Mask>(state.features, Transparency) && materialOf<Mask>(state, hitInfo).transparency < 1.0f && dot < 0) {
         dot = -dot;
     }
 
     if (dot <= 0)
         return glm::vec3 { 0 };
 
-    return sampleMaterialKd(state, hitInfo) * lightColor * dot;
+    return sampleMaterialKd<Mask>(state, hitInfo) * lightColor * dot;
+}
+
+glm::vec3 computeLambertianModel(RenderState& state, const glm::vec3& cameraDirection, const glm::vec3& lightDirection, const glm::vec3& lightColor, const HitInfo& hitInfo)
+{
+    return kernel::computeLambertianModel<kernel::Dynamic>(state, cameraDirection, lightDirection, lightColor, hitInfo);
 }
 
 // TODO: Standard feature
@@ -89,18 +143,19 @@ glm::vec3 computeLambertianModel(RenderState& state, const glm::vec3& cameraDire
 // - return;          the result of shading along the cameraDirection vector
 //
 // This method is unit-tested, so do not change the function signature.
-glm::vec3 computePhongModel(RenderState& state, const glm::vec3& cameraDirection, const glm::vec3& lightDirection, const glm::vec3& lightColor, const HitInfo& hitInfo)
+template <uint32_t Mask>
+glm::vec3 kernel::computePhongModel(RenderState& state, const glm::vec3& cameraDirection, const glm::vec3& lightDirection, const glm::vec3& lightColor, const HitInfo& hitInfo)
 {
     // No ambient, diffuse = Lambertian, so only calculate specular
 
-    glm::vec3 diffuse = computeLambertianModel(state, cameraDirection, lightDirection, lightColor, hitInfo);
+    glm::vec3 diffuse = computeLambertianModel<Mask>(state, cameraDirection, lightDirection, lightColor, hitInfo);
 
     glm::vec3 d = glm::normalize(-lightDirection);
     glm::vec3 n = glm::normalize(hitInfo.normal);
 
     float dot = glm::dot(-d, n);
 
-    if (state.features.enableTransparency && hitInfo.material.transparency < 1.0f && dot < 0) {
+    if (enabled<Mask>(state.features, Transparency) && materialOf<Mask>(state, hitInfo).transparency < 1.0f && dot < 0) {
         dot = -dot;
     }
 
@@ -115,13 +170,19 @@ glm::vec3 computePhongModel(RenderState& state, const glm::vec3& cameraDirection
     if (VdotR <= 0)
         return diffuse;
 
-    float pow = glm::pow(VdotR, hitInfo.material.shininess);
+    const Material& material = materialOf<Mask>(state, hitInfo);
+    float pow = glm::pow(VdotR, material.shininess);
 
-    glm::vec3 specular = pow * hitInfo.material.ks * lightColor;
+    glm::vec3 specular = pow * material.ks * lightColor;
 
     return diffuse + specular;
 }
 
+glm::vec3 computePhongModel(RenderState& state, const glm::vec3& cameraDirection, const glm::vec3& lightDirection, const glm::vec3& lightColor, const HitInfo& hitInfo)
+{
+    return kernel::computePhongModel<kernel::Dynamic>(state, cameraDirection, lightDirection, lightColor, hitInfo);
+}
+
 // TODO: Standard feature
 // Given a camera direction, a light direction, a relevant intersection, and a color coming in
 // from the light, evaluate the Blinn-Phong Model returning the reflected light towards the target.
@@ -137,11 +198,12 @@ glm::vec3 computePhongModel(RenderState& state, const glm::vec3& cameraDirection
 // - return;          the result of shading along the cameraDirection vector
 //
 // This method is unit-tested, so do not change the function signature.
-glm::vec3 computeBlinnPhongModel(RenderState& state, const glm::vec3& cameraDirection, const glm::vec3& lightDirection, const glm::vec3& lightColor, const HitInfo& hitInfo)
+template <uint32_t Mask>
+glm::vec3 kernel::computeBlinnPhongModel(RenderState& state, const glm::vec3& cameraDirection, const glm::vec3& lightDirection, const glm::vec3& lightColor, const HitInfo& hitInfo)
 {
     // Similarly to computePhongModel(), only the specular is needed here
 
-    glm::vec3 diffuse = computeLambertianModel(state, cameraDirection, lightDirection, lightColor, hitInfo);
+    glm::vec3 diffuse = computeLambertianModel<Mask>(state, cameraDirection, lightDirection, lightColor, hitInfo);
 
     glm::vec3 d = glm::normalize(lightDirection);
     glm::vec3 n = glm::normalize(hitInfo.normal);
@@ -150,7 +212,7 @@ glm::vec3 computeBlinnPhongModel(RenderState& state, const glm::vec3& cameraDire
     if (dot <= 0)
         return diffuse;
 
-    if (state.features.enableTransparency && hitInfo.material.transparency < 1.0f && dot < 0) {
+    if (enabled<Mask>(state.features, Transparency) && materialOf<Mask>(state, hitInfo).transparency < 1.0f && dot < 0) {
         dot = -dot;
     }
 
@@ -161,13 +223,19 @@ glm::vec3 computeBlinnPhongModel(RenderState& state, const glm::vec3& cameraDire
     if (NdotH <= 0)
         return diffuse;
 
-    float pow = glm::pow(NdotH, hitInfo.material.shininess);
+    const Material& material = materialOf<Mask>(state, hitInfo);
+    float pow = glm::pow(NdotH, material.shininess);
 
-    glm::vec3 specular = pow * hitInfo.material.ks * lightColor;
+    glm::vec3 specular = pow * material.ks * lightColor;
 
     return diffuse + specular;
 }
 
+glm::vec3 computeBlinnPhongModel(RenderState& state, const glm::vec3& cameraDirection, const glm::vec3& lightDirection, const glm::vec3& lightColor, const HitInfo& hitInfo)
+{
+    return kernel::computeBlinnPhongModel<kernel::Dynamic>(state, cameraDirection, lightDirection, lightColor, hitInfo);
+}
+
 // Comparator for two linear gradients components
 // Used to sort ascending by their t value
 bool componentsComparator(const LinearGradient::Component c1, const LinearGradient::Component c2)
@@ -184,30 +252,52 @@ bool componentsComparator(const LinearGradient::Component c1, const LinearGradie
 // This method is unit-tested, so do not change the function signature.
 glm::vec3 LinearGradient::sample(float ti) const
 {
-    std::vector<LinearGradient::Component> componentsCopy = components;
-
-    // Concept of using a comparator to sort a custom vector: https://www.geeksforgeeks.org/sort-vector-of-pairs-in-ascending-order-in-c/
-    std::sort(componentsCopy.begin(), componentsCopy.end(), componentsComparator);
+    // Only copy and sort the components if they are not already in ascending order
+    std::vector<LinearGradient::Component> componentsCopy;
+    std::span<const LinearGradient::Component> sorted = components;
+    if (!std::is_sorted(components.begin(), components.end(), componentsComparator)) {
+        componentsCopy = components;
+
+        // Concept of using a comparator to sort a custom vector: https://www.geeksforgeeks.org/sort-vector-of-pairs-in-ascending-order-in-c/
+        std::sort(componentsCopy.begin(), componentsCopy.end(), componentsComparator);
+        sorted = componentsCopy;
+    }
 
-    if (componentsCopy[0].t > ti)
-        return componentsCopy[0].color;
+    if (sorted[0].t > ti)
+        return sorted[0].color;
 
-    for (int i = 0; i < componentsCopy.size() - 1; i++) {
-        if (std::fabs(componentsCopy[i].t - ti) <= 1e-6f) // ti is on a boundary
-            return componentsCopy[i].color;
+    for (size_t i = 0; i < sorted.size() - 1; i++) {
+        if (std::fabs(sorted[i].t - ti) <= 1e-6f) // ti is on a boundary
+            return sorted[i].color;
 
-        if (componentsCopy[i].t < ti && componentsCopy[i + 1].t > ti) {
-            float tLeft = componentsCopy[i].t;
-            float tRight = componentsCopy[i + 1].t;
-            glm::vec3 colorLeft = componentsCopy[i].color;
-            glm::vec3 colorRight = componentsCopy[i + 1].color;
+        if (sorted[i].t < ti && sorted[i + 1].t > ti) {
+            float tLeft = sorted[i].t;
+            float tRight = sorted[i + 1].t;
+            glm::vec3 colorLeft = sorted[i].color;
+            glm::vec3 colorRight = sorted[i + 1].color;
 
             float alpha = (ti - tLeft) / (tRight - tLeft);
             return (1.0f - alpha) * colorLeft + alpha * colorRight;
         }
     }
 
-    return componentsCopy[componentsCopy.size() - 1].color;
+    return sorted[sorted.size() - 1].color;
+}
+
+LinearGradientTable::LinearGradientTable(const LinearGradient& gradient)
+{
+    for (size_t i = 0; i < Size; i++) {
+        float ti = -1.0f + 2.0f * static_cast<float>(i) / static_cast<float>(Size - 1);
+        colors[i] = gradient.sample(ti);
+    }
+}
+
+glm::vec3 LinearGradientTable::sample(float ti) const
+{
+    float x = glm::clamp((ti + 1.0f) * 0.5f, 0.0f, 1.0f) * static_cast<float>(Size - 1);
+    size_t i = std::min(static_cast<size_t>(x), Size - 2);
+    float alpha = x - static_cast<float>(i);
+    return (1.0f - alpha) * colors[i] + alpha * colors[i + 1];
 }
 
 // TODO: Standard feature
@@ -230,4 +320,11 @@ glm::vec3 computeLinearGradientModel(RenderState& state, const glm::vec3& camera
     float cos_theta = glm::dot(glm::normalize(lightDirection), glm::normalize(hitInfo.normal));
     glm::vec3 sampledColor = gradient.sample(cos_theta);
     return lightColor * sampledColor;
-}
\ No newline at end of file
+}
+#define INSTANTIATE_SHADING_KERNEL(Mask)                                                                                                                                                       \
+    template glm::vec3 kernel::sampleMaterialKd<Mask>(RenderState&, const HitInfo&);                                                                                                           \
+    template glm::vec3 kernel::computeShading<Mask>(RenderState&, const glm::vec3&, const glm::vec3&, const glm::vec3&, const HitInfo&);                                                     \
+    template glm::vec3 kernel::computeLambertianModel<Mask>(RenderState&, const glm::vec3&, const glm::vec3&, const glm::vec3&, const HitInfo&);                                             \
+    template glm::vec3 kernel::computePhongModel<Mask>(RenderState&, const glm::vec3&, const glm::vec3&, const glm::vec3&, const HitInfo&);                                                  \
+    template glm::vec3 kernel::computeBlinnPhongModel<Mask>(RenderState&, const glm::vec3&, const glm::vec3&, const glm::vec3&, const HitInfo&);
+FOR_EACH_RENDER_KERNEL(INSTANTIATE_SHADING_KERNEL)
@@ -2,6 +2,7 @@
 #include "fwd.h"
 #include "common.h"
 #include <framework/ray.h>
+#include <array>
 
 /* Baseline render code; you do not have to implement the following methods */
 
@@ -53,6 +54,19 @@ struct LinearGradient {
   glm::vec3 sample(float ti) const;
 };
 
+// A linear gradient baked into a table of evenly spaced samples over [-1, 1]. Sampling the table
+// is a constant-time lerp between two entries, instead of a search over the gradient's components.
+struct LinearGradientTable {
+  static constexpr size_t Size = 1024;
+
+  std::array<glm::vec3, Size> colors;
+
+  explicit LinearGradientTable(const LinearGradient &gradient);
+
+  // Given a number ti between [-1, 1], return the approximately interpolated gradient color
+  glm::vec3 sample(float ti) const;
+};
+
 // TODO: Standard feature
 // Given a camera direction, a light direction, a relevant intersection, and a color coming in
 // from the light, evaluate a diffuse shading model, such that the diffuse component is sampled not
@@ -0,0 +1,177 @@
+#include "shadow_packet.h"
+#include "bvh.h"
+#include "intersect.h"
+#include "scene.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+// Geometry this close to a shading point is the surface it lies on; `visibilityOfLightSampleBinary()` accepts
+// hits within the same distance of the shading point
+static constexpr float ShadowRayTolerance = 5e-4f;
+
+namespace {
+// The rays of a packet, one lane per ray, with their components in separate arrays s.t. loops over the lanes
+// vectorise. Unused and occluded lanes have a negative `tMax`, which no box or triangle test passes.
+struct ShadowPacket {
+    using Lanes = std::array<float, ShadowPacketSize>;
+
+    glm::vec3 origin;
+    Lanes directionX, directionY, directionZ;
+    Lanes inverseDirectionX, inverseDirectionY, inverseDirectionZ;
+    Lanes tMax; // Distance to the light sample
+
+    // Cone around all rays of the packet, from `origin`
+    glm::vec3 coneAxis;
+    float coneCos, coneSin;
+    float coneLength; // Largest `tMax`
+
+    [[nodiscard]] bool anyActive() const
+    {
+        return std::any_of(tMax.begin(), tMax.end(), [](float t) { return t >= 0.0f; });
+    }
+};
+}
+
+// Whether a box may intersect the cone of a packet, by testing the box's bounding sphere
+static bool intersectsCone(const ShadowPacket& packet, const AxisAlignedBox& box)
+{
+    const glm::vec3 toCenter = (box.lower + box.upper) / 2.0f - packet.origin;
+    const float radius = glm::length(box.upper - box.lower) / 2.0f;
+    const float distance = glm::length(toCenter);
+    if (distance <= radius)
+        return true;
+    if (distance - radius > packet.coneLength)
+        return false;
+
+    // The sphere is inside the cone widened by its half angle; if the two angles add up to more than pi, the
+    // widened cone covers all directions
+    const float sphereSin = radius / distance;
+    const float sphereCos = std::sqrt(1.0f - sphereSin * sphereSin);
+    if (packet.coneCos <= -sphereCos)
+        return true;
+    return glm::dot(packet.coneAxis, toCenter) / distance >= packet.coneCos * sphereCos - packet.coneSin * sphereSin;
+}
+
+// Whether any active ray of a packet enters a box before its light sample
+static bool intersectsBox(const ShadowPacket& packet, const AxisAlignedBox& box)
+{
+    const glm::vec3 lower = box.lower - packet.origin, upper = box.upper - packet.origin;
+    bool hit = false;
+    for (size_t lane = 0; lane < ShadowPacketSize; lane++) {
+        const float x0 = lower.x * packet.inverseDirectionX[lane], x1 = upper.x * packet.inverseDirectionX[lane];
+        const float y0 = lower.y * packet.inverseDirectionY[lane], y1 = upper.y * packet.inverseDirectionY[lane];
+        const float z0 = lower.z * packet.inverseDirectionZ[lane], z1 = upper.z * packet.inverseDirectionZ[lane];
+        const float entry = std::max(std::max(std::min(x0, x1), std::min(y0, y1)), std::max(std::min(z0, z1), 0.0f));
+        const float exit = std::min(std::min(std::max(x0, x1), std::max(y0, y1)), std::min(std::max(z0, z1), packet.tMax[lane]));
+        hit |= entry <= exit;
+    }
+    return hit;
+}
+
+// Intersect a triangle with all rays of a packet (Moeller-Trumbore), and retire the rays that it occludes. The
+// rays share their origin, so all terms that only depend on the origin and the triangle are computed once.
+static void occludeByTriangle(ShadowPacket& packet, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2)
+{
+    const glm::vec3 edge1 = v1 - v0, edge2 = v2 - v0;
+    const glm::vec3 s = packet.origin - v0;
+    const glm::vec3 q = glm::cross(s, edge1);
+    const float qEdge2 = glm::dot(edge2, q);
+    for (size_t lane = 0; lane < ShadowPacketSize; lane++) {
+        const glm::vec3 direction { packet.directionX[lane], packet.directionY[lane], packet.directionZ[lane] };
+        const glm::vec3 p = glm::cross(direction, edge2);
+        const float determinant = glm::dot(edge1, p);
+        const float inverseDeterminant = 1.0f / determinant;
+        const float u = glm::dot(s, p) * inverseDeterminant;
+        const float v = glm::dot(direction, q) * inverseDeterminant;
+        const float t = qEdge2 * inverseDeterminant;
+        const bool hit = determinant != 0.0f && u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > ShadowRayTolerance && t <= packet.tMax[lane];
+        packet.tMax[lane] = hit ? -1.0f : packet.tMax[lane];
+    }
+}
+
+// A depth-first traversal holds at most one node per level of the hierarchy on its stack
+using TraversalStack = std::array<uint32_t, 64>;
+
+static void traceShadowPacket(const Scene& scene, const BVHInterface& bvh, ShadowPacket& packet, TraversalStack& stack)
+{
+    std::span<const BVHInterface::Node> nodes = bvh.nodes();
+    std::span<const BVHInterface::Primitive> primitives = bvh.primitives();
+    if (!nodes.empty()) {
+        size_t stackSize = 0;
+        stack[stackSize++] = BVH::RootIndex;
+        while (stackSize > 0 && packet.anyActive()) {
+            const BVHInterface::Node& node = nodes[stack[--stackSize]];
+            if (!intersectsCone(packet, node.aabb) || !intersectsBox(packet, node.aabb))
+                continue;
+            if (node.isLeaf()) {
+                for (uint32_t i = node.primitiveOffset(); i < node.primitiveOffset() + node.primitiveCount(); i++)
+                    occludeByTriangle(packet, primitives[i].v0.position, primitives[i].v1.position, primitives[i].v2.position);
+            } else {
+                stack[stackSize++] = node.rightChild();
+                stack[stackSize++] = node.leftChild();
+            }
+        }
+    }
+
+    // Spheres are few, and are not in the BVH; they are tested ray by ray
+    for (const Sphere& sphere : scene.spheres) {
+        for (size_t lane = 0; lane < ShadowPacketSize; lane++) {
+            if (packet.tMax[lane] < 0.0f)
+                continue;
+            const glm::vec3 direction { packet.directionX[lane], packet.directionY[lane], packet.directionZ[lane] };
+            Ray ray { .origin = packet.origin + ShadowRayTolerance * direction, .direction = direction, .t = packet.tMax[lane] - ShadowRayTolerance };
+            HitInfo hitInfo;
+            if (intersectRayWithShape(sphere, ray, hitInfo))
+                packet.tMax[lane] = -1.0f;
+        }
+    }
+}
+
+void traceShadowPacket(const Scene& scene, const BVHInterface& bvh, const glm::vec3& origin, std::span<const glm::vec3> targets, std::span<bool> visible)
+{
+    TraversalStack stack;
+    assert(bvh.numLevels() <= stack.size());
+    for (size_t first = 0; first < targets.size(); first += ShadowPacketSize) {
+        const size_t count = std::min(targets.size() - first, ShadowPacketSize);
+        ShadowPacket packet { .origin = origin };
+        glm::vec3 axis { 0.0f };
+        packet.coneLength = 0.0f;
+        for (size_t lane = 0; lane < ShadowPacketSize; lane++) {
+            // Unused lanes repeat the first ray, but are inactive
+            const glm::vec3 toTarget = targets[first + (lane < count ? lane : 0)] - origin;
+            const float distance = glm::length(toTarget);
+            const glm::vec3 direction = distance > 0.0f ? toTarget / distance : glm::vec3(0.0f, 0.0f, 1.0f);
+            packet.directionX[lane] = direction.x;
+            packet.directionY[lane] = direction.y;
+            packet.directionZ[lane] = direction.z;
+            packet.inverseDirectionX[lane] = 1.0f / direction.x;
+            packet.inverseDirectionY[lane] = 1.0f / direction.y;
+            packet.inverseDirectionZ[lane] = 1.0f / direction.z;
+            packet.tMax[lane] = lane < count ? distance : -1.0f;
+            axis += direction;
+            packet.coneLength = std::max(packet.coneLength, distance);
+        }
+
+        // The cone's axis is the mean direction, and its angle is that of the ray farthest from it; if the rays
+        // cancel out, the cone covers all directions
+        const float axisLength = glm::length(axis);
+        packet.coneAxis = axisLength > 0.0f ? axis / axisLength : glm::vec3(0.0f, 0.0f, 1.0f);
+        packet.coneCos = axisLength > 0.0f ? 1.0f : -1.0f;
+        for (size_t lane = 0; lane < count && axisLength > 0.0f; lane++)
+            packet.coneCos = std::min(packet.coneCos, glm::dot(packet.coneAxis, glm::vec3(packet.directionX[lane], packet.directionY[lane], packet.directionZ[lane])));
+        packet.coneCos = std::max(packet.coneCos - 1e-4f, -1.0f); // Leave some room for rounding
+        packet.coneSin = std::sqrt(1.0f - packet.coneCos * packet.coneCos);
+
+        traceShadowPacket(scene, bvh, packet, stack);
+        for (size_t lane = 0; lane < count; lane++)
+            visible[first + lane] = packet.tMax[lane] >= 0.0f;
+    }
+}
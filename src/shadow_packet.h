@@ -0,0 +1,26 @@
+#pragma once
+#include "bvh_interface.h"
+#include "common.h"
+#include "fwd.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstddef>
+#include <span>
+
+// Number of shadow rays traced together by `traceShadowPacket()`; the lanes of a packet are processed in fixed
+// size loops, which the compiler vectorises
+static constexpr size_t ShadowPacketSize = 16;
+
+// Test which of `targets` are visible from `origin`, and write the results into `visible`; this gives the same
+// answer as `visibilityOfLightSampleBinary()` for a shading point at `origin` and light samples at `targets`.
+//
+// All shadow rays towards samples on one light start at the same shading point, and fan out in a narrow cone.
+// So they are traced in packets of `ShadowPacketSize` rays, which share a single traversal of the BVH: a node
+// is skipped if its bounding sphere lies outside the cone around the packet's rays, or if its box is missed by
+// all rays that are still unoccluded; the triangles of a leaf are then tested against all of those rays at
+// once. The traversal stops as soon as every ray of the packet is occluded.
+//
+// The BVH must hold the scene's triangles in its primitives, i.e. the scene must not use a `GeometryCache`.
+void traceShadowPacket(const Scene& scene, const BVHInterface& bvh, const glm::vec3& origin, std::span<const glm::vec3> targets, std::span<bool> visible);
@@ -1,6 +1,20 @@
 #include "texture.h"
+#include "blur.h"
 #include "render.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/packing.hpp>
+DISABLE_WARNINGS_POP()
 #include <framework/image.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <span>
+#ifdef NDEBUG
+#include <omp.h>
+#endif
 
 glm::vec3 getPixelFromCoordinates(const Image& image, int xCoord, int yCoord) 
 {
@@ -111,4 +125,282 @@ glm::vec3 sampleTextureBilinear(const Image& image, const glm::vec2& texCoord)
     result += coefBR * getPixelFromCoordinates(image, xCoordBR, yCoordBR);
 
     return result;
-}
\ No newline at end of file
+}
+
+// Texels per side of a texture tile
+static constexpr size_t TileSize = 4;
+
+// Decoding tables from 8-bit values to floats; a table lookup is cheaper than converting and scaling
+static const std::array<float, 256> unormToFloat = [] {
+    std::array<float, 256> table;
+    for (size_t i = 0; i < table.size(); i++)
+        table[i] = float(i) / 255.0f;
+    return table;
+}();
+static const std::array<float, 256> srgbToLinear = [] {
+    std::array<float, 256> table;
+    for (size_t i = 0; i < table.size(); i++) {
+        const float c = float(i) / 255.0f;
+        table[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    return table;
+}();
+
+// Encode a linear color to sRGB, the inverse of `srgbToLinear`
+static glm::vec4 linearToSrgb(const glm::vec4& color)
+{
+    const auto encode = [](float c) { return c <= 0.0031308f ? 12.92f * c : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f; };
+    return { encode(color.r), encode(color.g), encode(color.b), color.a };
+}
+
+// Downsample an image by 2 (rounding up) with a separable 6-tap Kaiser-windowed sinc. Every output texel
+// lies between two input texels, at offsets +-0.5, +-1.5 and +-2.5 from the taps; texels past the edges
+// are clamped. Negative lobes may ring below zero, so the result is clamped to be non-negative.
+static glm::ivec2 downsampleKaiser(std::span<const glm::vec3> pixels, glm::ivec2 resolution, std::vector<glm::vec3>& output)
+{
+    static const std::array<float, 6> weights = [] {
+        // Kaiser window with alpha = 4 (beta = 4 pi) over a half width of 3 input texels
+        const auto besselI0 = [](float x) {
+            float sum = 1.0f, term = 1.0f;
+            for (int k = 1; k < 20; k++) {
+                term *= (x / (2.0f * float(k))) * (x / (2.0f * float(k)));
+                sum += term;
+            }
+            return sum;
+        };
+        const float beta = 4.0f * glm::pi<float>();
+        std::array<float, 6> w;
+        float sum = 0.0f;
+        for (size_t i = 0; i < w.size(); i++) {
+            const float x = float(i) - 2.5f;
+            const float sinc = std::sin(glm::half_pi<float>() * x) / (glm::half_pi<float>() * x);
+            const float r = x / 3.0f;
+            w[i] = sinc * besselI0(beta * std::sqrt(1.0f - r * r)) / besselI0(beta);
+            sum += w[i];
+        }
+        for (float& weight : w)
+            weight /= sum;
+        return w;
+    }();
+
+    const glm::ivec2 outResolution = (resolution + 1) / 2;
+    std::vector<glm::vec3> horizontal(size_t(outResolution.x) * size_t(resolution.y));
+#ifdef NDEBUG // Enable multi threading in Release mode
+#pragma omp parallel for schedule(static)
+#endif
+    for (int y = 0; y < resolution.y; y++) {
+        const glm::vec3* row = &pixels[size_t(y) * size_t(resolution.x)];
+        for (int x = 0; x < outResolution.x; x++) {
+            glm::vec3 sum { 0.0f };
+            for (int i = 0; i < 6; i++)
+                sum += weights[size_t(i)] * row[std::clamp(2 * x - 2 + i, 0, resolution.x - 1)];
+            horizontal[size_t(y) * size_t(outResolution.x) + size_t(x)] = sum;
+        }
+    }
+
+    output.resize(size_t(outResolution.x) * size_t(outResolution.y));
+#ifdef NDEBUG // Enable multi threading in Release mode
+#pragma omp parallel for schedule(static)
+#endif
+    for (int y = 0; y < outResolution.y; y++) {
+        glm::vec3* outRow = &output[size_t(y) * size_t(outResolution.x)];
+        std::fill_n(outRow, outResolution.x, glm::vec3(0.0f));
+        for (int i = 0; i < 6; i++) {
+            const glm::vec3* row = &horizontal[size_t(std::clamp(2 * y - 2 + i, 0, resolution.y - 1)) * size_t(outResolution.x)];
+            for (int x = 0; x < outResolution.x; x++)
+                outRow[x] += weights[size_t(i)] * row[x];
+        }
+        for (int x = 0; x < outResolution.x; x++)
+            outRow[x] = glm::max(outRow[x], 0.0f);
+    }
+    return outResolution;
+}
+
+Texture::Texture(const Image& image, TextureFormat format, MipmapFilter mipmapFilter)
+    : m_format(format)
+{
+    // Lay out all levels up front
+    size_t numTexels = 0;
+    for (glm::ivec2 resolution { image.width, image.height };; resolution = (resolution + 1) / 2) {
+        const int numTilesX = (resolution.x + int(TileSize) - 1) / int(TileSize);
+        const int numTilesY = (resolution.y + int(TileSize) - 1) / int(TileSize);
+        m_levels.push_back({ resolution.x, resolution.y, numTilesX, numTexels });
+        numTexels += size_t(numTilesX) * size_t(numTilesY) * TileSize * TileSize;
+        if (mipmapFilter == MipmapFilter::None || resolution == glm::ivec2(1))
+            break;
+    }
+    switch (m_format) {
+    case TextureFormat::Unorm8:
+    case TextureFormat::Srgb8:
+        m_texels8.resize(numTexels);
+        break;
+    case TextureFormat::Half:
+        m_texelsHalf.resize(numTexels);
+        break;
+    case TextureFormat::Float:
+        m_texelsFloat.resize(numTexels);
+        break;
+    }
+
+    // Mip levels are filtered from the full precision values, with rows in the same order as the texture
+    std::vector<glm::vec3> pixels(image.pixels.size()), scratch;
+    for (int y = 0; y < image.height; y++)
+        std::copy_n(&image.pixels[size_t(image.height - y - 1) * size_t(image.width)], image.width, &pixels[size_t(y) * size_t(image.width)]);
+    // sRGB textures are filtered in linear space
+    if (m_format == TextureFormat::Srgb8) {
+        for (glm::vec3& pixel : pixels)
+            pixel = glm::vec3(srgbToLinear[size_t(pixel.r * 255.0f + 0.5f)], srgbToLinear[size_t(pixel.g * 255.0f + 0.5f)], srgbToLinear[size_t(pixel.b * 255.0f + 0.5f)]);
+    }
+
+    for (size_t i = 0; i < m_levels.size(); i++) {
+        const Level& level = m_levels[i];
+        if (i > 0) {
+            const glm::ivec2 resolution { m_levels[i - 1].width, m_levels[i - 1].height };
+            if (mipmapFilter == MipmapFilter::Kaiser)
+                downsampleKaiser(pixels, resolution, scratch);
+            else
+                downsampleImage(pixels, resolution, scratch);
+            std::swap(pixels, scratch);
+        }
+
+        // Texels of partial tiles past the edges of the level are never read, and stay zero
+        const auto encodeLevel = [&](auto& texels, auto encode) {
+#ifdef NDEBUG // Enable multi threading in Release mode
+#pragma omp parallel for schedule(static)
+#endif
+            for (int y = 0; y < level.height; y++) {
+                const glm::vec3* row = &pixels[size_t(y) * size_t(level.width)];
+                for (int x = 0; x < level.width; x++)
+                    texels[tiledIndex(level, x, y)] = encode(glm::vec4(row[x], 1.0f));
+            }
+        };
+        // Images are loaded from 8-bit files, so the 8-bit formats store level 0 exactly
+        const auto toUnorm8 = [](const glm::vec4& color) { return glm::u8vec4(glm::round(glm::clamp(color, 0.0f, 1.0f) * 255.0f)); };
+        switch (m_format) {
+        case TextureFormat::Unorm8:
+            encodeLevel(m_texels8, toUnorm8);
+            break;
+        case TextureFormat::Srgb8:
+            encodeLevel(m_texels8, [&](const glm::vec4& color) { return toUnorm8(linearToSrgb(color)); });
+            break;
+        case TextureFormat::Half:
+            encodeLevel(m_texelsHalf, [](const glm::vec4& color) { return glm::packHalf(color); });
+            break;
+        case TextureFormat::Float:
+            encodeLevel(m_texelsFloat, [](const glm::vec4& color) { return color; });
+            break;
+        }
+    }
+}
+
+Texture::Texture(const std::filesystem::path& filePath, TextureFormat format, MipmapFilter mipmapFilter)
+    : Texture(Image(filePath), format, mipmapFilter)
+{
+}
+
+size_t Texture::sizeInBytes() const
+{
+    return m_texels8.size() * sizeof(glm::u8vec4) + m_texelsHalf.size() * sizeof(glm::u16vec4) + m_texelsFloat.size() * sizeof(glm::vec4);
+}
+
+size_t Texture::tiledIndex(const Level& level, int x, int y)
+{
+    // Coordinates are non-negative; unsigned division by the tile size compiles to shifts and masks
+    const size_t ux = size_t(x), uy = size_t(y);
+    const size_t tile = (uy / TileSize) * size_t(level.numTilesX) + ux / TileSize;
+    return level.offset + tile * (TileSize * TileSize) + (uy % TileSize) * TileSize + ux % TileSize;
+}
+
+template <TextureFormat Format>
+glm::vec4 Texture::fetch(size_t index) const
+{
+    if constexpr (Format == TextureFormat::Unorm8 || Format == TextureFormat::Srgb8) {
+        const auto& table = Format == TextureFormat::Unorm8 ? unormToFloat : srgbToLinear;
+        const glm::u8vec4 texel = m_texels8[index];
+        return { table[texel.r], table[texel.g], table[texel.b], 1.0f };
+    } else if constexpr (Format == TextureFormat::Half) {
+        return glm::unpackHalf(m_texelsHalf[index]);
+    } else {
+        return m_texelsFloat[index];
+    }
+}
+
+glm::vec3 Texture::texel(int x, int y, int level) const
+{
+    const Level& l = m_levels[size_t(std::clamp(level, 0, numLevels() - 1))];
+    const size_t index = tiledIndex(l, std::clamp(x, 0, l.width - 1), std::clamp(y, 0, l.height - 1));
+    switch (m_format) {
+    case TextureFormat::Unorm8:
+        return fetch<TextureFormat::Unorm8>(index);
+    case TextureFormat::Srgb8:
+        return fetch<TextureFormat::Srgb8>(index);
+    case TextureFormat::Half:
+        return fetch<TextureFormat::Half>(index);
+    default:
+        return fetch<TextureFormat::Float>(index);
+    }
+}
+
+glm::vec3 Texture::sampleNearest(const glm::vec2& texCoord) const
+{
+    return texel(int(glm::floor(texCoord.x * float(width()))), int(glm::floor(texCoord.y * float(height()))));
+}
+
+// The four texels of the footprint are decoded and blended as 4-wide vectors, which compile to
+// packed SIMD arithmetic; only the addressing is done per texel.
+template <TextureFormat Format>
+glm::vec4 Texture::bilinear(const Level& level, const glm::vec2& texCoord) const
+{
+    const glm::vec2 size { level.width, level.height };
+    const glm::vec2 position = glm::clamp(texCoord * size - 0.5f, glm::vec2(0.0f), size - 1.0f);
+    const glm::ivec2 p0 = glm::ivec2(position);
+    const glm::ivec2 p1 = glm::min(p0 + 1, glm::ivec2(level.width, level.height) - 1);
+    const glm::vec2 t = position - glm::vec2(p0);
+
+    const glm::vec4 bottom = glm::mix(fetch<Format>(tiledIndex(level, p0.x, p0.y)), fetch<Format>(tiledIndex(level, p1.x, p0.y)), t.x);
+    const glm::vec4 top = glm::mix(fetch<Format>(tiledIndex(level, p0.x, p1.y)), fetch<Format>(tiledIndex(level, p1.x, p1.y)), t.x);
+    return glm::mix(bottom, top, t.y);
+}
+
+template <TextureFormat Format>
+glm::vec3 Texture::trilinear(const glm::vec2& texCoord, float lod) const
+{
+    // Also catches NaN lods, e.g. of degenerate footprints
+    if (!(lod > 0.0f))
+        return bilinear<Format>(m_levels[0], texCoord);
+
+    lod = std::min(lod, float(numLevels() - 1));
+    const size_t level = size_t(lod);
+    const float t = lod - float(level);
+    if (t == 0.0f)
+        return bilinear<Format>(m_levels[level], texCoord);
+    return glm::mix(bilinear<Format>(m_levels[level], texCoord), bilinear<Format>(m_levels[level + 1], texCoord), t);
+}
+
+glm::vec3 Texture::sampleBilinear(const glm::vec2& texCoord) const
+{
+    switch (m_format) {
+    case TextureFormat::Unorm8:
+        return bilinear<TextureFormat::Unorm8>(m_levels[0], texCoord);
+    case TextureFormat::Srgb8:
+        return bilinear<TextureFormat::Srgb8>(m_levels[0], texCoord);
+    case TextureFormat::Half:
+        return bilinear<TextureFormat::Half>(m_levels[0], texCoord);
+    default:
+        return bilinear<TextureFormat::Float>(m_levels[0], texCoord);
+    }
+}
+
+glm::vec3 Texture::sampleTrilinear(const glm::vec2& texCoord, float lod) const
+{
+    switch (m_format) {
+    case TextureFormat::Unorm8:
+        return trilinear<TextureFormat::Unorm8>(texCoord, lod);
+    case TextureFormat::Srgb8:
+        return trilinear<TextureFormat::Srgb8>(texCoord, lod);
+    case TextureFormat::Half:
+        return trilinear<TextureFormat::Half>(texCoord, lod);
+    default:
+        return trilinear<TextureFormat::Float>(texCoord, lod);
+    }
+}
@@ -6,7 +6,11 @@
 DISABLE_WARNINGS_PUSH()
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/gtc/type_precision.hpp>
 DISABLE_WARNINGS_POP()
+#include <filesystem>
+#include <vector>
 
 // TODO: Standard feature
 // Given an image, and relevant texture coordinates, sample the texture s.t.
@@ -20,4 +24,78 @@ glm::vec3 sampleTextureNearest(const Image &image, const glm::vec2 &texCoord);
 // a bilinearly interpolated texel is acquired from the image.
 // For a description of the method's arguments, refer to 'light.cpp'
 // This method is unit-tested, so do not change the function signature.
-glm::vec3 sampleTextureBilinear(const Image &image, const glm::vec2 &texCoord);
\ No newline at end of file
+glm::vec3 sampleTextureBilinear(const Image &image, const glm::vec2 &texCoord);
+
+// Storage format of a `Texture`'s texels. All formats store four channels, s.t. texels are aligned
+// and a bilinear footprint decodes into 4-wide vectors; the fourth channel is unused.
+enum class TextureFormat {
+    Unorm8, // 4 bytes per texel; 8-bit values decoded to value / 255 (like `Image`) through a lookup table
+    Srgb8, // 4 bytes per texel; 8-bit sRGB-encoded values, decoded to linear through a lookup table
+    Half, // 8 bytes per texel; 16-bit floats
+    Float, // 16 bytes per texel; 32-bit floats
+};
+
+// Filter used to compute the mip levels of a `Texture`.
+enum class MipmapFilter {
+    None, // Only store the full resolution texture
+    Box, // Average 2x2 texels; cheap, but passes some aliasing into coarse levels
+    Kaiser, // 6-tap Kaiser-windowed sinc; sharper levels with less aliasing, may ring on hard edges
+};
+
+// Compact, read-only copy of an image for the render kernels to sample from.
+//
+// Texels are stored in 4x4 tiles, and the tiles in row-major order, s.t. a 2x2 bilinear footprint
+// touches a single tile (one 64-byte cache line for the 8-bit formats) in 9 out of 16 cases, instead
+// of always two rows of the image. Rows are stored bottom-up: texel (x, y) covers texture coordinates
+// [x, x + 1] / width by [y, y + 1] / height, matching `sampleTextureNearest()`.
+//
+// Unless created without mipmaps, the texture also stores a mip pyramid: level 0 is the full texture,
+// and every next level halves the resolution of the previous one (rounding up), down to a single texel.
+class Texture {
+public:
+    explicit Texture(const Image& image, TextureFormat format = TextureFormat::Unorm8, MipmapFilter mipmapFilter = MipmapFilter::Box);
+    explicit Texture(const std::filesystem::path& filePath, TextureFormat format = TextureFormat::Unorm8, MipmapFilter mipmapFilter = MipmapFilter::Box);
+
+    [[nodiscard]] int width() const { return m_levels[0].width; }
+    [[nodiscard]] int height() const { return m_levels[0].height; }
+    [[nodiscard]] TextureFormat format() const { return m_format; }
+    [[nodiscard]] int numLevels() const { return int(m_levels.size()); }
+    // Size of the texel storage of all levels, in bytes.
+    [[nodiscard]] size_t sizeInBytes() const;
+
+    // Return the texel at (x, y) of a mip level, clamping the coordinates to the level.
+    [[nodiscard]] glm::vec3 texel(int x, int y, int level = 0) const;
+
+    // Equivalent to `sampleTextureNearest()` on the source image.
+    [[nodiscard]] glm::vec3 sampleNearest(const glm::vec2& texCoord) const;
+    // Bilinear lookup with texel centers at (i + 0.5) / size; coordinates outside of the outer texel
+    // centers clamp to the edge texels.
+    [[nodiscard]] glm::vec3 sampleBilinear(const glm::vec2& texCoord) const;
+    // Trilinear lookup: blend bilinear lookups in the two mip levels around `lod`, which is the log2 of
+    // the footprint's width in level 0 texels. It is clamped to the levels; lods <= 0 read level 0.
+    [[nodiscard]] glm::vec3 sampleTrilinear(const glm::vec2& texCoord, float lod) const;
+
+private:
+    struct Level {
+        int width, height;
+        int numTilesX;
+        size_t offset; // Index of the level's first texel in the texel vector
+    };
+
+    template <TextureFormat Format>
+    glm::vec4 fetch(size_t index) const;
+    template <TextureFormat Format>
+    glm::vec4 bilinear(const Level& level, const glm::vec2& texCoord) const;
+    template <TextureFormat Format>
+    glm::vec3 trilinear(const glm::vec2& texCoord, float lod) const;
+
+    static size_t tiledIndex(const Level& level, int x, int y);
+
+private:
+    TextureFormat m_format;
+    std::vector<Level> m_levels;
+    // Only the vector matching `m_format` is filled
+    std::vector<glm::u8vec4> m_texels8;
+    std::vector<glm::u16vec4> m_texelsHalf;
+    std::vector<glm::vec4> m_texelsFloat;
+};
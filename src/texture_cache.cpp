@@ -0,0 +1,353 @@
+#include "texture_cache.h"
+#include "file_io.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/vec4.hpp>
+#include <glm/gtc/type_precision.hpp>
+#include <stb/stb_image.h>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// Backing files start with a header of one page, s.t. pages are aligned in the file
+static constexpr uint32_t TiledFileMagic = 0x43545452; // "RTTC"
+static constexpr uint32_t TiledFileVersion = 1;
+static constexpr uint64_t TiledFileHeaderSize = 4096;
+
+struct TiledFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t width, height;
+};
+
+TextureCache::TextureCache(const TextureCacheConfig& config)
+    : m_config(config)
+    , m_shardBudget(std::max(config.budgetBytes / std::tuple_size_v<decltype(m_shards)>, sizeof(Page)))
+{
+    if (m_config.directory.empty())
+        m_config.directory = std::filesystem::temp_directory_path() / "ray-tracer-texture-cache";
+}
+
+TextureCache::~TextureCache()
+{
+    for (const TextureFile& file : m_textures) {
+        if (file.fd >= 0)
+            closeFile(file.fd);
+    }
+}
+
+TextureCache::TextureID TextureCache::addTexture(const std::filesystem::path& filePath)
+{
+    const std::string key = std::filesystem::absolute(filePath).lexically_normal().string();
+    if (auto iter = m_textureIDs.find(key); iter != std::end(m_textureIDs))
+        return iter->second;
+
+    const auto id = TextureID(m_textures.size());
+    m_textures.emplace_back().sourcePath = filePath;
+    m_textureIDs[key] = id;
+    return id;
+}
+
+TextureCache::TextureFile& TextureCache::open(TextureID texture)
+{
+    TextureFile& file = m_textures[texture];
+    std::call_once(file.openFlag, [&]() {
+        // Name the backing file after the source file and its version, s.t. edited sources are converted again
+        std::error_code error;
+        const auto writeTime = std::filesystem::last_write_time(file.sourcePath, error).time_since_epoch().count();
+        const auto fileSize = std::filesystem::file_size(file.sourcePath, error);
+        const std::string identity = std::filesystem::absolute(file.sourcePath).string() + "|" + std::to_string(writeTime) + "|" + std::to_string(fileSize);
+        const std::filesystem::path tiledPath = m_config.directory / (std::to_string(std::hash<std::string> {}(identity)) + ".tiles");
+
+        if (!openTiledFile(file, tiledPath))
+            std::cerr << "Failed to open texture " << file.sourcePath << " through the texture cache" << std::endl;
+    });
+    return file;
+}
+
+// Lay out the mip levels of a texture in its backing file; every level is stored as rows of whole pages
+static std::vector<glm::ivec2> levelResolutions(glm::ivec2 resolution)
+{
+    std::vector<glm::ivec2> resolutions { resolution };
+    while (resolution != glm::ivec2(1)) {
+        resolution = (resolution + 1) / 2;
+        resolutions.push_back(resolution);
+    }
+    return resolutions;
+}
+
+// Decode a source image and write it as a tiled backing file, with box filtered mip levels. This needs the
+// full image in memory once; stb_image cannot decode parts of an image.
+static bool writeTiledFile(const std::filesystem::path& sourcePath, const std::filesystem::path& tiledPath, int pageSize)
+{
+    const auto sourcePathStr = sourcePath.string();
+    int width, height, numChannels;
+    stbi_uc* stbPixels = stbi_load(sourcePathStr.c_str(), &width, &height, &numChannels, STBI_rgb_alpha);
+    if (!stbPixels)
+        return false;
+
+    // Rows are stored bottom-up, like in `Texture`
+    std::vector<glm::u8vec4> pixels(size_t(width) * size_t(height));
+    for (int y = 0; y < height; y++)
+        std::memcpy(&pixels[size_t(y) * size_t(width)], stbPixels + size_t(height - y - 1) * size_t(width) * 4, size_t(width) * 4);
+    stbi_image_free(stbPixels);
+
+    std::filesystem::create_directories(tiledPath.parent_path());
+    // Write to a temporary file first, s.t. other processes never see a partial file
+    const std::filesystem::path tempPath = tiledPath.string() + ".tmp";
+    std::ofstream out { tempPath, std::ios::binary };
+    TiledFileHeader header { TiledFileMagic, TiledFileVersion, width, height };
+    std::vector<char> headerPage(TiledFileHeaderSize, 0);
+    std::memcpy(headerPage.data(), &header, sizeof(header));
+    out.write(headerPage.data(), std::streamsize(headerPage.size()));
+
+    std::vector<glm::u8vec4> pageRow, nextPixels;
+    const std::vector<glm::ivec2> resolutions = levelResolutions({ width, height });
+    for (size_t level = 0; level < resolutions.size(); level++) {
+        const glm::ivec2 resolution = resolutions[level];
+        if (level > 0) {
+            // Box filter the previous level; odd sizes repeat their last row or column
+            const glm::ivec2 previous { width, height };
+            nextPixels.resize(size_t(resolution.x) * size_t(resolution.y));
+            for (int y = 0; y < resolution.y; y++) {
+                const int y0 = std::min(2 * y, previous.y - 1), y1 = std::min(2 * y + 1, previous.y - 1);
+                for (int x = 0; x < resolution.x; x++) {
+                    const int x0 = std::min(2 * x, previous.x - 1), x1 = std::min(2 * x + 1, previous.x - 1);
+                    const glm::uvec4 sum = glm::uvec4(pixels[size_t(y0) * size_t(previous.x) + size_t(x0)]) + glm::uvec4(pixels[size_t(y0) * size_t(previous.x) + size_t(x1)])
+                        + glm::uvec4(pixels[size_t(y1) * size_t(previous.x) + size_t(x0)]) + glm::uvec4(pixels[size_t(y1) * size_t(previous.x) + size_t(x1)]);
+                    nextPixels[size_t(y) * size_t(resolution.x) + size_t(x)] = glm::u8vec4((sum + 2u) / 4u);
+                }
+            }
+            std::swap(pixels, nextPixels);
+            width = resolution.x;
+            height = resolution.y;
+        }
+
+        // Write a row of pages at a time; texels past the edges repeat the edge texels
+        const int numPagesX = (width + pageSize - 1) / pageSize;
+        const int numPagesY = (height + pageSize - 1) / pageSize;
+        pageRow.resize(size_t(numPagesX) * size_t(pageSize * pageSize));
+        for (int pageY = 0; pageY < numPagesY; pageY++) {
+            for (int pageX = 0; pageX < numPagesX; pageX++) {
+                glm::u8vec4* page = &pageRow[size_t(pageX) * size_t(pageSize * pageSize)];
+                for (int y = 0; y < pageSize; y++) {
+                    const int sourceY = std::min(pageY * pageSize + y, height - 1);
+                    for (int x = 0; x < pageSize; x++) {
+                        const int sourceX = std::min(pageX * pageSize + x, width - 1);
+                        page[y * pageSize + x] = pixels[size_t(sourceY) * size_t(width) + size_t(sourceX)];
+                    }
+                }
+            }
+            out.write(reinterpret_cast<const char*>(pageRow.data()), std::streamsize(pageRow.size() * sizeof(glm::u8vec4)));
+        }
+    }
+
+    out.close();
+    if (!out)
+        return false;
+    std::error_code error;
+    std::filesystem::rename(tempPath, tiledPath, error);
+    return !error;
+}
+
+bool TextureCache::openTiledFile(TextureFile& file, const std::filesystem::path& tiledPath)
+{
+    TiledFileHeader header {};
+    const auto readHeader = [&]() {
+        file.fd = openReadOnly(tiledPath);
+        if (file.fd >= 0 && readAt(file.fd, 0, &header, sizeof(header)) && header.magic == TiledFileMagic && header.version == TiledFileVersion)
+            return true;
+        if (file.fd >= 0)
+            closeFile(file.fd);
+        file.fd = -1;
+        return false;
+    };
+
+    if (!readHeader()) {
+        std::scoped_lock lock { m_conversionMutex };
+        if (!writeTiledFile(file.sourcePath, tiledPath, PageSize) || !readHeader())
+            return false;
+    }
+
+    uint64_t offset = TiledFileHeaderSize;
+    for (glm::ivec2 resolution : levelResolutions({ header.width, header.height })) {
+        const int numPagesX = (resolution.x + PageSize - 1) / PageSize;
+        const int numPagesY = (resolution.y + PageSize - 1) / PageSize;
+        file.levels.push_back({ resolution.x, resolution.y, numPagesX, offset });
+        offset += uint64_t(numPagesX) * uint64_t(numPagesY) * sizeof(Page);
+    }
+    return true;
+}
+
+void TextureCache::readTexels(TextureID texture, const TextureFile& file, int level, glm::ivec2 page, std::span<const int> indices, std::span<uint32_t> texels)
+{
+    const uint64_t key = (uint64_t(texture) << 40) | (uint64_t(level) << 32) | (uint64_t(page.y) << 16) | uint64_t(page.x);
+    Shard& shard = m_shards[(key * 0x9E3779B97F4A7C15ull) >> 58];
+    static_assert(std::tuple_size_v<decltype(m_shards)> == 64);
+
+    const auto copyTexels = [&](const Page& source) {
+        for (size_t i = 0; i < indices.size(); i++)
+            texels[i] = source[size_t(indices[i])];
+    };
+
+    {
+        std::scoped_lock lock { shard.mutex };
+        if (auto iter = shard.pages.find(key); iter != std::end(shard.pages)) {
+            shard.lru.splice(std::begin(shard.lru), shard.lru, iter->second.second);
+            shard.hits++;
+            copyTexels(*iter->second.first);
+            return;
+        }
+    }
+
+    // Miss; read the page without holding the lock, s.t. other lookups in this shard are not blocked
+    const Level& levelInfo = file.levels[size_t(level)];
+    auto pageData = std::make_unique<Page>();
+    const uint64_t offset = levelInfo.fileOffset + (uint64_t(page.y) * uint64_t(levelInfo.numPagesX) + uint64_t(page.x)) * sizeof(Page);
+    if (!readAt(file.fd, offset, pageData->data(), sizeof(Page)))
+        pageData->fill(0);
+    m_bytesRead += sizeof(Page);
+    copyTexels(*pageData);
+
+    std::scoped_lock lock { shard.mutex };
+    shard.misses++;
+    if (shard.pages.contains(key))
+        return; // Another thread read the same page in the meantime
+
+    shard.lru.push_front(key);
+    shard.pages.emplace(key, std::pair { std::move(pageData), std::begin(shard.lru) });
+    shard.numBytes += sizeof(Page);
+    size_t residentBytes = (m_residentBytes += sizeof(Page));
+    while (shard.numBytes > m_shardBudget && shard.lru.size() > 1) {
+        shard.pages.erase(shard.lru.back());
+        shard.lru.pop_back();
+        shard.numBytes -= sizeof(Page);
+        shard.evictions++;
+        residentBytes = (m_residentBytes -= sizeof(Page));
+    }
+    size_t peak = m_peakResidentBytes.load();
+    while (residentBytes > peak && !m_peakResidentBytes.compare_exchange_weak(peak, residentBytes)) { }
+}
+
+glm::vec4 TextureCache::bilinear(TextureID texture, const TextureFile& file, int level, const glm::vec2& texCoord)
+{
+    const Level& levelInfo = file.levels[size_t(level)];
+    const glm::vec2 size { levelInfo.width, levelInfo.height };
+    const glm::vec2 position = glm::clamp(texCoord * size - 0.5f, glm::vec2(0.0f), size - 1.0f);
+    const glm::ivec2 p0 = glm::ivec2(position);
+    const glm::ivec2 p1 = glm::min(p0 + 1, glm::ivec2(levelInfo.width, levelInfo.height) - 1);
+    const glm::vec2 t = position - glm::vec2(p0);
+
+    // Gather the footprint a page at a time; mostly, all four texels lie in the same page
+    const std::array<glm::ivec2, 4> coords { p0, glm::ivec2(p1.x, p0.y), glm::ivec2(p0.x, p1.y), p1 };
+    std::array<uint32_t, 4> texels;
+    std::array<bool, 4> done {};
+    for (size_t i = 0; i < coords.size(); i++) {
+        if (done[i])
+            continue;
+        const glm::ivec2 page = coords[i] / PageSize;
+        std::array<int, 4> indices;
+        std::array<size_t, 4> slots;
+        size_t count = 0;
+        for (size_t j = i; j < coords.size(); j++) {
+            if (!done[j] && coords[j] / PageSize == page) {
+                const glm::ivec2 inPage = coords[j] - page * PageSize;
+                indices[count] = inPage.y * PageSize + inPage.x;
+                slots[count++] = j;
+                done[j] = true;
+            }
+        }
+        std::array<uint32_t, 4> pageTexels;
+        readTexels(texture, file, level, page, std::span(indices.data(), count), std::span(pageTexels.data(), count));
+        for (size_t k = 0; k < count; k++)
+            texels[slots[k]] = pageTexels[k];
+    }
+
+    const auto decode = [](uint32_t texel) {
+        glm::u8vec4 bytes;
+        std::memcpy(&bytes, &texel, sizeof(texel));
+        return glm::vec4(bytes) * (1.0f / 255.0f);
+    };
+    const glm::vec4 bottom = glm::mix(decode(texels[0]), decode(texels[1]), t.x);
+    const glm::vec4 top = glm::mix(decode(texels[2]), decode(texels[3]), t.x);
+    return glm::mix(bottom, top, t.y);
+}
+
+glm::ivec2 TextureCache::resolution(TextureID texture)
+{
+    const TextureFile& file = open(texture);
+    return file.levels.empty() ? glm::ivec2(0) : glm::ivec2(file.levels[0].width, file.levels[0].height);
+}
+
+glm::vec3 TextureCache::sampleNearest(TextureID texture, const glm::vec2& texCoord)
+{
+    const TextureFile& file = open(texture);
+    if (file.levels.empty())
+        return glm::vec3(0.0f);
+
+    const Level& level = file.levels[0];
+    const glm::ivec2 texel = glm::clamp(glm::ivec2(glm::floor(texCoord * glm::vec2(level.width, level.height))), glm::ivec2(0), glm::ivec2(level.width, level.height) - 1);
+    const glm::ivec2 page = texel / PageSize;
+    const glm::ivec2 inPage = texel - page * PageSize;
+    const int index = inPage.y * PageSize + inPage.x;
+    uint32_t value;
+    readTexels(texture, file, 0, page, std::span(&index, 1), std::span(&value, 1));
+
+    glm::u8vec4 bytes;
+    std::memcpy(&bytes, &value, sizeof(value));
+    return glm::vec3(bytes) * (1.0f / 255.0f);
+}
+
+glm::vec3 TextureCache::sampleBilinear(TextureID texture, const glm::vec2& texCoord)
+{
+    const TextureFile& file = open(texture);
+    if (file.levels.empty())
+        return glm::vec3(0.0f);
+    return bilinear(texture, file, 0, texCoord);
+}
+
+glm::vec3 TextureCache::sampleTrilinear(TextureID texture, const glm::vec2& texCoord, float lod)
+{
+    const TextureFile& file = open(texture);
+    if (file.levels.empty())
+        return glm::vec3(0.0f);
+
+    // Also catches NaN lods, e.g. of degenerate footprints
+    if (!(lod > 0.0f))
+        return bilinear(texture, file, 0, texCoord);
+
+    lod = std::min(lod, float(file.levels.size() - 1));
+    const int level = int(lod);
+    const float t = lod - float(level);
+    if (t == 0.0f)
+        return bilinear(texture, file, level, texCoord);
+    return glm::mix(bilinear(texture, file, level, texCoord), bilinear(texture, file, level + 1, texCoord), t);
+}
+
+TextureCache::Stats TextureCache::stats() const
+{
+    Stats stats {};
+    for (const Shard& shard : m_shards) {
+        std::scoped_lock lock { shard.mutex };
+        stats.hits += shard.hits;
+        stats.misses += shard.misses;
+        stats.evictions += shard.evictions;
+    }
+    stats.bytesRead = m_bytesRead;
+    stats.residentBytes = m_residentBytes;
+    stats.peakResidentBytes = m_peakResidentBytes;
+    return stats;
+}
+
+void TextureCache::resetStats()
+{
+    for (Shard& shard : m_shards) {
+        std::scoped_lock lock { shard.mutex };
+        shard.hits = shard.misses = shard.evictions = 0;
+    }
+    m_bytesRead = 0;
+    m_peakResidentBytes = m_residentBytes.load();
+}
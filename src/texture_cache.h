@@ -0,0 +1,114 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct TextureCacheConfig {
+    size_t budgetBytes = size_t(256) << 20; // Upper bound on the memory held by decoded pages
+    std::filesystem::path directory; // Where tiled copies of textures are kept; empty for a temp directory
+};
+
+// Out-of-core texture storage, shared by all render threads.
+//
+// Registering a texture only records its file. On the first lookup, the texture is converted once into a
+// tiled backing file (8-bit RGBA, with box filtered mip levels) in the cache directory; files converted in
+// an earlier run are reused. Lookups then read fixed-size pages of texels from that file on demand, and keep
+// them in an LRU pool that never holds more than the byte budget. The pool is split into shards with a lock
+// each, so threads only contend when they touch pages of the same shard at the same time.
+//
+// Lookups follow the conventions of `Texture`: rows are bottom-up, and bilinear lookups clamp to the edge.
+class TextureCache {
+public:
+    using TextureID = uint32_t;
+    static constexpr TextureID InvalidTexture = ~TextureID(0);
+
+    struct Stats {
+        uint64_t hits = 0; // Page lookups served from memory
+        uint64_t misses = 0; // Page lookups that read the backing file
+        uint64_t evictions = 0; // Pages dropped to stay within the budget
+        uint64_t bytesRead = 0; // Bytes read from backing files
+        size_t residentBytes = 0; // Bytes of pages currently held
+        size_t peakResidentBytes = 0;
+    };
+
+    explicit TextureCache(const TextureCacheConfig& config);
+    ~TextureCache();
+    TextureCache(const TextureCache&) = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+
+    // Register a texture file without reading it; registering the same file again returns the same ID.
+    // Textures are added while loading a scene; this must not run concurrently with lookups.
+    TextureID addTexture(const std::filesystem::path& filePath);
+
+    // Resolution of level 0 of a texture; opens the texture if needed.
+    [[nodiscard]] glm::ivec2 resolution(TextureID texture);
+
+    [[nodiscard]] glm::vec3 sampleNearest(TextureID texture, const glm::vec2& texCoord);
+    [[nodiscard]] glm::vec3 sampleBilinear(TextureID texture, const glm::vec2& texCoord);
+    // See `Texture::sampleTrilinear()`
+    [[nodiscard]] glm::vec3 sampleTrilinear(TextureID texture, const glm::vec2& texCoord, float lod);
+
+    [[nodiscard]] Stats stats() const;
+    void resetStats();
+
+private:
+    // Pages are 32x32 texels of 4 bytes; one 4 KiB read each
+    static constexpr int PageSize = 32;
+    using Page = std::array<uint32_t, PageSize * PageSize>;
+
+    struct Level {
+        int width, height;
+        int numPagesX;
+        uint64_t fileOffset; // Offset of the level's first page in the backing file
+    };
+    struct TextureFile {
+        std::filesystem::path sourcePath;
+        std::once_flag openFlag;
+        std::vector<Level> levels;
+        int fd = -1;
+    };
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<uint64_t> lru; // Page keys, most recently used first
+        std::unordered_map<uint64_t, std::pair<std::unique_ptr<Page>, std::list<uint64_t>::iterator>> pages;
+        size_t numBytes = 0;
+        // Counted under the shard's lock, instead of in shared atomics that every lookup would write
+        uint64_t hits = 0, misses = 0, evictions = 0;
+    };
+
+    TextureFile& open(TextureID texture);
+    bool openTiledFile(TextureFile& file, const std::filesystem::path& tiledPath);
+
+    // Copy texels of one page into `texels`; `indices` are positions within the page.
+    void readTexels(TextureID texture, const TextureFile& file, int level, glm::ivec2 page, std::span<const int> indices, std::span<uint32_t> texels);
+    glm::vec4 bilinear(TextureID texture, const TextureFile& file, int level, const glm::vec2& texCoord);
+
+private:
+    TextureCacheConfig m_config;
+    size_t m_shardBudget;
+
+    std::deque<TextureFile> m_textures; // A deque, as `TextureFile` cannot be moved
+    std::unordered_map<std::string, TextureID> m_textureIDs;
+    std::mutex m_conversionMutex; // Conversions run one at a time, to bound their memory use
+
+    std::array<Shard, 64> m_shards;
+
+    // Only updated on misses
+    std::atomic<uint64_t> m_bytesRead { 0 };
+    std::atomic<size_t> m_residentBytes { 0 }, m_peakResidentBytes { 0 };
+};
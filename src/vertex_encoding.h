@@ -0,0 +1,56 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/packing.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+
+// Compact encodings of vertex attributes, for geometry that is stored compressed (see `GeometryCache`).
+
+// Encode a normal in 32 bits, as two 16-bit SNORMs of its octahedral projection; after Q. Meyer et al.,
+// "On Floating-Point Normal Vectors", EGSR 2010. The decoded normal is normalized, within 7e-5 radians (0.004
+// degrees) of the input's direction; the projection is rounded to the nearest SNORMs, which is up to 1.5x as far
+// off as the best of the neighbouring encodings.
+inline uint32_t encodeOctahedral(glm::vec3 normal)
+{
+    const float l1Norm = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (!(l1Norm > 0.0f))
+        return glm::packSnorm2x16(glm::vec2(0.0f)); // Decodes to +Z
+    normal /= l1Norm;
+    glm::vec2 projected { normal.x, normal.y };
+    if (normal.z < 0.0f) {
+        // Fold the lower hemisphere over the diagonals
+        const glm::vec2 signs { normal.x >= 0.0f ? 1.0f : -1.0f, normal.y >= 0.0f ? 1.0f : -1.0f };
+        projected = (1.0f - glm::abs(glm::vec2(normal.y, normal.x))) * signs;
+    }
+    return glm::packSnorm2x16(projected);
+}
+
+inline glm::vec3 decodeOctahedral(uint32_t encoded)
+{
+    const glm::vec2 projected = glm::unpackSnorm2x16(encoded);
+    glm::vec3 normal { projected, 1.0f - std::abs(projected.x) - std::abs(projected.y) };
+    if (normal.z < 0.0f) {
+        const glm::vec2 signs { normal.x >= 0.0f ? 1.0f : -1.0f, normal.y >= 0.0f ? 1.0f : -1.0f };
+        const glm::vec2 unfolded = (1.0f - glm::abs(glm::vec2(normal.y, normal.x))) * signs;
+        normal.x = unfolded.x;
+        normal.y = unfolded.y;
+    }
+    return glm::normalize(normal);
+}
+
+// Texture coordinates in [0, 1] are encoded as two 16-bit UNORMs, with a uniform precision of 2^-16; any
+// others as two halfs, which keep about three decimal digits of tiled coordinates.
+inline uint32_t encodeTexCoord(const glm::vec2& texCoord, bool unorm)
+{
+    return unorm ? glm::packUnorm2x16(texCoord) : glm::packHalf2x16(texCoord);
+}
+
+inline glm::vec2 decodeTexCoord(uint32_t encoded, bool unorm)
+{
+    return unorm ? glm::unpackUnorm2x16(encoded) : glm::unpackHalf2x16(encoded);
+}
@@ -0,0 +1,369 @@
+#include "visibility_buffer.h"
+#include "camera.h"
+#include "common.h"
+#include "intersect.h"
+#include "scene.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+// Screen positions are snapped to fixed point with this many fractional bits
+static constexpr int SubpixelBits = 8;
+static constexpr int64_t SubpixelScale = 1 << SubpixelBits;
+
+// Triangles are binned into square tiles of this many pixels, which are rasterised in parallel; every tile
+// holds whole depth blocks, the squares of pixels that the hierarchical depth buffer stores a depth for
+static constexpr int RasterTileSize = 32;
+static constexpr int DepthBlockSize = 8;
+static constexpr int DepthBlocksPerTile = RasterTileSize / DepthBlockSize;
+
+// Triangles are clipped to points in front of this depth, and to a guard band of this many times the screen's
+// extent in NDC, which keeps fixed point positions and edge functions small enough to never overflow
+static constexpr float NearDepth = 1e-5f;
+static constexpr float GuardBand = 4.0f;
+
+// Triangles are set up and binned in chunks of this many primitives at a time
+static constexpr size_t SetupChunkSize = 4096;
+
+namespace {
+// Triangle vertex in homogeneous screen coordinates (see `Camera::project()`), with the barycentric coordinates
+// of the primitive at that point; clipping creates vertices in between the primitive's
+struct ClipVertex {
+    glm::vec3 position;
+    glm::vec2 barycentricCoord;
+};
+using ClipPolygon = std::array<ClipVertex, 8>; // A triangle clipped by 5 planes has at most 8 vertices
+
+// A screen space triangle, ready to be rasterised. Its edge functions A * x + B * y + C are positive for
+// samples inside the triangle, and include the fill rule's bias; the edge function of edge i is opposite to
+// vertex i, and proportional to the vertex's (screen space) barycentric coordinate.
+struct RasterTriangle {
+    std::array<int32_t, 3> A, B;
+    std::array<int64_t, 3> C;
+    glm::ivec2 pixelMin, pixelMax; // Inclusive range of pixels whose centers may be covered
+    float invArea; // Inverse of the sum of the edge functions
+    glm::vec3 invDepth; // Per vertex 1 / w
+    glm::vec3 b1OverDepth, b2OverDepth; // Per vertex barycentric coordinates of the primitive, divided by w
+    float maxInvDepth; // Nearest depth of the triangle, as 1 / w
+    uint32_t primitiveID;
+};
+
+struct BinnedChunk {
+    std::vector<RasterTriangle> triangles;
+    std::vector<std::pair<uint32_t, uint32_t>> bins; // Tile and triangle index
+};
+}
+
+// Signed distance to the clipping planes; points with a negative distance are clipped
+static float clipDistance(const glm::vec3& position, int plane)
+{
+    switch (plane) {
+        case 0:
+            return position.z - NearDepth;
+        case 1:
+            return GuardBand * position.z - position.x;
+        case 2:
+            return GuardBand * position.z + position.x;
+        case 3:
+            return GuardBand * position.z - position.y;
+        default:
+            return GuardBand * position.z + position.y;
+    }
+}
+
+// Sutherland-Hodgman clipping of a convex polygon against all clipping planes; returns the number of vertices left
+static size_t clipPolygon(ClipPolygon& polygon, size_t numVertices)
+{
+    for (int plane = 0; plane < 5 && numVertices >= 3; plane++) {
+        ClipPolygon clipped;
+        size_t numClipped = 0;
+        for (size_t i = 0; i < numVertices; i++) {
+            const ClipVertex& current = polygon[i];
+            const ClipVertex& next = polygon[(i + 1) % numVertices];
+            const float currentDistance = clipDistance(current.position, plane);
+            const float nextDistance = clipDistance(next.position, plane);
+            if (currentDistance >= 0.0f)
+                clipped[numClipped++] = current;
+            if ((currentDistance >= 0.0f) != (nextDistance >= 0.0f)) {
+                const float alpha = currentDistance / (currentDistance - nextDistance);
+                clipped[numClipped++] = { glm::mix(current.position, next.position, alpha), glm::mix(current.barycentricCoord, next.barycentricCoord, alpha) };
+            }
+        }
+        polygon = clipped;
+        numVertices = numClipped;
+    }
+    return numVertices >= 3 ? numVertices : 0;
+}
+
+// Rounds towards negative infinity, unlike integer division
+static int64_t floorDivide(int64_t numerator, int64_t denominator)
+{
+    return numerator / denominator - (numerator % denominator < 0 ? 1 : 0);
+}
+
+// Set up a triangle of clipped vertices for rasterisation; returns false if it covers no pixel centers
+static bool setupTriangle(std::array<ClipVertex, 3> vertices, glm::ivec2 resolution, uint32_t primitiveID, RasterTriangle& triangle)
+{
+    // Snap vertices to fixed point pixel coordinates, with pixel centers at half-pixel positions
+    std::array<glm::i64vec2, 3> fixed;
+    for (size_t i = 0; i < 3; i++) {
+        const glm::vec2 ndc = glm::vec2(vertices[i].position) / vertices[i].position.z;
+        const glm::vec2 pixel = (ndc * 0.5f + 0.5f) * glm::vec2(resolution);
+        fixed[i] = glm::i64vec2(glm::round(pixel * float(SubpixelScale)));
+    }
+
+    // Counter-clockwise winding makes the edge functions positive inside the triangle; rays hit both sides
+    // of a triangle, so clockwise triangles are flipped instead of culled
+    const auto edgeArea = [](const glm::i64vec2& a, const glm::i64vec2& b, const glm::i64vec2& c) {
+        return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    };
+    const int64_t area = edgeArea(fixed[0], fixed[1], fixed[2]);
+    if (area == 0)
+        return false;
+    if (area < 0) {
+        std::swap(fixed[1], fixed[2]);
+        std::swap(vertices[1], vertices[2]);
+    }
+
+    const glm::i64vec2 fixedMin = glm::min(fixed[0], glm::min(fixed[1], fixed[2]));
+    const glm::i64vec2 fixedMax = glm::max(fixed[0], glm::max(fixed[1], fixed[2]));
+    constexpr int64_t halfPixel = SubpixelScale / 2;
+    triangle.pixelMin = glm::max(glm::ivec2(floorDivide(fixedMin.x - halfPixel + SubpixelScale - 1, SubpixelScale), floorDivide(fixedMin.y - halfPixel + SubpixelScale - 1, SubpixelScale)), glm::ivec2(0));
+    triangle.pixelMax = glm::min(glm::ivec2(floorDivide(fixedMax.x - halfPixel, SubpixelScale), floorDivide(fixedMax.y - halfPixel, SubpixelScale)), resolution - 1);
+    if (glm::any(glm::greaterThan(triangle.pixelMin, triangle.pixelMax)))
+        return false;
+
+    for (size_t i = 0; i < 3; i++) {
+        const glm::i64vec2& a = fixed[(i + 1) % 3];
+        const glm::i64vec2& b = fixed[(i + 2) % 3];
+        const int64_t A = a.y - b.y, B = b.x - a.x;
+        triangle.A[i] = int32_t(A);
+        triangle.B[i] = int32_t(B);
+        // Top-left fill rule: samples exactly on an edge belong to the triangle on its left or top side only,
+        // s.t. triangles that share an edge do not both cover its samples
+        const bool topLeft = A > 0 || (A == 0 && B > 0);
+        triangle.C[i] = a.x * b.y - a.y * b.x - (topLeft ? 0 : 1);
+    }
+    triangle.invArea = 1.0f / float(std::abs(area));
+
+    for (int i = 0; i < 3; i++) {
+        const float invDepth = 1.0f / vertices[size_t(i)].position.z;
+        triangle.invDepth[i] = invDepth;
+        triangle.b1OverDepth[i] = vertices[size_t(i)].barycentricCoord.x * invDepth;
+        triangle.b2OverDepth[i] = vertices[size_t(i)].barycentricCoord.y * invDepth;
+    }
+    triangle.maxInvDepth = glm::max(triangle.invDepth.x, glm::max(triangle.invDepth.y, triangle.invDepth.z));
+    triangle.primitiveID = primitiveID;
+    return true;
+}
+
+// Clip a primitive, set up the triangles that remain, and bin them into the tiles their pixels lie in
+static void setupPrimitive(const BVHInterface::Primitive& primitive, uint32_t primitiveID, const Camera& camera, glm::ivec2 resolution, glm::ivec2 numTiles, BinnedChunk& chunk)
+{
+    ClipPolygon polygon;
+    polygon[0] = { camera.project(primitive.v0.position), glm::vec2(0, 0) };
+    polygon[1] = { camera.project(primitive.v1.position), glm::vec2(1, 0) };
+    polygon[2] = { camera.project(primitive.v2.position), glm::vec2(0, 1) };
+
+    // Reject triangles that lie outside the screen, and only clip those that cross the near plane or guard band
+    bool insideClipPlanes = true;
+    for (int plane = 0; plane < 5; plane++) {
+        int numOutside = 0;
+        for (size_t i = 0; i < 3; i++)
+            numOutside += clipDistance(polygon[i].position, plane) < 0.0f ? 1 : 0;
+        if (numOutside == 3)
+            return;
+        insideClipPlanes &= numOutside == 0;
+    }
+    for (int axis = 0; axis < 2; axis++) {
+        if (std::all_of(std::begin(polygon), std::begin(polygon) + 3, [&](const ClipVertex& v) { return v.position[axis] > v.position.z; })
+            || std::all_of(std::begin(polygon), std::begin(polygon) + 3, [&](const ClipVertex& v) { return v.position[axis] < -v.position.z; }))
+            return;
+    }
+    const size_t numVertices = insideClipPlanes ? 3 : clipPolygon(polygon, 3);
+
+    // Triangulate the clipped polygon as a fan
+    for (size_t i = 1; i + 1 < numVertices; i++) {
+        RasterTriangle triangle;
+        if (!setupTriangle({ polygon[0], polygon[i], polygon[i + 1] }, resolution, primitiveID, triangle))
+            continue;
+        const auto triangleIndex = uint32_t(chunk.triangles.size());
+        const glm::ivec2 tileMin = triangle.pixelMin / RasterTileSize;
+        const glm::ivec2 tileMax = triangle.pixelMax / RasterTileSize;
+        for (int y = tileMin.y; y <= tileMax.y; y++) {
+            for (int x = tileMin.x; x <= tileMax.x; x++)
+                chunk.bins.emplace_back(uint32_t(y * numTiles.x + x), triangleIndex);
+        }
+        chunk.triangles.push_back(triangle);
+    }
+}
+
+// Rasterise one triangle into a tile's depth blocks that it overlaps and is not hidden in
+static void rasterTriangle(const RasterTriangle& triangle, glm::ivec2 tileBegin, glm::ivec2 tileEnd, int resolutionX,
+    std::span<float> invDepthBuffer, std::span<VisibilityBuffer::Sample> samples, std::array<float, DepthBlocksPerTile * DepthBlocksPerTile>& blockDepths)
+{
+    const glm::ivec2 pixelMin = glm::max(triangle.pixelMin, tileBegin);
+    const glm::ivec2 pixelMax = glm::min(triangle.pixelMax, tileEnd - 1);
+    const auto edgeFunction = [&](size_t i, int64_t x, int64_t y) {
+        return int64_t(triangle.A[i]) * x + int64_t(triangle.B[i]) * y + triangle.C[i];
+    };
+    const auto sampleCoord = [](int pixel) { return int64_t(pixel) * SubpixelScale + SubpixelScale / 2; };
+
+    for (int blockY = (pixelMin.y - tileBegin.y) / DepthBlockSize; blockY <= (pixelMax.y - tileBegin.y) / DepthBlockSize; blockY++) {
+        for (int blockX = (pixelMin.x - tileBegin.x) / DepthBlockSize; blockX <= (pixelMax.x - tileBegin.x) / DepthBlockSize; blockX++) {
+            // Hierarchical depth test: skip blocks whose every pixel is nearer than the whole triangle
+            float& blockDepth = blockDepths[size_t(blockY * DepthBlocksPerTile + blockX)];
+            if (triangle.maxInvDepth <= blockDepth)
+                continue;
+
+            const glm::ivec2 blockBegin = glm::max(tileBegin + glm::ivec2(blockX, blockY) * DepthBlockSize, pixelMin);
+            const glm::ivec2 blockEnd = glm::min(tileBegin + glm::ivec2(blockX + 1, blockY + 1) * DepthBlockSize, pixelMax + 1);
+
+            // Skip blocks that lie entirely outside one of the edges; edge functions are linear, so they
+            // are largest in one of the block's corners
+            bool outside = false;
+            for (size_t i = 0; i < 3 && !outside; i++) {
+                int64_t maxEdge = std::numeric_limits<int64_t>::min();
+                for (int corner = 0; corner < 4; corner++) {
+                    const int x = corner & 1 ? blockEnd.x - 1 : blockBegin.x;
+                    const int y = corner & 2 ? blockEnd.y - 1 : blockBegin.y;
+                    maxEdge = std::max(maxEdge, edgeFunction(i, sampleCoord(x), sampleCoord(y)));
+                }
+                outside = maxEdge < 0;
+            }
+            if (outside)
+                continue;
+
+            // Evaluate the edge functions for a row of the block at a time, one lane per pixel; the lanes are
+            // independent, s.t. the compiler can vectorise them
+            bool wroteSample = false;
+            for (int y = blockBegin.y; y < blockEnd.y; y++) {
+                std::array<int64_t, 3> rowStart;
+                for (size_t i = 0; i < 3; i++)
+                    rowStart[i] = edgeFunction(i, sampleCoord(blockBegin.x), sampleCoord(y));
+
+                std::array<std::array<int64_t, DepthBlockSize>, 3> edges;
+                std::array<bool, DepthBlockSize> covered;
+                for (int lane = 0; lane < DepthBlockSize; lane++) {
+                    for (size_t i = 0; i < 3; i++)
+                        edges[i][size_t(lane)] = rowStart[i] + int64_t(lane) * SubpixelScale * triangle.A[i];
+                    covered[size_t(lane)] = (edges[0][size_t(lane)] | edges[1][size_t(lane)] | edges[2][size_t(lane)]) >= 0;
+                }
+
+                for (int lane = 0; lane < blockEnd.x - blockBegin.x; lane++) {
+                    if (!covered[size_t(lane)])
+                        continue;
+                    const glm::vec3 screenCoord = glm::vec3(float(edges[0][size_t(lane)]), float(edges[1][size_t(lane)]), float(edges[2][size_t(lane)])) * triangle.invArea;
+                    const float invDepth = glm::dot(screenCoord, triangle.invDepth);
+                    // Triangles are rasterised in the order of their primitives, so ties keep the lower primitive
+                    const size_t pixel = size_t(y) * size_t(resolutionX) + size_t(blockBegin.x + lane);
+                    if (invDepth <= invDepthBuffer[pixel])
+                        continue;
+                    invDepthBuffer[pixel] = invDepth;
+                    samples[pixel] = {
+                        .primitiveID = triangle.primitiveID,
+                        .barycentricCoord = glm::vec2(glm::dot(screenCoord, triangle.b1OverDepth), glm::dot(screenCoord, triangle.b2OverDepth)) / invDepth
+                    };
+                    wroteSample = true;
+                }
+            }
+
+            // Update the block's farthest depth; it only grows, and is 0 while the block has uncovered pixels
+            if (wroteSample) {
+                const glm::ivec2 fullBegin = tileBegin + glm::ivec2(blockX, blockY) * DepthBlockSize;
+                const glm::ivec2 fullEnd = glm::min(fullBegin + DepthBlockSize, tileEnd);
+                float farthest = std::numeric_limits<float>::max();
+                for (int y = fullBegin.y; y < fullEnd.y; y++) {
+                    for (int x = fullBegin.x; x < fullEnd.x; x++)
+                        farthest = std::min(farthest, invDepthBuffer[size_t(y) * size_t(resolutionX) + size_t(x)]);
+                }
+                blockDepth = farthest;
+            }
+        }
+    }
+}
+
+bool VisibilityBuffer::supports(const Scene& scene, const BVHInterface& bvh, const Features& features, const Camera& camera)
+{
+    return scene.spheres.empty() && !scene.geometryCache && !bvh.primitives().empty()
+        && features.numPixelSamples <= 1 && !camera.hasThinLens() && !features.extra.enableMotionBlur;
+}
+
+VisibilityBuffer::VisibilityBuffer(std::span<const BVHInterface::Primitive> primitives, const Camera& camera, glm::ivec2 resolution)
+    : m_resolution(resolution)
+    , m_samples(size_t(resolution.x) * size_t(resolution.y))
+{
+    const glm::ivec2 numTiles = (resolution + RasterTileSize - 1) / RasterTileSize;
+
+    // Set up and bin the triangles of fixed chunks of primitives in parallel
+    std::vector<BinnedChunk> chunks((primitives.size() + SetupChunkSize - 1) / SetupChunkSize);
+#ifdef NDEBUG // Enable multi threading in Release mode
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int chunk = 0; chunk < int(chunks.size()); chunk++) {
+        const size_t begin = size_t(chunk) * SetupChunkSize;
+        const size_t end = std::min(begin + SetupChunkSize, primitives.size());
+        for (size_t i = begin; i < end; i++)
+            setupPrimitive(primitives[i], uint32_t(i), camera, resolution, numTiles, chunks[size_t(chunk)]);
+    }
+
+    // Gather the triangles, and sort the bins by tile; within a tile, triangles stay in the order of their primitives
+    std::vector<RasterTriangle> triangles;
+    std::vector<uint32_t> tileOffsets(size_t(numTiles.x * numTiles.y) + 1, 0);
+    for (const BinnedChunk& chunk : chunks) {
+        for (const auto& [tile, triangleIndex] : chunk.bins)
+            tileOffsets[tile + 1]++;
+    }
+    for (size_t tile = 1; tile < tileOffsets.size(); tile++)
+        tileOffsets[tile] += tileOffsets[tile - 1];
+    std::vector<uint32_t> tileTriangles(tileOffsets.back());
+    std::vector<uint32_t> tileCursors(std::begin(tileOffsets), std::end(tileOffsets) - 1);
+    for (BinnedChunk& chunk : chunks) {
+        const auto chunkOffset = uint32_t(triangles.size());
+        for (const auto& [tile, triangleIndex] : chunk.bins)
+            tileTriangles[tileCursors[tile]++] = chunkOffset + triangleIndex;
+        triangles.insert(std::end(triangles), std::begin(chunk.triangles), std::end(chunk.triangles));
+        chunk = {};
+    }
+
+    // Rasterise tiles in parallel; every tile owns its pixels, and its blocks of the hierarchical depth buffer
+    std::vector<float> invDepthBuffer(m_samples.size(), 0.0f);
+#ifdef NDEBUG // Enable multi threading in Release mode
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int tile = 0; tile < numTiles.x * numTiles.y; tile++) {
+        const glm::ivec2 tileBegin = glm::ivec2(tile % numTiles.x, tile / numTiles.x) * RasterTileSize;
+        const glm::ivec2 tileEnd = glm::min(tileBegin + RasterTileSize, resolution);
+        std::array<float, DepthBlocksPerTile * DepthBlocksPerTile> blockDepths;
+        blockDepths.fill(0.0f);
+        for (uint32_t i = tileOffsets[size_t(tile)]; i < tileOffsets[size_t(tile) + 1]; i++)
+            rasterTriangle(triangles[tileTriangles[i]], tileBegin, tileEnd, resolution.x, invDepthBuffer, m_samples, blockDepths);
+    }
+}
+
+float VisibilityBuffer::hitDistance(const Ray& ray, const BVHInterface::Primitive& primitive, const Sample& sample)
+{
+    // Intersect the ray with the primitive as the BVH does, s.t. the hit matches a ray traced one exactly
+    Ray tracedRay = ray;
+    tracedRay.t = std::numeric_limits<float>::max();
+    HitInfo hitInfo;
+    if (intersectRayWithTriangle(primitive.v0.position, primitive.v1.position, primitive.v2.position, tracedRay, hitInfo))
+        return tracedRay.t;
+
+    // The sample lies just outside the primitive, on an edge with a neighbour; intersect the ray with the
+    // primitive's plane, or for a primitive seen almost edge-on, project the rasterised hit onto the ray
+    const glm::vec3 normal = glm::cross(primitive.v1.position - primitive.v0.position, primitive.v2.position - primitive.v0.position);
+    const float cosine = glm::dot(ray.direction, normal);
+    if (std::abs(cosine) > 1e-3f * glm::length(normal) * glm::length(ray.direction))
+        return glm::dot(primitive.v0.position - ray.origin, normal) / cosine;
+
+    const glm::vec3 position = (1.0f - sample.barycentricCoord.x - sample.barycentricCoord.y) * primitive.v0.position
+        + sample.barycentricCoord.x * primitive.v1.position + sample.barycentricCoord.y * primitive.v2.position;
+    return glm::dot(position - ray.origin, ray.direction) / glm::dot(ray.direction, ray.direction);
+}
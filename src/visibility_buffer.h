@@ -0,0 +1,46 @@
+#pragma once
+#include "bvh_interface.h"
+#include "fwd.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/ray.h>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Primary visibility of a pinhole camera, computed by rasterising the BVH's triangles on the CPU instead of
+// tracing a ray through every pixel. Stores the triangle and the barycentric coordinates of the first hit
+// through every pixel's center; `renderImage()` shades camera rays from there on.
+//
+// Triangles are set up and binned into screen tiles in parallel, and the tiles are then rasterised in
+// parallel. Coverage is decided by edge functions on 8 bits of subpixel precision with a top-left rule, s.t.
+// triangles that share an edge cover each of its pixels exactly once; the edge functions are evaluated a
+// block row of pixels at a time. A hierarchical depth buffer stores the farthest depth of every 8x8 block,
+// which skips the blocks that a triangle is entirely behind. Triangles are clipped against a near plane
+// and a guard band around the screen, and barycentric coordinates are interpolated perspective correctly.
+class VisibilityBuffer {
+public:
+    static constexpr uint32_t NoHit = ~0u;
+    struct Sample {
+        uint32_t primitiveID = NoHit; // Index into the BVH's primitives
+        glm::vec2 barycentricCoord { 0.0f }; // Weights of the primitive's v1 and v2
+    };
+
+    // Whether primary hits may be rasterised: the camera must be a pinhole camera with one sample through
+    // the center of every pixel, and all geometry must be resident triangles (no spheres or streamed meshes).
+    // Motion blur renders images of its own, so it never uses a visibility buffer.
+    [[nodiscard]] static bool supports(const Scene& scene, const BVHInterface& bvh, const Features& features, const Camera& camera);
+
+    VisibilityBuffer(std::span<const BVHInterface::Primitive> primitives, const Camera& camera, glm::ivec2 resolution);
+
+    [[nodiscard]] const Sample& sample(glm::ivec2 pixel) const { return m_samples[size_t(pixel.y) * size_t(m_resolution.x) + size_t(pixel.x)]; }
+
+    // Distance along a camera ray (with a normalized direction) to the sample's hit on `primitive`
+    [[nodiscard]] static float hitDistance(const Ray& ray, const BVHInterface::Primitive& primitive, const Sample& sample);
+
+private:
+    glm::ivec2 m_resolution;
+    std::vector<Sample> m_samples;
+};
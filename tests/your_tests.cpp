@@ -1,16 +1,34 @@
 // Put your includes here
+#include "blur.h"
 #include "bvh.h"
+#include "camera.h"
+#include "config.h"
+#include "geometry_cache.h"
+#include "intersect.h"
+#include "light.h"
 #include "render.h"
 #include "sampler.h"
 #include "scene.h"
 #include "shading.h"
+#include "screen.h"
+#include "shadow_packet.h"
+#include "vertex_encoding.h"
+#include "visibility_buffer.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <filesystem>
 #include <limits>
+#include <span>
+#include <vector>
 
 // Suppress warnings in third-party code.
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
 #include <catch2/catch_all.hpp>
 #include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtx/component_wise.hpp>
 DISABLE_WARNINGS_POP()
 
 // In this file you can add your own unit tests using the Catch2 library.
@@ -27,6 +45,416 @@ TEST_CASE("StudentTest")
     // Add your own tests here...
 }
 
+// Blur an image with a sampled, normalized Gaussian kernel of radius 4 sigma, first along the rows and then along
+// the columns, reading outside of the image by clamping to the nearest edge pixel
+static std::vector<glm::vec3> referenceGaussianBlur(const std::vector<glm::vec3>& pixels, glm::ivec2 resolution, float sigma)
+{
+    const int radius = int(std::ceil(4.0f * sigma));
+    std::vector<float> weights;
+    float sum = 0.0f;
+    for (int i = -radius; i <= radius; i++)
+        sum += weights.emplace_back(std::exp(-0.5f * float(i * i) / (sigma * sigma)));
+    for (float& weight : weights)
+        weight /= sum;
+
+    const auto at = [&](const std::vector<glm::vec3>& image, int x, int y) {
+        return image[size_t(std::clamp(y, 0, resolution.y - 1)) * size_t(resolution.x) + size_t(std::clamp(x, 0, resolution.x - 1))];
+    };
+    std::vector<glm::vec3> rows(pixels.size()), output(pixels.size());
+    for (int y = 0; y < resolution.y; y++) {
+        for (int x = 0; x < resolution.x; x++) {
+            glm::vec3 color { 0.0f };
+            for (int i = -radius; i <= radius; i++)
+                color += weights[size_t(i + radius)] * at(pixels, x + i, y);
+            rows[size_t(y) * size_t(resolution.x) + size_t(x)] = color;
+        }
+    }
+    for (int y = 0; y < resolution.y; y++) {
+        for (int x = 0; x < resolution.x; x++) {
+            glm::vec3 color { 0.0f };
+            for (int i = -radius; i <= radius; i++)
+                color += weights[size_t(i + radius)] * at(rows, x, y + i);
+            output[size_t(y) * size_t(resolution.x) + size_t(x)] = color;
+        }
+    }
+    return output;
+}
+
+TEST_CASE("GaussianBlur")
+{
+    // Odd sizes, s.t. the last row block and column strip are partial. The image varies smoothly, but is far from
+    // constant at the edges, s.t. the clamping there matters.
+    const glm::ivec2 resolution { 37, 29 };
+    std::vector<glm::vec3> pixels(size_t(resolution.x) * size_t(resolution.y));
+    for (int y = 0; y < resolution.y; y++) {
+        for (int x = 0; x < resolution.x; x++) {
+            const glm::vec2 p { float(x), float(y) };
+            pixels[size_t(y) * size_t(resolution.x) + size_t(x)] = 0.5f + 0.4f * glm::vec3(std::sin(0.3f * p.x + 0.2f * p.y), std::cos(0.25f * p.x - 0.35f * p.y), std::sin(0.15f * (p.x + p.y) + 1.0f));
+        }
+    }
+
+    std::vector<glm::vec3> scratch;
+    SECTION("Matches a Gaussian")
+    {
+        for (float sigma : { 1.5f, 3.0f, 6.0f }) {
+            const std::vector<glm::vec3> reference = referenceGaussianBlur(pixels, resolution, sigma);
+            std::vector<glm::vec3> blurred = pixels;
+            gaussianBlur(blurred, resolution, sigma, scratch);
+
+            // Three box blurs are within a few percent of the Gaussian; edge pixels are checked separately, as the
+            // clamping is where an implementation is most likely to be off
+            float maxError = 0.0f, maxEdgeError = 0.0f;
+            for (int y = 0; y < resolution.y; y++) {
+                for (int x = 0; x < resolution.x; x++) {
+                    const size_t i = size_t(y) * size_t(resolution.x) + size_t(x);
+                    const float error = glm::length(blurred[i] - reference[i]);
+                    if (x == 0 || y == 0 || x == resolution.x - 1 || y == resolution.y - 1)
+                        maxEdgeError = std::max(maxEdgeError, error);
+                    else
+                        maxError = std::max(maxError, error);
+                }
+            }
+            CAPTURE(sigma, maxError, maxEdgeError);
+            CHECK(maxError < 0.03f);
+            CHECK(maxEdgeError < 0.03f);
+        }
+    }
+
+    SECTION("Keeps a constant image")
+    {
+        std::vector<glm::vec3> constant(pixels.size(), glm::vec3(0.3f, 0.6f, 0.9f));
+        gaussianBlur(constant, resolution, 3.0f, scratch);
+        CHECK(std::all_of(constant.begin(), constant.end(), [](const glm::vec3& color) { return glm::all(glm::epsilonEqual(color, glm::vec3(0.3f, 0.6f, 0.9f), 1e-5f)); }));
+    }
+}
+
+TEST_CASE("LightImportanceSampling")
+{
+    SECTION("Linear and bilinear densities integrate to one")
+    {
+        // Midpoint rule; the densities are linear in every cell, so this is exact up to rounding
+        constexpr int n = 256;
+        for (const glm::vec2 ab : { glm::vec2(1.0f, 1.0f), glm::vec2(0.0f, 3.0f), glm::vec2(5.0f, 0.5f) }) {
+            float integral = 0.0f;
+            for (int i = 0; i < n; i++)
+                integral += linearPdf((float(i) + 0.5f) / float(n), ab.x, ab.y) / float(n);
+            CAPTURE(ab.x, ab.y);
+            CHECK(integral == Catch::Approx(1.0f).epsilon(1e-4f));
+        }
+        for (const glm::vec4 weights : { glm::vec4(1.0f), glm::vec4(0.0f, 1.0f, 2.0f, 0.0f), glm::vec4(4.0f, 0.5f, 1.0f, 3.0f) }) {
+            float integral = 0.0f;
+            for (int y = 0; y < n; y++) {
+                for (int x = 0; x < n; x++)
+                    integral += bilinearPdf((glm::vec2(x, y) + 0.5f) / float(n), weights) / float(n * n);
+            }
+            CAPTURE(weights.x, weights.y, weights.z, weights.w);
+            CHECK(integral == Catch::Approx(1.0f).epsilon(1e-4f));
+        }
+    }
+
+    SECTION("Samples follow their densities")
+    {
+        // The fraction of a stratified set of samples that lands in the left half of [0, 1) is the density's
+        // integral over it; the same in y for the bilinear density, whose marginal in y is sampled first
+        constexpr int n = 4096;
+        const float a = 0.5f, b = 3.0f;
+        int numLeft = 0, numOutside = 0;
+        for (int i = 0; i < n; i++) {
+            const float x = sampleLinear((float(i) + 0.5f) / float(n), a, b);
+            numOutside += x < 0.0f || x >= 1.0f;
+            numLeft += x < 0.5f;
+        }
+        CHECK(numOutside == 0);
+        CHECK(float(numLeft) / float(n) == Catch::Approx(0.5f * glm::mix(a, b, 0.25f) * 2.0f / (a + b)).epsilon(1e-3f));
+
+        const glm::vec4 weights { 4.0f, 0.5f, 1.0f, 3.0f };
+        int numBottom = 0;
+        for (int i = 0; i < n; i++) {
+            const glm::vec2 p = sampleBilinear({ 0.5f, (float(i) + 0.5f) / float(n) }, weights);
+            numBottom += p.y < 0.5f;
+        }
+        const float bottom = weights.x + weights.y, top = weights.z + weights.w;
+        CHECK(float(numBottom) / float(n) == Catch::Approx(0.5f * glm::mix(bottom, top, 0.25f) * 2.0f / (bottom + top)).epsilon(1e-3f));
+    }
+
+    SECTION("Estimators converge to the uniform estimators")
+    {
+        // A hit on a horizontal, glossy surface, lit by lights that are partially below its horizon; without
+        // shadows, s.t. the estimators only differ by how they sample the lights
+        Scene scene = loadScenePrebuilt(SceneType::CornellBox, DATA_DIR);
+        Features features = { .enableShading = true };
+        BVH bvh(scene, features);
+        const Ray ray { .origin = glm::vec3(0.0f, 1.0f, 1.0f), .direction = glm::normalize(glm::vec3(0.0f, -1.0f, -1.0f)), .t = std::sqrt(2.0f) };
+        HitInfo hitInfo {};
+        hitInfo.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+        hitInfo.material = Material { .kd = glm::vec3(0.8f, 0.6f, 0.4f), .ks = glm::vec3(0.5f), .shininess = 20.0f };
+
+        const SegmentLight segment { .endpoint0 = glm::vec3(-1.0f, -0.2f, -0.5f), .endpoint1 = glm::vec3(1.0f, 1.5f, -0.5f), .color0 = glm::vec3(1.0f, 0.2f, 0.2f), .color1 = glm::vec3(0.2f, 0.2f, 1.0f) };
+        const ParallelogramLight parallelogram { .v0 = glm::vec3(-1.0f, -0.3f, -1.0f), .edge01 = glm::vec3(2.0f, 0.0f, 0.0f), .edge02 = glm::vec3(0.0f, 1.5f, 1.5f),
+            .color0 = glm::vec3(1.0f), .color1 = glm::vec3(0.2f, 1.0f, 0.2f), .color2 = glm::vec3(1.0f, 0.2f, 0.2f), .color3 = glm::vec3(0.2f, 0.2f, 1.0f) };
+
+        constexpr uint32_t numSamples = 1 << 18;
+        for (ShadingModel shadingModel : { ShadingModel::Lambertian, ShadingModel::Phong, ShadingModel::BlinnPhong }) {
+            features.shadingModel = shadingModel;
+            const auto estimate = [&](bool importanceSampled, auto&& computeContribution) {
+                features.extra.enableLightImportanceSampling = importanceSampled;
+                RenderState state = { .scene = scene, .features = features, .bvh = bvh, .sampler = Sampler(1) };
+                return computeContribution(state);
+            };
+            const auto segmentContribution = [&](RenderState& state) { return computeContributionSegmentLight(state, segment, ray, hitInfo, numSamples); };
+            const auto parallelogramContribution = [&](RenderState& state) { return computeContributionParallelogramLight(state, parallelogram, ray, hitInfo, numSamples); };
+
+            CAPTURE(int(shadingModel));
+            const glm::vec3 uniformSegment = estimate(false, segmentContribution);
+            const glm::vec3 sampledSegment = estimate(true, segmentContribution);
+            CAPTURE(uniformSegment.x, uniformSegment.y, uniformSegment.z, sampledSegment.x, sampledSegment.y, sampledSegment.z);
+            CHECK(glm::length(sampledSegment - uniformSegment) < 0.01f * glm::length(uniformSegment));
+
+            const glm::vec3 uniformParallelogram = estimate(false, parallelogramContribution);
+            const glm::vec3 sampledParallelogram = estimate(true, parallelogramContribution);
+            CAPTURE(uniformParallelogram.x, uniformParallelogram.y, uniformParallelogram.z, sampledParallelogram.x, sampledParallelogram.y, sampledParallelogram.z);
+            CHECK(glm::length(sampledParallelogram - uniformParallelogram) < 0.01f * glm::length(uniformParallelogram));
+        }
+    }
+}
+
+TEST_CASE("ShadowPacket")
+{
+    // Shading points all over the Cornell box, lit by an area light below its ceiling, s.t. the boxes inside of it
+    // cast soft shadows: from many of the points, part of the light is occluded
+    Features features = { .enableShadows = true, .enableAccelStructure = true };
+    Scene scene = loadScenePrebuilt(SceneType::CornellBox, DATA_DIR);
+    BVH bvh(scene, features);
+    RenderState state = { .scene = scene, .features = features, .bvh = bvh, .sampler = Sampler(1) };
+
+    // Packets of fewer lanes than `ShadowPacketSize` leave the rest of the lanes unused
+    size_t numVisible = 0, numOccluded = 0, numPartial = 0, numMismatches = 0;
+    for (size_t numTargets : { size_t(1), size_t(5), ShadowPacketSize, ShadowPacketSize + 5 }) {
+        for (int i = 0; i < 64; i++) {
+            // Rays from the top of the box, towards the floor and walls
+            const glm::vec2 direction = state.sampler.next_2d();
+            Ray ray { .origin = glm::vec3(0.0f, 0.4f, 0.0f), .direction = glm::normalize(glm::vec3(2.0f * direction.x - 1.0f, -1.0f, 2.0f * direction.y - 1.0f)) };
+            HitInfo hitInfo;
+            if (!state.bvh.intersect(state, ray, hitInfo))
+                continue;
+            const glm::vec3 origin = ray.origin + ray.t * ray.direction;
+
+            std::vector<glm::vec3> targets(numTargets);
+            for (glm::vec3& target : targets) {
+                const glm::vec2 sample = state.sampler.next_2d();
+                target = glm::vec3(-0.4f + 0.8f * sample.x, 0.5f, -0.4f + 0.8f * sample.y);
+            }
+            std::array<bool, ShadowPacketSize + 5> visible;
+            traceShadowPacket(scene, bvh, origin, targets, std::span(visible).first(numTargets));
+
+            size_t numVisibleTargets = 0;
+            for (size_t j = 0; j < numTargets; j++) {
+                const bool expected = visibilityOfLightSampleBinary(state, targets[j], glm::vec3(1.0f), ray, hitInfo);
+                numMismatches += visible[j] != expected;
+                numVisibleTargets += expected;
+            }
+            numVisible += numVisibleTargets == numTargets;
+            numOccluded += numVisibleTargets == 0;
+            numPartial += numVisibleTargets > 0 && numVisibleTargets < numTargets;
+        }
+    }
+    // Number of shading points from which all, none, or some of the targets are visible
+    CAPTURE(numVisible, numOccluded, numPartial);
+    CHECK(numMismatches == 0);
+    CHECK(numVisible > 0);
+    CHECK(numOccluded > 0);
+    CHECK(numPartial > 0);
+}
+
+TEST_CASE("GeometryCache")
+{
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "ray-tracer-geometry-cache-test";
+    std::filesystem::remove_all(directory);
+    const Scene scene = loadScenePrebuilt(SceneType::CornellBox, DATA_DIR);
+
+    SECTION("Vertex encodings are within their tolerances")
+    {
+        Sampler sampler(1);
+        float maxAngle = 0.0f, maxLengthError = 0.0f, maxTexCoordError = 0.0f;
+        for (int i = 0; i < 100000; i++) {
+            // Uniformly distributed directions, of varying lengths
+            const glm::vec2 sample = sampler.next_2d();
+            const float z = 2.0f * sample.x - 1.0f, phi = 2.0f * glm::pi<float>() * sample.y;
+            const glm::vec3 normal = glm::vec3(std::sqrt(1.0f - z * z) * glm::vec2(std::cos(phi), std::sin(phi)), z);
+            const glm::vec3 decoded = decodeOctahedral(encodeOctahedral((0.1f + 10.0f * sampler.next_1d()) * normal));
+            maxLengthError = std::max(maxLengthError, std::abs(glm::length(decoded) - 1.0f));
+            maxAngle = std::max(maxAngle, std::atan2(glm::length(glm::cross(decoded, normal)), glm::dot(decoded, normal)));
+
+            const glm::vec2 texCoord = sampler.next_2d();
+            maxTexCoordError = std::max(maxTexCoordError, glm::compMax(glm::abs(decodeTexCoord(encodeTexCoord(texCoord, true), true) - texCoord)));
+        }
+        CAPTURE(maxAngle, maxLengthError, maxTexCoordError);
+        CHECK(maxAngle < 7e-5f);
+        CHECK(maxLengthError < 1e-6f);
+        CHECK(maxTexCoordError <= 0x1p-16f);
+        // The axes are exact
+        for (const glm::vec3 axis : { glm::vec3(1, 0, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1) })
+            CHECK(decodeOctahedral(encodeOctahedral(axis)) == axis);
+    }
+
+    SECTION("Round trips the meshes' geometry")
+    {
+        for (bool compressAttributes : { false, true }) {
+            // Clusters of a few triangles, s.t. the meshes of the box are split over several of them
+            const GeometryCacheConfig config { .directory = directory, .clusterSize = 4, .compressAttributes = compressAttributes };
+            // The second cache reads the paged file that the first one wrote
+            for (int run = 0; run < 2; run++) {
+                GeometryCache cache(config, scene.meshes);
+                size_t numTriangles = 0, numPositionMismatches = 0;
+                float maxPositionError = 0.0f, maxNormalAngle = 0.0f, maxTexCoordError = 0.0f;
+                for (uint32_t clusterID = 0; clusterID < cache.clusterBounds().size(); clusterID++) {
+                    const std::shared_ptr<const GeometryCache::Cluster> cluster = cache.cluster(clusterID);
+                    const Mesh& mesh = scene.meshes[cluster->meshID];
+                    for (const glm::u16vec3& triangle : cluster->triangles()) {
+                        numTriangles++;
+                        for (int corner = 0; corner < 3; corner++) {
+                            // The original vertex is the closest one of the mesh; of vertices at the same position,
+                            // the one whose normal is closest
+                            const Vertex vertex = cluster->vertex(triangle[corner]);
+                            const auto distance = [&](const Vertex& original) {
+                                return std::pair(glm::length(original.position - vertex.position), -glm::dot(glm::normalize(original.normal), vertex.normal));
+                            };
+                            const Vertex& original = *std::min_element(mesh.vertices.begin(), mesh.vertices.end(), [&](const Vertex& lhs, const Vertex& rhs) { return distance(lhs) < distance(rhs); });
+                            numPositionMismatches += cluster->position(triangle[corner]) != vertex.position;
+                            const glm::vec3 normal = glm::normalize(original.normal);
+                            maxPositionError = std::max(maxPositionError, glm::length(original.position - vertex.position));
+                            maxNormalAngle = std::max(maxNormalAngle, std::atan2(glm::length(glm::cross(vertex.normal, normal)), glm::dot(vertex.normal, normal)));
+                            maxTexCoordError = std::max(maxTexCoordError, glm::compMax(glm::abs(original.texCoord - vertex.texCoord)));
+                        }
+                    }
+                }
+
+                size_t numMeshTriangles = 0;
+                for (const Mesh& mesh : scene.meshes)
+                    numMeshTriangles += mesh.triangles.size();
+                CAPTURE(compressAttributes, run, maxPositionError, maxNormalAngle, maxTexCoordError);
+                CHECK(cache.clusterBounds().size() > scene.meshes.size());
+                CHECK(numTriangles == numMeshTriangles);
+                // Traversal decodes the same positions as hits
+                CHECK(numPositionMismatches == 0);
+                if (compressAttributes) {
+                    // Positions are rounded to a grid whose step is at most 1/65534 of a cluster's extent; the
+                    // Cornell box is 2 units wide
+                    CHECK(maxPositionError <= 0.5f * std::sqrt(3.0f) * 2.0f / 65534.0f);
+                    CHECK(maxNormalAngle < 7e-5f);
+                    CHECK(maxTexCoordError <= 0x1p-16f);
+                } else {
+                    CHECK(maxPositionError == 0.0f);
+                    CHECK(maxNormalAngle < 1e-6f);
+                    CHECK(maxTexCoordError == 0.0f);
+                }
+            }
+        }
+    }
+
+    SECTION("Renders like the in-memory meshes")
+    {
+        Features features = { .enableShading = true, .enableReflections = true, .enableShadows = true, .enableNormalInterp = true, .enableAccelStructure = true, .shadingModel = ShadingModel::Phong };
+        const glm::ivec2 resolution { 48, 48 };
+        const Camera camera { CameraConfig { .rotation = glm::vec3(0.0f) }, 1.0f };
+        const auto render = [&](const Scene& renderedScene) {
+            const BVH bvh(renderedScene, features);
+            Screen screen(resolution, false);
+            screen.clear(glm::vec3(0.0f));
+            renderImage(renderedScene, bvh, features, camera, screen);
+            return screen.pixels();
+        };
+        const std::vector<glm::vec3> reference = render(scene);
+
+        for (bool compressAttributes : { false, true }) {
+            Scene streamedScene = scene;
+            streamGeometry(streamedScene, { .directory = directory, .clusterSize = 4, .compressAttributes = compressAttributes });
+            REQUIRE(streamedScene.meshes.front().triangles.empty());
+            const std::vector<glm::vec3> pixels = render(streamedScene);
+
+            // Compressed vertices move hits by a tiny fraction of a pixel, and their normals by a tiny angle
+            float maxError = 0.0f;
+            for (size_t i = 0; i < pixels.size(); i++)
+                maxError = std::max(maxError, glm::compMax(glm::abs(pixels[i] - reference[i])));
+            CAPTURE(compressAttributes, maxError);
+            CHECK(maxError < (compressAttributes ? 1e-3f : 1e-5f));
+        }
+    }
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("VisibilityBuffer")
+{
+    Features features = { .enableAccelStructure = true };
+    Scene scene = loadScenePrebuilt(SceneType::CornellBox, DATA_DIR);
+    BVH bvh(scene, features);
+    RenderState state = { .scene = scene, .features = features, .bvh = bvh, .sampler = Sampler(1) };
+    const glm::ivec2 resolution { 160, 120 };
+    const Camera camera { CameraConfig { .distanceFromLookAt = 1.5f, .rotation = { 10.0f, 20.0f, 0.0f } }, float(resolution.x) / float(resolution.y) };
+
+    SECTION("Matches the first hits of traced camera rays")
+    {
+        REQUIRE(VisibilityBuffer::supports(scene, bvh, features, camera));
+        const VisibilityBuffer visibilityBuffer(bvh.primitives(), camera, resolution);
+        std::vector<Ray> rays(size_t(resolution.x) * size_t(resolution.y));
+        camera.generateTileRays({ 0, 0 }, resolution, resolution, rays);
+
+        // Coverage of the pixels whose centers lie on a triangle's edge is decided in fixed point by the rasteriser,
+        // and in floating point by the BVH, so the two may pick different triangles (or none) there
+        size_t numHits = 0, numMismatches = 0, numDistanceErrors = 0;
+        float maxBarycentricError = 0.0f;
+        for (int y = 0; y < resolution.y; y++) {
+            for (int x = 0; x < resolution.x; x++) {
+                const Ray& cameraRay = rays[size_t(y) * size_t(resolution.x) + size_t(x)];
+                Ray ray = cameraRay;
+                HitInfo hitInfo;
+                uint32_t tracedID = VisibilityBuffer::NoHit;
+                if (bvh.intersect(state, ray, hitInfo)) {
+                    numHits++;
+                    // The traced primitive is the one whose intersection is the traced hit
+                    for (uint32_t i = 0; i < bvh.primitives().size() && tracedID == VisibilityBuffer::NoHit; i++) {
+                        const BVHInterface::Primitive& primitive = bvh.primitives()[i];
+                        Ray primitiveRay = cameraRay;
+                        HitInfo primitiveHitInfo;
+                        if (intersectRayWithTriangle(primitive.v0.position, primitive.v1.position, primitive.v2.position, primitiveRay, primitiveHitInfo) && primitiveRay.t == ray.t)
+                            tracedID = i;
+                    }
+                }
+
+                const VisibilityBuffer::Sample& sample = visibilityBuffer.sample({ x, y });
+                if (sample.primitiveID != tracedID) {
+                    numMismatches++;
+                } else if (tracedID != VisibilityBuffer::NoHit) {
+                    // The rasterised hit is at exactly the traced distance, and close to the traced point on the triangle
+                    numDistanceErrors += VisibilityBuffer::hitDistance(cameraRay, bvh.primitives()[sample.primitiveID], sample) != ray.t;
+                    maxBarycentricError = std::max(maxBarycentricError, glm::compMax(glm::abs(sample.barycentricCoord - glm::vec2(hitInfo.barycentricCoord.y, hitInfo.barycentricCoord.z))));
+                }
+            }
+        }
+        CAPTURE(numHits, numMismatches, numDistanceErrors, maxBarycentricError);
+        CHECK(numHits > rays.size() / 2);
+        CHECK(numMismatches <= rays.size() / 1000);
+        CHECK(numDistanceErrors == 0);
+        // Vertices are snapped to the subpixel grid, which moves the barycentric coordinates of narrow triangles most
+        CHECK(maxBarycentricError < 2e-3f);
+    }
+
+    SECTION("Is only used for pinhole cameras without motion blur")
+    {
+        Camera thinLens = camera;
+        thinLens.setThinLens(0.05f, 3.0f);
+        CHECK_FALSE(VisibilityBuffer::supports(scene, bvh, features, thinLens));
+
+        Features motionBlur = features;
+        motionBlur.extra.enableMotionBlur = true;
+        CHECK_FALSE(VisibilityBuffer::supports(scene, bvh, motionBlur, camera));
+
+        Features multipleSamples = features;
+        multipleSamples.numPixelSamples = 4;
+        CHECK_FALSE(VisibilityBuffer::supports(scene, bvh, multipleSamples, camera));
+    }
+}
+
 // The below tests are not "good" unit tests. They don't actually test correctness.
 // They simply exist for demonstrative purposes. As they interact with the interfaces
 // (scene, bvh_interface, etc), they allow you to verify that you haven't broken